@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "image.h"
+#include "qoi.h"
+#include "queue.h"
+#include "gaussian.h"
+
+enum { STAGE_READ, STAGE_COMPUTE, STAGE_WRITE };
+
+// One image in flight, owned by exactly one stage at a time
+typedef struct batch_job {
+    int index; // position in the file list
+    int ok;
+    IMAGE img;
+    IMAGE scratch; // blur output, swapped with img after each pass
+} BATCHJOB;
+
+typedef struct batch_ctx {
+    char **files;
+    int count;
+    const char *outdir;
+    int times;
+    LFQUEUE free_q; // recycled job slots
+    LFQUEUE work_q; // decoded, waiting for compute
+    LFQUEUE done_q; // computed, waiting for encode
+    int next_file;
+    int readers_left;
+    int workers_left;
+    int threads[3];
+    long long busy_ns[3];
+    int done;
+    int failed;
+} BATCHCTX;
+
+// poison pill telling the next stage that no more job will come
+static BATCHJOB batch_stop;
+
+static long long now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void *batch_reader(void *arg)
+{
+    BATCHCTX *ctx = arg;
+    for(;;) {
+        int idx = __atomic_fetch_add(&ctx->next_file, 1, __ATOMIC_RELAXED);
+        if(idx >= ctx->count)
+            break;
+        BATCHJOB *job = lfq_pop_wait(&ctx->free_q);
+        long long t0 = now_ns();
+        job->index = idx;
+        job->ok = bmp_load(&job->img, ctx->files[idx]);
+        __atomic_fetch_add(&ctx->busy_ns[STAGE_READ], now_ns() - t0, __ATOMIC_RELAXED);
+        lfq_push_wait(&ctx->work_q, job);
+    }
+    if(__atomic_sub_fetch(&ctx->readers_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        for(int i = 0; i < ctx->threads[STAGE_COMPUTE]; i++)
+            lfq_push_wait(&ctx->work_q, &batch_stop);
+    }
+    return NULL;
+}
+
+static void *batch_worker(void *arg)
+{
+    BATCHCTX *ctx = arg;
+    for(;;) {
+        BATCHJOB *job = lfq_pop_wait(&ctx->work_q);
+        if(job == &batch_stop)
+            break;
+        long long t0 = now_ns();
+        if(job->ok) {
+            int w = IMAGE_WIDTH(&job->img), h = IMAGE_HEIGHT(&job->img);
+            if(!image_reserve(&job->scratch, w, h)) {
+                job->ok = 0;
+            } else {
+                for(int i = 0; i < ctx->times; i++) {
+                    IMAGE tmp;
+                    sse_gaussian_blur_5_vec_ori_r(job->img.data, job->scratch.data, w, h);
+                    tmp = job->img;
+                    job->img.data = job->scratch.data;
+                    job->img.capacity = job->scratch.capacity;
+                    job->scratch.data = tmp.data;
+                    job->scratch.capacity = tmp.capacity;
+                }
+            }
+        }
+        __atomic_fetch_add(&ctx->busy_ns[STAGE_COMPUTE], now_ns() - t0, __ATOMIC_RELAXED);
+        lfq_push_wait(&ctx->done_q, job);
+    }
+    if(__atomic_sub_fetch(&ctx->workers_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        for(int i = 0; i < ctx->threads[STAGE_WRITE]; i++)
+            lfq_push_wait(&ctx->done_q, &batch_stop);
+    }
+    return NULL;
+}
+
+static void *batch_writer(void *arg)
+{
+    BATCHCTX *ctx = arg;
+    char path[4096];
+    for(;;) {
+        BATCHJOB *job = lfq_pop_wait(&ctx->done_q);
+        if(job == &batch_stop)
+            break;
+        long long t0 = now_ns();
+        const char *name = strrchr(ctx->files[job->index], '/');
+        name = name ? name + 1 : ctx->files[job->index];
+        snprintf(path, sizeof(path), "%s/%s", ctx->outdir, name);
+        if(job->ok && bmp_save(&job->img, path))
+            __atomic_fetch_add(&ctx->done, 1, __ATOMIC_RELAXED);
+        else
+            __atomic_fetch_add(&ctx->failed, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ctx->busy_ns[STAGE_WRITE], now_ns() - t0, __ATOMIC_RELAXED);
+        lfq_push_wait(&ctx->free_q, job);
+    }
+    return NULL;
+}
+
+static int has_image_suffix(const char *name)
+{
+    size_t len = strlen(name);
+    return (len > 4 && strcasecmp(name + len - 4, ".bmp") == 0) || qoi_is_name(name);
+}
+
+static int cmp_path(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int push_path(char ***files, int *count, int *cap, const char *path)
+{
+    if(*count == *cap) {
+        int ncap = *cap ? *cap * 2 : 64;
+        char **p = realloc(*files, ncap * sizeof(char *));
+        if(!p)
+            return 0;
+        *files = p;
+        *cap = ncap;
+    }
+    (*files)[(*count)++] = strdup(path);
+    return 1;
+}
+
+/*********************************************************/
+// build the input list from a directory or a list file
+/*********************************************************/
+char **batch_collect(const char *path, int *count)
+{
+    char **files = NULL;
+    int cap = 0;
+    struct stat st;
+    char line[4096];
+    *count = 0;
+    if(stat(path, &st) != 0) {
+        fprintf(stderr, "%s: no such file or directory\n", path);
+        return NULL;
+    }
+    if(S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        struct dirent *ent;
+        if(!dir)
+            return NULL;
+        while((ent = readdir(dir)) != NULL) {
+            if(!has_image_suffix(ent->d_name))
+                continue;
+            snprintf(line, sizeof(line), "%s/%s", path, ent->d_name);
+            if(!push_path(&files, count, &cap, line))
+                break;
+        }
+        closedir(dir);
+        if(*count > 1)
+            qsort(files, *count, sizeof(char *), cmp_path);
+    } else {
+        FILE *list = fopen(path, "r");
+        if(!list)
+            return NULL;
+        while(fgets(line, sizeof(line), list)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if(line[0] == '\0' || line[0] == '#')
+                continue;
+            if(!push_path(&files, count, &cap, line))
+                break;
+        }
+        fclose(list);
+    }
+    return files;
+}
+
+void batch_free_list(char **files, int count)
+{
+    for(int i = 0; i < count; i++)
+        free(files[i]);
+    free(files);
+}
+
+/*********************************************************/
+// run the three stages over the whole list
+/*********************************************************/
+int batch_run(char **files, int count, const char *outdir, int times,
+              int num_threads, BATCHSTATS *stats)
+{
+    BATCHCTX ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.files = files;
+    ctx.count = count;
+    ctx.outdir = outdir;
+    ctx.times = times;
+    if(num_threads < 1)
+        num_threads = 1;
+    // decode and encode mostly wait on the disk, a few threads keep it busy
+    ctx.threads[STAGE_READ] = 1 + num_threads / 4;
+    ctx.threads[STAGE_COMPUTE] = num_threads;
+    ctx.threads[STAGE_WRITE] = 1 + num_threads / 4;
+    ctx.readers_left = ctx.threads[STAGE_READ];
+    ctx.workers_left = ctx.threads[STAGE_COMPUTE];
+
+    // enough slots for every thread to hold one job and one more queued
+    int total = ctx.threads[0] + ctx.threads[1] + ctx.threads[2];
+    int slots = 2 * total;
+    BATCHJOB *jobs = calloc(slots, sizeof(BATCHJOB));
+    pthread_t *handler = malloc(total * sizeof(pthread_t));
+    if(!jobs || !handler ||
+       !lfq_init(&ctx.free_q, slots) ||
+       !lfq_init(&ctx.work_q, slots + total) ||
+       !lfq_init(&ctx.done_q, slots + total)) {
+        free(jobs);
+        free(handler);
+        return 0;
+    }
+    for(int i = 0; i < slots; i++)
+        lfq_push(&ctx.free_q, &jobs[i]);
+
+    long long t0 = now_ns();
+    int n = 0;
+    for(int i = 0; i < ctx.threads[STAGE_WRITE]; i++)
+        pthread_create(&handler[n++], NULL, batch_writer, &ctx);
+    for(int i = 0; i < ctx.threads[STAGE_COMPUTE]; i++)
+        pthread_create(&handler[n++], NULL, batch_worker, &ctx);
+    for(int i = 0; i < ctx.threads[STAGE_READ]; i++)
+        pthread_create(&handler[n++], NULL, batch_reader, &ctx);
+    for(int i = 0; i < n; i++)
+        pthread_join(handler[i], NULL);
+    long long t1 = now_ns();
+
+    if(stats) {
+        stats->done = ctx.done;
+        stats->failed = ctx.failed;
+        stats->wall_ms = (t1 - t0) / 1000000.0;
+        for(int s = 0; s < 3; s++) {
+            stats->busy_ms[s] = ctx.busy_ns[s] / 1000000.0;
+            stats->threads[s] = ctx.threads[s];
+        }
+    }
+    for(int i = 0; i < slots; i++) {
+        image_release(&jobs[i].img);
+        image_release(&jobs[i].scratch);
+    }
+    lfq_destroy(&ctx.free_q);
+    lfq_destroy(&ctx.work_q);
+    lfq_destroy(&ctx.done_q);
+    free(jobs);
+    free(handler);
+    return ctx.failed == 0;
+}
+
+/*********************************************************/
+// throughput and per stage utilization
+/*********************************************************/
+void batch_report(const BATCHSTATS *stats)
+{
+    const char *name[3] = {"read", "compute", "write"};
+    int bottleneck = 0;
+    double util[3];
+    printf("batch: %d images, %d failed, %f ms, %.2f images/s\n",
+           stats->done, stats->failed, stats->wall_ms,
+           stats->wall_ms > 0 ? stats->done * 1000.0 / stats->wall_ms : 0.0);
+    for(int s = 0; s < 3; s++) {
+        util[s] = stats->wall_ms > 0 ?
+                  100.0 * stats->busy_ms[s] / (stats->wall_ms * stats->threads[s]) : 0.0;
+        if(util[s] > util[bottleneck])
+            bottleneck = s;
+        printf("  %-8s: %d threads, busy %f ms, utilization %.1f %%\n",
+               name[s], stats->threads[s], stats->busy_ms[s], util[s]);
+    }
+    printf("  bottleneck stage : %s\n", name[bottleneck]);
+}
@@ -0,0 +1,21 @@
+#ifndef BATCH
+#define BATCH
+
+// Batch mode : reader threads -> compute pool -> writer threads, connected
+// by bounded lock-free queues. Job slots (and their pixel buffers) are
+// recycled, so the memory in flight stays bounded whatever the list size.
+typedef struct batch_stats {
+    int done; // images written
+    int failed; // images which couldn't be read or written
+    double wall_ms;
+    double busy_ms[3]; // accumulated work time : read, compute, write
+    int threads[3]; // thread count of each stage
+} BATCHSTATS;
+
+// collect *.bmp and *.qoi from a directory, or one path per line from a list file
+char **batch_collect(const char *path, int *count);
+void batch_free_list(char **files, int count);
+int batch_run(char **files, int count, const char *outdir, int times,
+              int num_threads, BATCHSTATS *stats);
+void batch_report(const BATCHSTATS *stats);
+#endif // BATCH
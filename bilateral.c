@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "bilateral.h"
+#include "convolve.h"
+#include "pool.h"
+
+// empty cells around the data on every axis, the blur radius
+#define GRID_PAD 2
+
+typedef struct bilateral_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+    float sigma_s;
+    float inv_s;
+    int cs; // floats per cell : the channels then the weight
+    int gx; // grid columns
+    int gz; // grid key levels
+    int ny; // grid rows read by the slicing
+    int *splat_x; // nearest cell of each column
+    int *slice_x; // cell left of each column
+    float *frac_x;
+    int splat_z[256];
+    int slice_z[256];
+    float frac_z[256];
+    KERNEL k;
+    int ok;
+} BILATERALJOB;
+
+static int splat_y(const BILATERALJOB *job, int y)
+{
+    return (int)(y * job->inv_s + 0.5f) + GRID_PAD;
+}
+
+static int slice_y(const BILATERALJOB *job, int y)
+{
+    return (int)(y * job->inv_s) + GRID_PAD;
+}
+
+static int pixel_key(const unsigned char *p, int cstep)
+{
+    return cstep == 1 ? p[0] : (29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8;
+}
+
+static void splat_row(const BILATERALJOB *job, int y, float *grid)
+{
+    const unsigned char *p = job->src + (size_t)y * job->w * job->cstep;
+    int cstep = job->cstep, cs = job->cs;
+    for(int x = 0; x < job->w; x++, p += cstep) {
+        float *cell = grid + ((size_t)job->splat_x[x] * job->gz + job->splat_z[pixel_key(p, cstep)]) * cs;
+        for(int c = 0; c < cstep; c++)
+            cell[c] += p[c];
+        cell[cstep] += 1;
+    }
+}
+
+// along the key axis, then along x ; the pad cells at the ends of the row
+// keep their (empty) splat
+static void blur_row(const BILATERALJOB *job, float *grid, float *tmp)
+{
+    int n = job->gx * job->gz * job->cs, i0 = GRID_PAD * job->cs;
+    conv_row_float(&job->k, grid, tmp, n, job->cs);
+    memcpy(tmp, grid, i0 * sizeof(float));
+    memcpy(tmp + n - i0, grid + n - i0, i0 * sizeof(float));
+    conv_row_float(&job->k, tmp, grid, n, job->cs * job->gz);
+}
+
+/*********************************************************/
+// trilinear read back of row y between grid rows b0 and
+// b1 : the 4 corners are summed first, both key levels of
+// a corner sit side by side
+/*********************************************************/
+static void slice_row(const BILATERALJOB *job, int y, const float *b0, const float *b1)
+{
+    const unsigned char *p = job->src + (size_t)y * job->w * job->cstep;
+    unsigned char *out = job->dst + (size_t)y * job->w * job->cstep;
+    int cstep = job->cstep, cs = job->cs, zs = job->gz * cs;
+    float fy = y * job->inv_s - (slice_y(job, y) - GRID_PAD);
+    for(int x = 0; x < job->w; x++, p += cstep, out += cstep) {
+        int key = pixel_key(p, cstep);
+        size_t o = ((size_t)job->slice_x[x] * job->gz + job->slice_z[key]) * cs;
+        float fx = job->frac_x[x], fz = job->frac_z[key];
+        __m128 w00 = _mm_set1_ps((1 - fx) * (1 - fy)), w10 = _mm_set1_ps(fx * (1 - fy));
+        __m128 w01 = _mm_set1_ps((1 - fx) * fy), w11 = _mm_set1_ps(fx * fy);
+        __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(b0 + o), w00), _mm_mul_ps(_mm_loadu_ps(b0 + o + zs), w10)),
+                              _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(b1 + o), w01), _mm_mul_ps(_mm_loadu_ps(b1 + o + zs), w11)));
+        if(cs == 2) {
+            // a = value, weight at key level z then z + 1
+            a = _mm_mul_ps(a, _mm_setr_ps(1 - fz, 1 - fz, fz, fz));
+            a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+            float wsum = _mm_cvtss_f32(_mm_shuffle_ps(a, a, 0x55));
+            if(wsum > 0) {
+                int v = _mm_cvtss_si32(_mm_div_ss(a, _mm_shuffle_ps(a, a, 0x55)));
+                out[0] = v < 0 ? 0 : v > 255 ? 255 : v;
+            } else {
+                out[0] = p[0];
+            }
+            continue;
+        }
+        __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(b0 + o + cs), w00), _mm_mul_ps(_mm_loadu_ps(b0 + o + zs + cs), w10)),
+                              _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(b1 + o + cs), w01), _mm_mul_ps(_mm_loadu_ps(b1 + o + zs + cs), w11)));
+        a = _mm_add_ps(_mm_mul_ps(a, _mm_set1_ps(1 - fz)), _mm_mul_ps(c, _mm_set1_ps(fz)));
+        __m128 wsum = _mm_shuffle_ps(a, a, 0xff);
+        if(_mm_cvtss_f32(wsum) > 0) {
+            __m128i v = _mm_cvtps_epi32(_mm_div_ps(a, wsum));
+            v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+            int bytes = _mm_cvtsi128_si32(v);
+            out[0] = bytes;
+            out[1] = bytes >> 8;
+            out[2] = bytes >> 16;
+        } else {
+            memcpy(out, p, 3);
+        }
+    }
+}
+
+/*********************************************************/
+// grid rows [g0,g1) of the slicing : splatted rows stream
+// through a ring of 5, every 5 of them give a blurred row
+// and every 2 blurred rows slice the image rows between
+/*********************************************************/
+static void bilateral_slab(void *arg, int item)
+{
+    BILATERALJOB *job = arg;
+    int g0 = GRID_PAD + item * BILATERAL_SLAB;
+    int g1 = g0 + BILATERAL_SLAB < GRID_PAD + job->ny ? g0 + BILATERAL_SLAB : GRID_PAD + job->ny;
+    size_t n = (size_t)job->gx * job->gz * job->cs;
+    float *buf = malloc(8 * n * sizeof(float));
+    if(!buf) {
+        fprintf(stderr, "bilateral : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    float *ring[5], *blurred[2], *tmp = buf + 7 * n;
+    for(int i = 0; i < 5; i++)
+        ring[i] = buf + i * n;
+    blurred[0] = buf + 5 * n;
+    blurred[1] = buf + 6 * n;
+    // first rows splatted into g0 - 2 and sliced from g0
+    int ys = (int)((g0 - GRID_PAD - 3) * job->sigma_s), yl;
+    ys = ys > 0 ? ys : 0;
+    yl = ys;
+    while(ys < job->h && splat_y(job, ys) < g0 - 2)
+        ys++;
+    while(yl < job->h && slice_y(job, yl) < g0)
+        yl++;
+    for(int g = g0 - 2; g <= g1 + 2; g++) {
+        float *row = ring[g % 5];
+        memset(row, 0, n * sizeof(float));
+        int splatted = 0;
+        for(; ys < job->h && splat_y(job, ys) == g; ys++, splatted++)
+            splat_row(job, ys, row);
+        if(splatted)
+            blur_row(job, row, tmp);
+        int b = g - 2;
+        if(b < g0)
+            continue;
+        const float *rows[5];
+        for(int i = 0; i < 5; i++)
+            rows[i] = ring[(b - 2 + i) % 5];
+        conv_col_float(&job->k, rows, blurred[b % 2], n);
+        for(; b - 1 >= g0 && yl < job->h && slice_y(job, yl) == b - 1; yl++)
+            slice_row(job, yl, blurred[(b - 1) % 2], blurred[b % 2]);
+    }
+    free(buf);
+}
+
+int bilateral_filter(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, float sigma_s, float sigma_r)
+{
+    static const int binomial[5] = {1, 4, 6, 4, 1};
+    int weight[25];
+    if(!(sigma_s >= 1) || !(sigma_r >= 1)) {
+        fprintf(stderr, "bilateral : sigma_s and sigma_r must be at least 1\n");
+        return 0;
+    }
+    BILATERALJOB *job = malloc(sizeof(BILATERALJOB));
+    if(!job) {
+        fprintf(stderr, "bilateral : out of memory\n");
+        return 0;
+    }
+    job->src = src;
+    job->dst = dst;
+    job->w = w;
+    job->h = h;
+    job->cstep = cstep;
+    job->sigma_s = sigma_s;
+    job->inv_s = 1 / sigma_s;
+    job->cs = cstep + 1;
+    job->gx = (int)((w - 1) * job->inv_s) + 2 + 2 * GRID_PAD;
+    job->gz = (int)(255 / sigma_r) + 2 + 2 * GRID_PAD;
+    job->ny = (int)((h - 1) * job->inv_s) + 1;
+    job->ok = 1;
+    for(int i = 0; i < 25; i++)
+        weight[i] = binomial[i / 5] * binomial[i % 5];
+    kernel_int(&job->k, 5, weight, 256); // separable, the slicing normalizes
+    for(int v = 0; v < 256; v++) {
+        job->splat_z[v] = (int)(v / sigma_r + 0.5f) + GRID_PAD;
+        job->slice_z[v] = (int)(v / sigma_r) + GRID_PAD;
+        job->frac_z[v] = v / sigma_r - (job->slice_z[v] - GRID_PAD);
+    }
+    job->splat_x = malloc((size_t)w * (2 * sizeof(int) + sizeof(float)));
+    if(!job->splat_x) {
+        fprintf(stderr, "bilateral : out of memory\n");
+        free(job);
+        return 0;
+    }
+    job->slice_x = job->splat_x + w;
+    job->frac_x = (float *)(job->slice_x + w);
+    for(int x = 0; x < w; x++) {
+        job->splat_x[x] = (int)(x * job->inv_s + 0.5f) + GRID_PAD;
+        job->slice_x[x] = (int)(x * job->inv_s) + GRID_PAD;
+        job->frac_x[x] = x * job->inv_s - (job->slice_x[x] - GRID_PAD);
+    }
+    pool_run(pool_default(), (job->ny + BILATERAL_SLAB - 1) / BILATERAL_SLAB, bilateral_slab, job);
+    int ok = job->ok;
+    free(job->splat_x);
+    free(job);
+    return ok;
+}
+
+int bilateral_tri(const unsigned char *src, unsigned char *dst, int w, int h, float sigma_s, float sigma_r)
+{
+    return bilateral_filter(src, dst, w, h, 1, sigma_s, sigma_r);
+}
+
+int bilateral_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, float sigma_s, float sigma_r)
+{
+    return bilateral_filter((const unsigned char *)src, (unsigned char *)dst, w, h, 3, sigma_s, sigma_r);
+}
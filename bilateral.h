@@ -0,0 +1,21 @@
+#ifndef BILATERAL_GRID
+#define BILATERAL_GRID
+#include "bmp.h"
+
+// grid rows sliced by one pool worker, the 2 rows halo each side is splatted twice
+#define BILATERAL_SLAB 32
+
+// Edge preserving smoothing through a bilateral grid : every pixel is
+// splatted into the nearest cell of a (x / sigma_s, y / sigma_s, key /
+// sigma_r) grid, the grid is blurred by a 5 taps gaussian along the 3 axes
+// (convolve.h row / column passes) and the pixel is read back by trilinear
+// interpolation, value / weight. The grid shrinks as sigma_s grows, so the
+// cost does not depend on it. The key is the value for a planar plane and
+// the luma for RGB, whose 3 channels share the cells.
+// Slabs of grid rows stream through 5 + 2 grid rows rings per worker, the
+// memory does not depend on the image height.
+// sigma_s : pixels (>= 1), sigma_r : levels out of 255 (>= 1)
+int bilateral_filter(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, float sigma_s, float sigma_r);
+int bilateral_tri(const unsigned char *src, unsigned char *dst, int w, int h, float sigma_s, float sigma_r);
+int bilateral_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, float sigma_s, float sigma_r);
+#endif // BILATERAL_GRID
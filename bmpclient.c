@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "client.h"
+
+static void usage(const char *name)
+{
+    printf("Usage: %s <socket> <ops> <input> <output> [--shm]\n", name);
+    printf("       %s <socket> --load <jobs> <concurrency> <ops> <input> [output]\n", name);
+    printf("       %s <socket> --shutdown\n", name);
+    printf("  --shm : pass the image through a shared memory fd instead of paths\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc >= 3 && strcmp(argv[2], "--shutdown") == 0)
+        return client_shutdown(argv[1]) ? 0 : 1;
+    if(argc >= 7 && strcmp(argv[2], "--load") == 0)
+        return client_load(argv[1], atoi(argv[3]), atoi(argv[4]), argv[5], argv[6],
+                           argc > 7 ? argv[7] : "/dev/null") ? 0 : 1;
+    if(argc < 5) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int shm = argc > 5 && strcmp(argv[5], "--shm") == 0;
+    int fd = -1, ok;
+    long server_us = 0;
+    int sock = client_connect(argv[1]);
+    if(sock < 0) {
+        printf("Can't connect to %s\n", argv[1]);
+        return 1;
+    }
+    if(shm) {
+        fd = client_file_to_memfd(argv[3]);
+        ok = fd >= 0 && client_job(sock, argv[2], "-", "-", fd, &server_us) &&
+             client_memfd_to_file(fd, argv[4]);
+    } else {
+        ok = client_job(sock, argv[2], argv[3], argv[4], -1, &server_us);
+    }
+    if(ok)
+        printf("job done, daemon latency : %ld us\n", server_us);
+    else
+        printf("job failed\n");
+    if(fd >= 0)
+        close(fd);
+    close(sock);
+    return ok ? 0 : 1;
+}
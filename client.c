@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "client.h"
+
+static long long now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+int client_connect(const char *sock_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if(strlen(sock_path) >= sizeof(addr.sun_path))
+        return -1;
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_path);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(sock < 0)
+        return -1;
+    if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int send_request(int sock, const char *req, int fd)
+{
+    union {
+        char raw[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = {(void *)req, strlen(req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if(fd >= 0) {
+        memset(&ctrl, 0, sizeof(ctrl));
+        msg.msg_control = ctrl.raw;
+        msg.msg_controllen = sizeof(ctrl.raw);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)iov.iov_len;
+}
+
+// the daemon has its own working directory, send absolute paths ; NULL when
+// the absolute path does not fit in cap
+static const char *absolute_path(const char *path, char *buf, size_t cap)
+{
+    char cwd[4096];
+    int n;
+    if(path[0] == '/' || strcmp(path, "-") == 0 || !getcwd(cwd, sizeof(cwd)))
+        return path;
+    n = snprintf(buf, cap, "%s/%s", cwd, path);
+    if(n < 0 || (size_t)n >= cap) {
+        fprintf(stderr, "client : path too long : %s\n", path);
+        return NULL;
+    }
+    return buf;
+}
+
+int client_job(int sock, const char *ops, const char *input, const char *output,
+               int fd, long *server_us)
+{
+    char req[16384], reply[256], inbuf[4096], outbuf[4096];
+    const char *in = absolute_path(input, inbuf, sizeof(inbuf));
+    const char *out = absolute_path(output, outbuf, sizeof(outbuf));
+    int len;
+    if(!in || !out)
+        return 0;
+    len = snprintf(req, sizeof(req), "%s %s %s", ops, in, out);
+    if(len < 0 || (size_t)len >= sizeof(req)) {
+        fprintf(stderr, "client : request too long\n");
+        return 0;
+    }
+    if(!send_request(sock, req, fd))
+        return 0;
+    ssize_t n = recv(sock, reply, sizeof(reply) - 1, 0);
+    if(n <= 0)
+        return 0;
+    reply[n] = '\0';
+    if(strncmp(reply, "OK", 2) != 0) {
+        fprintf(stderr, "%s\n", reply);
+        return 0;
+    }
+    if(server_us)
+        *server_us = atol(reply + 2);
+    return 1;
+}
+
+int client_shutdown(const char *sock_path)
+{
+    int sock = client_connect(sock_path);
+    if(sock < 0)
+        return 0;
+    int ok = send_request(sock, "SHUTDOWN", -1);
+    char reply[64];
+    if(ok)
+        ok = recv(sock, reply, sizeof(reply), 0) > 0;
+    close(sock);
+    return ok;
+}
+
+int client_file_to_memfd(const char *path)
+{
+    char buf[1 << 16];
+    ssize_t n;
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    int fd = memfd_create("bmpjob", MFD_CLOEXEC);
+    if(in < 0 || fd < 0) {
+        if(in >= 0)
+            close(in);
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    while((n = read(in, buf, sizeof(buf))) > 0) {
+        if(write(fd, buf, n) != n) {
+            n = -1;
+            break;
+        }
+    }
+    close(in);
+    if(n < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int client_memfd_to_file(int fd, const char *path)
+{
+    char buf[1 << 16];
+    ssize_t n;
+    off_t off = 0;
+    int out = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(out < 0)
+        return 0;
+    while((n = pread(fd, buf, sizeof(buf), off)) > 0) {
+        if(write(out, buf, n) != n)
+            break;
+        off += n;
+    }
+    return close(out) == 0 && n == 0;
+}
+
+typedef struct load_info {
+    pthread_t thread_id;
+    const char *sock_path;
+    const char *ops;
+    const char *input;
+    const char *output;
+    int jobs;
+    int failed;
+    long *rtt_us; // client round trip of every job
+    long *server_us; // latency reported by the daemon
+} LOADINFO;
+
+static void *load_thread(void *arg)
+{
+    LOADINFO *info = arg;
+    int sock = client_connect(info->sock_path);
+    for(int i = 0; i < info->jobs; i++) {
+        long long t0 = now_ns();
+        if(sock < 0 || !client_job(sock, info->ops, info->input, info->output, -1,
+                                   &info->server_us[i])) {
+            info->failed++;
+            info->server_us[i] = 0;
+        }
+        info->rtt_us[i] = (now_ns() - t0) / 1000;
+    }
+    if(sock >= 0)
+        close(sock);
+    return NULL;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+static long percentile(const long *sorted, int n, int p)
+{
+    int idx = (int)((long long)n * p / 100);
+    return sorted[idx < n ? idx : n - 1];
+}
+
+/*********************************************************/
+// load generator
+/*********************************************************/
+int client_load(const char *sock_path, int jobs, int concurrency,
+                const char *ops, const char *input, const char *output)
+{
+    if(concurrency < 1)
+        concurrency = 1;
+    if(jobs < concurrency)
+        jobs = concurrency;
+    LOADINFO *info = calloc(concurrency, sizeof(LOADINFO));
+    long *rtt = malloc(jobs * sizeof(long));
+    long *srv = malloc(jobs * sizeof(long));
+    if(!info || !rtt || !srv) {
+        free(info);
+        free(rtt);
+        free(srv);
+        return 0;
+    }
+    int offset = 0, failed = 0;
+    long long t0 = now_ns();
+    for(int t = 0; t < concurrency; t++) {
+        info[t].sock_path = sock_path;
+        info[t].ops = ops;
+        info[t].input = input;
+        info[t].output = output;
+        info[t].jobs = jobs / concurrency + (t < jobs % concurrency);
+        info[t].rtt_us = rtt + offset;
+        info[t].server_us = srv + offset;
+        offset += info[t].jobs;
+        pthread_create(&info[t].thread_id, NULL, load_thread, &info[t]);
+    }
+    for(int t = 0; t < concurrency; t++) {
+        pthread_join(info[t].thread_id, NULL);
+        failed += info[t].failed;
+    }
+    double wall_ms = (now_ns() - t0) / 1000000.0;
+    qsort(rtt, jobs, sizeof(long), cmp_long);
+    qsort(srv, jobs, sizeof(long), cmp_long);
+    printf("load: %d jobs, %d failed, %d connections, %f ms, %.2f jobs/s\n",
+           jobs, failed, concurrency, wall_ms, jobs * 1000.0 / wall_ms);
+    printf("  round trip latency : p50 %ld us, p99 %ld us, max %ld us\n",
+           percentile(rtt, jobs, 50), percentile(rtt, jobs, 99), rtt[jobs - 1]);
+    printf("  daemon latency     : p50 %ld us, p99 %ld us, max %ld us\n",
+           percentile(srv, jobs, 50), percentile(srv, jobs, 99), srv[jobs - 1]);
+    free(info);
+    free(rtt);
+    free(srv);
+    return failed == 0;
+}
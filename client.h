@@ -0,0 +1,18 @@
+#ifndef JOB_CLIENT
+#define JOB_CLIENT
+
+// Client side of the daemon protocol (see server.h)
+int client_connect(const char *sock_path);
+// send one job, fd (or -1) is passed along for "-" paths;
+// return 1 on success with the daemon side latency in *server_us
+int client_job(int sock, const char *ops, const char *input, const char *output,
+               int fd, long *server_us);
+int client_shutdown(const char *sock_path);
+// copy a file into an anonymous shared memory fd and back
+int client_file_to_memfd(const char *path);
+int client_memfd_to_file(int fd, const char *path);
+// load generator : jobs spread over concurrency connections, print
+// throughput and p50/p99 of the round trip and daemon side latencies
+int client_load(const char *sock_path, int jobs, int concurrency,
+                const char *ops, const char *input, const char *output);
+#endif // JOB_CLIENT
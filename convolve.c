@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "convolve.h"
+#include "gaussian.h"
+#include "pool.h"
+#include "fft.h"
+
+// rows handed to a pool worker at a time
+#define BAND_ROWS 32
+// integer sums are exact in a float below 2^24
+#define CONV_INT_LIMIT (1 << 24)
+
+static const int kernel_sharpen[9] = {
+    0, -1, 0,
+    -1, 5, -1,
+    0, -1, 0
+};
+
+static const int kernel_emboss[9] = {
+    -2, -1, 0,
+    -1, 1, 1,
+    0, 1, 2
+};
+
+static const int kernel_edge[9] = {
+    -1, -1, -1,
+    -1, 8, -1,
+    -1, -1, -1
+};
+
+static int gcd(int a, int b)
+{
+    a = abs(a);
+    b = abs(b);
+    while(b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static int kernel_size_ok(int size)
+{
+    if(size < 1 || size > KERNEL_MAX || size % 2 == 0) {
+        fprintf(stderr, "kernel size must be odd and at most %d : %d\n", KERNEL_MAX, size);
+        return 0;
+    }
+    return 1;
+}
+
+// pivot on the largest weight, row[x] / col[y] are its row / column
+static int kernel_pivot(const KERNEL *k, int *py, int *px)
+{
+    float best = 0;
+    for(int i = 0; i < k->size * k->size; i++) {
+        float a = k->weight[i] < 0 ? -k->weight[i] : k->weight[i];
+        if(a > best) {
+            best = a;
+            *py = i / k->size;
+            *px = i % k->size;
+        }
+    }
+    return best > 0;
+}
+
+/*********************************************************/
+// integer kernel, rank 1 is checked with exact products
+/*********************************************************/
+int kernel_int(KERNEL *k, int size, const int *weight, int divisor)
+{
+    long long total = 0;
+    int py = 0, px = 0, n = size * size;
+    if(!kernel_size_ok(size))
+        return 0;
+    for(int i = 0; i < n; i++)
+        total += llabs(weight[i]);
+    if(divisor <= 0 || total * 255 >= CONV_INT_LIMIT) {
+        fprintf(stderr, "kernel weights too large or divisor not positive\n");
+        return 0;
+    }
+    memset(k, 0, sizeof(KERNEL));
+    k->size = size;
+    k->integer = 1;
+    k->divisor = divisor;
+    for(int i = 0; i < n; i++)
+        k->weight[i] = weight[i];
+    if(size == 1 || !kernel_pivot(k, &py, &px))
+        return 1;
+    int p = weight[py * size + px], g = 0;
+    for(int y = 0; y < size; y++) {
+        for(int x = 0; x < size; x++) {
+            if((long long)weight[y * size + x] * p != (long long)weight[y * size + px] * weight[py * size + x])
+                return 1;
+        }
+    }
+    // integer factors : the pivot row over the gcd of its weights, the
+    // column factors are then integers too
+    for(int x = 0; x < size; x++)
+        g = gcd(g, weight[py * size + x]);
+    for(int x = 0; x < size; x++)
+        k->row[x] = weight[py * size + x] / g;
+    for(int y = 0; y < size; y++)
+        k->col[y] = (long long)weight[y * size + px] * g / p;
+    k->separable = 1;
+    return 1;
+}
+
+int kernel_float(KERNEL *k, int size, const float *weight)
+{
+    int py = 0, px = 0, n = size * size;
+    if(!kernel_size_ok(size))
+        return 0;
+    memset(k, 0, sizeof(KERNEL));
+    k->size = size;
+    k->divisor = 1;
+    memcpy(k->weight, weight, n * sizeof(float));
+    if(size == 1 || !kernel_pivot(k, &py, &px))
+        return 1;
+    float p = weight[py * size + px], tol = (p < 0 ? -p : p) * 1e-5f;
+    for(int x = 0; x < size; x++)
+        k->row[x] = weight[py * size + x];
+    for(int y = 0; y < size; y++)
+        k->col[y] = weight[y * size + px] / p;
+    for(int y = 0; y < size; y++) {
+        for(int x = 0; x < size; x++) {
+            float d = weight[y * size + x] - k->col[y] * k->row[x];
+            if(d > tol || d < -tol)
+                return 1;
+        }
+    }
+    k->separable = 1;
+    return 1;
+}
+
+int kernel_box(KERNEL *k, int size)
+{
+    int ones[KERNEL_MAX * KERNEL_MAX];
+    if(!kernel_size_ok(size))
+        return 0;
+    for(int i = 0; i < size * size; i++)
+        ones[i] = 1;
+    return kernel_int(k, size, ones, size * size);
+}
+
+int kernel_named(KERNEL *k, const char *name)
+{
+    int weight[9];
+    if(strcmp(name, "gaussian3") == 0) {
+        for(int i = 0; i < 9; i++)
+            weight[i] = gaussian33[i];
+        return kernel_int(k, 3, weight, deno33);
+    }
+    if(strcmp(name, "gaussian5") == 0)
+        return kernel_int(k, 5, gaussian55, deno55);
+    if(strcmp(name, "sharpen") == 0)
+        return kernel_int(k, 3, kernel_sharpen, 1);
+    if(strcmp(name, "emboss") == 0)
+        return kernel_int(k, 3, kernel_emboss, 1);
+    if(strcmp(name, "edge") == 0)
+        return kernel_int(k, 3, kernel_edge, 1);
+    if(strncmp(name, "box", 3) == 0)
+        return kernel_box(k, atoi(name + 3));
+    fprintf(stderr, "unknown kernel : %s\n", name);
+    return 0;
+}
+
+/****************************************************************************/
+// Row kernels : 16 output bytes are accumulated as 4 x 4 floats, one shifted
+// load per tap. Every row kernel is written once as a macro and instantiated
+// with a constant size for 3, 5 and 7 (the tap loops are then fully unrolled)
+// and with k->size for the generic path.
+
+// 16 bytes -> 4 x 4 floats
+#define CONV_EXPAND(b, f0, f1, f2, f3) do { \
+        f0 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(b)); \
+        f1 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(b, 4))); \
+        f2 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(b, 8))); \
+        f3 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(b, 12))); \
+    } while(0)
+
+#define CONV_MAC(a0, a1, a2, a3, f0, f1, f2, f3, vw) do { \
+        a0 = _mm_add_ps(a0, _mm_mul_ps(f0, vw)); \
+        a1 = _mm_add_ps(a1, _mm_mul_ps(f1, vw)); \
+        a2 = _mm_add_ps(a2, _mm_mul_ps(f2, vw)); \
+        a3 = _mm_add_ps(a3, _mm_mul_ps(f3, vw)); \
+    } while(0)
+
+// 4 x 4 sums -> 16 bytes : integer kernels divide and truncate, float ones
+// round, packs / packus saturate to 0 ~ 255
+#define CONV_STORE(p, a0, a1, a2, a3) do { \
+        __m128i i0, i1, i2, i3; \
+        if(k->integer) { \
+            i0 = _mm_cvttps_epi32(_mm_div_ps(a0, vdiv)); \
+            i1 = _mm_cvttps_epi32(_mm_div_ps(a1, vdiv)); \
+            i2 = _mm_cvttps_epi32(_mm_div_ps(a2, vdiv)); \
+            i3 = _mm_cvttps_epi32(_mm_div_ps(a3, vdiv)); \
+        } else { \
+            i0 = _mm_cvtps_epi32(a0); \
+            i1 = _mm_cvtps_epi32(a1); \
+            i2 = _mm_cvtps_epi32(a2); \
+            i3 = _mm_cvtps_epi32(a3); \
+        } \
+        _mm_storeu_si128((__m128i *)(p), _mm_packus_epi16(_mm_packs_epi32(i0, i1), _mm_packs_epi32(i2, i3))); \
+    } while(0)
+
+// Output bytes [i0,n-i0) of a row from the size input rows centered on it,
+// already widened to floats. 32 bytes per iteration, 8 independent sums, the
+// last iteration overlaps the previous one, so n - 2 * i0 >= 32.
+#define CONV_ROW_2D(NAME, N) \
+static void NAME(const KERNEL *k, const float *const *rows, unsigned char *out, int n, int cstep) \
+{ \
+    const int size = (N), i0 = size / 2 * cstep, i1 = n - i0; \
+    const __m128 vdiv = _mm_set1_ps((float)k->divisor); \
+    for(int i = i0; i < i1; i += 32) { \
+        int o = i + 32 > i1 ? i1 - 32 : i; \
+        __m128 a0 = _mm_setzero_ps(), a1 = a0, a2 = a0, a3 = a0, a4 = a0, a5 = a0, a6 = a0, a7 = a0; \
+        _Pragma("GCC unroll 15") \
+        for(int y = 0; y < size; y++) { \
+            const float *in = rows[y] + o - i0; \
+            _Pragma("GCC unroll 15") \
+            for(int x = 0; x < size; x++) { \
+                const float *p = in + x * cstep; \
+                __m128 vw = _mm_set1_ps(k->weight[y * size + x]); \
+                CONV_MAC(a0, a1, a2, a3, _mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), _mm_loadu_ps(p + 12), vw); \
+                CONV_MAC(a4, a5, a6, a7, _mm_loadu_ps(p + 16), _mm_loadu_ps(p + 20), _mm_loadu_ps(p + 24), _mm_loadu_ps(p + 28), vw); \
+            } \
+        } \
+        CONV_STORE(out + o, a0, a1, a2, a3); \
+        CONV_STORE(out + o + 16, a4, a5, a6, a7); \
+    } \
+}
+
+// Separable, first pass : horizontal sums of one widened row into hrow[i0,n-i0)
+#define CONV_ROW_H(NAME, N) \
+static void NAME(const KERNEL *k, const float *in, float *hrow, int n, int cstep) \
+{ \
+    const int size = (N), i0 = size / 2 * cstep, i1 = n - i0; \
+    for(int i = i0; i < i1; i += 16) { \
+        int o = i + 16 > i1 ? i1 - 16 : i; \
+        __m128 a0 = _mm_setzero_ps(), a1 = a0, a2 = a0, a3 = a0; \
+        _Pragma("GCC unroll 15") \
+        for(int x = 0; x < size; x++) { \
+            const float *p = in + o - i0 + x * cstep; \
+            __m128 vw = _mm_set1_ps(k->row[x]); \
+            CONV_MAC(a0, a1, a2, a3, _mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), _mm_loadu_ps(p + 12), vw); \
+        } \
+        _mm_storeu_ps(hrow + o, a0); \
+        _mm_storeu_ps(hrow + o + 4, a1); \
+        _mm_storeu_ps(hrow + o + 8, a2); \
+        _mm_storeu_ps(hrow + o + 12, a3); \
+    } \
+}
+
+// Separable, second pass : vertical sums of the size horizontal rows
+#define CONV_ROW_V(NAME, N) \
+static void NAME(const KERNEL *k, const float *const *hrows, unsigned char *out, int n, int cstep) \
+{ \
+    const int size = (N), i0 = size / 2 * cstep, i1 = n - i0; \
+    const __m128 vdiv = _mm_set1_ps((float)k->divisor); \
+    for(int i = i0; i < i1; i += 16) { \
+        int o = i + 16 > i1 ? i1 - 16 : i; \
+        __m128 a0 = _mm_setzero_ps(), a1 = a0, a2 = a0, a3 = a0; \
+        _Pragma("GCC unroll 15") \
+        for(int y = 0; y < size; y++) { \
+            __m128 vw = _mm_set1_ps(k->col[y]); \
+            const float *in = hrows[y] + o; \
+            CONV_MAC(a0, a1, a2, a3, _mm_loadu_ps(in), _mm_loadu_ps(in + 4), _mm_loadu_ps(in + 8), _mm_loadu_ps(in + 12), vw); \
+        } \
+        CONV_STORE(out + o, a0, a1, a2, a3); \
+    } \
+}
+
+CONV_ROW_2D(conv_row_2d_3, 3)
+CONV_ROW_2D(conv_row_2d_5, 5)
+CONV_ROW_2D(conv_row_2d_7, 7)
+CONV_ROW_2D(conv_row_2d_n, k->size)
+CONV_ROW_H(conv_row_h_3, 3)
+CONV_ROW_H(conv_row_h_5, 5)
+CONV_ROW_H(conv_row_h_7, 7)
+CONV_ROW_H(conv_row_h_n, k->size)
+CONV_ROW_V(conv_row_v_3, 3)
+CONV_ROW_V(conv_row_v_5, 5)
+CONV_ROW_V(conv_row_v_7, 7)
+CONV_ROW_V(conv_row_v_n, k->size)
+
+typedef void (*CONVROW2D)(const KERNEL *, const float *const *, unsigned char *, int, int);
+typedef void (*CONVROWH)(const KERNEL *, const float *, float *, int, int);
+typedef void (*CONVROWV)(const KERNEL *, const float *const *, unsigned char *, int, int);
+
+// Rows too narrow for a vector, same arithmetic one byte at a time
+static void conv_row_scalar(const KERNEL *k, const unsigned char *const *rows, unsigned char *out, int n, int cstep)
+{
+    int size = k->size, i0 = size / 2 * cstep;
+    for(int i = i0; i < n - i0; i++) {
+        float sum = 0;
+        int v;
+        for(int y = 0; y < size; y++) {
+            for(int x = 0; x < size; x++)
+                sum += rows[y][i - i0 + x * cstep] * k->weight[y * size + x];
+        }
+        if(k->integer)
+            v = _mm_cvttss_si32(_mm_set_ss(sum / k->divisor));
+        else
+            v = _mm_cvtss_si32(_mm_set_ss(sum));
+        out[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+}
+
+static void conv_widen(const unsigned char *in, float *out, int n)
+{
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128 f0, f1, f2, f3;
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + i));
+        CONV_EXPAND(b, f0, f1, f2, f3);
+        _mm_storeu_ps(out + i, f0);
+        _mm_storeu_ps(out + i + 4, f1);
+        _mm_storeu_ps(out + i + 8, f2);
+        _mm_storeu_ps(out + i + 12, f3);
+    }
+    for(; i < n; i++)
+        out[i] = in[i];
+}
+
+/*********************************************************/
+// convolve rows [y0,y1), in order ; each input row is
+// widened to floats once, and for a separable kernel run
+// through the horizontal pass, into a ring of size rows
+/*********************************************************/
+int conv_rows(const KERNEL *k, const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int y0, int y1)
+{
+    int size = k->size, r = size / 2, n = w * cstep, i0 = r * cstep;
+    // a 3x3 is cheaper as 9 taps than as two passes of 3
+    int vec = n - 2 * i0 >= 32, separable = k->separable && size >= 5, next = -1;
+    CONVROW2D row_2d = size == 3 ? conv_row_2d_3 : size == 5 ? conv_row_2d_5 : size == 7 ? conv_row_2d_7 : conv_row_2d_n;
+    CONVROWH row_h = size == 3 ? conv_row_h_3 : size == 5 ? conv_row_h_5 : size == 7 ? conv_row_h_7 : conv_row_h_n;
+    CONVROWV row_v = size == 3 ? conv_row_v_3 : size == 5 ? conv_row_v_5 : size == 7 ? conv_row_v_7 : conv_row_v_n;
+    float *ring = NULL;
+    if(vec) {
+        // + 1 line to widen the rows of a separable kernel
+        ring = malloc((size_t)(size + 1) * n * sizeof(float));
+        if(!ring) {
+            fprintf(stderr, "convolution : out of memory\n");
+            return 0;
+        }
+    }
+    for(int y = y0; y < y1; y++) {
+        const unsigned char *rows[KERNEL_MAX];
+        const float *frows[KERNEL_MAX];
+        unsigned char *out = dst + (size_t)y * n;
+        if(w < size || y < r || y >= h - r) {
+            memcpy(out, src + (size_t)y * n, n);
+            continue;
+        }
+        memcpy(out, src + (size_t)y * n, i0);
+        memcpy(out + n - i0, src + (size_t)y * n + n - i0, i0);
+        if(!vec) {
+            for(int j = 0; j < size; j++)
+                rows[j] = src + (size_t)(y - r + j) * n;
+            conv_row_scalar(k, rows, out, n, cstep);
+            continue;
+        }
+        // only the row entering the window is new
+        if(next < 0)
+            next = y - r;
+        for(; next <= y + r; next++) {
+            float *slot = ring + (size_t)(next % size) * n;
+            if(separable) {
+                float *line = ring + (size_t)size * n;
+                conv_widen(src + (size_t)next * n, line, n);
+                row_h(k, line, slot, n, cstep);
+            } else {
+                conv_widen(src + (size_t)next * n, slot, n);
+            }
+        }
+        for(int j = 0; j < size; j++)
+            frows[j] = ring + (size_t)((y - r + j) % size) * n;
+        if(separable)
+            row_v(k, frows, out, n, cstep);
+        else
+            row_2d(k, frows, out, n, cstep);
+    }
+    free(ring);
+    return 1;
+}
+
+typedef struct conv_job {
+    const KERNEL *k;
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+    int ok;
+} CONVJOB;
+
+static void conv_band(void *arg, int item)
+{
+    CONVJOB *job = arg;
+    int y0 = item * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < job->h ? y0 + BAND_ROWS : job->h;
+    if(!conv_rows(job->k, job->src, job->dst, job->w, job->h, job->cstep, y0, y1))
+        job->ok = 0;
+}
+
+int conv_apply(const KERNEL *k, const unsigned char *src, unsigned char *dst, int w, int h, int cstep)
+{
+    CONVJOB job = {k, src, dst, w, h, cstep, 1};
+    if(!k->separable && k->size >= CONV_FFT_MIN_SIZE)
+        return conv_fft(k, src, dst, w, h, cstep);
+    pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, conv_band, &job);
+    return job.ok;
+}
+
+int conv_apply_ori(const KERNEL *k, const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h)
+{
+    return conv_apply(k, (const unsigned char *)src, (unsigned char *)dst, w, h, 3);
+}
+
+int conv_apply_tri(const KERNEL *k, const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    return conv_apply(k, src, dst, w, h, 1);
+}
+
+void conv_row_float(const KERNEL *k, const float *in, float *out, int n, int cstep)
+{
+    int size = k->size, i0 = size / 2 * cstep;
+    if(n - 2 * i0 >= 16) {
+        CONVROWH row_h = size == 3 ? conv_row_h_3 : size == 5 ? conv_row_h_5 : size == 7 ? conv_row_h_7 : conv_row_h_n;
+        row_h(k, in, out, n, cstep);
+        return;
+    }
+    for(int i = i0; i < n - i0; i++) {
+        float sum = 0;
+        for(int x = 0; x < size; x++)
+            sum += in[i - i0 + x * cstep] * k->row[x];
+        out[i] = sum;
+    }
+}
+
+void conv_col_float(const KERNEL *k, const float *const *rows, float *out, int n)
+{
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m128 a0 = _mm_setzero_ps(), a1 = a0;
+        for(int y = 0; y < k->size; y++) {
+            __m128 vw = _mm_set1_ps(k->col[y]);
+            a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(rows[y] + i), vw));
+            a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(rows[y] + i + 4), vw));
+        }
+        _mm_storeu_ps(out + i, a0);
+        _mm_storeu_ps(out + i + 4, a1);
+    }
+    for(; i < n; i++) {
+        float sum = 0;
+        for(int y = 0; y < k->size; y++)
+            sum += rows[y][i] * k->col[y];
+        out[i] = sum;
+    }
+}
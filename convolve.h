@@ -0,0 +1,42 @@
+#ifndef CONVOLUTION
+#define CONVOLUTION
+#include "bmp.h"
+
+#define KERNEL_MAX 63
+
+// Square convolution kernel of size x size (odd, up to KERNEL_MAX) weights.
+// Integer kernels are divided by divisor and truncated like the hand written
+// blurs (sum / 273), float kernels are rounded ; both saturate to 0 ~ 255.
+// A rank 1 kernel, weight[y][x] = col[y] * row[x], is run as two 1D passes.
+typedef struct conv_kernel {
+    int size;
+    int integer;
+    int divisor;
+    float weight[KERNEL_MAX * KERNEL_MAX];
+    int separable;
+    float row[KERNEL_MAX];
+    float col[KERNEL_MAX];
+} KERNEL;
+
+int kernel_int(KERNEL *k, int size, const int *weight, int divisor);
+int kernel_float(KERNEL *k, int size, const float *weight);
+// size x size mean
+int kernel_box(KERNEL *k, int size);
+// "gaussian3", "gaussian5", "sharpen", "emboss", "edge" or "box<size>"
+int kernel_named(KERNEL *k, const char *name);
+
+// Rows [y0,y1) of dst from src, w pixels of cstep bytes per row (1 : planar,
+// 3 : RGBTRIPLE), the size / 2 pixels border is copied unchanged.
+int conv_rows(const KERNEL *k, const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int y0, int y1);
+// whole image, bands spread over the default worker pool ; large non
+// separable kernels go through conv_fft (fft.h)
+int conv_apply(const KERNEL *k, const unsigned char *src, unsigned char *dst, int w, int h, int cstep);
+int conv_apply_ori(const KERNEL *k, const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h);
+int conv_apply_tri(const KERNEL *k, const unsigned char *src, unsigned char *dst, int w, int h);
+// The two passes of a separable kernel on float rows, not divided : out[i]
+// = sum of row[x] * in[i + (x - size / 2) * cstep] over [size / 2 * cstep,
+// n - size / 2 * cstep), the ends are left alone ; out[i] = sum of col[y] *
+// rows[y][i] over [0,n).
+void conv_row_float(const KERNEL *k, const float *in, float *out, int n, int cstep);
+void conv_col_float(const KERNEL *k, const float *const *rows, float *out, int n);
+#endif // CONVOLUTION
@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+#include "edge.h"
+#include "gaussian.h"
+#include "pool.h"
+
+// rows handed to a pool worker at a time
+#define BAND_ROWS 32
+
+// candidate classes of the suppressed gradient, STRONG_ROOT marks a
+// union-find root whose component holds a strong pixel
+#define CLASS_WEAK 1
+#define CLASS_STRONG 2
+#define CLASS_MASK 3
+#define STRONG_ROOT 4
+
+static void grad_weights(int kind, int *a, int *b)
+{
+    *a = kind == GRAD_SCHARR ? 3 : 1;
+    *b = kind == GRAD_SCHARR ? 10 : 2;
+}
+
+// tan 22.5 ~ 5 / 12 splits the 4 direction bins without a division
+static int grad_dir(int gx, int gy)
+{
+    int ax = abs(gx), ay = abs(gy);
+    if(ay * 12 <= ax * 5)
+        return 0;
+    if(ay * 5 >= ax * 12)
+        return 2;
+    return (gx ^ gy) >= 0 ? 1 : 3;
+}
+
+#define LOAD8(p) _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(p)))
+// a <= b on unsigned 16 bits lanes
+#define LE_EPU16(a, b) _mm_cmpeq_epi16(_mm_max_epu16(a, b), b)
+
+/*********************************************************/
+// gradient of row r1 from its neighbours r0 (above) and r2,
+// 8 pixels per iteration on 16 bits lanes
+/*********************************************************/
+static void gradient_row(const unsigned char *r0, const unsigned char *r1, const unsigned char *r2,
+                         unsigned short *mag, unsigned char *dir, int w, int a, int b)
+{
+    const __m128i va = _mm_set1_epi16(a), vb = _mm_set1_epi16(b);
+    const __m128i v5 = _mm_set1_epi16(5), v12 = _mm_set1_epi16(12);
+    const __m128i v1 = _mm_set1_epi16(1), v2 = _mm_set1_epi16(2), v3 = _mm_set1_epi16(3);
+    const __m128i vm1 = _mm_set1_epi16(-1);
+    mag[0] = mag[w - 1] = 0;
+    dir[0] = dir[w - 1] = 0;
+    int x = 1;
+    if(w - 2 >= 8) {
+        for(;; x += 8) {
+            if(x + 8 > w - 1)
+                x = w - 9; // last vector overlaps the previous one
+            __m128i l0 = LOAD8(r0 + x - 1), c0 = LOAD8(r0 + x), q0 = LOAD8(r0 + x + 1);
+            __m128i l1 = LOAD8(r1 + x - 1), q1 = LOAD8(r1 + x + 1);
+            __m128i l2 = LOAD8(r2 + x - 1), c2 = LOAD8(r2 + x), q2 = LOAD8(r2 + x + 1);
+            __m128i gx = _mm_add_epi16(_mm_mullo_epi16(_mm_add_epi16(_mm_sub_epi16(q0, l0), _mm_sub_epi16(q2, l2)), va),
+                                       _mm_mullo_epi16(_mm_sub_epi16(q1, l1), vb));
+            __m128i gy = _mm_add_epi16(_mm_mullo_epi16(_mm_add_epi16(_mm_sub_epi16(l2, l0), _mm_sub_epi16(q2, q0)), va),
+                                       _mm_mullo_epi16(_mm_sub_epi16(c2, c0), vb));
+            __m128i ax = _mm_abs_epi16(gx), ay = _mm_abs_epi16(gy);
+            _mm_storeu_si128((__m128i *)(mag + x), _mm_add_epi16(ax, ay));
+            __m128i ay12 = _mm_mullo_epi16(ay, v12), ax5 = _mm_mullo_epi16(ax, v5);
+            __m128i ay5 = _mm_mullo_epi16(ay, v5), ax12 = _mm_mullo_epi16(ax, v12);
+            __m128i same = _mm_cmpgt_epi16(_mm_xor_si128(gx, gy), vm1);
+            __m128i d = _mm_blendv_epi8(v3, v1, same);
+            d = _mm_blendv_epi8(d, v2, LE_EPU16(ax12, ay5));
+            d = _mm_andnot_si128(LE_EPU16(ay12, ax5), d);
+            _mm_storel_epi64((__m128i *)(dir + x), _mm_packus_epi16(d, d));
+            if(x == w - 9)
+                return;
+        }
+    }
+    for(; x < w - 1; x++) {
+        int gx = a * (r0[x + 1] - r0[x - 1] + r2[x + 1] - r2[x - 1]) + b * (r1[x + 1] - r1[x - 1]);
+        int gy = a * (r2[x - 1] - r0[x - 1] + r2[x + 1] - r0[x + 1]) + b * (r2[x] - r0[x]);
+        mag[x] = abs(gx) + abs(gy);
+        dir[x] = grad_dir(gx, gy);
+    }
+}
+
+/*********************************************************/
+// non-maximum suppression of row m1 (m0 above, m2 below) :
+// a pixel survives when it is above its first neighbour
+// along the gradient and not below the second one
+/*********************************************************/
+static void nms_row(const unsigned short *m0, const unsigned short *m1, const unsigned short *m2,
+                    const unsigned char *dir, unsigned char *cls, int w, int low, int high)
+{
+    const __m128i v1 = _mm_set1_epi16(1), v2 = _mm_set1_epi16(2);
+    const __m128i vk0 = _mm_setzero_si128(), vone = _mm_set1_epi16(1);
+    const __m128i vlow = _mm_set1_epi16(low), vhigh = _mm_set1_epi16(high);
+    cls[0] = cls[w - 1] = 0;
+    int x = 1;
+    if(w - 2 >= 8) {
+        for(;; x += 8) {
+            if(x + 8 > w - 1)
+                x = w - 9;
+            __m128i m = _mm_loadu_si128((const __m128i *)(m1 + x));
+            __m128i d = LOAD8(dir + x);
+            __m128i e0 = _mm_cmpeq_epi16(d, vk0), e1 = _mm_cmpeq_epi16(d, v1), e2 = _mm_cmpeq_epi16(d, v2);
+            // direction 3 by default : (x+1,y-1) and (x-1,y+1)
+            __m128i n1 = _mm_loadu_si128((const __m128i *)(m0 + x + 1));
+            __m128i n2 = _mm_loadu_si128((const __m128i *)(m2 + x - 1));
+            n1 = _mm_blendv_epi8(n1, _mm_loadu_si128((const __m128i *)(m0 + x)), e2);
+            n2 = _mm_blendv_epi8(n2, _mm_loadu_si128((const __m128i *)(m2 + x)), e2);
+            n1 = _mm_blendv_epi8(n1, _mm_loadu_si128((const __m128i *)(m0 + x - 1)), e1);
+            n2 = _mm_blendv_epi8(n2, _mm_loadu_si128((const __m128i *)(m2 + x + 1)), e1);
+            n1 = _mm_blendv_epi8(n1, _mm_loadu_si128((const __m128i *)(m1 + x - 1)), e0);
+            n2 = _mm_blendv_epi8(n2, _mm_loadu_si128((const __m128i *)(m1 + x + 1)), e0);
+            // magnitudes stay below 2^15, signed compares are fine
+            __m128i keep = _mm_andnot_si128(_mm_cmpgt_epi16(n2, m), _mm_cmpgt_epi16(m, n1));
+            __m128i c = _mm_add_epi16(_mm_and_si128(_mm_cmpgt_epi16(m, vlow), vone),
+                                      _mm_and_si128(_mm_cmpgt_epi16(m, vhigh), vone));
+            c = _mm_and_si128(c, keep);
+            _mm_storel_epi64((__m128i *)(cls + x), _mm_packus_epi16(c, c));
+            if(x == w - 9)
+                return;
+        }
+    }
+    for(; x < w - 1; x++) {
+        int m = m1[x], n1, n2;
+        switch(dir[x]) {
+        case 0: n1 = m1[x - 1]; n2 = m1[x + 1]; break;
+        case 1: n1 = m0[x - 1]; n2 = m2[x + 1]; break;
+        case 2: n1 = m0[x]; n2 = m2[x]; break;
+        default: n1 = m0[x + 1]; n2 = m2[x - 1]; break;
+        }
+        cls[x] = m > n1 && m >= n2 ? (m > low) + (m > high) : 0;
+    }
+}
+
+/*********************************************************/
+// lock free union-find : a parent index is never above its
+// child, so linking the larger root under the smaller one
+// with a CAS cannot build a cycle
+/*********************************************************/
+static int uf_find(int *parent, int p)
+{
+    for(;;) {
+        int q = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+        if(q == p)
+            return p;
+        int r = __atomic_load_n(&parent[q], __ATOMIC_RELAXED);
+        if(r != q) // path halving
+            __sync_bool_compare_and_swap(&parent[p], q, r);
+        p = r;
+    }
+}
+
+static void uf_union(int *parent, int a, int b)
+{
+    for(;;) {
+        a = uf_find(parent, a);
+        b = uf_find(parent, b);
+        if(a == b)
+            return;
+        if(a > b) {
+            int t = a;
+            a = b;
+            b = t;
+        }
+        if(__sync_bool_compare_and_swap(&parent[b], b, a))
+            return;
+    }
+}
+
+typedef struct gradient_job {
+    const unsigned char *src;
+    unsigned short *mag;
+    unsigned char *dir;
+    int w;
+    int h;
+    int a;
+    int b;
+    int ok;
+} GRADIENTJOB;
+
+static void gradient_band(void *arg, int item)
+{
+    GRADIENTJOB *job = arg;
+    int w = job->w, h = job->h;
+    int y0 = item * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < h ? y0 + BAND_ROWS : h;
+    // rows of the output left out land in a scratch row
+    unsigned short *mrow = job->mag ? NULL : malloc(w * sizeof(*mrow));
+    unsigned char *drow = job->dir ? NULL : malloc(w);
+    if((!job->mag && !mrow) || (!job->dir && !drow)) {
+        fprintf(stderr, "gradient : out of memory\n");
+        job->ok = 0;
+        y1 = y0;
+    }
+    for(int y = y0; y < y1; y++) {
+        unsigned short *mag = job->mag ? job->mag + (size_t)y * w : mrow;
+        unsigned char *dir = job->dir ? job->dir + (size_t)y * w : drow;
+        if(y == 0 || y == h - 1 || w < 3) {
+            memset(mag, 0, w * sizeof(*mag));
+            memset(dir, 0, w);
+            continue;
+        }
+        const unsigned char *r1 = job->src + (size_t)y * w;
+        gradient_row(r1 - w, r1, r1 + w, mag, dir, w, job->a, job->b);
+    }
+    free(mrow);
+    free(drow);
+}
+
+int gradient_tri(const unsigned char *src, unsigned short *mag, unsigned char *dir, int w, int h, int kind)
+{
+    GRADIENTJOB job = {src, mag, dir, w, h, 0, 0, 1};
+    grad_weights(kind, &job.a, &job.b);
+    pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, gradient_band, &job);
+    return job.ok;
+}
+
+typedef struct canny_job {
+    const unsigned char *src;
+    unsigned char *cls; // the edges plane holds the classes until the last pass
+    int *parent;
+    int w;
+    int h;
+    int low;
+    int high;
+    int a;
+    int b;
+    int ok;
+} CANNYJOB;
+
+static void canny_blur_row(const CANNYJOB *job, int t, unsigned char *out)
+{
+    int w = job->w, h = job->h;
+    const unsigned char *row = job->src + (size_t)t * w;
+    if(h < 5 || t < 2 || t >= h - 2) {
+        memcpy(out, row, w);
+        return;
+    }
+    unsigned char *rows[5];
+    for(int k = 0; k < 5; k++)
+        rows[k] = (unsigned char *)row + (ptrdiff_t)(k - 2) * w;
+    sse_gaussian_blur_5_row(rows, out, w, 1);
+}
+
+static void canny_nms_row(const CANNYJOB *job, int c, unsigned short *const mag[3], const unsigned char *dir)
+{
+    int w = job->w, h = job->h;
+    unsigned char *cls = job->cls + (size_t)c * w;
+    if(c == 0 || c == h - 1 || w < 3) {
+        memset(cls, 0, w);
+        return;
+    }
+    nms_row(mag[(c - 1) % 3], mag[c % 3], mag[(c + 1) % 3], dir, cls, w, job->low, job->high);
+    int *parent = job->parent + (size_t)c * w;
+    for(int x = 1; x < w - 1; x++)
+        if(cls[x])
+            parent[x] = c * w + x;
+}
+
+/*********************************************************/
+// blur, gradient and suppression of the band rows : blur
+// rows run 2 rows ahead of the classes, gradient rows 1,
+// through 3 rows rings
+/*********************************************************/
+static void canny_class_band(void *arg, int item)
+{
+    CANNYJOB *job = arg;
+    int w = job->w, h = job->h;
+    int y0 = item * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < h ? y0 + BAND_ROWS : h;
+    unsigned char *buf = malloc((size_t)w * 3 * (1 + 2 + 1));
+    if(!buf) {
+        fprintf(stderr, "canny : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    unsigned char *blur[3], *dir[3];
+    unsigned short *mag[3];
+    for(int k = 0; k < 3; k++) {
+        mag[k] = (unsigned short *)buf + (size_t)k * w;
+        blur[k] = buf + (size_t)w * (6 + k);
+        dir[k] = buf + (size_t)w * (9 + k);
+    }
+    int g0 = y0 > 0 ? y0 - 1 : 0, g1 = y1 < h ? y1 + 1 : h;
+    int next = g0 > 0 ? g0 - 1 : 0; // next blur row
+    for(int g = g0; g < g1; g++) {
+        if(g == 0 || g == h - 1 || w < 3) {
+            memset(mag[g % 3], 0, w * sizeof(**mag));
+        } else {
+            for(; next <= g + 1; next++)
+                canny_blur_row(job, next, blur[next % 3]);
+            gradient_row(blur[(g - 1) % 3], blur[g % 3], blur[(g + 1) % 3], mag[g % 3], dir[g % 3], w, job->a, job->b);
+        }
+        if(g - 1 >= y0)
+            canny_nms_row(job, g - 1, mag, dir[(g - 1) % 3]);
+    }
+    if(y1 == h)
+        canny_nms_row(job, h - 1, mag, NULL);
+    free(buf);
+}
+
+// true when the 16 bytes from p are all 0
+static int zero16(const unsigned char *p)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), _mm_setzero_si128())) == 0xffff;
+}
+
+static void canny_union_band(void *arg, int item)
+{
+    CANNYJOB *job = arg;
+    int w = job->w;
+    int y0 = item * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < job->h ? y0 + BAND_ROWS : job->h;
+    // rows 0 and h - 1 and the side columns hold no candidate
+    for(int y = y0 > 1 ? y0 : 1; y < y1 && y < job->h - 1; y++) {
+        const unsigned char *cls = job->cls + (size_t)y * w, *up = cls - w;
+        for(int x = 1; x < w - 1; x++) {
+            if(x + 16 <= w && zero16(cls + x)) {
+                x += 15;
+                continue;
+            }
+            if(!cls[x])
+                continue;
+            int p = y * w + x;
+            if(cls[x - 1])
+                uf_union(job->parent, p, p - 1);
+            if(up[x - 1])
+                uf_union(job->parent, p, p - w - 1);
+            if(up[x])
+                uf_union(job->parent, p, p - w);
+            if(up[x + 1])
+                uf_union(job->parent, p, p - w + 1);
+        }
+    }
+}
+
+static void canny_mark_band(void *arg, int item)
+{
+    CANNYJOB *job = arg;
+    size_t p0 = (size_t)item * BAND_ROWS * job->w;
+    size_t p1 = p0 + (size_t)BAND_ROWS * job->w;
+    if(p1 > (size_t)job->w * job->h)
+        p1 = (size_t)job->w * job->h;
+    for(size_t p = p0; p < p1; p++) {
+        if(p + 16 <= p1 && zero16(job->cls + p)) {
+            p += 15;
+            continue;
+        }
+        if((__atomic_load_n(&job->cls[p], __ATOMIC_RELAXED) & CLASS_MASK) == CLASS_STRONG)
+            __atomic_or_fetch(&job->cls[uf_find(job->parent, p)], STRONG_ROOT, __ATOMIC_RELAXED);
+    }
+}
+
+// classes become 255 / 0 in place : a root turns into 255 exactly when
+// it carries STRONG_ROOT, which is one of 255's bits, so readers from
+// other bands see the same answer before and after it is rewritten
+static void canny_output_band(void *arg, int item)
+{
+    CANNYJOB *job = arg;
+    size_t p0 = (size_t)item * BAND_ROWS * job->w;
+    size_t p1 = p0 + (size_t)BAND_ROWS * job->w;
+    if(p1 > (size_t)job->w * job->h)
+        p1 = (size_t)job->w * job->h;
+    for(size_t p = p0; p < p1; p++) {
+        if(p + 16 <= p1 && zero16(job->cls + p)) {
+            p += 15;
+            continue;
+        }
+        if(!(job->cls[p] & CLASS_MASK))
+            continue;
+        int r = uf_find(job->parent, p);
+        int on = __atomic_load_n(&job->cls[r], __ATOMIC_RELAXED) & STRONG_ROOT;
+        __atomic_store_n(&job->cls[p], on ? 255 : 0, __ATOMIC_RELAXED);
+    }
+}
+
+int canny_tri(const unsigned char *src, unsigned char *edges, int w, int h, int low, int high, int kind)
+{
+    // parent indices are ints
+    if((size_t)w * h > 0x7fffffff) {
+        fprintf(stderr, "canny : %d x %d image is too large\n", w, h);
+        return 0;
+    }
+    if(low > high)
+        low = high;
+    // only candidate pixels get a parent, the rest of the pages stay untouched
+    int *parent = malloc((size_t)w * h * sizeof(*parent));
+    if(!parent) {
+        fprintf(stderr, "canny : out of memory\n");
+        return 0;
+    }
+    CANNYJOB job = {src, edges, parent, w, h, low, high, 0, 0, 1};
+    grad_weights(kind, &job.a, &job.b);
+    int bands = (h + BAND_ROWS - 1) / BAND_ROWS;
+    THREADPOOL *pool = pool_default();
+    pool_run(pool, bands, canny_class_band, &job);
+    if(job.ok) {
+        pool_run(pool, bands, canny_union_band, &job);
+        pool_run(pool, bands, canny_mark_band, &job);
+        pool_run(pool, bands, canny_output_band, &job);
+    }
+    free(parent);
+    return job.ok;
+}
+
+typedef struct luma_job {
+    const RGBTRIPLE *rgb;
+    RGBTRIPLE *out;
+    unsigned char *plane;
+    int w;
+    int h;
+} LUMAJOB;
+
+static void luma_band(void *arg, int item)
+{
+    LUMAJOB *job = arg;
+    size_t p0 = (size_t)item * BAND_ROWS * job->w;
+    size_t p1 = p0 + (size_t)BAND_ROWS * job->w;
+    if(p1 > (size_t)job->w * job->h)
+        p1 = (size_t)job->w * job->h;
+    for(size_t p = p0; p < p1; p++) {
+        const RGBTRIPLE *c = job->rgb + p;
+        job->plane[p] = (29 * c->rgbBlue + 150 * c->rgbGreen + 77 * c->rgbRed + 128) >> 8;
+    }
+}
+
+static void gray_band(void *arg, int item)
+{
+    LUMAJOB *job = arg;
+    size_t p0 = (size_t)item * BAND_ROWS * job->w;
+    size_t p1 = p0 + (size_t)BAND_ROWS * job->w;
+    if(p1 > (size_t)job->w * job->h)
+        p1 = (size_t)job->w * job->h;
+    for(size_t p = p0; p < p1; p++)
+        job->out[p].rgbBlue = job->out[p].rgbGreen = job->out[p].rgbRed = job->plane[p];
+}
+
+int canny_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int low, int high)
+{
+    unsigned char *plane = malloc((size_t)w * h * 2);
+    if(!plane) {
+        fprintf(stderr, "canny : out of memory\n");
+        return 0;
+    }
+    LUMAJOB job = {src, dst, plane, w, h};
+    int bands = (h + BAND_ROWS - 1) / BAND_ROWS;
+    pool_run(pool_default(), bands, luma_band, &job);
+    int ok = canny_tri(plane, plane + (size_t)w * h, w, h, low, high, GRAD_SOBEL);
+    if(ok) {
+        job.plane = plane + (size_t)w * h;
+        pool_run(pool_default(), bands, gray_band, &job);
+    }
+    free(plane);
+    return ok;
+}
@@ -0,0 +1,22 @@
+#ifndef EDGE_DETECT
+#define EDGE_DETECT
+#include "bmp.h"
+
+// gradient operators : [a b a] smoothing across the [-1 0 1] derivative
+#define GRAD_SOBEL 0 // a = 1 , b = 2
+#define GRAD_SCHARR 1 // a = 3 , b = 10
+
+// Gradient of a planar w x h plane : mag = |gx| + |gy| and dir the gradient
+// orientation in 4 bins (0 : horizontal , 1 : down right , 2 : vertical ,
+// 3 : down left , rows going down), either output may be NULL. The 1 pixel
+// border has mag 0.
+int gradient_tri(const unsigned char *src, unsigned short *mag, unsigned char *dir, int w, int h, int kind);
+
+// Canny edges of a planar plane into edges (255 / 0) : 5x5 gaussian, the
+// gradient and non-maximum suppression are fused in one row pass per band,
+// then pixels above low are linked with a lock free union-find and a
+// component is kept when one of its pixels is above high.
+int canny_tri(const unsigned char *src, unsigned char *edges, int w, int h, int low, int high, int kind);
+// on the luma of an RGB image, the edge map is written to the 3 channels
+int canny_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int low, int high);
+#endif // EDGE_DETECT
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "fft.h"
+#include "pool.h"
+
+#define FFT_PI 3.14159265358979323846
+
+typedef struct fft_plan {
+    int n;
+    int log2n;
+    float *cos; // W_n^k = cos[k] - i * sin[k] , k < n / 2
+    float *sin;
+    int *rev; // bit reversed index
+} FFTPLAN;
+
+// cos / sin of 2 * pi * k / n without libm : Taylor series on [0,pi/2]
+static void unit_root(int k, int n, double *c, double *s)
+{
+    double x = 2 * FFT_PI * k / n, x2, term_c = 1, term_s, sum_c = 1, sum_s;
+    int quarter = 0;
+    while(x > FFT_PI / 2) {
+        x -= FFT_PI / 2;
+        quarter++;
+    }
+    x2 = x * x;
+    term_s = sum_s = x;
+    for(int i = 1; i < 14; i++) {
+        term_c *= -x2 / ((2 * i - 1) * (2 * i));
+        term_s *= -x2 / ((2 * i) * (2 * i + 1));
+        sum_c += term_c;
+        sum_s += term_s;
+    }
+    // rotate back by quarter * pi / 2
+    for(; quarter > 0; quarter--) {
+        double t = sum_c;
+        sum_c = -sum_s;
+        sum_s = t;
+    }
+    *c = sum_c;
+    *s = sum_s;
+}
+
+static int fft_plan_init(FFTPLAN *plan, int n)
+{
+    plan->n = n;
+    for(plan->log2n = 0; (1 << plan->log2n) < n; plan->log2n++);
+    plan->cos = malloc(n / 2 * sizeof(float));
+    plan->sin = malloc(n / 2 * sizeof(float));
+    plan->rev = malloc(n * sizeof(int));
+    if(!plan->cos || !plan->sin || !plan->rev)
+        return 0;
+    for(int k = 0; k < n / 2; k++) {
+        double c, s;
+        unit_root(k, n, &c, &s);
+        plan->cos[k] = c;
+        plan->sin[k] = s;
+    }
+    for(int i = 0; i < n; i++) {
+        int r = 0;
+        for(int b = 0; b < plan->log2n; b++)
+            r |= ((i >> b) & 1) << (plan->log2n - 1 - b);
+        plan->rev[i] = r;
+    }
+    return 1;
+}
+
+static void fft_plan_free(FFTPLAN *plan)
+{
+    free(plan->cos);
+    free(plan->sin);
+    free(plan->rev);
+}
+
+static void swap_rows(float *a, float *b, int n)
+{
+    for(int c = 0; c < n; c += 4) {
+        __m128 t = _mm_loadu_ps(a + c);
+        _mm_storeu_ps(a + c, _mm_loadu_ps(b + c));
+        _mm_storeu_ps(b + c, t);
+    }
+}
+
+// t = b * (wr + i * wi)
+#define CMUL(tr, ti, br, bi, wr, wi) do { \
+        tr = _mm_sub_ps(_mm_mul_ps(br, wr), _mm_mul_ps(bi, wi)); \
+        ti = _mm_add_ps(_mm_mul_ps(br, wi), _mm_mul_ps(bi, wr)); \
+    } while(0)
+
+// a , b = a + t , a - t
+#define BUTTERFLY(ar, ai, br, bi, tr, ti) do { \
+        br = _mm_sub_ps(ar, tr); \
+        bi = _mm_sub_ps(ai, ti); \
+        ar = _mm_add_ps(ar, tr); \
+        ai = _mm_add_ps(ai, ti); \
+    } while(0)
+
+/*********************************************************/
+// n transforms of length n at once, one per column of the
+// n x n split complex tile : a butterfly between 2 rows
+// uses the same twiddle for every column, so it runs on
+// whole rows, 4 columns per vector. Radix 4 stages (two
+// radix 2 stages per pass over the data) after a radix 2
+// stage when log2(n) is odd.
+/*********************************************************/
+static void fft_columns(const FFTPLAN *plan, float *re, float *im, int inverse)
+{
+    int n = plan->n;
+    float sign = inverse ? -1 : 1;
+    for(int i = 0; i < n; i++) {
+        if(i < plan->rev[i]) {
+            swap_rows(re + i * n, re + plan->rev[i] * n, n);
+            swap_rows(im + i * n, im + plan->rev[i] * n, n);
+        }
+    }
+    int h = 1;
+    if(plan->log2n & 1) {
+        for(int i = 0; i < n; i += 2) {
+            float *r0 = re + i * n, *i0 = im + i * n, *r1 = r0 + n, *i1 = i0 + n;
+            for(int c = 0; c < n; c += 4) {
+                __m128 ar = _mm_loadu_ps(r0 + c), ai = _mm_loadu_ps(i0 + c);
+                __m128 tr = _mm_loadu_ps(r1 + c), ti = _mm_loadu_ps(i1 + c), br, bi;
+                BUTTERFLY(ar, ai, br, bi, tr, ti);
+                _mm_storeu_ps(r0 + c, ar);
+                _mm_storeu_ps(i0 + c, ai);
+                _mm_storeu_ps(r1 + c, br);
+                _mm_storeu_ps(i1 + c, bi);
+            }
+        }
+        h = 2;
+    }
+    // fused stages of length 2h and 4h
+    for(; 4 * h <= n; h *= 4) {
+        for(int i = 0; i < n; i += 4 * h) {
+            for(int j = 0; j < h; j++) {
+                // W_2h^j , W_4h^j and W_4h^(j+h) = W_4h^j * W_4^1
+                int k1 = j * (n / (2 * h)), k2 = j * (n / (4 * h));
+                // W_4^1 = -i , i for the inverse
+                const __m128 w1r = _mm_set1_ps(plan->cos[k1]), w1i = _mm_set1_ps(-sign * plan->sin[k1]);
+                const __m128 w2r = _mm_set1_ps(plan->cos[k2]), w2i = _mm_set1_ps(-sign * plan->sin[k2]);
+                const __m128 w3r = _mm_set1_ps(-plan->sin[k2]), w3i = _mm_set1_ps(-sign * plan->cos[k2]);
+                float *r0 = re + (i + j) * n, *r1 = r0 + h * n, *r2 = r0 + 2 * h * n, *r3 = r0 + 3 * h * n;
+                float *i0 = im + (i + j) * n, *i1 = i0 + h * n, *i2 = i0 + 2 * h * n, *i3 = i0 + 3 * h * n;
+                for(int c = 0; c < n; c += 4) {
+                    __m128 ar = _mm_loadu_ps(r0 + c), ai = _mm_loadu_ps(i0 + c);
+                    __m128 br = _mm_loadu_ps(r1 + c), bi = _mm_loadu_ps(i1 + c);
+                    __m128 cr = _mm_loadu_ps(r2 + c), ci = _mm_loadu_ps(i2 + c);
+                    __m128 dr = _mm_loadu_ps(r3 + c), di = _mm_loadu_ps(i3 + c);
+                    __m128 tr, ti;
+                    CMUL(tr, ti, br, bi, w1r, w1i);
+                    BUTTERFLY(ar, ai, br, bi, tr, ti);
+                    CMUL(tr, ti, dr, di, w1r, w1i);
+                    BUTTERFLY(cr, ci, dr, di, tr, ti);
+                    CMUL(tr, ti, cr, ci, w2r, w2i);
+                    BUTTERFLY(ar, ai, cr, ci, tr, ti);
+                    CMUL(tr, ti, dr, di, w3r, w3i);
+                    BUTTERFLY(br, bi, dr, di, tr, ti);
+                    _mm_storeu_ps(r0 + c, ar);
+                    _mm_storeu_ps(i0 + c, ai);
+                    _mm_storeu_ps(r1 + c, br);
+                    _mm_storeu_ps(i1 + c, bi);
+                    _mm_storeu_ps(r2 + c, cr);
+                    _mm_storeu_ps(i2 + c, ci);
+                    _mm_storeu_ps(r3 + c, dr);
+                    _mm_storeu_ps(i3 + c, di);
+                }
+            }
+        }
+    }
+}
+
+// in place n x n transpose by 4 x 4 blocks
+static void transpose_square(float *a, int n)
+{
+    for(int bi = 0; bi < n; bi += 4) {
+        for(int bj = bi; bj < n; bj += 4) {
+            float *p = a + bi * n + bj, *q = a + bj * n + bi;
+            __m128 p0 = _mm_loadu_ps(p), p1 = _mm_loadu_ps(p + n), p2 = _mm_loadu_ps(p + 2 * n), p3 = _mm_loadu_ps(p + 3 * n);
+            _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+            if(bi == bj) {
+                _mm_storeu_ps(p, p0);
+                _mm_storeu_ps(p + n, p1);
+                _mm_storeu_ps(p + 2 * n, p2);
+                _mm_storeu_ps(p + 3 * n, p3);
+                continue;
+            }
+            __m128 q0 = _mm_loadu_ps(q), q1 = _mm_loadu_ps(q + n), q2 = _mm_loadu_ps(q + 2 * n), q3 = _mm_loadu_ps(q + 3 * n);
+            _MM_TRANSPOSE4_PS(q0, q1, q2, q3);
+            _mm_storeu_ps(q, p0);
+            _mm_storeu_ps(q + n, p1);
+            _mm_storeu_ps(q + 2 * n, p2);
+            _mm_storeu_ps(q + 3 * n, p3);
+            _mm_storeu_ps(p, q0);
+            _mm_storeu_ps(p + n, q1);
+            _mm_storeu_ps(p + 2 * n, q2);
+            _mm_storeu_ps(p + 3 * n, q3);
+        }
+    }
+}
+
+// 2D transform : columns, transpose, columns. The forward result is the
+// transposed spectrum, which the inverse (same steps) turns back.
+static void fft_2d(const FFTPLAN *plan, float *re, float *im, int inverse)
+{
+    fft_columns(plan, re, im, inverse);
+    transpose_square(re, plan->n);
+    transpose_square(im, plan->n);
+    fft_columns(plan, re, im, inverse);
+}
+
+typedef struct fft_job {
+    const FFTPLAN *plan;
+    const float *kre; // kernel spectrum, scaled by 1 / n^2
+    const float *kim;
+    const unsigned char *src;
+    int w;
+    int h;
+    int cstep;
+    int size;
+    int tile;
+    int ty; // tile row
+    int parity; // tiles tx = parity , parity + 2 , ...
+    int planes; // (tile, channel) planes in this pass
+    float *acc; // sums of the rows from acc_y0
+    int acc_y0;
+    int ok;
+} FFTJOB;
+
+// one complex transform for planes 2 * item and 2 * item + 1 (real / imag)
+static void fft_tile(void *arg, int item)
+{
+    FFTJOB *job = arg;
+    int n = job->plan->n, T = job->tile, r = job->size / 2, span = T + job->size - 1;
+    int w = job->w, cstep = job->cstep, stride = w * cstep;
+    float *buf = malloc(2 * (size_t)n * n * sizeof(float));
+    if(!buf) {
+        job->ok = 0;
+        return;
+    }
+    float *re = buf, *im = buf + (size_t)n * n;
+    memset(buf, 0, 2 * (size_t)n * n * sizeof(float));
+    for(int part = 0; part < 2; part++) {
+        int p = 2 * item + part;
+        if(p >= job->planes)
+            break;
+        int x0 = (job->parity + 2 * (p / cstep)) * T, ch = p % cstep, y0 = job->ty * T;
+        float *dst = part ? im : re;
+        for(int y = y0; y < y0 + T && y < job->h; y++) {
+            const unsigned char *in = job->src + (size_t)y * stride + ch;
+            float *out = dst + (y - y0) * n;
+            for(int x = x0; x < x0 + T && x < w; x++)
+                out[x - x0] = in[x * cstep];
+        }
+    }
+    fft_2d(job->plan, re, im, 0);
+    // (re + i * im) * kernel : the kernel is real, so the real and imaginary
+    // parts of the product are the convolutions of the two planes
+    for(int i = 0; i < n * n; i += 4) {
+        __m128 xr = _mm_loadu_ps(re + i), xi = _mm_loadu_ps(im + i), tr, ti;
+        __m128 kr = _mm_loadu_ps(job->kre + i), ki = _mm_loadu_ps(job->kim + i);
+        CMUL(tr, ti, xr, xi, kr, ki);
+        _mm_storeu_ps(re + i, tr);
+        _mm_storeu_ps(im + i, ti);
+    }
+    fft_2d(job->plan, re, im, 1);
+    for(int part = 0; part < 2; part++) {
+        int p = 2 * item + part;
+        if(p >= job->planes)
+            break;
+        int x0 = (job->parity + 2 * (p / cstep)) * T - r, ch = p % cstep, y0 = job->ty * T - r;
+        const float *res = part ? im : re;
+        for(int m = 0; m < span; m++) {
+            int y = y0 + m;
+            if(y < 0 || y >= job->h)
+                continue;
+            float *acc = job->acc + (size_t)(y - job->acc_y0) * stride + ch;
+            for(int q = 0; q < span; q++) {
+                int x = x0 + q;
+                if(x >= 0 && x < w)
+                    acc[x * cstep] += res[m * n + q];
+            }
+        }
+    }
+    free(buf);
+}
+
+// cost of a pixel ~ n^2 log2(n) / tile^2 , the tiles of a pass must be
+// 2 tiles apart without overlap, so tile >= size - 1
+static int fft_size(int size, int w, int h)
+{
+    int best = 0;
+    double best_cost = 0;
+    for(int n = 16; n <= FFT_MAX; n *= 2) {
+        int T = n - size + 1, log2n = 0;
+        if(T < size - 1 || T < 1)
+            continue;
+        for(; (1 << log2n) < n; log2n++);
+        double tiles = (double)((w + T - 1) / T) * ((h + T - 1) / T);
+        double cost = tiles * n * n * log2n;
+        if(!best || cost < best_cost) {
+            best = n;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+static void emit_row(const KERNEL *k, const unsigned char *src, unsigned char *dst, const float *acc, int w, int h, int cstep, int y)
+{
+    int r = k->size / 2, n = w * cstep, i0 = r * cstep;
+    memcpy(dst, src, n);
+    if(w < k->size || y < r || y >= h - r)
+        return;
+    for(int i = i0; i < n - i0; i++) {
+        int v = _mm_cvtss_si32(_mm_set_ss(acc[i]));
+        // integer sums are rounded back to integers before the division
+        if(k->integer)
+            v /= k->divisor;
+        dst[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+}
+
+/*********************************************************/
+// overlap-add : a tile row is added into a band of
+// tile + size - 1 rows, the rows no later tile reaches
+// are written out and the band slides down
+/*********************************************************/
+int conv_fft(const KERNEL *k, const unsigned char *src, unsigned char *dst, int w, int h, int cstep)
+{
+    int size = k->size, r = size / 2, n = fft_size(size, w, h), stride = w * cstep;
+    FFTPLAN plan = {0};
+    if(!n) {
+        fprintf(stderr, "fft : kernel too large\n");
+        return 0;
+    }
+    int T = n - size + 1, band = T + 2 * r, tiles_x = (w + T - 1) / T, tiles_y = (h + T - 1) / T;
+    float *kre = calloc(2 * (size_t)n * n, sizeof(float));
+    float *acc = calloc((size_t)band * stride, sizeof(float));
+    int ok = kre && acc && fft_plan_init(&plan, n);
+    if(ok) {
+        float *kim = kre + (size_t)n * n, scale = 1.0f / ((float)n * n);
+        // flipped : the engine correlates, the transform convolves
+        for(int y = 0; y < size; y++) {
+            for(int x = 0; x < size; x++)
+                kre[y * n + x] = k->weight[(size - 1 - y) * size + size - 1 - x] * scale;
+        }
+        fft_2d(&plan, kre, kim, 0);
+        for(int ty = 0; ty < tiles_y && ok; ty++) {
+            FFTJOB job = {&plan, kre, kim, src, w, h, cstep, size, T, ty, 0, 0, acc, ty * T - r, 1};
+            for(job.parity = 0; job.parity < 2 && job.parity < tiles_x; job.parity++) {
+                job.planes = (tiles_x - job.parity + 1) / 2 * cstep;
+                pool_run(pool_default(), (job.planes + 1) / 2, fft_tile, &job);
+            }
+            ok = job.ok;
+            int y1 = ty == tiles_y - 1 ? h : ty * T + T - r;
+            for(int y = ty * T - r > 0 ? ty * T - r : 0; y < y1; y++)
+                emit_row(k, src + (size_t)y * stride, dst + (size_t)y * stride, acc + (size_t)(y - job.acc_y0) * stride, w, h, cstep, y);
+            memmove(acc, acc + (size_t)T * stride, (size_t)2 * r * stride * sizeof(float));
+            memset(acc + (size_t)2 * r * stride, 0, (size_t)T * stride * sizeof(float));
+        }
+    } else {
+        fprintf(stderr, "fft : out of memory\n");
+    }
+    fft_plan_free(&plan);
+    free(kre);
+    free(acc);
+    return ok;
+}
@@ -0,0 +1,17 @@
+#ifndef FFT_CONVOLUTION
+#define FFT_CONVOLUTION
+#include "convolve.h"
+
+// Non separable kernels from this size up are convolved through the FFT,
+// below it the direct path is faster (2000x1500 RGB : 11 at -O2, 9 at -O0)
+#define CONV_FFT_MIN_SIZE 11
+// largest transform, a tile is FFT_MAX - size + 1 pixels wide
+#define FFT_MAX 512
+
+// Same result and border handling as conv_rows over the whole image, through
+// overlap-add tiles : each tile is zero padded to n x n, transformed, multiplied
+// by the kernel spectrum, transformed back and added to its neighbours' tails.
+// Two real planes (channels or tiles) share one complex transform. Integer
+// kernels are exact while the FFT rounding error stays under half a unit.
+int conv_fft(const KERNEL *k, const unsigned char *src, unsigned char *dst, int w, int h, int cstep);
+#endif // FFT_CONVOLUTION
@@ -1,4 +1,32 @@
 #include "gaussian.h"
+#include "lut.h"
+#include "pool.h"
+
+int deno33 = 16;
+int deno55 = 273;
+
+// Gaussian kernel #1
+unsigned char gaussian33[9] = {
+    1,2,1,
+    2,4,2,
+    1,2,1
+};
+// Gaussian kernel #2
+int gaussian55[25] = {
+    1,  4,  7,  4, 1,
+    4, 16, 26, 16, 4,
+    7, 26, 41, 26, 7,
+    4, 16, 26, 16, 4,
+    1,  4,  7,  4, 1,
+};
+
+// Gaussian 1D kernel #1
+float gaussian15[5] = {0.0545, 0.2442, 0.4026, 0.2442, 0.0545};
+
+unsigned char *global_src = NULL;
+uint32_t *global_out = NULL;
+RGBTRIPLE *global_src_ori = NULL;
+RGBTRIPLE *global_out_ori = NULL;
 
 void *thread_blur(void *arg)
 {
@@ -925,3 +953,478 @@ void sse_gaussian_blur_5_tri(unsigned char *src,int w,int h)
 
     global_out = NULL;
 }
+
+static RGBTRIPLE blur_pixel_5_ori(const RGBTRIPLE *src,int w,int j,int i)
+{
+    int sum_r = 0,sum_g = 0,sum_b = 0,index = 0;
+    RGBTRIPLE out;
+    for(int sqr_j=j-2; sqr_j<j+3; sqr_j++) {
+        for(int sqr_i=i-2; sqr_i<i+3; sqr_i++) {
+            sum_r += (int)src[sqr_j*w+sqr_i].rgbRed*gaussian55[index];
+            sum_g += (int)src[sqr_j*w+sqr_i].rgbGreen*gaussian55[index];
+            sum_b += (int)src[sqr_j*w+sqr_i].rgbBlue*gaussian55[index];
+            index++;
+        }
+    }
+    out.rgbRed = sum_r/273;
+    out.rgbGreen = sum_g/273;
+    out.rgbBlue = sum_b/273;
+    return out;
+}
+
+// Reentrant version of the sse original structure blur : no global buffer,
+// reads src and writes rows [y0,y1) of dst (the 2 pixels border is copied
+// unchanged), so several images or bands can be blurred at the same time.
+void sse_gaussian_blur_5_rows_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h,int y0,int y1)
+{
+    const __m128i vk0 = _mm_set1_epi8(0);
+    const __m128i vg1lo = _mm_setr_epi16(1,1,1,4,4,4,7,7);
+    const __m128i vg1hi = _mm_setr_epi16(7,4,4,4,1,1,1,0);
+    const __m128i vg2lo = _mm_setr_epi16(4,4,4,16,16,16,26,26);
+    const __m128i vg2hi = _mm_setr_epi16(26,16,16,16,4,4,4,0);
+    const __m128i vg3lo = _mm_setr_epi16(7,7,7,26,26,26,41,41);
+    const __m128i vg3hi = _mm_setr_epi16(41,26,26,26,7,7,7,0);
+    for(int j=y0; j<y1; j++) {
+        if(w < 5 || j < 2 || j >= h-2) {
+            memcpy(dst+j*w,src+j*w,w*sizeof(RGBTRIPLE));
+            continue;
+        }
+        const RGBTRIPLE *row = src+(j-2)*w;
+        dst[j*w] = src[j*w];
+        dst[j*w+1] = src[j*w+1];
+        dst[j*w+w-2] = src[j*w+w-2];
+        dst[j*w+w-1] = src[j*w+w-1];
+        // a 16 bytes load covers 5 pixels + 1 byte, keep it inside the image
+        int last = (j+2 == h-1) ? w-5 : w-4;
+        for(int i=0; i<last; i++) {
+            __m128i L0 = _mm_loadu_si128((__m128i *)(row+0*w+i));
+            __m128i L1 = _mm_loadu_si128((__m128i *)(row+1*w+i));
+            __m128i L2 = _mm_loadu_si128((__m128i *)(row+2*w+i));
+            __m128i L3 = _mm_loadu_si128((__m128i *)(row+3*w+i));
+            __m128i L4 = _mm_loadu_si128((__m128i *)(row+4*w+i));
+            // rows 0/4 and 1/3 share the same weights
+            __m128i vsumlo = _mm_mullo_epi16(_mm_add_epi16(_mm_unpacklo_epi8(L0,vk0),_mm_unpacklo_epi8(L4,vk0)),vg1lo);
+            __m128i vsumhi = _mm_mullo_epi16(_mm_add_epi16(_mm_unpackhi_epi8(L0,vk0),_mm_unpackhi_epi8(L4,vk0)),vg1hi);
+            vsumlo = _mm_add_epi16(vsumlo,_mm_mullo_epi16(_mm_add_epi16(_mm_unpacklo_epi8(L1,vk0),_mm_unpacklo_epi8(L3,vk0)),vg2lo));
+            vsumhi = _mm_add_epi16(vsumhi,_mm_mullo_epi16(_mm_add_epi16(_mm_unpackhi_epi8(L1,vk0),_mm_unpackhi_epi8(L3,vk0)),vg2hi));
+            vsumlo = _mm_add_epi16(vsumlo,_mm_mullo_epi16(_mm_unpacklo_epi8(L2,vk0),vg3lo));
+            vsumhi = _mm_add_epi16(vsumhi,_mm_mullo_epi16(_mm_unpackhi_epi8(L2,vk0),vg3hi));
+            // 16 bits lanes : b g r b g r b g | r b g r b g r x
+            uint16_t lane[16];
+            _mm_storeu_si128((__m128i *)lane,vsumlo);
+            _mm_storeu_si128((__m128i *)(lane+8),vsumhi);
+            int sum_b = lane[0] + lane[3] + lane[6] + lane[9] + lane[12];
+            int sum_g = lane[1] + lane[4] + lane[7] + lane[10] + lane[13];
+            int sum_r = lane[2] + lane[5] + lane[8] + lane[11] + lane[14];
+            dst[j*w+i+2].rgbRed = sum_r/273;
+            dst[j*w+i+2].rgbGreen = sum_g/273;
+            dst[j*w+i+2].rgbBlue = sum_b/273;
+        }
+        for(int i=last; i<w-4; i++)
+            dst[j*w+i+2] = blur_pixel_5_ori(src,w,j,i+2);
+    }
+}
+
+void sse_gaussian_blur_5_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h)
+{
+    sse_gaussian_blur_5_rows_ori_r(src,dst,w,h,0,h);
+}
+
+// One output row of the 5x5 blur from the 5 input rows centered on it, for
+// rows of w pixels of cstep bytes (1 : planar / gray, 3 : BGR), the 2 pixels
+// at both ends are copied from the center row. Used by the streaming modes
+// which only keep a window of rows.
+void unroll_gaussian_blur_5_row(unsigned char *const rows[5],unsigned char *out,int w,int cstep)
+{
+    const unsigned char *r0 = rows[0], *r1 = rows[1], *r2 = rows[2], *r3 = rows[3], *r4 = rows[4];
+    int n = w*cstep, c2 = 2*cstep;
+    if(w < 5) {
+        memcpy(out,r2,n);
+        return;
+    }
+    memcpy(out,r2,c2);
+    memcpy(out+n-c2,r2+n-c2,c2);
+    for(int i=c2; i<n-c2; i++) {
+        int outer = r0[i-c2] + r0[i+c2] + r4[i-c2] + r4[i+c2];
+        int sum = outer*gaussian55[0]
+                  + (r0[i-cstep] + r0[i+cstep] + r4[i-cstep] + r4[i+cstep] + r1[i-c2] + r1[i+c2] + r3[i-c2] + r3[i+c2])*gaussian55[1]
+                  + (r0[i] + r4[i] + r2[i-c2] + r2[i+c2])*gaussian55[2]
+                  + (r1[i-cstep] + r1[i+cstep] + r3[i-cstep] + r3[i+cstep])*gaussian55[6]
+                  + (r1[i] + r3[i] + r2[i-cstep] + r2[i+cstep])*gaussian55[7]
+                  + r2[i]*gaussian55[12];
+        out[i] = sum/273;
+    }
+}
+
+/****************************************************************************/
+// Output vectorized 5x5 blur : instead of one pixel per 5x5 window, each
+// vector holds 8 (sse) or 16 (avx2) consecutive output bytes. The kernel is
+// symmetric, so the 5 rows are first folded into 3 vertical sums per byte
+// (a = r0+r4, b = r1+r3, c = r2) :
+//   V0 = 7a + 26b + 41c  (center column, 7 26 41 26 7)
+//   V2 =  a +  4b +  7c  (outer columns, 1 4 7 4 1)
+//   V1 = 4*V2 - 2c       (inner columns, 4 16 26 16 4)
+// and an output byte is V0[i] + V1[i-+cstep] + V2[i-+2*cstep], read from the
+// 16 bits line buffers with shifted loads. That sum goes up to 255*273 = 69615,
+// one bit more than a 16 bits lane : the wrap around is detected (sum < V0)
+// and folded back, as 65536 = 273*240 + 16, before the division by 273 which
+// is a multiply high + shift exact for every 16 bits value.
+#define BLUR5_HALO 16
+#define BLUR5_CHUNK 1024
+#define BLUR5_DIV273 57375
+
+#define SSE_BLUR5_VERT_8(k,L0,L1,L2,L3,L4,unpack) do { \
+        __m128i a = _mm_add_epi16(unpack(L0,vk0),unpack(L4,vk0)); \
+        __m128i b = _mm_add_epi16(unpack(L1,vk0),unpack(L3,vk0)); \
+        __m128i c = unpack(L2,vk0); \
+        __m128i x2 = _mm_add_epi16(_mm_add_epi16(a,_mm_slli_epi16(b,2)),_mm_mullo_epi16(c,vk7)); \
+        __m128i x0 = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(a,vk7),_mm_mullo_epi16(b,vk26)),_mm_mullo_epi16(c,vk41)); \
+        _mm_storeu_si128((__m128i *)(v0+(k)),x0); \
+        _mm_storeu_si128((__m128i *)(v1+(k)),_mm_sub_epi16(_mm_slli_epi16(x2,2),_mm_slli_epi16(c,1))); \
+        _mm_storeu_si128((__m128i *)(v2+(k)),x2); \
+    } while(0)
+
+#define SSE_BLUR5_VERT(k) do { \
+        __m128i L0 = _mm_loadu_si128((__m128i *)(r0+(k))); \
+        __m128i L1 = _mm_loadu_si128((__m128i *)(r1+(k))); \
+        __m128i L2 = _mm_loadu_si128((__m128i *)(r2+(k))); \
+        __m128i L3 = _mm_loadu_si128((__m128i *)(r3+(k))); \
+        __m128i L4 = _mm_loadu_si128((__m128i *)(r4+(k))); \
+        SSE_BLUR5_VERT_8(k,L0,L1,L2,L3,L4,_mm_unpacklo_epi8); \
+        SSE_BLUR5_VERT_8((k)+8,L0,L1,L2,L3,L4,_mm_unpackhi_epi8); \
+    } while(0)
+
+#define SSE_BLUR5_HORZ_8(k,q) do { \
+        __m128i x0 = _mm_loadu_si128((__m128i *)(v0+(k)+c2)); \
+        __m128i t = _mm_add_epi16(_mm_loadu_si128((__m128i *)(v1+(k)+c2-cstep)),_mm_loadu_si128((__m128i *)(v1+(k)+c2+cstep))); \
+        t = _mm_add_epi16(t,_mm_add_epi16(_mm_loadu_si128((__m128i *)(v2+(k))),_mm_loadu_si128((__m128i *)(v2+(k)+2*c2)))); \
+        __m128i sum = _mm_add_epi16(x0,t); \
+        __m128i nocarry = _mm_cmpeq_epi16(_mm_max_epu16(sum,x0),sum); \
+        sum = _mm_add_epi16(sum,_mm_andnot_si128(nocarry,vk16)); \
+        t = _mm_mulhi_epu16(sum,vkdiv); \
+        q = _mm_srli_epi16(_mm_add_epi16(_mm_srli_epi16(_mm_sub_epi16(sum,t),1),t),8); \
+        q = _mm_add_epi16(q,_mm_andnot_si128(nocarry,vk240)); \
+    } while(0)
+
+#define SSE_BLUR5_HORZ(k) do { \
+        __m128i qlo,qhi; \
+        SSE_BLUR5_HORZ_8(k,qlo); \
+        SSE_BLUR5_HORZ_8((k)+8,qhi); \
+        _mm_storeu_si128((__m128i *)(out+(k)),_mm_packus_epi16(qlo,qhi)); \
+    } while(0)
+
+// Output bytes [i0,i0+len) of one row, len >= 32 and the window
+// [i0-2*cstep,i0+len+2*cstep) inside the row.
+static void sse_blur_5_chunk(unsigned char *const rows[5],unsigned char *out,int i0,int len,int cstep)
+{
+    uint16_t v0[BLUR5_CHUNK+2*BLUR5_HALO],v1[BLUR5_CHUNK+2*BLUR5_HALO],v2[BLUR5_CHUNK+2*BLUR5_HALO];
+    const __m128i vk0 = _mm_setzero_si128();
+    const __m128i vk7 = _mm_set1_epi16(7),vk26 = _mm_set1_epi16(26),vk41 = _mm_set1_epi16(41);
+    const __m128i vk16 = _mm_set1_epi16(16),vk240 = _mm_set1_epi16(240);
+    const __m128i vkdiv = _mm_set1_epi16((short)BLUR5_DIV273);
+    int c2 = 2*cstep, m = len+2*c2, k;
+    const unsigned char *r0 = rows[0]+i0-c2, *r1 = rows[1]+i0-c2, *r2 = rows[2]+i0-c2, *r3 = rows[3]+i0-c2, *r4 = rows[4]+i0-c2;
+    out += i0;
+    // 48 bytes = 16 BGR pixels per iteration, the last vector overlaps
+    for(k=0; k+48<=m; k+=48) {
+        SSE_BLUR5_VERT(k);
+        SSE_BLUR5_VERT(k+16);
+        SSE_BLUR5_VERT(k+32);
+    }
+    for(; k<m; k+=16)
+        SSE_BLUR5_VERT((k+16 > m) ? m-16 : k);
+    for(k=0; k+48<=len; k+=48) {
+        SSE_BLUR5_HORZ(k);
+        SSE_BLUR5_HORZ(k+16);
+        SSE_BLUR5_HORZ(k+32);
+    }
+    for(; k<len; k+=16)
+        SSE_BLUR5_HORZ((k+16 > len) ? len-16 : k);
+}
+
+#define AVX_BLUR5_VERT(k) do { \
+        __m256i a = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(r0+(k)))),_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(r4+(k))))); \
+        __m256i b = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(r1+(k)))),_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(r3+(k))))); \
+        __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(r2+(k)))); \
+        __m256i x2 = _mm256_add_epi16(_mm256_add_epi16(a,_mm256_slli_epi16(b,2)),_mm256_mullo_epi16(c,vk7)); \
+        __m256i x0 = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(a,vk7),_mm256_mullo_epi16(b,vk26)),_mm256_mullo_epi16(c,vk41)); \
+        _mm256_storeu_si256((__m256i *)(v0+(k)),x0); \
+        _mm256_storeu_si256((__m256i *)(v1+(k)),_mm256_sub_epi16(_mm256_slli_epi16(x2,2),_mm256_slli_epi16(c,1))); \
+        _mm256_storeu_si256((__m256i *)(v2+(k)),x2); \
+    } while(0)
+
+#define AVX_BLUR5_HORZ(k) do { \
+        __m256i x0 = _mm256_loadu_si256((__m256i *)(v0+(k)+c2)); \
+        __m256i t = _mm256_add_epi16(_mm256_loadu_si256((__m256i *)(v1+(k)+c2-cstep)),_mm256_loadu_si256((__m256i *)(v1+(k)+c2+cstep))); \
+        t = _mm256_add_epi16(t,_mm256_add_epi16(_mm256_loadu_si256((__m256i *)(v2+(k))),_mm256_loadu_si256((__m256i *)(v2+(k)+2*c2)))); \
+        __m256i sum = _mm256_add_epi16(x0,t); \
+        __m256i nocarry = _mm256_cmpeq_epi16(_mm256_max_epu16(sum,x0),sum); \
+        sum = _mm256_add_epi16(sum,_mm256_andnot_si256(nocarry,vk16)); \
+        t = _mm256_mulhi_epu16(sum,vkdiv); \
+        __m256i q = _mm256_srli_epi16(_mm256_add_epi16(_mm256_srli_epi16(_mm256_sub_epi16(sum,t),1),t),8); \
+        q = _mm256_add_epi16(q,_mm256_andnot_si256(nocarry,vk240)); \
+        _mm_storeu_si128((__m128i *)(out+(k)),_mm_packus_epi16(_mm256_castsi256_si128(q),_mm256_extracti128_si256(q,1))); \
+    } while(0)
+
+__attribute__((target("avx2")))
+static void avx_blur_5_chunk(unsigned char *const rows[5],unsigned char *out,int i0,int len,int cstep)
+{
+    uint16_t v0[BLUR5_CHUNK+2*BLUR5_HALO],v1[BLUR5_CHUNK+2*BLUR5_HALO],v2[BLUR5_CHUNK+2*BLUR5_HALO];
+    const __m256i vk7 = _mm256_set1_epi16(7),vk26 = _mm256_set1_epi16(26),vk41 = _mm256_set1_epi16(41);
+    const __m256i vk16 = _mm256_set1_epi16(16),vk240 = _mm256_set1_epi16(240);
+    const __m256i vkdiv = _mm256_set1_epi16((short)BLUR5_DIV273);
+    int c2 = 2*cstep, m = len+2*c2, k;
+    const unsigned char *r0 = rows[0]+i0-c2, *r1 = rows[1]+i0-c2, *r2 = rows[2]+i0-c2, *r3 = rows[3]+i0-c2, *r4 = rows[4]+i0-c2;
+    out += i0;
+    // 96 bytes = 32 BGR pixels per iteration, the last vector overlaps
+    for(k=0; k+96<=m; k+=96) {
+        AVX_BLUR5_VERT(k);
+        AVX_BLUR5_VERT(k+16);
+        AVX_BLUR5_VERT(k+32);
+        AVX_BLUR5_VERT(k+48);
+        AVX_BLUR5_VERT(k+64);
+        AVX_BLUR5_VERT(k+80);
+    }
+    for(; k<m; k+=16)
+        AVX_BLUR5_VERT((k+16 > m) ? m-16 : k);
+    for(k=0; k+96<=len; k+=96) {
+        AVX_BLUR5_HORZ(k);
+        AVX_BLUR5_HORZ(k+16);
+        AVX_BLUR5_HORZ(k+32);
+        AVX_BLUR5_HORZ(k+48);
+        AVX_BLUR5_HORZ(k+64);
+        AVX_BLUR5_HORZ(k+80);
+    }
+    for(; k<len; k+=16)
+        AVX_BLUR5_HORZ((k+16 > len) ? len-16 : k);
+}
+
+// Same contract as unroll_gaussian_blur_5_row (out must not alias rows),
+// rows too short for a vector and cstep > 8 go through the scalar version.
+void sse_gaussian_blur_5_row(unsigned char *const rows[5],unsigned char *out,int w,int cstep)
+{
+    int n = w*cstep, c2 = 2*cstep;
+    if(w < 5 || n-2*c2 < 32 || c2 > BLUR5_HALO) {
+        unroll_gaussian_blur_5_row(rows,out,w,cstep);
+        return;
+    }
+    void (*chunk)(unsigned char *const *,unsigned char *,int,int,int) = __builtin_cpu_supports("avx2") ? avx_blur_5_chunk : sse_blur_5_chunk;
+    memcpy(out,rows[2],c2);
+    memcpy(out+n-c2,rows[2]+n-c2,c2);
+    for(int i0=c2; i0<n-c2; i0+=BLUR5_CHUNK) {
+        int len = n-c2-i0;
+        if(len > BLUR5_CHUNK)
+            len = BLUR5_CHUNK;
+        // a short last chunk is moved back over the previous one
+        if(len < 32) {
+            i0 = n-c2-32;
+            len = 32;
+        }
+        chunk(rows,out,i0,len,cstep);
+    }
+}
+
+// Rows [y0,y1) of dst, top to bottom, the 2 pixels border is copied.
+void sse_gaussian_blur_5_rows_vec_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h,int y0,int y1)
+{
+    for(int j=y0; j<y1; j++) {
+        if(j < 2 || j >= h-2) {
+            memcpy(dst+j*w,src+j*w,w*sizeof(RGBTRIPLE));
+            continue;
+        }
+        unsigned char *rows[5];
+        for(int k=0; k<5; k++)
+            rows[k] = (unsigned char *)(src+(j-2+k)*w);
+        sse_gaussian_blur_5_row(rows,(unsigned char *)(dst+j*w),w,3);
+    }
+}
+
+// Same on a planar plane.
+void sse_gaussian_blur_5_rows_tri_r(const unsigned char *src,unsigned char *dst,int w,int h,int y0,int y1)
+{
+    for(int j=y0; j<y1; j++) {
+        if(j < 2 || j >= h-2) {
+            memcpy(dst+j*w,src+j*w,w);
+            continue;
+        }
+        unsigned char *rows[5];
+        for(int k=0; k<5; k++)
+            rows[k] = (unsigned char *)(src+(j-2+k)*w);
+        sse_gaussian_blur_5_row(rows,dst+j*w,w,1);
+    }
+}
+
+void sse_gaussian_blur_5_vec_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h)
+{
+    sse_gaussian_blur_5_rows_vec_ori_r(src,dst,w,h,0,h);
+}
+
+// In place : the original of the 2 rows above are kept in a 3 rows ring.
+void sse_gaussian_blur_5_vec_ori(RGBTRIPLE *src,int w,int h)
+{
+    size_t stride = w*sizeof(RGBTRIPLE);
+    unsigned char *ring = malloc(4*stride);
+    if(ring == NULL)
+        return;
+    unsigned char *tmp = ring+3*stride;
+    for(int j=0; j<h; j++) {
+        unsigned char *row = (unsigned char *)(src+j*w);
+        if(j >= 2 && j < h-2) {
+            unsigned char *rows[5] = {ring+(j-2)%3*stride, ring+(j-1)%3*stride, row, row+stride, row+2*stride};
+            sse_gaussian_blur_5_row(rows,tmp,w,3);
+        }
+        memcpy(ring+j%3*stride,row,stride);
+        if(j >= 2 && j < h-2)
+            memcpy(row,tmp,stride);
+    }
+    free(ring);
+}
+
+/****************************************************************************/
+// Linear light 5x5 blur : blurring the sRGB codes directly darkens edges and
+// highlights, so the codes are blurred as the light they stand for. The
+// rows come converted by srgb_to_linear_row (once per input row, by the
+// caller), the folding above runs on 16 bits lanes with the weights divided
+// by 273 beforehand (rounding multiply high), and every output byte is one
+// lookup in the 4096 entries linear_srgb_table.
+#define BLUR5_LIN_K(k) ((short)((k)*32768.0/273+0.5))
+#define BLUR5_LIN_TOP ((1<<SRGB_LINEAR_BITS)-1)
+
+#define SSE_BLUR5_LIN_VERT(k) do { \
+        __m128i a = _mm_add_epi16(_mm_loadu_si128((__m128i *)(r0+(k))),_mm_loadu_si128((__m128i *)(r4+(k)))); \
+        __m128i b = _mm_add_epi16(_mm_loadu_si128((__m128i *)(r1+(k))),_mm_loadu_si128((__m128i *)(r3+(k)))); \
+        __m128i c = _mm_loadu_si128((__m128i *)(r2+(k))); \
+        _mm_storeu_si128((__m128i *)(v0+(k)),_mm_add_epi16(_mm_add_epi16(_mm_mulhrs_epi16(a,vk7),_mm_mulhrs_epi16(b,vk26)),_mm_mulhrs_epi16(c,vk41))); \
+        _mm_storeu_si128((__m128i *)(v1+(k)),_mm_add_epi16(_mm_add_epi16(_mm_mulhrs_epi16(a,vk4),_mm_mulhrs_epi16(b,vk16)),_mm_mulhrs_epi16(c,vk26))); \
+        _mm_storeu_si128((__m128i *)(v2+(k)),_mm_add_epi16(_mm_add_epi16(_mm_mulhrs_epi16(a,vk1),_mm_mulhrs_epi16(b,vk4)),_mm_mulhrs_epi16(c,vk7))); \
+    } while(0)
+
+#define SSE_BLUR5_LIN_HORZ(k) do { \
+        __m128i t = _mm_add_epi16(_mm_loadu_si128((__m128i *)(v1+(k)+c2-cstep)),_mm_loadu_si128((__m128i *)(v1+(k)+c2+cstep))); \
+        t = _mm_add_epi16(t,_mm_add_epi16(_mm_loadu_si128((__m128i *)(v2+(k))),_mm_loadu_si128((__m128i *)(v2+(k)+2*c2)))); \
+        t = _mm_add_epi16(t,_mm_loadu_si128((__m128i *)(v0+(k)+c2))); \
+        _mm_storeu_si128((__m128i *)(q+(k)),_mm_srli_epi16(_mm_min_epi16(t,vktop),SRGB_LINEAR_BITS-SRGB_OUT_BITS)); \
+    } while(0)
+
+// Output bytes [i0,i0+len) of one row, len >= 8 and the window
+// [i0-2*cstep,i0+len+2*cstep) inside the row.
+static void sse_blur_5_linear_chunk(const uint16_t *const lin[5],unsigned char *out,int i0,int len,int cstep)
+{
+    uint16_t v0[BLUR5_CHUNK+2*BLUR5_HALO],v1[BLUR5_CHUNK+2*BLUR5_HALO],v2[BLUR5_CHUNK+2*BLUR5_HALO],q[BLUR5_CHUNK];
+    const unsigned char *to_srgb = linear_srgb_table();
+    const __m128i vk1 = _mm_set1_epi16(BLUR5_LIN_K(1)),vk4 = _mm_set1_epi16(BLUR5_LIN_K(4)),vk7 = _mm_set1_epi16(BLUR5_LIN_K(7));
+    const __m128i vk16 = _mm_set1_epi16(BLUR5_LIN_K(16)),vk26 = _mm_set1_epi16(BLUR5_LIN_K(26)),vk41 = _mm_set1_epi16(BLUR5_LIN_K(41));
+    const __m128i vktop = _mm_set1_epi16(BLUR5_LIN_TOP);
+    int c2 = 2*cstep, m = len+2*c2, k;
+    const uint16_t *r0 = lin[0]+i0-c2, *r1 = lin[1]+i0-c2, *r2 = lin[2]+i0-c2, *r3 = lin[3]+i0-c2, *r4 = lin[4]+i0-c2;
+    // the last vector overlaps
+    for(k=0; k<m; k+=8)
+        SSE_BLUR5_LIN_VERT((k+8 > m) ? m-8 : k);
+    for(k=0; k<len; k+=8)
+        SSE_BLUR5_LIN_HORZ((k+8 > len) ? len-8 : k);
+    out += i0;
+    for(k=0; k<len; k++)
+        out[k] = to_srgb[q[k]];
+}
+
+// Same contract as sse_gaussian_blur_5_row on rows of linear light, center
+// holds the bytes of lin[2] for the 2 pixels border.
+void sse_gaussian_blur_5_row_linear(const uint16_t *const lin[5],const unsigned char *center,unsigned char *out,int w,int cstep)
+{
+    int n = w*cstep, c2 = 2*cstep;
+    const unsigned char *to_srgb = linear_srgb_table();
+    if(w < 5) {
+        memcpy(out,center,n);
+        return;
+    }
+    memcpy(out,center,c2);
+    memcpy(out+n-c2,center+n-c2,c2);
+    if(n-2*c2 < 8 || c2 > BLUR5_HALO) {
+        for(int i=c2; i<n-c2; i++) {
+            int sum = 0;
+            for(int y=0; y<5; y++)
+                for(int x=-2; x<=2; x++)
+                    sum += lin[y][i+x*cstep]*gaussian55[y*5+x+2];
+            sum = (sum+136)/273;
+            out[i] = to_srgb[(sum > BLUR5_LIN_TOP ? BLUR5_LIN_TOP : sum) >> (SRGB_LINEAR_BITS-SRGB_OUT_BITS)];
+        }
+        return;
+    }
+    for(int i0=c2; i0<n-c2; i0+=BLUR5_CHUNK) {
+        int len = n-c2-i0;
+        if(len > BLUR5_CHUNK)
+            len = BLUR5_CHUNK;
+        // a short last chunk is moved back over the previous one
+        if(len < 8) {
+            i0 = n-c2-8;
+            len = 8;
+        }
+        sse_blur_5_linear_chunk(lin,out,i0,len,cstep);
+    }
+}
+
+// Rows [y0,y1) of dst, top to bottom, the 2 pixels border is copied. Every
+// source row is converted once into a ring of 5 linear rows, 0 when it
+// cannot be allocated.
+int sse_gaussian_blur_5_rows_linear_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h,int y0,int y1)
+{
+    size_t n = (size_t)w*3;
+    uint16_t *ring = malloc(5*n*sizeof(uint16_t));
+    int next = 0;
+    if(ring == NULL)
+        return 0;
+    for(int j=y0; j<y1; j++) {
+        if(j < 2 || j >= h-2) {
+            memcpy(dst+j*w,src+j*w,w*sizeof(RGBTRIPLE));
+            continue;
+        }
+        const uint16_t *lin[5];
+        if(next < j-2)
+            next = j-2;
+        for(; next<=j+2; next++)
+            srgb_to_linear_row((const unsigned char *)(src+next*w),ring+next%5*n,n);
+        for(int k=0; k<5; k++)
+            lin[k] = ring+(j-2+k)%5*n;
+        sse_gaussian_blur_5_row_linear(lin,(const unsigned char *)(src+j*w),(unsigned char *)(dst+j*w),w,3);
+    }
+    free(ring);
+    return 1;
+}
+
+int sse_gaussian_blur_5_linear_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h)
+{
+    return sse_gaussian_blur_5_rows_linear_ori_r(src,dst,w,h,0,h);
+}
+
+typedef struct linear_job {
+    const RGBTRIPLE *src;
+    RGBTRIPLE *dst;
+    int w;
+    int h;
+    int rows; // rows per thread
+    int ok;
+} LINEARJOB;
+
+static void linear_band(void *arg, int item)
+{
+    LINEARJOB *job = arg;
+    int y0 = item * job->rows;
+    int y1 = y0 + job->rows < job->h ? y0 + job->rows : job->h;
+    if(y0 < y1 && !sse_gaussian_blur_5_rows_linear_ori_r(job->src,job->dst,job->w,job->h,y0,y1))
+        __atomic_store_n(&job->ok, 0, __ATOMIC_RELAXED);
+}
+
+int pt_sse_gaussian_blur_5_linear_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int num_threads,int w,int h)
+{
+    LINEARJOB job = {src, dst, w, h, 0, 1};
+    THREADPOOL *pool;
+    if(num_threads < 1)
+        num_threads = 1;
+    job.rows = (h + num_threads - 1) / num_threads;
+    pool = pool_create(num_threads - 1);
+    if(!pool)
+        return 0;
+    pool_run(pool, num_threads, linear_band, &job);
+    pool_destroy(pool);
+    return job.ok;
+}
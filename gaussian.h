@@ -1,5 +1,5 @@
-#ifndef GAUSSIAN
-#define GAUSSIAN
+#ifndef GAUSSIAN_BLUR
+#define GAUSSIAN_BLUR
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -15,26 +15,16 @@
 #include <pthread.h>
 #include "bmp.h"
 
-int deno33 = 16;
-int deno55 = 273;
+extern int deno33;
+extern int deno55;
 
 // Gaussian kernel #1
-unsigned char gaussian33[9] = {
-    1,2,1,
-    2,4,2,
-    1,2,1
-};
+extern unsigned char gaussian33[9];
 // Gaussian kernel #2
-int gaussian55[25] = {
-    1,  4,  7,  4, 1,
-    4, 16, 26, 16, 4,
-    7, 26, 41, 26, 7,
-    4, 16, 26, 16, 4,
-    1,  4,  7,  4, 1,
-};
+extern int gaussian55[25];
 
 // Gaussian 1D kernel #1
-float gaussian15[] = {0.0545, 0.2442, 0.4026, 0.2442, 0.0545};
+extern float gaussian15[5];
 
 // Pthread data structure
 typedef struct thread_info {
@@ -44,10 +34,10 @@ typedef struct thread_info {
     int height; // image height
 } tInfo;
 
-unsigned char *global_src = NULL;
-uint32_t *global_out = NULL;
-RGBTRIPLE *global_src_ori = NULL;
-RGBTRIPLE *global_out_ori = NULL;
+extern unsigned char *global_src;
+extern uint32_t *global_out;
+extern RGBTRIPLE *global_src_ori;
+extern RGBTRIPLE *global_out_ori;
 
 void unroll_gaussian_blur_5_tri(unsigned char *src,int w,int h);
 void unroll_gaussian_blur_5_ori(RGBTRIPLE *src,int w,int h);
@@ -60,5 +50,19 @@ void sse_gaussian_blur_5_prefetch_ori(RGBTRIPLE *src,int w,int h);
 void pt_gaussian_blur_5_tri(unsigned char *src,int num_threads,int w,int h);
 void pt_sse_gaussian_blur_5_ori(RGBTRIPLE *src,int num_threads,int w,int h);
 void naive_gaussian_blur_5_expand(unsigned char *src,int w,int h);
+void sse_gaussian_blur_5_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h);
+void unroll_gaussian_blur_5_row(unsigned char *const rows[5],unsigned char *out,int w,int cstep);
+void sse_gaussian_blur_5_rows_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h,int y0,int y1);
+void sse_gaussian_blur_5_row(unsigned char *const rows[5],unsigned char *out,int w,int cstep);
+void sse_gaussian_blur_5_rows_vec_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h,int y0,int y1);
+void sse_gaussian_blur_5_rows_tri_r(const unsigned char *src,unsigned char *dst,int w,int h,int y0,int y1);
+void sse_gaussian_blur_5_vec_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h);
+void sse_gaussian_blur_5_vec_ori(RGBTRIPLE *src,int w,int h);
+// linear light : rows of srgb_to_linear_row (lut.h) in, sRGB bytes out
+void sse_gaussian_blur_5_row_linear(const uint16_t *const lin[5],const unsigned char *center,unsigned char *out,int w,int cstep);
+int sse_gaussian_blur_5_rows_linear_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h,int y0,int y1);
+int sse_gaussian_blur_5_linear_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int w,int h);
+// the same, rows split over num_threads threads (the caller is one of them)
+int pt_sse_gaussian_blur_5_linear_ori_r(const RGBTRIPLE *src,RGBTRIPLE *dst,int num_threads,int w,int h);
 
 #endif
@@ -0,0 +1,626 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <immintrin.h>
+#include "hdr.h"
+#include "gaussian.h"
+#include "pool.h"
+
+// rows handed to a pool worker at a time
+#define BAND_ROWS 32
+// output pixels of the blur line buffers
+#define HDR_CHUNK 1024
+
+typedef struct hdr_job {
+    const HALF *src;
+    HALF *dst;
+    HALF *plane[3];
+    int w;
+    int h;
+    int channels;
+    float factor;
+} HDRJOB;
+
+/****************************************************************************/
+HALF half_from_float(float f)
+{
+    union {
+        float f;
+        unsigned int u;
+    } v = {f};
+    unsigned int sign = (v.u >> 16) & 0x8000, m = v.u & 0x7fffff, half, rem;
+    int e = (int)((v.u >> 23) & 0xff) - 127 + 15;
+    if(e == 128 + 15)
+        return sign | 0x7c00 | (m ? 0x200 : 0);
+    if(e >= 31)
+        return sign | 0x7c00;
+    if(e <= 0) {
+        // subnormal : the implicit bit joins the mantissa
+        int shift = 14 - e;
+        if(shift > 24)
+            return sign;
+        m |= 0x800000;
+        half = m >> shift;
+        rem = m & ((1u << shift) - 1);
+        if(rem > 1u << (shift - 1) || (rem == 1u << (shift - 1) && (half & 1)))
+            half++;
+        return sign | half;
+    }
+    // a carry out of the mantissa moves to the exponent, up to infinity
+    half = sign | e << 10 | m >> 13;
+    rem = m & 0x1fff;
+    if(rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+        half++;
+    return half;
+}
+
+float half_to_float(HALF h)
+{
+    union {
+        unsigned int u;
+        float f;
+    } v;
+    unsigned int sign = (h & 0x8000u) << 16, e = (h >> 10) & 0x1f, m = h & 0x3ff;
+    if(e == 0x1f) {
+        v.u = sign | 0x7f800000 | m << 13;
+    } else if(e) {
+        v.u = sign | (e + 112) << 23 | m << 13;
+    } else if(!m) {
+        v.u = sign;
+    } else {
+        for(e = 113; !(m & 0x400); e--)
+            m <<= 1;
+        v.u = sign | e << 23 | (m & 0x3ff) << 13;
+    }
+    return v.f;
+}
+
+static int has_f16c(void)
+{
+    return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+}
+
+__attribute__((target("avx,f16c")))
+static void f16c_from_floats(const float *src, HALF *dst, int n)
+{
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), 0));
+    for(; i < n; i++)
+        dst[i] = half_from_float(src[i]);
+}
+
+__attribute__((target("avx,f16c")))
+static void f16c_to_floats(const HALF *src, float *dst, int n)
+{
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    for(; i < n; i++)
+        dst[i] = half_to_float(src[i]);
+}
+
+void half_from_floats(const float *src, HALF *dst, int n)
+{
+    if(has_f16c()) {
+        f16c_from_floats(src, dst, n);
+        return;
+    }
+    for(int i = 0; i < n; i++)
+        dst[i] = half_from_float(src[i]);
+}
+
+void half_to_floats(const HALF *src, float *dst, int n)
+{
+    if(has_f16c()) {
+        f16c_to_floats(src, dst, n);
+        return;
+    }
+    for(int i = 0; i < n; i++)
+        dst[i] = half_to_float(src[i]);
+}
+
+/****************************************************************************/
+int hdr_reserve(HDRIMAGE *img, int w, int h, int channels)
+{
+    size_t need = (size_t)w * h;
+    if(need > img->capacity) {
+        HALF *p = realloc(img->plane[0], 3 * need * sizeof(HALF));
+        if(!p) {
+            fprintf(stderr, "hdr : out of memory\n");
+            return 0;
+        }
+        img->plane[0] = p;
+        img->capacity = need;
+    }
+    img->plane[1] = img->plane[0] + img->capacity;
+    img->plane[2] = img->plane[1] + img->capacity;
+    img->width = w;
+    img->height = h;
+    img->channels = channels;
+    return 1;
+}
+
+void hdr_release(HDRIMAGE *img)
+{
+    free(img->plane[0]);
+    memset(img, 0, sizeof(*img));
+}
+
+static void swap_hdr(HDRIMAGE *a, HDRIMAGE *b)
+{
+    HDRIMAGE t = *a;
+    *a = *b;
+    *b = t;
+}
+
+// one source row of n pixels of cstep samples (1 or 2 bytes, big endian
+// for PNM) into the planes, scaled by 1 / maxval
+static void hdr_put_row(HDRIMAGE *img, int y, const unsigned char *row, int cstep, int wide, int big, float *tmp,
+                        int maxval, int bgr)
+{
+    int w = img->width;
+    float scale = 1.0f / maxval;
+    for(int c = 0; c < img->channels; c++) {
+        // PNM samples are red first, BMP ones blue first
+        int s = bgr || cstep == 1 ? c : cstep - 1 - c;
+        for(int x = 0; x < w; x++) {
+            const unsigned char *p = row + ((size_t)x * cstep + s) * (wide ? 2 : 1);
+            int v = !wide ? p[0] : big ? p[0] << 8 | p[1] : p[1] << 8 | p[0];
+            tmp[x] = v * scale;
+        }
+        half_from_floats(tmp, img->plane[c] + (size_t)y * w, w);
+    }
+}
+
+static int read_pnm_number(FILE *fp)
+{
+    int c, v = 0;
+    do {
+        c = fgetc(fp);
+        if(c == '#')
+            while(c != '\n' && c != EOF)
+                c = fgetc(fp);
+    } while(c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    if(c < '0' || c > '9')
+        return -1;
+    for(; c >= '0' && c <= '9'; c = fgetc(fp))
+        v = v * 10 + c - '0';
+    return v;
+}
+
+/*********************************************************/
+// 24 / 48 bits BMP, P5 / P6 of any maxval
+/*********************************************************/
+int hdr_load(HDRIMAGE *img, const char *fileName)
+{
+    unsigned char magic[2], *row = NULL;
+    float *tmp = NULL;
+    int w, h, cstep, wide, bmp, maxval, ok = 0, bottom_up = 0;
+    size_t rowbytes, pad = 0;
+    FILE *fp = fopen(fileName, "rb");
+    if(!fp) {
+        fprintf(stderr, "%s: can't open file\n", fileName);
+        return 0;
+    }
+    if(fread(magic, 2, 1, fp) != 1)
+        magic[0] = 0;
+    bmp = magic[0] == 'B' && magic[1] == 'M';
+    if(bmp) {
+        BMPHEADER header;
+        BMPINFO info;
+        header.bfType = 0x4d42;
+        if(fread((char *)&header + 2, sizeof(BMPHEADER) - 2, 1, fp) != 1 || fread(&info, sizeof(BMPINFO), 1, fp) != 1
+           || (info.biBitCount != 24 && info.biBitCount != 48) || info.biCompression != 0) {
+            fprintf(stderr, "%s: only uncompressed 24 or 48 bits BMP is supported\n", fileName);
+            fclose(fp);
+            return 0;
+        }
+        for(long skip = (long)header.bfOffbytes - (long)(sizeof(BMPHEADER) + sizeof(BMPINFO)); skip > 0; skip--)
+            fgetc(fp);
+        w = info.biWidth;
+        h = info.biHeight < 0 ? -info.biHeight : info.biHeight;
+        bottom_up = info.biHeight > 0;
+        cstep = 3;
+        wide = info.biBitCount == 48;
+        maxval = wide ? 65535 : 255;
+    } else if(magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6')) {
+        w = read_pnm_number(fp);
+        h = read_pnm_number(fp);
+        maxval = read_pnm_number(fp);
+        cstep = magic[1] == '5' ? 1 : 3;
+        wide = maxval > 255;
+        if(maxval < 1 || maxval > 65535)
+            w = 0;
+    } else {
+        fprintf(stderr, "%s: not a BMP, PGM or PPM file\n", fileName);
+        fclose(fp);
+        return 0;
+    }
+    rowbytes = (size_t)(w > 0 ? w : 0) * cstep * (wide ? 2 : 1);
+    if(bmp)
+        pad = (4 - rowbytes % 4) % 4;
+    if(w > 0 && h > 0 && hdr_reserve(img, w, h, cstep)) {
+        row = malloc(rowbytes + pad);
+        tmp = malloc(w * sizeof(float));
+        ok = row && tmp;
+    } else {
+        fprintf(stderr, "%s: bad size\n", fileName);
+    }
+    for(int y = 0; ok && y < h; y++) {
+        if(fread(row, rowbytes + pad, 1, fp) != 1) {
+            fprintf(stderr, "%s: truncated pixel data\n", fileName);
+            ok = 0;
+            break;
+        }
+        hdr_put_row(img, bottom_up ? h - 1 - y : y, row, cstep, wide, !bmp, tmp, maxval, bmp);
+    }
+    free(row);
+    free(tmp);
+    fclose(fp);
+    return ok;
+}
+
+static void hdr_get_row(const HDRIMAGE *img, int y, unsigned char *row, int cstep, int big, float *tmp)
+{
+    int w = img->width;
+    for(int c = 0; c < cstep; c++) {
+        int plane = img->channels == 1 ? 0 : big ? cstep - 1 - c : c;
+        half_to_floats(img->plane[plane] + (size_t)y * w, tmp, w);
+        for(int x = 0; x < w; x++) {
+            float f = tmp[x];
+            int v = f <= 0 ? 0 : f >= 1 ? 65535 : (int)(f * 65535 + 0.5f);
+            unsigned char *p = row + ((size_t)x * cstep + c) * 2;
+            p[big ? 0 : 1] = v >> 8;
+            p[big ? 1 : 0] = v & 0xff;
+        }
+    }
+}
+
+/*********************************************************/
+// 16 bits per sample : PNM by extension, else 48 bits BMP
+/*********************************************************/
+int hdr_save(const HDRIMAGE *img, const char *fileName)
+{
+    const char *ext = strrchr(fileName, '.');
+    int pnm = ext && (strcasecmp(ext, ".pgm") == 0 || strcasecmp(ext, ".ppm") == 0 || strcasecmp(ext, ".pnm") == 0);
+    int w = img->width, h = img->height, cstep = pnm ? img->channels : 3, ok;
+    size_t rowbytes = (size_t)w * cstep * 2, pad = pnm ? 0 : (4 - rowbytes % 4) % 4;
+    unsigned char *row = calloc(rowbytes + pad, 1);
+    float *tmp = malloc(w * sizeof(float));
+    FILE *fp = fopen(fileName, "wb");
+    if(!fp) {
+        fprintf(stderr, "%s: can't create file\n", fileName);
+        free(row);
+        free(tmp);
+        return 0;
+    }
+    ok = row && tmp;
+    if(ok && pnm) {
+        ok = fprintf(fp, "P%c\n%d %d\n65535\n", cstep == 1 ? '5' : '6', w, h) > 0;
+    } else if(ok) {
+        BMPHEADER header;
+        BMPINFO info;
+        memset(&info, 0, sizeof(info));
+        info.biSize = sizeof(BMPINFO);
+        info.biWidth = w;
+        info.biHeight = h;
+        info.biPlanes = 1;
+        info.biBitCount = 48;
+        info.biSizeImage = (rowbytes + pad) * h;
+        header.bfType = 0x4d42;
+        header.bfReserved1 = header.bfReserved2 = 0;
+        header.bfOffbytes = sizeof(BMPHEADER) + sizeof(BMPINFO);
+        header.bfSize = header.bfOffbytes + info.biSizeImage;
+        ok = fwrite(&header, sizeof(BMPHEADER), 1, fp) == 1 && fwrite(&info, sizeof(BMPINFO), 1, fp) == 1;
+    }
+    // BMP rows bottom-up
+    for(int j = 0; ok && j < h; j++) {
+        hdr_get_row(img, pnm ? j : h - 1 - j, row, cstep, pnm, tmp);
+        ok = fwrite(row, rowbytes + pad, 1, fp) == 1;
+    }
+    free(row);
+    free(tmp);
+    if(fclose(fp) != 0)
+        ok = 0;
+    return ok;
+}
+
+/****************************************************************************/
+// 5x5 blur, the kernel folded like sse_blur_5_chunk of gaussian.c : the 5
+// rows give 3 vertical sums per pixel (a = r0+r4, b = r1+r3, c = r2), the
+// weights already divided by 273
+#define K(v) ((v) / 273.0f)
+
+static void blur5_row_scalar(const HALF *const rows[5], HALF *out, int w)
+{
+    for(int x = 2; x < w - 2; x++) {
+        float sum = 0;
+        for(int y = 0; y < 5; y++)
+            for(int d = -2; d <= 2; d++)
+                sum += half_to_float(rows[y][x + d]) * gaussian55[y * 5 + d + 2];
+        out[x] = half_from_float(sum / 273);
+    }
+}
+
+// output pixels [x0,x0+len) of one row, len >= 8, the window [x0-2,x0+len+2)
+// inside the row
+__attribute__((target("avx,f16c")))
+static void blur5_chunk_f16c(const HALF *const rows[5], HALF *out, int x0, int len)
+{
+    float v0[HDR_CHUNK + 4], v1[HDR_CHUNK + 4], v2[HDR_CHUNK + 4];
+    const __m256 k1 = _mm256_set1_ps(K(1)), k4 = _mm256_set1_ps(K(4)), k7 = _mm256_set1_ps(K(7));
+    const __m256 k16 = _mm256_set1_ps(K(16)), k26 = _mm256_set1_ps(K(26)), k41 = _mm256_set1_ps(K(41));
+    int m = len + 4, k;
+    const HALF *r0 = rows[0] + x0 - 2, *r1 = rows[1] + x0 - 2, *r2 = rows[2] + x0 - 2, *r3 = rows[3] + x0 - 2,
+                *r4 = rows[4] + x0 - 2;
+    // the last vector overlaps
+    for(k = 0; k < m; k += 8) {
+        int o = k + 8 > m ? m - 8 : k;
+        __m256 a = _mm256_add_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(r0 + o))),
+                                 _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(r4 + o))));
+        __m256 b = _mm256_add_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(r1 + o))),
+                                 _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(r3 + o))));
+        __m256 c = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(r2 + o)));
+        _mm256_storeu_ps(v0 + o, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, k7), _mm256_mul_ps(b, k26)), _mm256_mul_ps(c, k41)));
+        _mm256_storeu_ps(v1 + o, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, k4), _mm256_mul_ps(b, k16)), _mm256_mul_ps(c, k26)));
+        _mm256_storeu_ps(v2 + o, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, k1), _mm256_mul_ps(b, k4)), _mm256_mul_ps(c, k7)));
+    }
+    for(k = 0; k < len; k += 8) {
+        int o = k + 8 > len ? len - 8 : k;
+        __m256 s = _mm256_add_ps(_mm256_loadu_ps(v1 + o + 1), _mm256_loadu_ps(v1 + o + 3));
+        s = _mm256_add_ps(s, _mm256_add_ps(_mm256_loadu_ps(v2 + o), _mm256_loadu_ps(v2 + o + 4)));
+        s = _mm256_add_ps(s, _mm256_loadu_ps(v0 + o + 2));
+        _mm_storeu_si128((__m128i *)(out + x0 + o), _mm256_cvtps_ph(s, 0));
+    }
+}
+
+static void blur5_band(void *arg, int item)
+{
+    const HDRJOB *job = arg;
+    int w = job->w, h = job->h, f16c = has_f16c();
+    int y1 = (item + 1) * BAND_ROWS < h ? (item + 1) * BAND_ROWS : h;
+    for(int y = item * BAND_ROWS; y < y1; y++) {
+        const HALF *rows[5];
+        HALF *out = job->dst + (size_t)y * w;
+        memcpy(out, job->src + (size_t)y * w, w * sizeof(HALF));
+        if(y < 2 || y >= h - 2 || w < 5)
+            continue;
+        for(int k = 0; k < 5; k++)
+            rows[k] = job->src + (size_t)(y - 2 + k) * w;
+        if(!f16c || w - 4 < 8) {
+            blur5_row_scalar(rows, out, w);
+            continue;
+        }
+        for(int x0 = 2; x0 < w - 2; x0 += HDR_CHUNK) {
+            int len = w - 2 - x0 < HDR_CHUNK ? w - 2 - x0 : HDR_CHUNK;
+            // a short last chunk is moved back over the previous one
+            if(len < 8) {
+                x0 = w - 2 - 8;
+                len = 8;
+            }
+            blur5_chunk_f16c(rows, out, x0, len);
+        }
+    }
+}
+
+int hdr_blur5(const HALF *src, HALF *dst, int w, int h)
+{
+    HDRJOB job = {src, dst, {NULL, NULL, NULL}, w, h, 1, 0};
+    if(w < 1 || h < 1 || src == dst) {
+        fprintf(stderr, "hdr : bad blur of %d x %d\n", w, h);
+        return 0;
+    }
+    pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, blur5_band, &job);
+    return 1;
+}
+
+/****************************************************************************/
+// flips : 8 halves reversed by one byte shuffle, from both ends of the row
+static void flip_row(HALF *row, int w)
+{
+    const __m128i rev = _mm_setr_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    int l = 0, r = w;
+    for(; r - l >= 16; l += 8, r -= 8) {
+        __m128i a = _mm_loadu_si128((__m128i *)(row + l)), b = _mm_loadu_si128((__m128i *)(row + r - 8));
+        _mm_storeu_si128((__m128i *)(row + l), _mm_shuffle_epi8(b, rev));
+        _mm_storeu_si128((__m128i *)(row + r - 8), _mm_shuffle_epi8(a, rev));
+    }
+    for(r--; l < r; l++, r--) {
+        HALF t = row[l];
+        row[l] = row[r];
+        row[r] = t;
+    }
+}
+
+static void swap_rows(HALF *a, HALF *b, int w)
+{
+    int x = 0;
+    for(; x + 8 <= w; x += 8) {
+        __m128i va = _mm_loadu_si128((__m128i *)(a + x)), vb = _mm_loadu_si128((__m128i *)(b + x));
+        _mm_storeu_si128((__m128i *)(a + x), vb);
+        _mm_storeu_si128((__m128i *)(b + x), va);
+    }
+    for(; x < w; x++) {
+        HALF t = a[x];
+        a[x] = b[x];
+        b[x] = t;
+    }
+}
+
+static void flip_h_band(void *arg, int item)
+{
+    const HDRJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h;
+    for(int y = item * BAND_ROWS; y < y1; y++)
+        flip_row(job->dst + (size_t)y * job->w, job->w);
+}
+
+// a band is a set of row pairs from the top half
+static void flip_v_band(void *arg, int item)
+{
+    const HDRJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h / 2 ? (item + 1) * BAND_ROWS : job->h / 2;
+    for(int y = item * BAND_ROWS; y < y1; y++)
+        swap_rows(job->dst + (size_t)y * job->w, job->dst + (size_t)(job->h - 1 - y) * job->w, job->w);
+}
+
+int hdr_flip_horizontal(HALF *data, int w, int h)
+{
+    HDRJOB job = {data, data, {NULL, NULL, NULL}, w, h, 1, 0};
+    pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, flip_h_band, &job);
+    return 1;
+}
+
+int hdr_flip_vertical(HALF *data, int w, int h)
+{
+    HDRJOB job = {data, data, {NULL, NULL, NULL}, w, h, 1, 0};
+    pool_run(pool_default(), (h / 2 + BAND_ROWS - 1) / BAND_ROWS, flip_v_band, &job);
+    return 1;
+}
+
+/****************************************************************************/
+// HSV without the conversion. V is the maximum : V' = min(1, k V) scales
+// every channel by min(k, 1 / V). S = (V - min) / V : S' = min(1, k S)
+// moves every channel c to V - (V - c) min(k, V / (V - min)). A gray pixel
+// gives 0 / 0 or x / 0, both end on k which leaves it unchanged.
+static void hsv_pixel(float *b, float *g, float *r, float k, int saturation)
+{
+    float v = *b > *g ? *b : *g, m = *b < *g ? *b : *g, ratio;
+    v = *r > v ? *r : v;
+    m = *r < m ? *r : m;
+    if(!saturation) {
+        ratio = v > 0 && 1 / v < k ? 1 / v : k;
+        *b *= ratio;
+        *g *= ratio;
+        *r *= ratio;
+        return;
+    }
+    ratio = v > m && v / (v - m) < k ? v / (v - m) : k;
+    *b = v - (v - *b) * ratio;
+    *g = v - (v - *g) * ratio;
+    *r = v - (v - *r) * ratio;
+}
+
+// 8 pixels per step, the min (a, b) of AVX returns b when a is not a number
+__attribute__((target("avx,f16c")))
+static void hsv_row_f16c(HALF *pb, HALF *pg, HALF *pr, int w, float factor, int saturation)
+{
+    const __m256 k = _mm256_set1_ps(factor), one = _mm256_set1_ps(1);
+    int x = 0;
+    for(; x + 8 <= w; x += 8) {
+        __m256 b = _mm256_cvtph_ps(_mm_loadu_si128((__m128i *)(pb + x)));
+        __m256 g = _mm256_cvtph_ps(_mm_loadu_si128((__m128i *)(pg + x)));
+        __m256 r = _mm256_cvtph_ps(_mm_loadu_si128((__m128i *)(pr + x)));
+        __m256 v = _mm256_max_ps(_mm256_max_ps(b, g), r);
+        if(!saturation) {
+            __m256 ratio = _mm256_min_ps(_mm256_div_ps(one, v), k);
+            b = _mm256_mul_ps(b, ratio);
+            g = _mm256_mul_ps(g, ratio);
+            r = _mm256_mul_ps(r, ratio);
+        } else {
+            __m256 m = _mm256_min_ps(_mm256_min_ps(b, g), r);
+            __m256 ratio = _mm256_min_ps(_mm256_div_ps(v, _mm256_sub_ps(v, m)), k);
+            b = _mm256_sub_ps(v, _mm256_mul_ps(_mm256_sub_ps(v, b), ratio));
+            g = _mm256_sub_ps(v, _mm256_mul_ps(_mm256_sub_ps(v, g), ratio));
+            r = _mm256_sub_ps(v, _mm256_mul_ps(_mm256_sub_ps(v, r), ratio));
+        }
+        _mm_storeu_si128((__m128i *)(pb + x), _mm256_cvtps_ph(b, 0));
+        _mm_storeu_si128((__m128i *)(pg + x), _mm256_cvtps_ph(g, 0));
+        _mm_storeu_si128((__m128i *)(pr + x), _mm256_cvtps_ph(r, 0));
+    }
+    for(; x < w; x++) {
+        float b = half_to_float(pb[x]), g = half_to_float(pg[x]), r = half_to_float(pr[x]);
+        hsv_pixel(&b, &g, &r, factor, saturation);
+        pb[x] = half_from_float(b);
+        pg[x] = half_from_float(g);
+        pr[x] = half_from_float(r);
+    }
+}
+
+static void hsv_band(void *arg, int item)
+{
+    const HDRJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h;
+    int saturation = job->src != NULL, f16c = has_f16c();
+    for(int y = item * BAND_ROWS; y < y1; y++) {
+        size_t o = (size_t)y * job->w;
+        // gray : V is the pixel and S is 0
+        HALF *pb = job->plane[0] + o, *pg = job->plane[job->channels == 3] + o, *pr = job->plane[job->channels == 3 ? 2 : 0] + o;
+        if(f16c) {
+            hsv_row_f16c(pb, pg, pr, job->w, job->factor, saturation);
+            continue;
+        }
+        for(int x = 0; x < job->w; x++) {
+            float b = half_to_float(pb[x]), g = half_to_float(pg[x]), r = half_to_float(pr[x]);
+            hsv_pixel(&b, &g, &r, job->factor, saturation);
+            pb[x] = half_from_float(b);
+            pg[x] = half_from_float(g);
+            pr[x] = half_from_float(r);
+        }
+    }
+}
+
+// src only tells saturation (non NULL) from brightness
+static int hdr_hsv(HDRIMAGE *img, float factor, int saturation)
+{
+    HDRJOB job = {saturation ? img->plane[0] : NULL, NULL, {img->plane[0], img->plane[1], img->plane[2]},
+                  img->width, img->height, img->channels, factor
+                 };
+    if(saturation && img->channels == 1)
+        return 1;
+    pool_run(pool_default(), (img->height + BAND_ROWS - 1) / BAND_ROWS, hsv_band, &job);
+    return 1;
+}
+
+int hdr_brightness(HDRIMAGE *img, float brightness)
+{
+    return hdr_hsv(img, brightness, 0);
+}
+
+int hdr_saturation(HDRIMAGE *img, float saturation)
+{
+    return hdr_hsv(img, saturation, 1);
+}
+
+/*********************************************************/
+// the chain on the planes
+/*********************************************************/
+int hdr_apply(const OPCHAIN *chain, HDRIMAGE *img, HDRIMAGE *scratch)
+{
+    int w = img->width, h = img->height;
+    for(int i = 0; i < chain->count; i++) {
+        const OP *op = &chain->op[i];
+        switch(op->type) {
+            case OP_BLUR:
+                if(!hdr_reserve(scratch, w, h, img->channels))
+                    return 0;
+                for(int pass = 0; pass < (int)op->arg; pass++) {
+                    for(int c = 0; c < img->channels; c++)
+                        hdr_blur5(img->plane[c], scratch->plane[c], w, h);
+                    swap_hdr(img, scratch);
+                }
+                break;
+            case OP_FLIP_H:
+            case OP_FLIP_V:
+                for(int c = 0; c < img->channels; c++) {
+                    if(op->type == OP_FLIP_H)
+                        hdr_flip_horizontal(img->plane[c], w, h);
+                    else
+                        hdr_flip_vertical(img->plane[c], w, h);
+                }
+                break;
+            case OP_BRIGHTNESS:
+                hdr_brightness(img, op->arg);
+                break;
+            case OP_SATURATION:
+                hdr_saturation(img, op->arg);
+                break;
+            default:
+                fprintf(stderr, "hdr : only blur, fliph, flipv, bright and sat run on 16 bits images\n");
+                return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,50 @@
+#ifndef HDR_IMAGE
+#define HDR_IMAGE
+#include "ops.h"
+
+// IEEE half float, the storage of the 16 bits pipeline
+typedef unsigned short HALF;
+
+// Image with more than 8 bits per channel : one plane of half floats per
+// channel (blue, green, red, or a single gray plane), top row first, 1.0 is
+// the white of the source. Halves keep 11 significant bits and half the
+// memory traffic of floats, the kernels convert 8 of them at a time to
+// floats (F16C) and back ; without F16C a scalar conversion is used.
+typedef struct hdr_image {
+    int width;
+    int height;
+    int channels; // 1 or 3
+    HALF *plane[3];
+    size_t capacity; // allocated halves per plane
+} HDRIMAGE;
+
+int hdr_reserve(HDRIMAGE *img, int w, int h, int channels);
+void hdr_release(HDRIMAGE *img);
+// 24 / 48 bits BMP and binary PGM / PPM (P5 / P6, maxval up to 65535)
+int hdr_load(HDRIMAGE *img, const char *fileName);
+// .pgm / .ppm : 16 bits PNM (maxval 65535) ; anything else : 48 bits BMP
+int hdr_save(const HDRIMAGE *img, const char *fileName);
+
+// scalar conversions, round to nearest even
+HALF half_from_float(float f);
+float half_to_float(HALF h);
+// n values
+void half_from_floats(const float *src, HALF *dst, int n);
+void half_to_floats(const HALF *src, float *dst, int n);
+
+// Kernels on one plane (blur, flips) or on the 3 planes (hsv), bands of rows
+// on the pool. hdr_blur5 is the 5x5 gaussian of gaussian.c in floats, the 2
+// pixels border is copied, dst must not be src. The flips work in place.
+// hdr_brightness scales V and hdr_saturation S of HSV, clamped to 1, as
+// change_brightness / change_saturation : with the hue kept, V scales every
+// channel and S moves every channel away from the maximum, so no
+// conversion to HSV is needed.
+int hdr_blur5(const HALF *src, HALF *dst, int w, int h);
+int hdr_flip_horizontal(HALF *data, int w, int h);
+int hdr_flip_vertical(HALF *data, int w, int h);
+int hdr_brightness(HDRIMAGE *img, float brightness);
+int hdr_saturation(HDRIMAGE *img, float saturation);
+// blur[=passes], fliph, flipv, bright and sat of the chain, the other
+// operations are refused ; scratch is an extra buffer kept by the caller
+int hdr_apply(const OPCHAIN *chain, HDRIMAGE *img, HDRIMAGE *scratch);
+#endif // HDR_IMAGE
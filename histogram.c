@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+#include "histogram.h"
+#include "pool.h"
+#include "lut.h"
+
+// rows handed to a pool worker at a time
+#define BAND_ROWS 32
+// counters of one worker : HIST_SPLIT x channels x 256
+#define SUB_SIZE (HIST_SPLIT * 3 * 256)
+
+/****************************************************************************/
+// Counts n pixels of cstep bytes into sub : byte k of a block of HIST_SPLIT
+// pixels goes to table k (sub-histogram k / cstep, channel k % cstep), so
+// the 4 pixels of a block never touch the same counter. Planar data is read
+// 8 bytes at a time, RGB data 12.
+static void hist_count(const unsigned char *p, size_t n, int cstep, unsigned int *sub)
+{
+    size_t bytes = n * cstep, i = 0;
+    unsigned long long v;
+    unsigned int u;
+    if(cstep == 1) {
+        for(; i + 8 <= bytes; i += 8) {
+            memcpy(&v, p + i, 8);
+            sub[v & 255]++;
+            sub[256 + (v >> 8 & 255)]++;
+            sub[512 + (v >> 16 & 255)]++;
+            sub[768 + (v >> 24 & 255)]++;
+            sub[(v >> 32 & 255)]++;
+            sub[256 + (v >> 40 & 255)]++;
+            sub[512 + (v >> 48 & 255)]++;
+            sub[768 + (v >> 56)]++;
+        }
+    } else if(cstep == 3) {
+        for(; i + 12 <= bytes; i += 12) {
+            memcpy(&v, p + i, 8);
+            memcpy(&u, p + i + 8, 4);
+            sub[v & 255]++;
+            sub[256 + (v >> 8 & 255)]++;
+            sub[512 + (v >> 16 & 255)]++;
+            sub[768 + (v >> 24 & 255)]++;
+            sub[1024 + (v >> 32 & 255)]++;
+            sub[1280 + (v >> 40 & 255)]++;
+            sub[1536 + (v >> 48 & 255)]++;
+            sub[1792 + (v >> 56)]++;
+            sub[2048 + (u & 255)]++;
+            sub[2304 + (u >> 8 & 255)]++;
+            sub[2560 + (u >> 16 & 255)]++;
+            sub[2816 + (u >> 24)]++;
+        }
+    }
+    for(int k = 0; i < bytes; i++, k = k + 1 < HIST_SPLIT * cstep ? k + 1 : 0)
+        sub[k * 256 + p[i]]++;
+}
+
+// sums the HIST_SPLIT sub-histograms of sub into hist[c]
+static void hist_merge(const unsigned int *sub, int cstep, unsigned long long hist[][256])
+{
+    for(int s = 0; s < HIST_SPLIT; s++)
+        for(int c = 0; c < cstep; c++)
+            for(int v = 0; v < 256; v++)
+                hist[c][v] += sub[(s * cstep + c) * 256 + v];
+}
+
+typedef struct stats_job {
+    const unsigned char *src;
+    size_t pixels;
+    int cstep;
+    int items;
+    unsigned int *sub; // SUB_SIZE per item
+} STATSJOB;
+
+static void stats_slice(void *arg, int item)
+{
+    STATSJOB *job = arg;
+    size_t p0 = job->pixels * item / job->items, p1 = job->pixels * (item + 1) / job->items;
+    unsigned int *sub = job->sub + (size_t)item * SUB_SIZE;
+    memset(sub, 0, SUB_SIZE * sizeof(unsigned int));
+    hist_count(job->src + p0 * job->cstep, p1 - p0, job->cstep, sub);
+}
+
+int image_stats(const unsigned char *src, int w, int h, int cstep, IMAGESTATS *st)
+{
+    STATSJOB job = {src, (size_t)w * h, cstep, pool_threads(pool_default()), NULL};
+    if(cstep != 1 && cstep != 3) {
+        fprintf(stderr, "histogram : %d bytes per pixel not supported\n", cstep);
+        return 0;
+    }
+    // a slice counts at most 4G pixels per counter
+    while(job.pixels / job.items >= 0xffffffffULL / HIST_SPLIT)
+        job.items *= 2;
+    job.sub = malloc((size_t)job.items * SUB_SIZE * sizeof(unsigned int));
+    if(!job.sub) {
+        fprintf(stderr, "histogram : out of memory\n");
+        return 0;
+    }
+    pool_run(pool_default(), job.items, stats_slice, &job);
+    memset(st, 0, sizeof(IMAGESTATS));
+    st->channels = cstep;
+    st->pixels = job.pixels;
+    for(int i = 0; i < job.items; i++)
+        hist_merge(job.sub + (size_t)i * SUB_SIZE, cstep, st->hist);
+    free(job.sub);
+    for(int c = 0; c < cstep; c++) {
+        double sum = 0, sq = 0;
+        st->min[c] = 255;
+        for(int v = 0; v < 256; v++) {
+            if(!st->hist[c][v])
+                continue;
+            st->min[c] = v < st->min[c] ? v : st->min[c];
+            st->max[c] = v;
+            sum += (double)st->hist[c][v] * v;
+            sq += (double)st->hist[c][v] * v * v;
+        }
+        if(st->pixels) {
+            st->mean[c] = sum / st->pixels;
+            sq = sq / st->pixels - st->mean[c] * st->mean[c];
+            st->stddev[c] = sq > 0 ? _mm_cvtsd_f64(_mm_sqrt_sd(_mm_set_sd(sq), _mm_set_sd(sq))) : 0;
+        }
+    }
+    return 1;
+}
+
+int stats_tri(const unsigned char *src, int w, int h, IMAGESTATS *st)
+{
+    return image_stats(src, w, h, 1, st);
+}
+
+int stats_ori(const RGBTRIPLE *src, int w, int h, IMAGESTATS *st)
+{
+    return image_stats((const unsigned char *)src, w, h, 3, st);
+}
+
+void stats_report(const IMAGESTATS *st, FILE *out, int hist)
+{
+    static const char *rgb[3] = {"blue", "green", "red"};
+    for(int c = 0; c < st->channels; c++) {
+        fprintf(out, "  %-5s : min %d max %d mean %.3f stddev %.3f\n", st->channels == 1 ? "gray" : rgb[c],
+                st->min[c], st->max[c], st->mean[c], st->stddev[c]);
+        if(!hist)
+            continue;
+        fprintf(out, "  %-5s :", st->channels == 1 ? "gray" : rgb[c]);
+        for(int v = 0; v < 256; v++)
+            fprintf(out, " %llu", st->hist[c][v]);
+        fprintf(out, "\n");
+    }
+}
+
+// cumulative histogram over [0,255] : the first level present maps to 0
+static void equalize_lut(const unsigned long long *hist, unsigned long long n, unsigned char *lut)
+{
+    unsigned long long cdf = 0, first = 0;
+    for(int v = 0; v < 256 && !first; v++)
+        first = hist[v];
+    for(int v = 0; v < 256; v++) {
+        cdf += hist[v];
+        if(n == first)
+            lut[v] = v;
+        else
+            lut[v] = cdf < first ? 0 : ((cdf - first) * 255 + (n - first) / 2) / (n - first);
+    }
+}
+
+int hist_equalize(const unsigned char *src, unsigned char *dst, int w, int h, int cstep)
+{
+    IMAGESTATS st;
+    CURVE curve;
+    if(!image_stats(src, w, h, cstep, &st))
+        return 0;
+    for(int c = 0; c < cstep; c++)
+        equalize_lut(st.hist[c], st.pixels, curve.map[c]);
+    return curve_apply(&curve, src, dst, w, h, cstep);
+}
+
+int equalize_ori(RGBTRIPLE *img, int w, int h)
+{
+    return hist_equalize((const unsigned char *)img, (unsigned char *)img, w, h, 3);
+}
+
+typedef struct clahe_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+    int tx; // tiles per row
+    int ty;
+    float clip;
+    int *xs; // tile column bounds, tx + 1
+    int *ys;
+    int *col_tile; // tile left of the column center
+    int *col_frac; // weight of the tile right of it, out of 256
+    unsigned char *lut; // tx * ty * cstep * 256
+    int ok;
+} CLAHEJOB;
+
+/*********************************************************/
+// histogram of one tile, clipped, the excess spread over
+// all levels, then its table
+/*********************************************************/
+static void clahe_tile(void *arg, int item)
+{
+    const CLAHEJOB *job = arg;
+    int i = item % job->tx, j = item / job->tx, cstep = job->cstep;
+    int x0 = job->xs[i], x1 = job->xs[i + 1], y0 = job->ys[j], y1 = job->ys[j + 1];
+    unsigned long long npix = (unsigned long long)(x1 - x0) * (y1 - y0), hist[3][256];
+    unsigned int sub[SUB_SIZE];
+    memset(sub, 0, sizeof(sub));
+    memset(hist, 0, sizeof(hist));
+    for(int y = y0; y < y1; y++)
+        hist_count(job->src + ((size_t)y * job->w + x0) * cstep, x1 - x0, cstep, sub);
+    hist_merge(sub, cstep, hist);
+    unsigned long long limit = job->clip > 0 ? (unsigned long long)(job->clip * npix / 256) : npix;
+    limit = limit ? limit : 1;
+    for(int c = 0; c < cstep; c++) {
+        unsigned long long excess = 0, cdf = 0;
+        for(int v = 0; v < 256; v++) {
+            if(hist[c][v] > limit) {
+                excess += hist[c][v] - limit;
+                hist[c][v] = limit;
+            }
+        }
+        int rest = excess % 256, step = rest ? 256 / rest : 0;
+        for(int v = 0; v < 256; v++)
+            hist[c][v] += excess / 256 + (rest && v % step == 0 && v / step < rest);
+        unsigned char *lut = job->lut + ((size_t)item * cstep + c) * 256;
+        for(int v = 0; v < 256; v++) {
+            cdf += hist[c][v];
+            lut[v] = (cdf * 255 + npix / 2) / npix;
+        }
+    }
+}
+
+// tile left of (above) position p and the weight of the next one : the
+// tables are anchored on the tile centers, clamped past the first and last
+static void clahe_axis(const int *bounds, int tiles, int p, int *tile, int *frac)
+{
+    int t = 0;
+    // centers doubled : bounds[t] + bounds[t + 1] - 1
+    while(t + 1 < tiles && 2 * p >= bounds[t + 1] + bounds[t + 2] - 1)
+        t++;
+    int c0 = bounds[t] + bounds[t + 1] - 1;
+    if(2 * p <= c0 || t + 1 == tiles) {
+        *tile = t;
+        *frac = 0;
+        return;
+    }
+    int c1 = bounds[t + 1] + bounds[t + 2] - 1;
+    *tile = t;
+    *frac = (2 * p - c0) * 256 / (c1 - c0);
+}
+
+/*********************************************************/
+// rows of a band : the tables of the 2 tile rows around y
+// are blended once per row on 16 bits, every pixel then
+// blends 2 of them
+/*********************************************************/
+static void clahe_band(void *arg, int item)
+{
+    CLAHEJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h, cstep = job->cstep;
+    size_t row_luts = (size_t)job->tx * cstep * 256;
+    unsigned short *blend = malloc(row_luts * sizeof(unsigned short));
+    if(!blend) {
+        fprintf(stderr, "histogram : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    for(int y = item * BAND_ROWS; y < y1; y++) {
+        int ty, fy;
+        clahe_axis(job->ys, job->ty, y, &ty, &fy);
+        const unsigned char *top = job->lut + ty * row_luts;
+        const unsigned char *bot = ty + 1 < job->ty ? top + row_luts : top;
+        for(size_t i = 0; i < row_luts; i++)
+            blend[i] = top[i] * (256 - fy) + bot[i] * fy;
+        const unsigned char *s = job->src + (size_t)y * job->w * cstep;
+        unsigned char *d = job->dst + (size_t)y * job->w * cstep;
+        for(int x = 0; x < job->w; x++, s += cstep, d += cstep) {
+            int tx = job->col_tile[x], fx = job->col_frac[x];
+            const unsigned short *l = blend + (size_t)tx * cstep * 256;
+            const unsigned short *r = tx + 1 < job->tx ? l + cstep * 256 : l;
+            for(int c = 0; c < cstep; c++, l += 256, r += 256)
+                d[c] = (l[s[c]] * (256 - fx) + r[s[c]] * fx + 32768) >> 16;
+        }
+    }
+    free(blend);
+}
+
+int clahe(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int tiles_x, int tiles_y, float clip)
+{
+    CLAHEJOB job = {src, dst, w, h, cstep, tiles_x < w ? tiles_x : w, tiles_y < h ? tiles_y : h, clip,
+                    NULL, NULL, NULL, NULL, NULL, 1
+                   };
+    if((cstep != 1 && cstep != 3) || tiles_x < 1 || tiles_y < 1) {
+        fprintf(stderr, "histogram : bad clahe setup, %d bytes per pixel, %d x %d tiles\n", cstep, tiles_x, tiles_y);
+        return 0;
+    }
+    job.xs = malloc((job.tx + 1 + job.ty + 1 + 2 * (size_t)w) * sizeof(int));
+    job.lut = malloc((size_t)job.tx * job.ty * cstep * 256);
+    if(!job.xs || !job.lut) {
+        fprintf(stderr, "histogram : out of memory\n");
+        free(job.xs);
+        free(job.lut);
+        return 0;
+    }
+    job.ys = job.xs + job.tx + 1;
+    job.col_tile = job.ys + job.ty + 1;
+    job.col_frac = job.col_tile + w;
+    for(int i = 0; i <= job.tx; i++)
+        job.xs[i] = (int)((long long)i * w / job.tx);
+    for(int j = 0; j <= job.ty; j++)
+        job.ys[j] = (int)((long long)j * h / job.ty);
+    for(int x = 0; x < w; x++)
+        clahe_axis(job.xs, job.tx, x, &job.col_tile[x], &job.col_frac[x]);
+    pool_run(pool_default(), job.tx * job.ty, clahe_tile, &job);
+    pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, clahe_band, &job);
+    free(job.xs);
+    free(job.lut);
+    return job.ok;
+}
+
+int clahe_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, float clip)
+{
+    return clahe((const unsigned char *)src, (unsigned char *)dst, w, h, 3, CLAHE_TILES, CLAHE_TILES, clip);
+}
@@ -0,0 +1,43 @@
+#ifndef HISTOGRAM
+#define HISTOGRAM
+#include <stdio.h>
+#include "bmp.h"
+
+// sub-histograms per channel and worker : consecutive pixels count into
+// different tables, so runs of equal values do not wait on the previous
+// increment of the same counter
+#define HIST_SPLIT 4
+// CLAHE tiles along each axis
+#define CLAHE_TILES 8
+
+// Per channel statistics of planar (1 channel) or RGBTRIPLE (3 channels,
+// blue, green, red) pixels. One pass on the pool : every worker counts its
+// rows into private sub-histograms, they are summed at the end and min, max,
+// mean and standard deviation are read from the histogram.
+typedef struct image_stats {
+    int channels;
+    unsigned long long pixels;
+    unsigned long long hist[3][256];
+    int min[3];
+    int max[3];
+    double mean[3];
+    double stddev[3];
+} IMAGESTATS;
+
+int image_stats(const unsigned char *src, int w, int h, int cstep, IMAGESTATS *st);
+int stats_tri(const unsigned char *src, int w, int h, IMAGESTATS *st);
+int stats_ori(const RGBTRIPLE *src, int w, int h, IMAGESTATS *st);
+// min, max, mean and stddev per channel, then the 256 counts if hist
+void stats_report(const IMAGESTATS *st, FILE *out, int hist);
+
+// Histogram equalization of every channel on its own : the cumulative
+// histogram becomes a 256 entries table applied by bands. dst may be src.
+int hist_equalize(const unsigned char *src, unsigned char *dst, int w, int h, int cstep);
+int equalize_ori(RGBTRIPLE *img, int w, int h);
+// Contrast limited adaptive equalization on tiles_x x tiles_y tiles : every
+// tile gets its own table from its histogram clipped to clip times the mean
+// count (the clipped counts are spread over all levels), pixels blend the
+// tables of the 4 nearest tile centers. dst must not overlap src.
+int clahe(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int tiles_x, int tiles_y, float clip);
+int clahe_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, float clip);
+#endif // HISTOGRAM
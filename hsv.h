@@ -1,5 +1,5 @@
-#ifndef HSV
-#define HSV
+#ifndef HSV_ADJUST
+#define HSV_ADJUST
 #include <stdlib.h>
 #include  "bmp.h"
 
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "mirror.h"
+#include "qoi.h"
+
+// view rows gathered at a time when the image is transposed
+#define VIEW_BLOCK 16
+
+/*********************************************************/
+// make sure img->data can hold w*h pixels
+/*********************************************************/
+int image_reserve(IMAGE *img, int w, int h)
+{
+    size_t need = (size_t)w * h;
+    if(need <= img->capacity)
+        return 1;
+    RGBTRIPLE *p = realloc(img->data, need * sizeof(RGBTRIPLE));
+    if(!p)
+        return 0;
+    img->data = p;
+    img->capacity = need;
+    return 1;
+}
+
+/*********************************************************/
+// plain 24 bits BMP header of a w x h image, rows bottom-up, no orientation
+/*********************************************************/
+void image_header(IMAGE *img, int w, int h)
+{
+    size_t row = (size_t)w * sizeof(RGBTRIPLE);
+    memset(&img->header, 0, sizeof(BMPHEADER));
+    memset(&img->info, 0, sizeof(BMPINFO));
+    img->header.bfType = 0x4d42;
+    img->header.bfOffbytes = sizeof(BMPHEADER) + sizeof(BMPINFO);
+    img->info.biSize = sizeof(BMPINFO);
+    img->info.biWidth = w;
+    img->info.biHeight = h;
+    img->info.biPlanes = 1;
+    img->info.biBitCount = 24;
+    img->info.biSizeImage = (row + (4 - row % 4) % 4) * h;
+    img->header.bfSize = img->header.bfOffbytes + img->info.biSizeImage;
+    img->orient = 0;
+}
+
+void image_release(IMAGE *img)
+{
+    free(img->data);
+    img->data = NULL;
+    img->capacity = 0;
+}
+
+/*********************************************************/
+// Read a 24 bits BMP, honoring the pixel offset and row padding ; a .qoi
+// name is decoded by qoi.c instead
+/*********************************************************/
+int bmp_load(IMAGE *img, const char *fileName)
+{
+    if(qoi_is_name(fileName))
+        return qoi_load(img, fileName);
+    FILE *bmpFile = fopen(fileName, "rb");
+    if(!bmpFile) {
+        fprintf(stderr, "%s: can't open file\n", fileName);
+        return 0;
+    }
+    int ok = bmp_read(img, bmpFile, fileName);
+    fclose(bmpFile);
+    return ok;
+}
+
+int bmp_read(IMAGE *img, FILE *bmpFile, const char *fileName)
+{
+    if(fread(&img->header, sizeof(BMPHEADER), 1, bmpFile) != 1 ||
+       img->header.bfType != 0x4d42 ||
+       fread(&img->info, sizeof(BMPINFO), 1, bmpFile) != 1) {
+        fprintf(stderr, "%s: not a BMP file\n", fileName);
+        return 0;
+    }
+    if(img->info.biBitCount != 24 || img->info.biCompression != 0) {
+        fprintf(stderr, "%s: only uncompressed 24 bits BMP is supported\n", fileName);
+        return 0;
+    }
+    int w = IMAGE_WIDTH(img), h = IMAGE_HEIGHT(img);
+    if(w <= 0 || h <= 0 || !image_reserve(img, w, h))
+        return 0;
+    img->orient = 0;
+    // skip a bigger info header / palette, without seeking so pipes work too
+    long skip = (long)img->header.bfOffbytes - (long)(sizeof(BMPHEADER) + sizeof(BMPINFO));
+    while(skip-- > 0) {
+        if(fgetc(bmpFile) == EOF)
+            return 0;
+    }
+    size_t row = (size_t)w * sizeof(RGBTRIPLE);
+    size_t pad = (4 - row % 4) % 4;
+    size_t got;
+    if(pad == 0) {
+        got = fread(img->data, row, h, bmpFile);
+    } else {
+        unsigned char padding[4];
+        for(got = 0; got < (size_t)h; got++) {
+            if(fread(img->data + got * w, row, 1, bmpFile) != 1 ||
+               fread(padding, pad, 1, bmpFile) != 1)
+                break;
+        }
+    }
+    if(got != (size_t)h) {
+        fprintf(stderr, "%s: truncated pixel data\n", fileName);
+        return 0;
+    }
+    return 1;
+}
+
+/*********************************************************/
+// Write a 24 bits BMP with a plain 40 bytes info header, or QOI for a .qoi
+// name
+/*********************************************************/
+int bmp_save(const IMAGE *img, const char *fileName)
+{
+    if(qoi_is_name(fileName))
+        return qoi_save(img, fileName);
+    FILE *newFile = fopen(fileName, "wb");
+    if(!newFile) {
+        fprintf(stderr, "%s: can't create file\n", fileName);
+        return 0;
+    }
+    int ok = bmp_write(img, newFile);
+    if(fclose(newFile) != 0)
+        ok = 0;
+    return ok;
+}
+
+/*********************************************************/
+// Write the view : a vertical flip only changes the row order, the other
+// orientations go through a small row buffer, never a full image copy
+/*********************************************************/
+int bmp_write(const IMAGE *img, FILE *newFile)
+{
+    int w = IMAGE_VIEW_WIDTH(img), h = IMAGE_VIEW_HEIGHT(img);
+    size_t row = (size_t)w * sizeof(RGBTRIPLE);
+    size_t pad = (4 - row % 4) % 4;
+    BMPHEADER header = img->header;
+    BMPINFO info = img->info;
+    info.biWidth = w;
+    info.biHeight = img->info.biHeight < 0 ? -h : h;
+    info.biSize = sizeof(BMPINFO);
+    info.biSizeImage = (row + pad) * h;
+    header.bfType = 0x4d42;
+    header.bfOffbytes = sizeof(BMPHEADER) + sizeof(BMPINFO);
+    header.bfSize = header.bfOffbytes + info.biSizeImage;
+    int ok = fwrite(&header, sizeof(BMPHEADER), 1, newFile) == 1 &&
+             fwrite(&info, sizeof(BMPINFO), 1, newFile) == 1;
+    const unsigned char zero[4] = {0, 0, 0, 0};
+    if(ok && img->orient == 0 && pad == 0) {
+        ok = fwrite(img->data, row, h, newFile) == (size_t)h;
+    } else if(ok && (img->orient & ~ORIENT_FLIP_V) == 0) {
+        for(int j = 0; j < h && ok; j++) {
+            int y = img->orient & ORIENT_FLIP_V ? h - 1 - j : j;
+            ok = fwrite(img->data + (size_t)y * w, row, 1, newFile) == 1 &&
+                 (pad == 0 || fwrite(zero, pad, 1, newFile) == 1);
+        }
+    } else if(ok) {
+        int block = img->orient & ORIENT_TRANSPOSE ? VIEW_BLOCK : 1;
+        RGBTRIPLE *buf = malloc(row * block);
+        ok = buf != NULL;
+        for(int j = 0; j < h && ok; j += block) {
+            int n = j + block < h ? block : h - j;
+            image_view_rows(img, buf, j, j + n);
+            for(int k = 0; k < n && ok; k++)
+                ok = fwrite(buf + (size_t)k * w, row, 1, newFile) == 1 &&
+                     (pad == 0 || fwrite(zero, pad, 1, newFile) == 1);
+        }
+        free(buf);
+    }
+    return ok;
+}
+
+/*********************************************************/
+// orientation bookkeeping, no pixel is touched
+/*********************************************************/
+void image_orient(IMAGE *img, int op)
+{
+    int o = img->orient;
+    if(op == ORIENT_TRANSPOSE) {
+        // transposing a mirrored view swaps the mirror axis
+        o = ((o & ORIENT_FLIP_H) ? ORIENT_FLIP_V : 0) |
+            ((o & ORIENT_FLIP_V) ? ORIENT_FLIP_H : 0) |
+            ((o & ORIENT_TRANSPOSE) ^ ORIENT_TRANSPOSE);
+    } else {
+        o ^= op & (ORIENT_FLIP_H | ORIENT_FLIP_V);
+    }
+    img->orient = o;
+}
+
+void image_rotate(IMAGE *img, int degrees)
+{
+    // clockwise on screen, rows are bottom-up in memory unless biHeight < 0
+    int bottom_up = img->info.biHeight > 0;
+    switch(((degrees % 360) + 360) % 360) {
+        case 90:
+            image_orient(img, ORIENT_TRANSPOSE);
+            image_orient(img, bottom_up ? ORIENT_FLIP_V : ORIENT_FLIP_H);
+            break;
+        case 180:
+            image_orient(img, ORIENT_FLIP_H | ORIENT_FLIP_V);
+            break;
+        case 270:
+            image_orient(img, ORIENT_TRANSPOSE);
+            image_orient(img, bottom_up ? ORIENT_FLIP_H : ORIENT_FLIP_V);
+            break;
+    }
+}
+
+void image_view_rows(const IMAGE *img, RGBTRIPLE *dst, int y0, int y1)
+{
+    int w = IMAGE_WIDTH(img);
+    int vw = IMAGE_VIEW_WIDTH(img), vh = IMAGE_VIEW_HEIGHT(img);
+    int flip_h = img->orient & ORIENT_FLIP_H, flip_v = img->orient & ORIENT_FLIP_V;
+    if(!(img->orient & ORIENT_TRANSPOSE)) {
+        for(int y = y0; y < y1; y++) {
+            RGBTRIPLE *out = dst + (size_t)(y - y0) * vw;
+            memcpy(out, img->data + (size_t)(flip_v ? vh - 1 - y : y) * w, vw * sizeof(RGBTRIPLE));
+            if(flip_h)
+                sse_flip_horizontal_rows_ori(out, vw, 0, 1);
+        }
+        return;
+    }
+    // view row y is source column y : walk the source rows so each one
+    // is read as a short contiguous run for the whole block
+    for(int x = 0; x < vw; x++) {
+        const RGBTRIPLE *src = img->data + (size_t)(flip_h ? vw - 1 - x : x) * w;
+        for(int y = y0; y < y1; y++)
+            dst[(size_t)(y - y0) * vw + x] = src[flip_v ? vh - 1 - y : y];
+    }
+}
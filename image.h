@@ -0,0 +1,50 @@
+#ifndef IMAGEIO
+#define IMAGEIO
+#include <stdio.h>
+#include <stddef.h>
+#include "bmp.h"
+
+// In-memory image, pixels are kept in file order (BGR, rows bottom-up as
+// stored in the BMP), one row is exactly width pixels without padding.
+// The pixel buffer is reused by later loads as long as it is big enough.
+// Flips and transposes are not applied to the pixels, they are kept in
+// orient and composed there ; the pixels move once, when the image is
+// written out (bmp_write) or when an operation needs the real layout.
+// The view is data transposed (ORIENT_TRANSPOSE) then mirrored, in memory
+// row order.
+typedef struct tagIMAGE {
+    BMPHEADER header;
+    BMPINFO info;
+    RGBTRIPLE *data;
+    size_t capacity; // allocated pixels
+    int orient; // ORIENT_* bits
+} IMAGE;
+
+#define ORIENT_FLIP_H 1
+#define ORIENT_FLIP_V 2
+#define ORIENT_TRANSPOSE 4
+
+// size of the pixel buffer
+#define IMAGE_WIDTH(img) ((img)->info.biWidth)
+#define IMAGE_HEIGHT(img) ((img)->info.biHeight < 0 ? -(img)->info.biHeight : (img)->info.biHeight)
+// size of the image once the orientation is applied
+#define IMAGE_VIEW_WIDTH(img) ((img)->orient & ORIENT_TRANSPOSE ? IMAGE_HEIGHT(img) : IMAGE_WIDTH(img))
+#define IMAGE_VIEW_HEIGHT(img) ((img)->orient & ORIENT_TRANSPOSE ? IMAGE_WIDTH(img) : IMAGE_HEIGHT(img))
+
+int image_reserve(IMAGE *img, int w, int h);
+void image_release(IMAGE *img);
+// header of a plain 24 bits w x h image, rows bottom-up, no orientation
+void image_header(IMAGE *img, int w, int h);
+// the format follows the extension : .qoi is QOI (qoi.h), anything else BMP
+int bmp_load(IMAGE *img, const char *fileName);
+int bmp_save(const IMAGE *img, const char *fileName);
+// same on an already opened stream (pipe, memfd, ...)
+int bmp_read(IMAGE *img, FILE *bmpFile, const char *fileName);
+int bmp_write(const IMAGE *img, FILE *newFile);
+// compose ORIENT_FLIP_H / ORIENT_FLIP_V / ORIENT_TRANSPOSE with the current
+// view, or a clockwise rotation of 90 , 180 or 270 degrees as displayed
+void image_orient(IMAGE *img, int op);
+void image_rotate(IMAGE *img, int degrees);
+// copy view rows y0..y1 into dst, rows of IMAGE_VIEW_WIDTH pixels
+void image_view_rows(const IMAGE *img, RGBTRIPLE *dst, int y0, int y1);
+#endif // IMAGEIO
@@ -32,7 +32,8 @@ format()
   astyle --style=kr --indent=spaces=4 --indent-switches --suffix=none *.[ch]
 }
 # =========== defined Objects here ===========
-OBJS=(gaussian mirror hsv)
+OBJS=(gaussian mirror hsv queue image batch pool ops server stream convolve fft unsharp edge median bilateral morph integral histogram resize pyramid warp lut hdr ycbcr qoi tile)
+OBJ_FILES="${OBJS[*]/%/.o}"
 TARGET=image_process
 # =========== defined Objects here ===========
 # Get string from command line
@@ -60,7 +61,7 @@ do
   case "$1" in
     -a)
       echo "compile with gau_all"
-      GAU_TYPE=2047
+      GAU_TYPE=4095
       shift
       ;;
     -e)
@@ -105,8 +106,8 @@ do
     --perf)
       echo "compile + run and plot execution times: $2"
       PERF=$2
-      # And must set gau_type to 2047
-      GAU_TYPE=2047
+      # And must set gau_type to 4095
+      GAU_TYPE=4095
       shift 2
       ;;
     --clean)
@@ -181,23 +182,23 @@ fi
 # compile and run
 if [ $TEST = "y" ]; then
   $CC -std=gnu99 -c -DTEST -o main.o main.c
-  $CC $CFLAGS gaussian.o mirror.o hsv.o main.o -o $TARGET -lpthread
+  $CC $CFLAGS ${OBJ_FILES} main.o -o $TARGET -lpthread
   ./$TARGET ${INPUT} ${OUTPUT}_${GAU_TYPE}_${MIRROR}_${HSV}.bmp ${TIMES} ${THREADS}
 else
   if [ $PERF -eq "0" ]; then
     if [ $VALG = "n" ]; then
       $CC -std=gnu99 -c -DGAUSSIAN=$GAU_TYPE -DMIRROR=$MIRROR -DHSV=$HSV -o main.o main.c
-      $CC $CFLAGS gaussian.o mirror.o hsv.o main.o -o $TARGET -lpthread
+      $CC $CFLAGS ${OBJ_FILES} main.o -o $TARGET -lpthread
       ./$TARGET ${INPUT} ${OUTPUT}_${GAU_TYPE}_${MIRROR}_${HSV}.bmp ${TIMES} ${THREADS}
     else
       $CC -std=gnu99 -c -DGAUSSIAN=$GAU_TYPE -DMIRROR=$MIRROR -DHSV=$HSV -g -o main.o main.c
-      $CC $CFLAGS gaussian.o mirror.o hsv.o main.o -o $TARGET -lpthread
+      $CC $CFLAGS ${OBJ_FILES} main.o -o $TARGET -lpthread
       valgrind --leak-check=full ./$TARGET img/input.bmp output_${GAU_TYPE}_${MIRROR}_${HSV}.bmp 1 4
     fi
   else
     if [ $VALG = "n" ]; then
       $CC -std=gnu99 -c -DPERF=1 -DGAUSSIAN=$GAU_TYPE -DMIRROR=$MIRROR -DHSV=$HSV -o main.o main.c
-      $CC $CFLAGS gaussian.o mirror.o hsv.o main.o -o $TARGET -lpthread
+      $CC $CFLAGS ${OBJ_FILES} main.o -o $TARGET -lpthread
       echo "Start to perf !"
       perf stat -r $PERF -e cache-misses,cache-references \
     	./$TARGET img/input.bmp output.bmp 1 4 > exec_time.log
@@ -205,7 +206,7 @@ else
     	gnuplot scripts/plot_time_2.gp
     else
       #$CC -std=gnu99 -c -DPERF=1 -DGAUSSIAN=$GAU_TYPE -DMIRROR=$MIRROR -DHSV=$HSV -g -o main.o main.c
-      #$CC $CFLAGS gaussian.o mirror.o hsv.o main.o -o $TARGET -lpthread
+      #$CC $CFLAGS ${OBJ_FILES} main.o -o $TARGET -lpthread
       echo "No avaliable! Terminating ... "
       exit 1
     fi
@@ -0,0 +1,460 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "integral.h"
+#include "pool.h"
+
+// rows handed to a pool worker at a time
+#define BAND_ROWS 32
+// bytes of a table row in a column strip of the vertical pass
+#define STRIP_BYTES 4096
+
+typedef struct integral_job {
+    const unsigned char *src;
+    unsigned int *sat32;
+    unsigned long long *sat64;
+    unsigned long long *sq64;
+    int w;
+    int h;
+} SATJOB;
+
+static __m128i broadcast_last_epi16(__m128i v)
+{
+    v = _mm_shufflehi_epi16(v, 0xff);
+    return _mm_unpackhi_epi64(v, v);
+}
+
+/****************************************************************************/
+// Running sums of 16 pixels as 4 vectors of 32 bits : 3 shifted adds on 16
+// bits lanes per half, the high half starts from the total of the low one.
+static void prefix_sum_16(const unsigned char *p, __m128i *s)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i a = _mm_unpacklo_epi8(v, zero), b = _mm_unpackhi_epi8(v, zero);
+    a = _mm_add_epi16(a, _mm_slli_si128(a, 2));
+    b = _mm_add_epi16(b, _mm_slli_si128(b, 2));
+    a = _mm_add_epi16(a, _mm_slli_si128(a, 4));
+    b = _mm_add_epi16(b, _mm_slli_si128(b, 4));
+    a = _mm_add_epi16(a, _mm_slli_si128(a, 8));
+    b = _mm_add_epi16(b, _mm_slli_si128(b, 8));
+    b = _mm_add_epi16(b, broadcast_last_epi16(a));
+    s[0] = _mm_unpacklo_epi16(a, zero);
+    s[1] = _mm_unpackhi_epi16(a, zero);
+    s[2] = _mm_unpacklo_epi16(b, zero);
+    s[3] = _mm_unpackhi_epi16(b, zero);
+}
+
+// same for the squares, which need 32 bits from the start
+static void prefix_sq_16(const unsigned char *p, __m128i *s)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i a = _mm_unpacklo_epi8(v, zero), b = _mm_unpackhi_epi8(v, zero);
+    __m128i al = _mm_mullo_epi16(a, a), ah = _mm_mulhi_epu16(a, a);
+    __m128i bl = _mm_mullo_epi16(b, b), bh = _mm_mulhi_epu16(b, b);
+    s[0] = _mm_unpacklo_epi16(al, ah);
+    s[1] = _mm_unpackhi_epi16(al, ah);
+    s[2] = _mm_unpacklo_epi16(bl, bh);
+    s[3] = _mm_unpackhi_epi16(bl, bh);
+    for(int i = 0; i < 4; i++) {
+        s[i] = _mm_add_epi32(s[i], _mm_slli_si128(s[i], 4));
+        s[i] = _mm_add_epi32(s[i], _mm_slli_si128(s[i], 8));
+        if(i)
+            s[i] = _mm_add_epi32(s[i], _mm_shuffle_epi32(s[i - 1], 0xff));
+    }
+}
+
+// 16 running sums plus the 64 bits carry into out, returns the next carry
+static __m128i store_16_64(unsigned long long *out, const __m128i *s, __m128i carry)
+{
+    for(int i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)(out + 4 * i), _mm_add_epi64(_mm_cvtepu32_epi64(s[i]), carry));
+        _mm_storeu_si128((__m128i *)(out + 4 * i + 2),
+                         _mm_add_epi64(_mm_cvtepu32_epi64(_mm_srli_si128(s[i], 8)), carry));
+    }
+    return _mm_add_epi64(carry, _mm_cvtepu32_epi64(_mm_shuffle_epi32(s[3], 0xff)));
+}
+
+// image row y into table row y + 1, horizontal sums only
+static void prefix_row(const SATJOB *job, int y)
+{
+    const unsigned char *p = job->src + (size_t)y * job->w;
+    size_t o = (size_t)(y + 1) * (job->w + 1);
+    int w = job->w, x = 0;
+    __m128i s[4];
+    if(job->sat32) {
+        unsigned int *out = job->sat32 + o;
+        __m128i carry = _mm_setzero_si128();
+        out[0] = 0;
+        out++;
+        for(; x + 16 <= w; x += 16) {
+            prefix_sum_16(p + x, s);
+            for(int i = 0; i < 4; i++)
+                _mm_storeu_si128((__m128i *)(out + x + 4 * i), _mm_add_epi32(s[i], carry));
+            carry = _mm_add_epi32(carry, _mm_shuffle_epi32(s[3], 0xff));
+        }
+        for(unsigned int acc = _mm_cvtsi128_si32(carry); x < w; x++)
+            out[x] = acc += p[x];
+        return;
+    }
+    unsigned long long *out = job->sat64 + o, *sq = job->sq64 ? job->sq64 + o : NULL;
+    __m128i carry = _mm_setzero_si128(), carry_sq = carry;
+    out[0] = 0;
+    out++;
+    if(sq)
+        *sq++ = 0;
+    for(; x + 16 <= w; x += 16) {
+        prefix_sum_16(p + x, s);
+        carry = store_16_64(out + x, s, carry);
+        if(sq) {
+            prefix_sq_16(p + x, s);
+            carry_sq = store_16_64(sq + x, s, carry_sq);
+        }
+    }
+    unsigned long long acc = _mm_cvtsi128_si64(carry), acc_sq = _mm_cvtsi128_si64(carry_sq);
+    for(; x < w; x++) {
+        out[x] = acc += p[x];
+        if(sq)
+            sq[x] = acc_sq += p[x] * p[x];
+    }
+}
+
+static void prefix_band(void *arg, int item)
+{
+    const SATJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h;
+    for(int y = item * BAND_ROWS; y < y1; y++)
+        prefix_row(job, y);
+}
+
+/*********************************************************/
+// vertical pass of one strip of columns : every table row
+// adds the row above, the strip stays in the cache while
+// it walks down the image
+/*********************************************************/
+static void column_strip(void *arg, int item)
+{
+    const SATJOB *job = arg;
+    size_t stride = job->w + 1;
+    if(job->sat32) {
+        int per = STRIP_BYTES / sizeof(unsigned int), x0 = item * per;
+        int x1 = x0 + per < (int)stride ? x0 + per : (int)stride;
+        for(int y = 2; y <= job->h; y++) {
+            unsigned int *row = job->sat32 + y * stride, *up = row - stride;
+            int x = x0;
+            for(; x + 4 <= x1; x += 4)
+                _mm_storeu_si128((__m128i *)(row + x), _mm_add_epi32(_mm_loadu_si128((__m128i *)(row + x)),
+                                 _mm_loadu_si128((__m128i *)(up + x))));
+            for(; x < x1; x++)
+                row[x] += up[x];
+        }
+        return;
+    }
+    int per = STRIP_BYTES / sizeof(unsigned long long), x0 = item * per;
+    int x1 = x0 + per < (int)stride ? x0 + per : (int)stride;
+    for(int t = 0; t < 2; t++) {
+        unsigned long long *sat = t ? job->sq64 : job->sat64;
+        if(!sat)
+            continue;
+        for(int y = 2; y <= job->h; y++) {
+            unsigned long long *row = sat + y * stride, *up = row - stride;
+            int x = x0;
+            for(; x + 2 <= x1; x += 2)
+                _mm_storeu_si128((__m128i *)(row + x), _mm_add_epi64(_mm_loadu_si128((__m128i *)(row + x)),
+                                 _mm_loadu_si128((__m128i *)(up + x))));
+            for(; x < x1; x++)
+                row[x] += up[x];
+        }
+    }
+}
+
+static int integral_build(SATJOB *job)
+{
+    size_t stride = job->w + 1;
+    if(job->w < 1 || job->h < 1) {
+        fprintf(stderr, "integral : bad size %d x %d\n", job->w, job->h);
+        return 0;
+    }
+    int per = job->sat32 ? STRIP_BYTES / sizeof(unsigned int) : STRIP_BYTES / sizeof(unsigned long long);
+    if(job->sat32)
+        memset(job->sat32, 0, stride * sizeof(unsigned int));
+    if(job->sat64)
+        memset(job->sat64, 0, stride * sizeof(unsigned long long));
+    if(job->sq64)
+        memset(job->sq64, 0, stride * sizeof(unsigned long long));
+    pool_run(pool_default(), (job->h + BAND_ROWS - 1) / BAND_ROWS, prefix_band, job);
+    pool_run(pool_default(), (int)((stride + per - 1) / per), column_strip, job);
+    return 1;
+}
+
+int integral_build32(const unsigned char *src, unsigned int *sat, int w, int h)
+{
+    SATJOB job = {src, sat, NULL, NULL, w, h};
+    return integral_build(&job);
+}
+
+int integral_build64(const unsigned char *src, unsigned long long *sat, unsigned long long *sq, int w, int h)
+{
+    SATJOB job = {src, NULL, sat, sq, w, h};
+    return integral_build(&job);
+}
+
+typedef struct box_job {
+    const unsigned int *sat32; // either this one
+    const unsigned long long *sat64; // or this one for the sums
+    const unsigned long long *sq64;
+    int w;
+    int h;
+    int rx;
+    int ry;
+    unsigned char *dst;
+    float *mean;
+    float *var;
+    int ok;
+} BOXJOB;
+
+static unsigned long long box_sum(const unsigned long long *sat, size_t stride, int x0, int y0, int x1, int y1)
+{
+    return sat[y1 * stride + x1] - sat[y1 * stride + x0] - sat[y0 * stride + x1] + sat[y0 * stride + x0];
+}
+
+/*********************************************************/
+// window sums of row y as doubles, rows [y0,y1) ; the
+// columns whose window is not clipped take 4 per vector
+/*********************************************************/
+static void box_sums(const BOXJOB *job, int y0, int y1, double *sum)
+{
+    int w = job->w, rx = job->rx, x = 0;
+    size_t stride = w + 1;
+    if(job->sat32) {
+        const unsigned int *top = job->sat32 + y0 * stride, *bot = job->sat32 + y1 * stride;
+        const __m128i sign = _mm_set1_epi32((int)0x80000000);
+        const __m128d bias = _mm_set1_pd(2147483648.0);
+        for(; x < w; x++) {
+            if(x >= rx && x + 4 + rx <= w)
+                break;
+            int x0 = x - rx > 0 ? x - rx : 0, x1 = x + rx + 1 < w ? x + rx + 1 : w;
+            sum[x] = bot[x1] - bot[x0] - top[x1] + top[x0];
+        }
+        for(; x >= rx && x + 4 + rx <= w; x += 4) {
+            const unsigned int *b = bot + x, *t = top + x;
+            __m128i v = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(b + rx + 1)),
+                                      _mm_loadu_si128((const __m128i *)(b - rx)));
+            v = _mm_sub_epi32(v, _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(t + rx + 1)),
+                                               _mm_loadu_si128((const __m128i *)(t - rx))));
+            // unsigned to double : flip the sign bit, convert, add 2^31 back
+            v = _mm_xor_si128(v, sign);
+            _mm_storeu_pd(sum + x, _mm_add_pd(_mm_cvtepi32_pd(v), bias));
+            _mm_storeu_pd(sum + x + 2, _mm_add_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), bias));
+        }
+        for(; x < w; x++) {
+            int x0 = x - rx > 0 ? x - rx : 0, x1 = x + rx + 1 < w ? x + rx + 1 : w;
+            sum[x] = bot[x1] - bot[x0] - top[x1] + top[x0];
+        }
+        return;
+    }
+    for(; x < w; x++) {
+        int x0 = x - rx > 0 ? x - rx : 0, x1 = x + rx + 1 < w ? x + rx + 1 : w;
+        sum[x] = (double)box_sum(job->sat64, stride, x0, y0, x1, y1);
+    }
+}
+
+// window width of column x
+static int box_width(const BOXJOB *job, int x)
+{
+    int x0 = x - job->rx > 0 ? x - job->rx : 0, x1 = x + job->rx + 1 < job->w ? x + job->rx + 1 : job->w;
+    return x1 - x0;
+}
+
+static void box_mean_row(const BOXJOB *job, int y, int y0, int y1, const double *sum)
+{
+    unsigned char *out = job->dst + (size_t)y * job->w;
+    int w = job->w, rx = job->rx, x = 0;
+    double ch = y1 - y0, inv = 1 / ((2 * rx + 1) * ch);
+    // the window sums are integers, 1e-10 keeps an exact .5 from rounding down
+    const __m128d vinv = _mm_set1_pd(inv), half = _mm_set1_pd(0.5 + 1e-10);
+    for(; x < w; x++) {
+        if(x >= rx && x + 4 + rx <= w)
+            break;
+        out[x] = (int)(sum[x] / (box_width(job, x) * ch) + (0.5 + 1e-10));
+    }
+    for(; x >= rx && x + 4 + rx <= w; x += 4) {
+        __m128i a = _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(sum + x), vinv), half));
+        __m128i b = _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(sum + x + 2), vinv), half));
+        a = _mm_unpacklo_epi64(a, b);
+        a = _mm_packus_epi16(_mm_packs_epi32(a, a), a);
+        int bytes = _mm_cvtsi128_si32(a);
+        memcpy(out + x, &bytes, 4);
+    }
+    for(; x < w; x++)
+        out[x] = (int)(sum[x] / (box_width(job, x) * ch) + (0.5 + 1e-10));
+}
+
+static void local_mean_row(const BOXJOB *job, int y, int y0, int y1, const double *sum)
+{
+    float *out = job->mean + (size_t)y * job->w;
+    int w = job->w, rx = job->rx, x = 0;
+    double ch = y1 - y0;
+    const __m128d vinv = _mm_set1_pd(1 / ((2 * rx + 1) * ch));
+    for(; x < w; x++) {
+        if(x >= rx && x + 4 + rx <= w)
+            break;
+        out[x] = (float)(sum[x] / (box_width(job, x) * ch));
+    }
+    for(; x >= rx && x + 4 + rx <= w; x += 4) {
+        __m128 a = _mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(sum + x), vinv));
+        __m128 b = _mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(sum + x + 2), vinv));
+        _mm_storeu_ps(out + x, _mm_movelh_ps(a, b));
+    }
+    for(; x < w; x++)
+        out[x] = (float)(sum[x] / (box_width(job, x) * ch));
+}
+
+// 64 bits integers below 2^52 to doubles : the bits of 2^52 + v, minus 2^52
+static __m128d epu64_pd(__m128i v)
+{
+    const __m128i magic = _mm_set1_epi64x(0x4330000000000000LL);
+    return _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(v, magic)), _mm_castsi128_pd(magic));
+}
+
+static __m128d box_sum_pd(const unsigned long long *top, const unsigned long long *bot, int x, int rx)
+{
+    __m128i v = _mm_sub_epi64(_mm_loadu_si128((const __m128i *)(bot + x + rx + 1)),
+                              _mm_loadu_si128((const __m128i *)(bot + x - rx)));
+    v = _mm_sub_epi64(v, _mm_sub_epi64(_mm_loadu_si128((const __m128i *)(top + x + rx + 1)),
+                                       _mm_loadu_si128((const __m128i *)(top + x - rx))));
+    return epu64_pd(v);
+}
+
+// E[v^2] - E[v]^2 in doubles, the cancellation stays far below float precision
+static void local_variance_row(const BOXJOB *job, int y, int y0, int y1)
+{
+    size_t stride = job->w + 1, o = (size_t)y * job->w;
+    int w = job->w, rx = job->rx, x = 0;
+    const unsigned long long *top = job->sat64 + y0 * stride, *bot = job->sat64 + y1 * stride;
+    const unsigned long long *top2 = job->sq64 + y0 * stride, *bot2 = job->sq64 + y1 * stride;
+    double ch = y1 - y0;
+    const __m128d vinv = _mm_set1_pd(1 / ((2 * rx + 1) * ch));
+    for(; x < w; x++) {
+        if(x >= rx && x + 2 + rx <= w)
+            break;
+        int x0 = x - rx > 0 ? x - rx : 0, x1 = x + rx + 1 < w ? x + rx + 1 : w;
+        double inv = 1 / ((x1 - x0) * ch), mu = box_sum(job->sat64, stride, x0, y0, x1, y1) * inv;
+        job->var[o + x] = (float)(box_sum(job->sq64, stride, x0, y0, x1, y1) * inv - mu * mu);
+        if(job->mean)
+            job->mean[o + x] = (float)mu;
+    }
+    for(; x >= rx && x + 2 + rx <= w; x += 2) {
+        __m128d mu = _mm_mul_pd(box_sum_pd(top, bot, x, rx), vinv);
+        __m128d var = _mm_sub_pd(_mm_mul_pd(box_sum_pd(top2, bot2, x, rx), vinv), _mm_mul_pd(mu, mu));
+        _mm_storel_pi((__m64 *)(job->var + o + x), _mm_cvtpd_ps(var));
+        if(job->mean)
+            _mm_storel_pi((__m64 *)(job->mean + o + x), _mm_cvtpd_ps(mu));
+    }
+    for(; x < w; x++) {
+        int x0 = x - rx > 0 ? x - rx : 0, x1 = x + rx + 1 < w ? x + rx + 1 : w;
+        double inv = 1 / ((x1 - x0) * ch), mu = box_sum(job->sat64, stride, x0, y0, x1, y1) * inv;
+        job->var[o + x] = (float)(box_sum(job->sq64, stride, x0, y0, x1, y1) * inv - mu * mu);
+        if(job->mean)
+            job->mean[o + x] = (float)mu;
+    }
+}
+
+static void box_band(void *arg, int item)
+{
+    BOXJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h;
+    double *sum = NULL;
+    if(!job->var && !(sum = malloc(job->w * sizeof(double)))) {
+        fprintf(stderr, "integral : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    for(int y = item * BAND_ROWS; y < y1; y++) {
+        int top = y - job->ry > 0 ? y - job->ry : 0, bot = y + job->ry + 1 < job->h ? y + job->ry + 1 : job->h;
+        if(job->var) {
+            local_variance_row(job, y, top, bot);
+            continue;
+        }
+        box_sums(job, top, bot, sum);
+        if(job->dst)
+            box_mean_row(job, y, top, bot, sum);
+        else
+            local_mean_row(job, y, top, bot, sum);
+    }
+    free(sum);
+}
+
+/****************************************************************************/
+// Builds the tables the filter needs and runs it by bands : the means take
+// 32 bits tables unless the window sum may not fit, the variance takes the
+// 64 bits sums and squares.
+static int box_filter(const unsigned char *src, int w, int h, int rx, int ry,
+                      unsigned char *dst, float *mean, float *var)
+{
+    BOXJOB job = {NULL, NULL, NULL, w, h, rx, ry, dst, mean, var, 1};
+    if(rx < 0 || ry < 0) {
+        fprintf(stderr, "integral : bad window radius %d x %d\n", rx, ry);
+        return 0;
+    }
+    size_t entries = (size_t)(w + 1) * (h + 1);
+    long long cw = 2LL * rx + 1 < w ? 2LL * rx + 1 : w, ch = 2LL * ry + 1 < h ? 2LL * ry + 1 : h;
+    int wide = var || cw * ch * 255 > 0xffffffffLL;
+    void *table = malloc(entries * (wide ? sizeof(unsigned long long) : sizeof(unsigned int)) * (var ? 2 : 1));
+    if(!table) {
+        fprintf(stderr, "integral : out of memory\n");
+        return 0;
+    }
+    int ok;
+    if(wide) {
+        job.sat64 = table;
+        job.sq64 = var ? job.sat64 + entries : NULL;
+        ok = integral_build64(src, (unsigned long long *)job.sat64, (unsigned long long *)job.sq64, w, h);
+    } else {
+        job.sat32 = table;
+        ok = integral_build32(src, (unsigned int *)job.sat32, w, h);
+    }
+    if(ok)
+        pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, box_band, &job);
+    free(table);
+    return ok && job.ok;
+}
+
+int box_mean_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry)
+{
+    return box_filter(src, w, h, rx, ry, dst, NULL, NULL);
+}
+
+int box_mean_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int rx, int ry)
+{
+    size_t n = (size_t)w * h;
+    unsigned char *plane = malloc(2 * n);
+    if(!plane) {
+        fprintf(stderr, "integral : out of memory\n");
+        return 0;
+    }
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *out = (unsigned char *)dst, *mean = plane + n;
+    int ok = 1;
+    for(int c = 0; ok && c < 3; c++) {
+        for(size_t i = 0; i < n; i++)
+            plane[i] = in[3 * i + c];
+        ok = box_mean_tri(plane, mean, w, h, rx, ry);
+        for(size_t i = 0; ok && i < n; i++)
+            out[3 * i + c] = mean[i];
+    }
+    free(plane);
+    return ok;
+}
+
+int local_mean_tri(const unsigned char *src, float *mean, int w, int h, int rx, int ry)
+{
+    return box_filter(src, w, h, rx, ry, NULL, mean, NULL);
+}
+
+int local_variance_tri(const unsigned char *src, float *mean, float *var, int w, int h, int rx, int ry)
+{
+    return box_filter(src, w, h, rx, ry, NULL, mean, var);
+}
@@ -0,0 +1,24 @@
+#ifndef INTEGRAL_IMAGE
+#define INTEGRAL_IMAGE
+#include "bmp.h"
+
+// Summed-area tables of a planar w x h plane : (w + 1) x (h + 1) entries, row
+// stride w + 1, row 0 and column 0 are 0 and entry (x, y) is the sum of the
+// pixels left of x and above y, so any box sum is 4 lookups. The rows are
+// prefix summed 16 pixels per vector by bands on the pool, then strips of
+// columns add up downward, one strip per worker.
+// 32 bits : the table wraps past 16.8M pixels, a box sum is still right
+// modulo 2^32 as long as the box itself is smaller.
+int integral_build32(const unsigned char *src, unsigned int *sat, int w, int h);
+// 64 bits, sq gets the sums of the squared pixels (may be NULL)
+int integral_build64(const unsigned char *src, unsigned long long *sat, unsigned long long *sq, int w, int h);
+
+// Filters over the (2 * rx + 1) x (2 * ry + 1) window around every pixel,
+// clipped to the image, in constant time per pixel whatever its size.
+// rounded mean
+int box_mean_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry);
+int box_mean_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int rx, int ry);
+int local_mean_tri(const unsigned char *src, float *mean, int w, int h, int rx, int ry);
+// population variance, mean may be NULL
+int local_variance_tri(const unsigned char *src, float *mean, float *var, int w, int h, int rx, int ry);
+#endif // INTEGRAL_IMAGE
@@ -0,0 +1,587 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <immintrin.h>
+#include "lut.h"
+#include "pool.h"
+
+// rows handed to a pool worker at a time
+#define BAND_ROWS 32
+#define LUT3D_ONE (1 << LUT3D_WBITS)
+#define LUT3D_TOP (255 << LUT3D_BITS)
+
+typedef struct lut3d_job {
+    const LUT3D *lut;
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+} LUT3DJOB;
+
+typedef struct curve_job {
+    const CURVE *c;
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+} CURVEJOB;
+
+// corner and position inside the cell of every 8 bit value, the domain
+// [lo,hi] of the channel spread over the size - 1 cells ; the top value
+// lands on the far side of the last cell
+static void lut3d_index(LUT3D *lut, const double lo[3], const double hi[3])
+{
+    int n = lut->size;
+    lut->step[0] = 4 * n * n;
+    lut->step[1] = 4 * n;
+    lut->step[2] = 4;
+    for(int c = 0; c < 3; c++) {
+        for(int v = 0; v < 256; v++) {
+            double p = (v / 255.0 - lo[c]) / (hi[c] - lo[c]) * (n - 1);
+            int i, f;
+            p = p < 0 ? 0 : p > n - 1 ? n - 1 : p;
+            i = (int)p;
+            f = (int)((p - i) * LUT3D_ONE + 0.5);
+            if(f == LUT3D_ONE) {
+                i++;
+                f = 0;
+            }
+            if(i == n - 1) {
+                i--;
+                f = LUT3D_ONE;
+            }
+            lut->base[c][v] = i * lut->step[c];
+            lut->frac[c][v] = f;
+        }
+    }
+}
+
+int lut3d_alloc(LUT3D *lut, int size)
+{
+    const double lo[3] = {0, 0, 0}, hi[3] = {1, 1, 1};
+    if(size < 2 || size > LUT3D_MAX) {
+        fprintf(stderr, "lut : bad table size %d\n", size);
+        return 0;
+    }
+    lut->size = size;
+    lut->table = calloc((size_t)size * size * size, 4 * sizeof(unsigned short));
+    if(!lut->table) {
+        fprintf(stderr, "lut : out of memory\n");
+        return 0;
+    }
+    lut3d_index(lut, lo, hi);
+    return 1;
+}
+
+void lut3d_free(LUT3D *lut)
+{
+    free(lut->table);
+    lut->table = NULL;
+    lut->size = 0;
+}
+
+/*********************************************************/
+// one pixel : the fractions sorted give the tetrahedron,
+// its 4 corners are blended channel by channel with two
+// multiply-add, the 32 bits sums are in the 3 low lanes
+/*********************************************************/
+static inline __m128i tetrahedral(const LUT3D *lut, const unsigned char *p, __m128i round)
+{
+    int f0 = lut->frac[0][p[0]], f1 = lut->frac[1][p[1]], f2 = lut->frac[2][p[2]];
+    const unsigned short *c0 = lut->table + lut->base[0][p[0]] + lut->base[1][p[1]] + lut->base[2][p[2]];
+    const unsigned short *c1, *c2, *c3;
+    int fa, fb, fc;
+    if(f0 >= f1) {
+        if(f1 >= f2) {
+            c1 = c0 + lut->step[0], c2 = c1 + lut->step[1], c3 = c2 + lut->step[2];
+            fa = f0, fb = f1, fc = f2;
+        } else if(f0 >= f2) {
+            c1 = c0 + lut->step[0], c2 = c1 + lut->step[2], c3 = c2 + lut->step[1];
+            fa = f0, fb = f2, fc = f1;
+        } else {
+            c1 = c0 + lut->step[2], c2 = c1 + lut->step[0], c3 = c2 + lut->step[1];
+            fa = f2, fb = f0, fc = f1;
+        }
+    } else {
+        if(f0 >= f2) {
+            c1 = c0 + lut->step[1], c2 = c1 + lut->step[0], c3 = c2 + lut->step[2];
+            fa = f1, fb = f0, fc = f2;
+        } else if(f1 >= f2) {
+            c1 = c0 + lut->step[1], c2 = c1 + lut->step[2], c3 = c2 + lut->step[0];
+            fa = f1, fb = f2, fc = f0;
+        } else {
+            c1 = c0 + lut->step[2], c2 = c1 + lut->step[1], c3 = c2 + lut->step[0];
+            fa = f2, fb = f1, fc = f0;
+        }
+    }
+    __m128i w01 = _mm_set1_epi32((LUT3D_ONE - fa) | (fa - fb) << 16);
+    __m128i w23 = _mm_set1_epi32((fb - fc) | fc << 16);
+    __m128i lo = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)c0), _mm_loadl_epi64((const __m128i *)c1));
+    __m128i hi = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)c2), _mm_loadl_epi64((const __m128i *)c3));
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(lo, w01), _mm_madd_epi16(hi, w23));
+    return _mm_srai_epi32(_mm_add_epi32(sum, round), LUT3D_WBITS + LUT3D_BITS);
+}
+
+/****************************************************************************/
+void lut3d_apply_row(const LUT3D *lut, const unsigned char *src, unsigned char *dst, int n)
+{
+    const __m128i round = _mm_set1_epi32(1 << (LUT3D_WBITS + LUT3D_BITS - 1));
+    const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int i = 0;
+    // 4 pixels are read before any is written, so dst may be src
+    for(; i + 4 <= n; i += 4) {
+        const unsigned char *s = src + 3 * i;
+        __m128i p0 = tetrahedral(lut, s, round), p1 = tetrahedral(lut, s + 3, round);
+        __m128i p2 = tetrahedral(lut, s + 6, round), p3 = tetrahedral(lut, s + 9, round);
+        __m128i v = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+        v = _mm_shuffle_epi8(v, compact);
+        int tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+        _mm_storel_epi64((__m128i *)(dst + 3 * i), v);
+        memcpy(dst + 3 * i + 8, &tail, 4);
+    }
+    for(; i < n; i++) {
+        __m128i p = tetrahedral(lut, src + 3 * i, round);
+        int v = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(p, p), p));
+        memcpy(dst + 3 * i, &v, 3);
+    }
+}
+
+static void lut3d_band(void *arg, int item)
+{
+    const LUT3DJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h;
+    for(int y = item * BAND_ROWS; y < y1; y++) {
+        size_t row = (size_t)y * job->w * 3;
+        lut3d_apply_row(job->lut, job->src + row, job->dst + row, job->w);
+    }
+}
+
+int lut3d_apply(const LUT3D *lut, const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    LUT3DJOB job = {lut, src, dst, w, h};
+    if(!lut->table || w < 1 || h < 1) {
+        fprintf(stderr, "lut : nothing to apply on %d x %d\n", w, h);
+        return 0;
+    }
+    pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, lut3d_band, &job);
+    return 1;
+}
+
+int lut3d_apply_ori(const LUT3D *lut, const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h)
+{
+    return lut3d_apply(lut, (const unsigned char *)src, (unsigned char *)dst, w, h);
+}
+
+void naive_lut3d_ori(const LUT3D *lut, const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h)
+{
+    for(size_t i = 0; i < (size_t)w * h; i++) {
+        const unsigned char *p = (const unsigned char *)&src[i];
+        const unsigned short *c0 = lut->table + lut->base[0][p[0]] + lut->base[1][p[1]] + lut->base[2][p[2]];
+        double f[3], out[3] = {0, 0, 0};
+        int order[3] = {0, 1, 2};
+        for(int c = 0; c < 3; c++)
+            f[c] = (double)lut->frac[c][p[c]] / LUT3D_ONE;
+        // decreasing fractions, ties keep the channel order
+        for(int a = 0; a < 2; a++)
+            for(int b = 2; b > a; b--)
+                if(f[order[b]] > f[order[b - 1]]) {
+                    int t = order[b];
+                    order[b] = order[b - 1];
+                    order[b - 1] = t;
+                }
+        const unsigned short *corner = c0;
+        double prev = 1;
+        for(int k = 0; k <= 3; k++) {
+            double fk = k < 3 ? f[order[k]] : 0;
+            for(int c = 0; c < 3; c++)
+                out[c] += (prev - fk) * corner[c];
+            if(k < 3)
+                corner += lut->step[order[k]];
+            prev = fk;
+        }
+        unsigned char *q = (unsigned char *)&dst[i];
+        for(int c = 0; c < 3; c++)
+            q[c] = (unsigned char)(out[c] / (1 << LUT3D_BITS) + 0.5);
+    }
+}
+
+/****************************************************************************/
+int lut3d_bake(LUT3D *lut, int size, void (*fn)(RGBTRIPLE *grid, int n, void *arg), void *arg)
+{
+    int n = size * size * size;
+    RGBTRIPLE *grid;
+    if(!lut3d_alloc(lut, size))
+        return 0;
+    grid = malloc(sizeof(RGBTRIPLE) * n);
+    if(!grid) {
+        fprintf(stderr, "lut : out of memory\n");
+        lut3d_free(lut);
+        return 0;
+    }
+    for(int i = 0; i < n; i++) {
+        grid[i].rgbRed = (i % size * 255 + (size - 1) / 2) / (size - 1);
+        grid[i].rgbGreen = (i / size % size * 255 + (size - 1) / 2) / (size - 1);
+        grid[i].rgbBlue = (i / size / size * 255 + (size - 1) / 2) / (size - 1);
+    }
+    fn(grid, n, arg);
+    for(int i = 0; i < n; i++) {
+        lut->table[4 * i] = grid[i].rgbBlue << LUT3D_BITS;
+        lut->table[4 * i + 1] = grid[i].rgbGreen << LUT3D_BITS;
+        lut->table[4 * i + 2] = grid[i].rgbRed << LUT3D_BITS;
+    }
+    free(grid);
+    return 1;
+}
+
+int lut3d_swap_rb(const LUT3D *src, LUT3D *dst)
+{
+    size_t n = (size_t)src->size * src->size * src->size;
+    if(!lut3d_alloc(dst, src->size))
+        return 0;
+    for(size_t i = 0; i < n; i++) {
+        dst->table[4 * i] = src->table[4 * i + 2];
+        dst->table[4 * i + 1] = src->table[4 * i + 1];
+        dst->table[4 * i + 2] = src->table[4 * i];
+    }
+    for(int c = 0; c < 3; c++) {
+        dst->step[c] = src->step[2 - c];
+        memcpy(dst->base[c], src->base[2 - c], sizeof(dst->base[c]));
+        memcpy(dst->frac[c], src->frac[2 - c], sizeof(dst->frac[c]));
+    }
+    return 1;
+}
+
+/*********************************************************/
+// .cube reader : keywords first, then size^3 lines of
+// red green blue, red fastest
+/*********************************************************/
+int lut3d_load_cube(LUT3D *lut, const char *path)
+{
+    // domains in blue, green, red order like the pixels
+    double lo[3] = {0, 0, 0}, hi[3] = {1, 1, 1};
+    char line[512];
+    int size, count = 0, total = 0, lineno = 0, ok = 1;
+    FILE *fp = fopen(path, "r");
+    lut->table = NULL;
+    if(!fp) {
+        fprintf(stderr, "lut : cannot open %s\n", path);
+        return 0;
+    }
+    while(ok && fgets(line, sizeof(line), fp)) {
+        char *p = line, *end;
+        double v[3];
+        int got = 0;
+        lineno++;
+        while(*p == ' ' || *p == '\t')
+            p++;
+        if(strncmp(p, "LUT_3D_SIZE", 11) == 0) {
+            size = atoi(p + 11);
+            if(lut->table || size < 2 || size > LUT3D_MAX) {
+                fprintf(stderr, "lut : %s:%d : bad LUT_3D_SIZE\n", path, lineno);
+                ok = 0;
+            } else {
+                ok = lut3d_alloc(lut, size);
+                total = size * size * size;
+            }
+        } else if(strncmp(p, "LUT_1D_SIZE", 11) == 0) {
+            fprintf(stderr, "lut : %s : 1D tables are not supported\n", path);
+            ok = 0;
+        } else if(strncmp(p, "DOMAIN_MIN", 10) == 0 || strncmp(p, "DOMAIN_MAX", 10) == 0) {
+            double *d = p[8] == 'I' ? lo : hi;
+            p += 10;
+            for(int c = 2; c >= 0; c--) {
+                d[c] = strtod(p, &end);
+                p = end;
+            }
+        } else if(strncmp(p, "LUT_3D_INPUT_RANGE", 18) == 0) {
+            lo[0] = lo[1] = lo[2] = strtod(p + 18, &end);
+            hi[0] = hi[1] = hi[2] = strtod(end, &end);
+        } else if((*p >= 'A' && *p <= 'Z') || *p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            // TITLE, comments and keywords of other tools
+            continue;
+        } else {
+            for(got = 0; got < 3; got++, p = end) {
+                v[got] = strtod(p, &end);
+                if(end == p)
+                    break;
+            }
+            if(got < 3 || !lut->table || count == total) {
+                fprintf(stderr, "lut : %s:%d : unexpected line\n", path, lineno);
+                ok = 0;
+                break;
+            }
+            // file order red, green, blue to the blue, green, red entries
+            for(int c = 0; c < 3; c++) {
+                double x = v[2 - c] * LUT3D_TOP + 0.5;
+                lut->table[4 * count + c] = x < 0 ? 0 : x > LUT3D_TOP ? LUT3D_TOP : (int)x;
+            }
+            count++;
+        }
+    }
+    fclose(fp);
+    if(ok && (!lut->table || count != total)) {
+        fprintf(stderr, "lut : %s : %d entries of %d\n", path, count, total);
+        ok = 0;
+    }
+    for(int c = 0; ok && c < 3; c++) {
+        if(hi[c] <= lo[c]) {
+            fprintf(stderr, "lut : %s : empty domain\n", path);
+            ok = 0;
+        }
+    }
+    if(!ok) {
+        lut3d_free(lut);
+        return 0;
+    }
+    lut3d_index(lut, lo, hi);
+    return 1;
+}
+
+typedef struct lut_cache {
+    char *path;
+    LUT3D lut;
+    int users; // chains holding the table, it is not evicted before 0
+    struct lut_cache *next;
+} LUTCACHE;
+
+// most recently used first
+static LUTCACHE *cache;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// drop the least recently used unused tables beyond LUT3D_CACHED_MAX,
+// cache_lock held
+static void cache_trim(void)
+{
+    int kept = 0;
+    for(LUTCACHE **p = &cache; *p;) {
+        LUTCACHE *e = *p;
+        if(++kept > LUT3D_CACHED_MAX && e->users == 0) {
+            *p = e->next;
+            lut3d_free(&e->lut);
+            free(e->path);
+            free(e);
+            kept--;
+        } else {
+            p = &e->next;
+        }
+    }
+}
+
+const LUT3D *lut3d_cached(const char *path)
+{
+    LUTCACHE *e, **p;
+    pthread_mutex_lock(&cache_lock);
+    for(p = &cache; *p; p = &(*p)->next) {
+        if(strcmp((*p)->path, path) == 0)
+            break;
+    }
+    e = *p;
+    if(e) {
+        *p = e->next;
+    } else {
+        e = calloc(1, sizeof(LUTCACHE));
+        if(!e || !(e->path = strdup(path)) || !lut3d_load_cube(&e->lut, path)) {
+            if(e)
+                free(e->path);
+            free(e);
+            e = NULL;
+        }
+    }
+    if(e) {
+        e->users++;
+        e->next = cache;
+        cache = e;
+        cache_trim();
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return e ? &e->lut : NULL;
+}
+
+void lut3d_release(const LUT3D *lut)
+{
+    pthread_mutex_lock(&cache_lock);
+    for(LUTCACHE *e = cache; e; e = e->next) {
+        if(&e->lut == lut) {
+            e->users--;
+            break;
+        }
+    }
+    cache_trim();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/****************************************************************************/
+// x^p for x in [0,1] without libm : ln through the atanh series once x is
+// brought to [0.5,1], exp through the Taylor series on (-ln 2, 0]
+#define LN2 0.69314718055994530942
+static double pow_unit(double x, double p)
+{
+    double z, z2, term, ln = 0, e = 1;
+    int k = 0, n;
+    if(x <= 0)
+        return p > 0 ? 0 : 1;
+    while(x < 0.5) {
+        x *= 2;
+        k++;
+    }
+    z = (x - 1) / (x + 1);
+    z2 = z * z;
+    term = z;
+    for(int i = 1; i < 40; i += 2) {
+        ln += term / i;
+        term *= z2;
+    }
+    ln = p * (2 * ln - k * LN2);
+    if(ln >= 0)
+        return 1;
+    n = (int)(-ln / LN2);
+    ln += n * LN2;
+    term = 1;
+    for(int i = 1; i < 20; i++) {
+        term *= ln / i;
+        e += term;
+    }
+    while(n-- > 0)
+        e *= 0.5;
+    return e;
+}
+
+static unsigned char clamp_byte(double v)
+{
+    return v <= 0 ? 0 : v >= 255 ? 255 : (unsigned char)(v + 0.5);
+}
+
+static void curve_fill(CURVE *c)
+{
+    memcpy(c->map[1], c->map[0], 256);
+    memcpy(c->map[2], c->map[0], 256);
+}
+
+void curve_identity(CURVE *c)
+{
+    for(int v = 0; v < 256; v++)
+        c->map[0][v] = v;
+    curve_fill(c);
+}
+
+void curve_levels(CURVE *c, float black, float white, float gamma)
+{
+    double range = white > black ? white - black : 1;
+    double inv = gamma > 0 ? 1.0 / gamma : 1;
+    for(int v = 0; v < 256; v++) {
+        double x = (v - black) / range;
+        x = x < 0 ? 0 : x > 1 ? 1 : x;
+        c->map[0][v] = clamp_byte(255 * pow_unit(x, inv));
+    }
+    curve_fill(c);
+}
+
+void curve_gamma(CURVE *c, float gamma)
+{
+    curve_levels(c, 0, 255, gamma);
+}
+
+void curve_contrast(CURVE *c, float factor)
+{
+    for(int v = 0; v < 256; v++)
+        c->map[0][v] = clamp_byte((v - 127.5) * factor + 127.5);
+    curve_fill(c);
+}
+
+void curve_scale(CURVE *c, float factor)
+{
+    for(int v = 0; v < 256; v++) {
+        float x = v * factor;
+        c->map[0][v] = x > 255 ? 255 : x < 0 ? 0 : (unsigned char)x;
+    }
+    curve_fill(c);
+}
+
+void curve_then(CURVE *c, const CURVE *next)
+{
+    for(int ch = 0; ch < 3; ch++)
+        for(int v = 0; v < 256; v++)
+            c->map[ch][v] = next->map[ch][c->map[ch][v]];
+}
+
+void curve_apply_row(const CURVE *c, const unsigned char *src, unsigned char *dst, int n, int cstep)
+{
+    if(cstep == 1) {
+        for(int i = 0; i < n; i++)
+            dst[i] = c->map[0][src[i]];
+        return;
+    }
+    for(int i = 0; i < 3 * n; i += 3) {
+        dst[i] = c->map[0][src[i]];
+        dst[i + 1] = c->map[1][src[i + 1]];
+        dst[i + 2] = c->map[2][src[i + 2]];
+    }
+}
+
+static void curve_band(void *arg, int item)
+{
+    const CURVEJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h;
+    size_t i0 = (size_t)item * BAND_ROWS * job->w * job->cstep;
+    curve_apply_row(job->c, job->src + i0, job->dst + i0, (y1 - item * BAND_ROWS) * job->w, job->cstep);
+}
+
+int curve_apply(const CURVE *c, const unsigned char *src, unsigned char *dst, int w, int h, int cstep)
+{
+    CURVEJOB job = {c, src, dst, w, h, cstep};
+    if(w < 1 || h < 1 || (cstep != 1 && cstep != 3)) {
+        fprintf(stderr, "lut : bad size %d x %d\n", w, h);
+        return 0;
+    }
+    pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, curve_band, &job);
+    return 1;
+}
+
+int curve_apply_ori(const CURVE *c, const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h)
+{
+    return curve_apply(c, (const unsigned char *)src, (unsigned char *)dst, w, h, 3);
+}
+
+/****************************************************************************/
+// sRGB transfer tables : the linear table gives the nearest level, every
+// output entry the code of the middle of the linear levels it covers
+#define LINEAR_TOP ((1 << SRGB_LINEAR_BITS) - 1)
+#define LINEAR_DROP (SRGB_LINEAR_BITS - SRGB_OUT_BITS)
+static unsigned short srgb_linear[256];
+static unsigned char linear_srgb[1 << SRGB_OUT_BITS];
+static pthread_once_t srgb_once = PTHREAD_ONCE_INIT;
+
+static void srgb_build(void)
+{
+    for(int v = 0; v < 256; v++) {
+        double x = v / 255.0;
+        x = x <= 0.04045 ? x / 12.92 : pow_unit((x + 0.055) / 1.055, 2.4);
+        srgb_linear[v] = (unsigned short)(x * LINEAR_TOP + 0.5);
+    }
+    for(int i = 0; i < 1 << SRGB_OUT_BITS; i++) {
+        double x = ((i << LINEAR_DROP) + ((1 << LINEAR_DROP) - 1) / 2.0) / LINEAR_TOP;
+        x = x <= 0.0031308 ? x * 12.92 : 1.055 * pow_unit(x, 1 / 2.4) - 0.055;
+        linear_srgb[i] = clamp_byte(x * 255);
+    }
+}
+
+const unsigned short *srgb_linear_table(void)
+{
+    pthread_once(&srgb_once, srgb_build);
+    return srgb_linear;
+}
+
+const unsigned char *linear_srgb_table(void)
+{
+    pthread_once(&srgb_once, srgb_build);
+    return linear_srgb;
+}
+
+void srgb_to_linear_row(const unsigned char *src, unsigned short *dst, int n)
+{
+    const unsigned short *lin = srgb_linear_table();
+    for(int i = 0; i < n; i++)
+        dst[i] = lin[src[i]];
+}
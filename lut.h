@@ -0,0 +1,88 @@
+#ifndef COLOR_LUT
+#define COLOR_LUT
+#include "bmp.h"
+
+// largest 3D table edge, .cube files come in 17, 33 and 65
+#define LUT3D_MAX 65
+// .cube files kept loaded by lut3d_cached once no chain uses them
+#define LUT3D_CACHED_MAX 8
+// edge of the baked tables : 255 / 51, every grid point is an 8 bit value so
+// the baked adjustment is exact on them
+#define LUT3D_BAKE 52
+// fractional bits of the table entries, 255 << 7 still fits the signed
+// 16 bits of the multiply-add
+#define LUT3D_BITS 7
+// bits of the tetrahedral weights, they sum to 1 << LUT3D_WBITS
+#define LUT3D_WBITS 14
+
+// 3D colour table : size^3 entries of 4 shorts (blue, green, red, 0) in
+// LUT3D_BITS fixed point, red fastest as in the .cube files. The per value
+// tables give the corner below every 8 bit input (as an offset in shorts)
+// and the position inside the cell, per channel of the pixels.
+typedef struct lut3d {
+    int size;
+    unsigned short *table;
+    int step[3]; // shorts between neighbouring entries along each channel
+    int base[3][256];
+    unsigned short frac[3][256];
+} LUT3D;
+
+// Tetrahedral interpolation of w x h pixels of 3 bytes (blue, green, red) :
+// the cell of every pixel is split into 6 tetrahedra along its diagonal,
+// the 4 corners of the one holding the pixel are blended with 2 multiply-add
+// per pixel, bands of rows on the pool. dst may be src.
+int lut3d_apply(const LUT3D *lut, const unsigned char *src, unsigned char *dst, int w, int h);
+int lut3d_apply_ori(const LUT3D *lut, const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h);
+void lut3d_apply_row(const LUT3D *lut, const unsigned char *src, unsigned char *dst, int n);
+// same interpolation per pixel in doubles
+void naive_lut3d_ori(const LUT3D *lut, const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h);
+
+// Tables. lut3d_load_cube reads an Adobe / Resolve .cube file (LUT_3D_SIZE,
+// DOMAIN_MIN / DOMAIN_MAX, then the red fastest entries, outputs clamped to
+// [0,1]). lut3d_cached keeps the loaded files, so that batch and daemon
+// requests parse a file only once ; an edited file is not reloaded. Every
+// table it returns is handed back with lut3d_release, and only the
+// LUT3D_CACHED_MAX most recently used ones stay once released. lut3d_bake samples fn on every grid point : fn gets the
+// size^3 grid pixels (red fastest) and changes them in place. lut3d_swap_rb
+// turns a table for blue, green, red pixels into one for red, green, blue.
+int lut3d_alloc(LUT3D *lut, int size);
+void lut3d_free(LUT3D *lut);
+int lut3d_load_cube(LUT3D *lut, const char *path);
+const LUT3D *lut3d_cached(const char *path);
+void lut3d_release(const LUT3D *lut);
+int lut3d_bake(LUT3D *lut, int size, void (*fn)(RGBTRIPLE *grid, int n, void *arg), void *arg);
+int lut3d_swap_rb(const LUT3D *src, LUT3D *dst);
+
+// 256 entries per channel (blue, green, red ; only the first on planar
+// pixels) for curves. The builders write the same curve on every channel,
+// curve_then appends next after c. Lookups stay scalar : at SSE width a
+// 256 entries pshufb lookup needs 16 shuffles and 16 compares per 16 bytes
+// and loses to 4 plain loads per pixel.
+typedef struct curve {
+    unsigned char map[3][256];
+} CURVE;
+
+void curve_identity(CURVE *c);
+// out = 255 ((in - black) / (white - black))^(1 / gamma), clamped
+void curve_levels(CURVE *c, float black, float white, float gamma);
+void curve_gamma(CURVE *c, float gamma);
+// out = (in - 127.5) * factor + 127.5
+void curve_contrast(CURVE *c, float factor);
+// out = in * factor, truncated
+void curve_scale(CURVE *c, float factor);
+void curve_then(CURVE *c, const CURVE *next);
+// w x h pixels of cstep bytes (1 or 3), dst may be src
+int curve_apply(const CURVE *c, const unsigned char *src, unsigned char *dst, int w, int h, int cstep);
+int curve_apply_ori(const CURVE *c, const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h);
+void curve_apply_row(const CURVE *c, const unsigned char *src, unsigned char *dst, int n, int cstep);
+
+// sRGB transfer. 8 bit codes go to linear light on SRGB_LINEAR_BITS bits,
+// which leaves one bit of headroom for the sum of two 16 bits lanes, and
+// come back from its top 12 bits through a 4096 entries table, both built
+// once. Every code survives the round trip.
+#define SRGB_LINEAR_BITS 14
+#define SRGB_OUT_BITS 12
+const unsigned short *srgb_linear_table(void);
+const unsigned char *linear_srgb_table(void);
+void srgb_to_linear_row(const unsigned char *src, unsigned short *dst, int n);
+#endif // COLOR_LUT
@@ -2,10 +2,23 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 #include "gaussian.h"
 #include "bmp.h"
 #include "mirror.h"
 #include "hsv.h"
+#include "image.h"
+#include "batch.h"
+#include "server.h"
+#include "stream.h"
+#include "median.h"
+#include "histogram.h"
+#include "warp.h"
+#include "lut.h"
+#include "hdr.h"
+#include "ycbcr.h"
+#include "qoi.h"
+#include "tile.h"
 #define FILTER(a,b) a&b
 //  Global variables declaration：                                             */
 //  bmpHeader    ： BMP's header part
@@ -22,6 +35,8 @@ unsigned char *color_b;
 // Function declaration：
 //  readBMP    ： read the source bmp data , and store data into BMPSaveData
 //  saveBMP    ： write the BMPSaveData into output file , which is also .bmp
+//                (both go through qoi.c for a .qoi name)
+//  readQOI    ： readBMP for a QOI file
 //  fetchloc   :  get the element which is on (X,Y)
 //  swap       ： swap 2 data pointer (BMPSaveData and BMPData)
 //  **alloc_memory： dynamically allocate the 1D array data (sim. 2D)
@@ -29,27 +44,48 @@ unsigned char *color_b;
 //  diff_in_millisecond : calculate the time of execution
 int readBMP( char *fileName);
 int saveBMP( char *fileName);
+int readQOI( char *fileName);
 RGBTRIPLE fetchloc(RGBTRIPLE *arr, int Y, int X);
 RGBTRIPLE *alloc_memory( int Y, int X );
 void swap(RGBTRIPLE **a, RGBTRIPLE **b);
 void split_structure();
 void merge_structure();
 static double diff_in_millisecond(struct timespec t1, struct timespec t2);
-// Gaussian - header , fixing lots of warning
-void unroll_gaussian_blur_5_tri(unsigned char *src,int w,int h);
-void unroll_gaussian_blur_5_ori(RGBTRIPLE *src,int w,int h);
-void unroll_gaussian_1D_tri(RGBTRIPLE *src,int w,int h);
-void naive_gaussian_blur_5(unsigned char *src,int w,int h);
-void naive_gaussian_blur_5_original(RGBTRIPLE *src,int w,int h);
-void sse_gaussian_blur_5_tri(unsigned char *src,int w,int h);
-void sse_gaussian_blur_5_ori(RGBTRIPLE *src,int w,int h);
-void sse_gaussian_blur_5_prefetch_ori(RGBTRIPLE *src,int w,int h);
-void pt_gaussian_blur_5_tri(unsigned char *src,int num_threads,int w,int h);
-void pt_sse_gaussian_blur_5_ori(RGBTRIPLE *src,int num_threads,int w,int h);
-void naive_gaussian_blur_5_expand(unsigned char *src,int w,int h);
+int batch_mode(int argc, char *argv[]);
+int stats_mode(int argc, char *argv[]);
+int hdr_mode(int argc, char *argv[]);
+int tile_mode(int argc, char *argv[]);
+#if FILTER(HDR,1)
+static void hsv_reference(const RGBTRIPLE *src, RGBTRIPLE *dst, int n, double k, int saturation);
+#endif
 
 int main(int argc,char *argv[])
 {
+#ifndef ARM
+    if(argc >= 4 && strcmp(argv[1], "--batch") == 0)
+        return batch_mode(argc, argv);
+    // pipe mode : bmpreader --pipe <ops> < frames > frames
+    if(argc >= 3 && strcmp(argv[1], "--pipe") == 0) {
+        OPCHAIN chain;
+        if(!ops_parse(&chain, argv[2]))
+            return 1;
+        int ok = stream_run(STDIN_FILENO, STDOUT_FILENO, &chain);
+        ops_release(&chain);
+        return ok ? 0 : 1;
+    }
+    // daemon mode : bmpreader --serve <socket> [threads]
+    if(argc >= 3 && strcmp(argv[1], "--serve") == 0)
+        return server_run(argv[2], argc > 3 ? atoi(argv[3]) : 4) ? 0 : 1;
+    // statistics : bmpreader --stats [--hist] <bmp> [...]
+    if(argc >= 3 && strcmp(argv[1], "--stats") == 0)
+        return stats_mode(argc, argv);
+    // 16 bits images : bmpreader --hdr <ops> <input> <output>
+    if(argc >= 5 && strcmp(argv[1], "--hdr") == 0)
+        return hdr_mode(argc, argv);
+    // tiled container : bmpreader --tile <pack|unpack|roi|blur|fliph|flipv> <input> <output> [...]
+    if(argc >= 5 && strcmp(argv[1], "--tile") == 0)
+        return tile_mode(argc, argv);
+#endif
     char *infileName = argv[1];
     char *outfileName = argv[2];
     int execution_times = atoi(argv[3]),threadcount;
@@ -65,6 +101,14 @@ int main(int argc,char *argv[])
 #endif
     } else
         printf("Read file failed\n");
+#if FILTER(GAUSSIAN,1) || FILTER(GAUSSIAN,2) || FILTER(GAUSSIAN,64) || FILTER(MIRROR,1)
+    // these SSE kernels take rows of a multiple of 4 pixels, as readBMP
+    // makes them ; a QOI input keeps its own width
+    if(bmpInfo.biWidth % 4 != 0) {
+        printf("This benchmark needs a width multiple of 4\n");
+        return 1;
+    }
+#endif
 
 // =================== Main Operation to BMP data ===================== //
 #ifdef TEST
@@ -257,6 +301,36 @@ int main(int argc,char *argv[])
 #else
     printf("Gaussian blur[5x5][original structure], execution time : %f ms , with %d times Gaussian blur\n",cpu_time,execution_times);
 #endif
+#endif
+#if FILTER(GAUSSIAN,2048) // sse output vectorized original
+    clock_gettime(CLOCK_REALTIME, &start);
+    for(int i=0; i<execution_times; i++)
+        sse_gaussian_blur_5_vec_ori(BMPSaveData,bmpInfo.biWidth,bmpInfo.biHeight);
+    clock_gettime(CLOCK_REALTIME, &end);
+    cpu_time = diff_in_millisecond(start, end);
+#ifdef PERF
+    printf("%f ",cpu_time);
+#else
+    printf("Gaussian blur[5x5][vectorized sse original structure], execution time : %f ms , with %d times Gaussian blur\n",cpu_time,execution_times);
+#endif
+#endif
+#if FILTER(GAUSSIAN,4096) // sse output vectorized original, linear light, pthread
+    {
+        RGBTRIPLE *blurred = alloc_memory(bmpInfo.biHeight,bmpInfo.biWidth);
+        clock_gettime(CLOCK_REALTIME, &start);
+        for(int i=0; i<execution_times; i++) {
+            pt_sse_gaussian_blur_5_linear_ori_r(BMPSaveData,blurred,threadcount,bmpInfo.biWidth,bmpInfo.biHeight);
+            memcpy(BMPSaveData,blurred,bmpInfo.biWidth*bmpInfo.biHeight*sizeof(RGBTRIPLE));
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        cpu_time = diff_in_millisecond(start, end);
+        free(blurred);
+    }
+#ifdef PERF
+    printf("%f ",cpu_time);
+#else
+    printf("Gaussian blur[5x5][vectorized sse pthread original structure, linear light], execution time : %f ms , with %d times Gaussian blur\n",cpu_time,execution_times);
+#endif
 #endif
     printf("\n");
 
@@ -287,6 +361,21 @@ int main(int argc,char *argv[])
     cpu_time = diff_in_millisecond(start, end);
     printf("flip vertical ori, execution time : %f ms\n", cpu_time);
     clock_gettime(CLOCK_REALTIME, &start);
+    sse_flip_vertical_ori(BMPSaveData,bmpInfo.biWidth,bmpInfo.biHeight);
+    clock_gettime(CLOCK_REALTIME, &end);
+    cpu_time = diff_in_millisecond(start, end);
+    printf("sse flip vertical ori, execution time : %f ms\n", cpu_time);
+    clock_gettime(CLOCK_REALTIME, &start);
+    avx_flip_vertical_ori(BMPSaveData,bmpInfo.biWidth,bmpInfo.biHeight);
+    clock_gettime(CLOCK_REALTIME, &end);
+    cpu_time = diff_in_millisecond(start, end);
+    printf("avx flip vertical ori, execution time : %f ms\n", cpu_time);
+    clock_gettime(CLOCK_REALTIME, &start);
+    omp_flip_vertical_ori(BMPSaveData,bmpInfo.biWidth,bmpInfo.biHeight);
+    clock_gettime(CLOCK_REALTIME, &end);
+    cpu_time = diff_in_millisecond(start, end);
+    printf("omp flip vertical ori, execution time : %f ms\n", cpu_time);
+    clock_gettime(CLOCK_REALTIME, &start);
     naive_flip_vertical_tri(color_r,bmpInfo.biWidth,bmpInfo.biHeight);
     naive_flip_vertical_tri(color_g,bmpInfo.biWidth,bmpInfo.biHeight);
     naive_flip_vertical_tri(color_b,bmpInfo.biWidth,bmpInfo.biHeight);
@@ -313,6 +402,21 @@ int main(int argc,char *argv[])
     cpu_time = diff_in_millisecond(start, end);
     printf("naive flip horizontal ori, execution time : %f ms\n", cpu_time);
     clock_gettime(CLOCK_REALTIME, &start);
+    sse_flip_horizontal_ori(BMPSaveData,bmpInfo.biWidth,bmpInfo.biHeight);
+    clock_gettime(CLOCK_REALTIME, &end);
+    cpu_time = diff_in_millisecond(start, end);
+    printf("sse flip horizontal ori, execution time : %f ms\n", cpu_time);
+    clock_gettime(CLOCK_REALTIME, &start);
+    avx_flip_horizontal_ori(BMPSaveData,bmpInfo.biWidth,bmpInfo.biHeight);
+    clock_gettime(CLOCK_REALTIME, &end);
+    cpu_time = diff_in_millisecond(start, end);
+    printf("avx flip horizontal ori, execution time : %f ms\n", cpu_time);
+    clock_gettime(CLOCK_REALTIME, &start);
+    omp_flip_horizontal_ori(BMPSaveData,bmpInfo.biWidth,bmpInfo.biHeight);
+    clock_gettime(CLOCK_REALTIME, &end);
+    cpu_time = diff_in_millisecond(start, end);
+    printf("omp flip horizontal ori, execution time : %f ms\n", cpu_time);
+    clock_gettime(CLOCK_REALTIME, &start);
     naive_flip_horizontal_tri(color_r,bmpInfo.biWidth,bmpInfo.biHeight);
     naive_flip_horizontal_tri(color_g,bmpInfo.biWidth,bmpInfo.biHeight);
     naive_flip_horizontal_tri(color_b,bmpInfo.biWidth,bmpInfo.biHeight);
@@ -333,12 +437,107 @@ int main(int argc,char *argv[])
     clock_gettime(CLOCK_REALTIME, &end);
     cpu_time = diff_in_millisecond(start, end);
     printf("omp flip horizontal tri using, execution time : %f ms\n", cpu_time);
+    // rotations are out of place : compare with copying the image once
+    {
+        int w = bmpInfo.biWidth, h = bmpInfo.biHeight;
+        double bytes = 2.0 * w * h * sizeof(RGBTRIPLE);
+        RGBTRIPLE *rotated = alloc_memory(h, w);
+        unsigned char *rotated_r = (unsigned char*)malloc(w*h*sizeof(unsigned char));
+        clock_gettime(CLOCK_REALTIME, &start);
+        memcpy(rotated, BMPSaveData, w*h*sizeof(RGBTRIPLE));
+        clock_gettime(CLOCK_REALTIME, &end);
+        cpu_time = diff_in_millisecond(start, end);
+        printf("memcpy ori, execution time : %f ms , %.2f GB/s\n", cpu_time, bytes / cpu_time / 1e6);
+        clock_gettime(CLOCK_REALTIME, &start);
+        naive_rotate_ori(BMPSaveData, rotated, w, h, 90);
+        clock_gettime(CLOCK_REALTIME, &end);
+        cpu_time = diff_in_millisecond(start, end);
+        printf("naive rotate 90 ori, execution time : %f ms , %.2f GB/s\n", cpu_time, bytes / cpu_time / 1e6);
+        for(int degrees = 90; degrees <= 270; degrees += 90) {
+            clock_gettime(CLOCK_REALTIME, &start);
+            sse_rotate_ori(BMPSaveData, rotated, w, h, degrees);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("sse rotate %d ori, execution time : %f ms , %.2f GB/s\n", degrees, cpu_time, bytes / cpu_time / 1e6);
+            clock_gettime(CLOCK_REALTIME, &start);
+            omp_rotate_ori(BMPSaveData, rotated, w, h, degrees);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("omp rotate %d ori, execution time : %f ms , %.2f GB/s\n", degrees, cpu_time, bytes / cpu_time / 1e6);
+        }
+        clock_gettime(CLOCK_REALTIME, &start);
+        omp_transpose_ori(BMPSaveData, rotated, w, h);
+        clock_gettime(CLOCK_REALTIME, &end);
+        cpu_time = diff_in_millisecond(start, end);
+        printf("omp transpose ori, execution time : %f ms , %.2f GB/s\n", cpu_time, bytes / cpu_time / 1e6);
+        bytes = 2.0 * w * h;
+        clock_gettime(CLOCK_REALTIME, &start);
+        naive_transpose_tri(color_r, rotated_r, w, h);
+        clock_gettime(CLOCK_REALTIME, &end);
+        cpu_time = diff_in_millisecond(start, end);
+        printf("naive transpose tri, execution time : %f ms , %.2f GB/s\n", cpu_time, bytes / cpu_time / 1e6);
+        clock_gettime(CLOCK_REALTIME, &start);
+        sse_transpose_tri(color_r, rotated_r, w, h);
+        clock_gettime(CLOCK_REALTIME, &end);
+        cpu_time = diff_in_millisecond(start, end);
+        printf("sse transpose tri, execution time : %f ms , %.2f GB/s\n", cpu_time, bytes / cpu_time / 1e6);
+        clock_gettime(CLOCK_REALTIME, &start);
+        omp_rotate_tri(color_r, rotated_r, w, h, 90);
+        clock_gettime(CLOCK_REALTIME, &end);
+        cpu_time = diff_in_millisecond(start, end);
+        printf("omp rotate 90 tri, execution time : %f ms , %.2f GB/s\n", cpu_time, bytes / cpu_time / 1e6);
+        free(rotated);
+        free(rotated_r);
+    }
 #endif
     merge_structure();
     free(color_r);
     free(color_b);
     free(color_g);
 #endif
+#if FILTER(ORIENT,1)
+    // save flipped and transposed views whose rows need no padding, reload
+    // them and compare with the pixels moved by hand
+    {
+        int w = bmpInfo.biWidth, h = bmpInfo.biHeight & ~3;
+        const int ops[3] = {ORIENT_FLIP_H, ORIENT_FLIP_V, ORIENT_TRANSPOSE};
+        const char *names[3] = {"flip horizontal", "flip vertical", "transpose"};
+        char orientName[512];
+        snprintf(orientName, sizeof(orientName), "%s.orient.bmp", outfileName);
+        for(int k = 0; k < 3; k++) {
+            IMAGE src = {bmpHeader, bmpInfo, BMPSaveData, 0, 0};
+            IMAGE back = {0};
+            int bad = 0;
+            src.info.biHeight = h;
+            image_orient(&src, ops[k]);
+            clock_gettime(CLOCK_REALTIME, &start);
+            if(!bmp_save(&src, orientName)) {
+                printf("orient %s: save failed\n", names[k]);
+                continue;
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            if(!bmp_load(&back, orientName)) {
+                printf("orient %s: load failed\n", names[k]);
+                image_release(&back);
+                continue;
+            }
+            int vw = IMAGE_WIDTH(&back), vh = IMAGE_HEIGHT(&back);
+            for(int y = 0; y < vh && !bad; y++)
+                for(int x = 0; x < vw && !bad; x++) {
+                    int sx = x, sy = y;
+                    if(ops[k] == ORIENT_FLIP_H) sx = w - 1 - x;
+                    if(ops[k] == ORIENT_FLIP_V) sy = h - 1 - y;
+                    if(ops[k] == ORIENT_TRANSPOSE) { sx = y; sy = x; }
+                    bad = memcmp(&back.data[y * vw + x],
+                                 &BMPSaveData[sy * w + sx], sizeof(RGBTRIPLE)) != 0;
+                }
+            printf("orient %s %dx%d: save, execution time : %f ms, %s\n", names[k], vw, vh, cpu_time, bad ? "mismatch" : "ok");
+            image_release(&back);
+        }
+        remove(orientName);
+    }
+#endif
 #if FILTER(HSV,1)
     clock_gettime(CLOCK_REALTIME, &start);
     change_brightness(BMPSaveData, 1, bmpInfo.biWidth,bmpInfo.biHeight);
@@ -350,6 +549,440 @@ int main(int argc,char *argv[])
     clock_gettime(CLOCK_REALTIME, &end);
     cpu_time = diff_in_millisecond(start, end);
     printf("change saturation: %f ms\n", cpu_time);
+#endif
+#if FILTER(MEDIAN,1)
+    {
+        // the histogram filter should stay flat while the naive one grows with radius^2
+        static const int radius[] = {1, 2, 3, 5, 8, 12, 16, 20, 32, 64};
+        int w = bmpInfo.biWidth, h = bmpInfo.biHeight;
+        RGBTRIPLE *filtered = alloc_memory(h, w);
+        for(size_t i = 0; i < sizeof(radius) / sizeof(radius[0]); i++) {
+            if(radius[i] <= 5) {
+                clock_gettime(CLOCK_REALTIME, &start);
+                naive_median_ori(BMPSaveData, filtered, w, h, radius[i]);
+                clock_gettime(CLOCK_REALTIME, &end);
+                cpu_time = diff_in_millisecond(start, end);
+                printf("naive median radius %d, execution time : %f ms\n", radius[i], cpu_time);
+            }
+            clock_gettime(CLOCK_REALTIME, &start);
+            median_ori(BMPSaveData, filtered, w, h, radius[i]);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("median radius %d, execution time : %f ms\n", radius[i], cpu_time);
+        }
+        free(filtered);
+    }
+#endif
+#if FILTER(WARP,1)
+    {
+        // the vector paths against the per pixel reference : the fixed point
+        // steps may move each coordinate by one weight step, never more
+        int w = bmpInfo.biWidth, h = bmpInfo.biHeight;
+        RGBTRIPLE *warped = alloc_memory(h, w), *reference = alloc_memory(h, w);
+        unsigned char *plane = (unsigned char*)malloc(2*w*h*sizeof(unsigned char));
+        const double quad[8] = {0.05*w, 0.02*h, 0.97*w, 0.08*h, w-1, 0.95*h, 0.01*w, h-1};
+        double m[9];
+        for(int i = 0; i < w*h; i++)
+            plane[i] = BMPSaveData[i].rgbGreen;
+        for(int test = 0; test < 4; test++) {
+            const char *name[] = {"rotate 7.5 ori", "rotate 30 tri", "perspective ori", "perspective tri"};
+            int cstep = test % 2 ? 1 : 3, worst = 0, over = 0;
+            const unsigned char *in = cstep == 3 ? (unsigned char*)BMPSaveData : plane;
+            unsigned char *out = cstep == 3 ? (unsigned char*)warped : plane + w*h;
+            if(test < 2)
+                warp_rotation(m, w, h, w, h, test ? 30 : 7.5);
+            else
+                warp_quad(m, w, h, quad);
+            clock_gettime(CLOCK_REALTIME, &start);
+            naive_warp(in, (unsigned char*)reference, w, h, w, h, cstep, m, 255);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("naive warp %s, execution time : %f ms , %.1f Mpixel/s\n", name[test], cpu_time, w * h / cpu_time / 1e3);
+            clock_gettime(CLOCK_REALTIME, &start);
+            warp_image(in, out, w, h, w, h, cstep, m, 255);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("sse warp %s, execution time : %f ms , %.1f Mpixel/s\n", name[test], cpu_time, w * h / cpu_time / 1e3);
+            for(int i = 0; i < w*h*cstep; i++) {
+                int d = abs(out[i] - ((unsigned char*)reference)[i]);
+                worst = d > worst ? d : worst;
+                over += d > 2 * ((255 >> WARP_FRAC) + 1);
+            }
+            printf("sse warp %s against naive : max difference %d, %d values beyond a weight step per axis\n", name[test], worst, over);
+        }
+        free(warped);
+        free(reference);
+        free(plane);
+    }
+#endif
+#if FILTER(LUT,1)
+    {
+        // a 33^3 grading table against the per pixel reference, then a run
+        // of hsv adjustments baked on the 52^3 grid against the direct ones
+        int w = bmpInfo.biWidth, h = bmpInfo.biHeight, n = 33;
+        RGBTRIPLE *graded = alloc_memory(h, w), *reference = alloc_memory(h, w);
+        LUT3D lut = {0};
+        int ok = lut3d_alloc(&lut, n);
+        for(int i = 0; ok && i < n*n*n; i++) {
+            int r = i % n, g = i / n % n, b = i / n / n;
+            lut.table[4*i] = (b * b * 255 / ((n-1) * (n-1))) << LUT3D_BITS;
+            lut.table[4*i + 1] = ((g * 3 + r) * 255 / (4 * (n-1))) << LUT3D_BITS;
+            lut.table[4*i + 2] = ((n-1 - r / 2) * 255 / (n-1)) << LUT3D_BITS;
+        }
+        for(int test = 0; ok && test < 2; test++) {
+            const char *name[] = {"cube 33", "baked bright 1.3, sat 0.6"};
+            int worst = 0, over = 0;
+            clock_gettime(CLOCK_REALTIME, &start);
+            if(test == 0) {
+                naive_lut3d_ori(&lut, BMPSaveData, reference, w, h);
+            } else {
+                memcpy(reference, BMPSaveData, sizeof(RGBTRIPLE) * w * h);
+                change_brightness(reference, 1.3, w, h);
+                change_saturation(reference, 0.6, w, h);
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("%s %s, execution time : %f ms\n", test ? "direct" : "naive", name[test], cpu_time);
+            clock_gettime(CLOCK_REALTIME, &start);
+            if(test) {
+                OPCHAIN chain;
+                CURVE curve;
+                ops_parse(&chain, "bright=1.3,sat=0.6");
+                lut3d_free(&lut);
+                if(!ops_color_run(&chain, 0, 3, &curve, &lut))
+                    break;
+            }
+            lut3d_apply_ori(&lut, BMPSaveData, graded, w, h);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("sse %s%s, execution time : %f ms\n", name[test], test ? " (bake included)" : "", cpu_time);
+            for(int i = 0; i < w*h*3; i++) {
+                int d = abs(((unsigned char*)graded)[i] - ((unsigned char*)reference)[i]);
+                worst = d > worst ? d : worst;
+                over += d > 2;
+            }
+            printf("sse %s against %s : max difference %d, %d values beyond 2\n", name[test], test ? "direct" : "naive", worst, over);
+        }
+        lut3d_free(&lut);
+        free(graded);
+        free(reference);
+    }
+#endif
+#if FILTER(HDR,1)
+    {
+        // the half float kernels on the image scaled to [0,1], rounded back
+        // to 8 bits against the 8 bits kernels or a round trip through HSV
+        // in doubles
+        int w = bmpInfo.biWidth, h = bmpInfo.biHeight, n = w * h;
+        HDRIMAGE img = {0}, blurred = {0};
+        RGBTRIPLE *reference = alloc_memory(h, w);
+        float *values = (float*)malloc(n*sizeof(float));
+        hdr_reserve(&img, w, h, 3);
+        hdr_reserve(&blurred, w, h, 3);
+        for(int c = 0; c < 3; c++) {
+            for(int i = 0; i < n; i++)
+                values[i] = ((unsigned char*)&BMPSaveData[i])[c] / 255.0f;
+            clock_gettime(CLOCK_REALTIME, &start);
+            half_from_floats(values, img.plane[c], n);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            if(c == 0)
+                printf("half from float, execution time : %f ms , %.1f Mvalue/s\n", cpu_time, n / cpu_time / 1e3);
+        }
+        for(int test = 0; test < 4; test++) {
+            const char *name[] = {"blur", "flip horizontal", "brightness 1.3", "saturation 0.6"};
+            int worst = 0, over = 0;
+            memcpy(reference, BMPSaveData, sizeof(RGBTRIPLE) * n);
+            clock_gettime(CLOCK_REALTIME, &start);
+            if(test == 0)
+                sse_gaussian_blur_5_vec_ori(reference, w, h);
+            else if(test == 1)
+                sse_flip_horizontal_ori(reference, w, h);
+            else if(test == 2)
+                change_brightness(reference, 1.3, w, h);
+            else
+                change_saturation(reference, 0.6, w, h);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("8 bits %s, execution time : %f ms\n", name[test], cpu_time);
+            // change_brightness / change_saturation keep whole degrees of hue
+            if(test >= 2)
+                hsv_reference(BMPSaveData, reference, n, test == 2 ? 1.3 : 0.6, test == 3);
+            clock_gettime(CLOCK_REALTIME, &start);
+            if(test == 0) {
+                for(int c = 0; c < 3; c++)
+                    hdr_blur5(img.plane[c], blurred.plane[c], w, h);
+            } else if(test == 1) {
+                for(int c = 0; c < 3; c++)
+                    hdr_flip_horizontal(img.plane[c], w, h);
+            } else if(test == 2) {
+                hdr_brightness(&img, 1.3);
+            } else {
+                hdr_saturation(&img, 0.6);
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("half float %s, execution time : %f ms\n", name[test], cpu_time);
+            for(int c = 0; c < 3; c++) {
+                half_to_floats((test ? img : blurred).plane[c], values, n);
+                for(int i = 0; i < n; i++) {
+                    int d = abs((int)(values[i] * 255 + 0.5f) - ((unsigned char*)&reference[i])[c]);
+                    worst = d > worst ? d : worst;
+                    over += d > 1;
+                }
+            }
+            printf("half float %s against %s : max difference %d, %d values beyond 1\n", name[test], test >= 2 ? "double hsv" : "8 bits", worst, over);
+            // every kernel starts from the source
+            for(int c = 0; test < 3 && c < 3; c++) {
+                for(int i = 0; i < n; i++)
+                    values[i] = ((unsigned char*)&BMPSaveData[i])[c] / 255.0f;
+                half_from_floats(values, img.plane[c], n);
+            }
+        }
+        hdr_release(&img);
+        hdr_release(&blurred);
+        free(reference);
+        free(values);
+    }
+#endif
+#if FILTER(YCC,1)
+    {
+        // conversions against the per pixel reference, then a luma only
+        // median and blur through YCbCr against the three planes split
+        int w = bmpInfo.biWidth, h = bmpInfo.biHeight, n = w * h;
+        RGBTRIPLE *back = alloc_memory(h, w), *reference = alloc_memory(h, w);
+        unsigned char *plane = (unsigned char*)malloc(n);
+        for(int test = 0; test < 4; test++) {
+            const char *name[] = {"bt601 4:4:4", "bt709 4:4:4", "bt601 4:2:0", "bt709 4:2:0"};
+            YCCIMAGE ycc, naive;
+            int worst_y = 0, worst_c = 0, worst_back = 0, cn;
+            ycc_alloc(&ycc, w, h, test % 2 ? YCC_BT709 : YCC_BT601, test >= 2);
+            ycc_alloc(&naive, w, h, ycc.matrix, ycc.subsampled);
+            cn = test >= 2 ? (w + 1) / 2 * ((h + 1) / 2) : n;
+            clock_gettime(CLOCK_REALTIME, &start);
+            naive_ycc_from_ori(BMPSaveData, &naive);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("naive to ycbcr %s, execution time : %f ms\n", name[test], cpu_time);
+            clock_gettime(CLOCK_REALTIME, &start);
+            ycc_from_ori(BMPSaveData, &ycc);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("sse to ycbcr %s, execution time : %f ms\n", name[test], cpu_time);
+            clock_gettime(CLOCK_REALTIME, &start);
+            ycc_to_ori(&ycc, back);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("sse from ycbcr %s, execution time : %f ms\n", name[test], cpu_time);
+            naive_ycc_to_ori(&ycc, reference);
+            for(int i = 0; i < n; i++)
+                worst_y = abs(ycc.y[i] - naive.y[i]) > worst_y ? abs(ycc.y[i] - naive.y[i]) : worst_y;
+            for(int i = 0; i < 2 * cn; i++)
+                worst_c = abs(ycc.cb[i] - naive.cb[i]) > worst_c ? abs(ycc.cb[i] - naive.cb[i]) : worst_c;
+            for(int i = 0; i < 3 * n; i++) {
+                int d = abs(((unsigned char*)back)[i] - ((unsigned char*)reference)[i]);
+                worst_back = d > worst_back ? d : worst_back;
+            }
+            printf("sse ycbcr %s against naive : max difference luma %d, chroma %d, back %d\n", name[test], worst_y, worst_c, worst_back);
+            ycc_free(&ycc);
+            ycc_free(&naive);
+        }
+        color_r = (unsigned char*)malloc(n);
+        color_g = (unsigned char*)malloc(n);
+        color_b = (unsigned char*)malloc(n);
+        for(int test = 0; test < 2; test++) {
+            const char *name[] = {"median 2", "blur"};
+            unsigned char *planes[3] = {color_b, color_g, color_r};
+            YCCIMAGE ycc;
+            memcpy(back, BMPSaveData, sizeof(RGBTRIPLE) * n);
+            clock_gettime(CLOCK_REALTIME, &start);
+            split_structure();
+            for(int c = 0; c < 3; c++) {
+                if(test == 0)
+                    median_tri(planes[c], plane, w, h, 2);
+                else
+                    sse_gaussian_blur_5_rows_tri_r(planes[c], plane, w, h, 0, h);
+                memcpy(planes[c], plane, n);
+            }
+            merge_structure();
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("%s on 3 planes (split and merge, %d bytes), execution time : %f ms\n", name[test], 3 * n, cpu_time);
+            memcpy(BMPSaveData, back, sizeof(RGBTRIPLE) * n);
+            for(int sub = 0; sub < 2; sub++) {
+                clock_gettime(CLOCK_REALTIME, &start);
+                ycc_alloc(&ycc, w, h, YCC_BT601, sub);
+                ycc_from_ori(BMPSaveData, &ycc);
+                if(test == 0)
+                    median_tri(ycc.y, plane, w, h, 2);
+                else
+                    sse_gaussian_blur_5_rows_tri_r(ycc.y, plane, w, h, 0, h);
+                memcpy(ycc.y, plane, n);
+                ycc_to_ori(&ycc, reference);
+                ycc_free(&ycc);
+                clock_gettime(CLOCK_REALTIME, &end);
+                cpu_time = diff_in_millisecond(start, end);
+                printf("%s on luma (%s, %d bytes), execution time : %f ms\n", name[test], sub ? "4:2:0" : "4:4:4",
+                       sub ? n + 2 * ((w + 1) / 2) * ((h + 1) / 2) : 3 * n, cpu_time);
+            }
+        }
+        free(color_r);
+        free(color_g);
+        free(color_b);
+        free(back);
+        free(reference);
+        free(plane);
+    }
+#endif
+#if FILTER(QOI,1)
+    {
+        // end to end job (load, blur, save) with BMP files against QOI
+        // files, then the QOI codec with one strip against the strips on
+        // the pool ; the files are written next to the output
+        int w = bmpInfo.biWidth, h = bmpInfo.biHeight;
+        IMAGE src = {bmpHeader, bmpInfo, BMPSaveData, 0, 0}, job = {{0}, {0}, NULL, 0, 0}, out = job;
+        char path[2][4096];
+        const char *name[] = {"bmp", "qoi"};
+        size_t size;
+        for(int fmt = 0; fmt < 2; fmt++) {
+            snprintf(path[fmt], sizeof(path[fmt]), "%s.job.%s", outfileName, name[fmt]);
+            bmp_save(&src, path[fmt]);
+            FILE *fp = fopen(path[fmt], "rb");
+            size = 0;
+            if(fp) {
+                fseek(fp, 0, SEEK_END);
+                size = ftell(fp);
+                fclose(fp);
+            }
+            clock_gettime(CLOCK_REALTIME, &start);
+            int ok = bmp_load(&job, path[fmt]) && image_reserve(&out, w, h);
+            if(ok) {
+                sse_gaussian_blur_5_vec_ori_r(job.data, out.data, w, h);
+                out.header = job.header;
+                out.info = job.info;
+                ok = bmp_save(&out, path[fmt]);
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("%s job (load, blur, save, %zu bytes file), execution time : %f ms%s\n", name[fmt], size, cpu_time,
+                   ok ? "" : " (failed)");
+        }
+        int same = bmp_load(&job, path[0]) && bmp_load(&out, path[1]) &&
+                   memcmp(job.data, out.data, sizeof(RGBTRIPLE) * w * h) == 0;
+        printf("qoi job against bmp job : %s\n", same ? "identical" : "different");
+        for(int strips = 0; strips < 2; strips++) {
+            unsigned char *buf;
+            clock_gettime(CLOCK_REALTIME, &start);
+            buf = qoi_encode(&src, strips ? QOI_STRIP_ROWS : 0, &size);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            printf("qoi encode (%s), %zu bytes for %zu, execution time : %f ms\n", strips ? "strips on the pool" : "one strip",
+                   size, sizeof(RGBTRIPLE) * w * h, cpu_time);
+            if(!buf)
+                continue;
+            clock_gettime(CLOCK_REALTIME, &start);
+            same = qoi_decode(&job, buf, size, "bench");
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            same = same && memcmp(job.data, BMPSaveData, sizeof(RGBTRIPLE) * w * h) == 0;
+            printf("qoi decode (%s), execution time : %f ms, round trip %s\n", strips ? "strips on the pool" : "one strip",
+                   cpu_time, same ? "exact" : "different");
+            free(buf);
+        }
+        remove(path[0]);
+        remove(path[1]);
+        image_release(&job);
+        image_release(&out);
+    }
+#endif
+#if FILTER(TILE,1)
+    {
+        // containers with each codec, a centred 512 x 512 region against
+        // loading the whole BMP, then the kernels tile by tile against the
+        // whole image ones ; the files are written next to the output
+        int w = bmpInfo.biWidth, h = bmpInfo.biHeight, n = w * h;
+        int rw = w < 512 ? w : 512, rh = h < 512 ? h : 512, rx = (w - rw) / 2, ry = (h - rh) / 2;
+        IMAGE src = {bmpHeader, bmpInfo, BMPSaveData, 0, 0}, img = {{0}, {0}, NULL, 0, 0};
+        RGBTRIPLE *region = alloc_memory(rh, rw), *whole = alloc_memory(h, w);
+        const char *name[] = {"raw", "rle", "qoi"};
+        char path[3][4096], other[4096];
+        TILEFILE tf;
+        int same;
+        snprintf(other, sizeof(other), "%s.bench.bmp", outfileName);
+        bmp_save(&src, other);
+        clock_gettime(CLOCK_REALTIME, &start);
+        same = bmp_load(&img, other);
+        for(int y = 0; y < rh && same; y++)
+            memcpy(region + y * rw, img.data + (h - 1 - ry - y) * w + rx, rw * sizeof(RGBTRIPLE));
+        clock_gettime(CLOCK_REALTIME, &end);
+        cpu_time = diff_in_millisecond(start, end);
+        printf("bmp %d x %d region (whole file loaded), execution time : %f ms\n", rw, rh, cpu_time);
+        for(int codec = TILE_RAW; codec <= TILE_QOI; codec++) {
+            snprintf(path[codec], sizeof(path[codec]), "%s.bench.%s.tiles", outfileName, name[codec]);
+            clock_gettime(CLOCK_REALTIME, &start);
+            same = tile_save(&src, path[codec], codec);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            FILE *fp = fopen(path[codec], "rb");
+            long size = 0;
+            if(fp) {
+                fseek(fp, 0, SEEK_END);
+                size = ftell(fp);
+                fclose(fp);
+            }
+            printf("tile %s pack (%ld bytes), execution time : %f ms%s\n", name[codec], size, cpu_time, same ? "" : " (failed)");
+            if(!same || !tile_open(&tf, path[codec]))
+                continue;
+            memset(region, 0, sizeof(RGBTRIPLE) * rw * rh);
+            clock_gettime(CLOCK_REALTIME, &start);
+            same = tile_read(&tf, rx, ry, rw, rh, region, rw);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            for(int y = 0; y < rh && same; y++)
+                same = memcmp(region + y * rw, BMPSaveData + (h - 1 - ry - y) * w + rx, rw * sizeof(RGBTRIPLE)) == 0;
+            printf("tile %s %d x %d region, execution time : %f ms, %s\n", name[codec], rw, rh, cpu_time, same ? "exact" : "different");
+            clock_gettime(CLOCK_REALTIME, &start);
+            same = tile_load(&img, path[codec]);
+            clock_gettime(CLOCK_REALTIME, &end);
+            cpu_time = diff_in_millisecond(start, end);
+            same = same && memcmp(img.data, BMPSaveData, sizeof(RGBTRIPLE) * n) == 0;
+            printf("tile %s whole image, execution time : %f ms, %s\n", name[codec], cpu_time, same ? "exact" : "different");
+            tile_close(&tf);
+        }
+        if(tile_open(&tf, path[TILE_RAW])) {
+            for(int test = 0; test < 2; test++) {
+                const char *kernel[] = {"blur", "fliph + flipv"};
+                clock_gettime(CLOCK_REALTIME, &start);
+                if(test == 0) {
+                    sse_gaussian_blur_5_vec_ori_r(BMPSaveData, whole, w, h);
+                } else {
+                    memcpy(whole, BMPSaveData, sizeof(RGBTRIPLE) * n);
+                    sse_flip_horizontal_ori(whole, w, h);
+                    sse_flip_vertical_ori(whole, w, h);
+                }
+                clock_gettime(CLOCK_REALTIME, &end);
+                cpu_time = diff_in_millisecond(start, end);
+                printf("%s on the whole image, execution time : %f ms\n", kernel[test], cpu_time);
+                snprintf(other, sizeof(other), "%s.bench.out.tiles", outfileName);
+                clock_gettime(CLOCK_REALTIME, &start);
+                same = test == 0 ? tile_blur(&tf, other, TILE_RAW) : tile_mirror(&tf, other, TILE_RAW, 1, 1);
+                clock_gettime(CLOCK_REALTIME, &end);
+                cpu_time = diff_in_millisecond(start, end);
+                same = same && tile_load(&img, other) && memcmp(img.data, whole, sizeof(RGBTRIPLE) * n) == 0;
+                printf("%s tile by tile (file to file), execution time : %f ms, %s\n", kernel[test], cpu_time,
+                       same ? "identical" : "different");
+                remove(other);
+            }
+            tile_close(&tf);
+        }
+        snprintf(other, sizeof(other), "%s.bench.bmp", outfileName);
+        remove(other);
+        for(int codec = TILE_RAW; codec <= TILE_QOI; codec++)
+            remove(path[codec]);
+        image_release(&img);
+        free(region);
+        free(whole);
+    }
 #endif
     // =================== Main Operation to BMP data ===================== //
 
@@ -367,6 +1000,141 @@ int main(int argc,char *argv[])
     return 0;
 }
 
+/*********************************************************/
+// batch mode : bmpreader --batch <list|dir> <outdir> [times] [threads]
+/*********************************************************/
+int batch_mode(int argc, char *argv[])
+{
+    int count, times = 1, threadcount = 4;
+    BATCHSTATS stats;
+    if(argc > 4)
+        times = atoi(argv[4]);
+    if(argc > 5)
+        threadcount = atoi(argv[5]);
+    char **files = batch_collect(argv[2], &count);
+    if(!files || count == 0) {
+        printf("No input image found in %s\n", argv[2]);
+        return 1;
+    }
+    int ok = batch_run(files, count, argv[3], times, threadcount, &stats);
+    batch_report(&stats);
+    batch_free_list(files, count);
+    return ok ? 0 : 1;
+}
+
+/*********************************************************/
+// statistics : bmpreader --stats [--hist] <bmp> [...]
+/*********************************************************/
+int stats_mode(int argc, char *argv[])
+{
+    IMAGE img = {0};
+    IMAGESTATS stats;
+    int hist = strcmp(argv[2], "--hist") == 0, failed = 0;
+    for(int i = 2 + hist; i < argc; i++) {
+        if(!bmp_load(&img, argv[i]) || !stats_ori(img.data, IMAGE_WIDTH(&img), IMAGE_HEIGHT(&img), &stats)) {
+            failed++;
+            continue;
+        }
+        printf("%s : %d x %d\n", argv[i], IMAGE_WIDTH(&img), IMAGE_HEIGHT(&img));
+        stats_report(&stats, stdout, hist);
+    }
+    image_release(&img);
+    return failed ? 1 : 0;
+}
+
+/*********************************************************/
+// 16 bits images : bmpreader --hdr <ops> <input> <output>
+/*********************************************************/
+int hdr_mode(int argc, char *argv[])
+{
+    HDRIMAGE img = {0}, scratch = {0};
+    OPCHAIN chain;
+    int ok = ops_parse(&chain, argv[2]) && hdr_load(&img, argv[3]) && hdr_apply(&chain, &img, &scratch)
+             && hdr_save(&img, argv[4]);
+    ops_release(&chain);
+    hdr_release(&img);
+    hdr_release(&scratch);
+    return ok ? 0 : 1;
+}
+
+/*********************************************************/
+// tiled container : conversions from / to BMP (or QOI), region reads and
+// the kernels tile by tile
+/*********************************************************/
+int tile_mode(int argc, char *argv[])
+{
+    const char *cmd = argv[2];
+    IMAGE img = {{0}, {0}, NULL, 0, 0};
+    TILEFILE tf;
+    int codec = tile_codec(argc > 5 ? argv[5] : "raw"), ok = 0;
+    if(codec < 0 && strcmp(cmd, "roi") != 0 && strcmp(cmd, "unpack") != 0) {
+        fprintf(stderr, "tile : unknown codec %s (raw, rle or qoi)\n", argv[5]);
+        return 1;
+    }
+    if(strcmp(cmd, "pack") == 0) {
+        ok = bmp_load(&img, argv[3]) && tile_save(&img, argv[4], codec);
+    } else if(strcmp(cmd, "unpack") == 0) {
+        ok = tile_load(&img, argv[3]) && bmp_save(&img, argv[4]);
+    } else if(strcmp(cmd, "roi") == 0 && argc >= 9) {
+        int x = atoi(argv[5]), y = atoi(argv[6]), w = atoi(argv[7]), h = atoi(argv[8]);
+        if(w > 0 && h > 0 && tile_open(&tf, argv[3])) {
+            ok = image_reserve(&img, w, h);
+            if(ok) {
+                image_header(&img, w, h);
+                ok = tile_read(&tf, x, y, w, h, img.data + (size_t)(h - 1) * w, -(ptrdiff_t)w) && bmp_save(&img, argv[4]);
+            }
+            tile_close(&tf);
+        }
+    } else if(strcmp(cmd, "blur") == 0 || strcmp(cmd, "fliph") == 0 || strcmp(cmd, "flipv") == 0) {
+        if(tile_open(&tf, argv[3])) {
+            if(cmd[0] == 'b')
+                ok = tile_blur(&tf, argv[4], codec);
+            else
+                ok = tile_mirror(&tf, argv[4], codec, cmd[4] == 'h', cmd[4] == 'v');
+            tile_close(&tf);
+        }
+    } else {
+        fprintf(stderr, "usage : --tile pack <image> <tiles> [raw|rle|qoi] | unpack <tiles> <image> |\n"
+                "        roi <tiles> <image> <x> <y> <w> <h> | blur|fliph|flipv <tiles> <tiles> [raw|rle|qoi]\n");
+        return 1;
+    }
+    image_release(&img);
+    return ok ? 0 : 1;
+}
+
+#if FILTER(HDR,1)
+/*********************************************************/
+// HSV round trip in doubles, V or S scaled by k and clamped
+/*********************************************************/
+static void hsv_reference(const RGBTRIPLE *src, RGBTRIPLE *dst, int n, double k, int saturation)
+{
+    for(int i = 0; i < n; i++) {
+        double b = src[i].rgbBlue / 255.0, g = src[i].rgbGreen / 255.0, r = src[i].rgbRed / 255.0;
+        double v = r > g ? r : g, m = r < g ? r : g, hue = 0, s, f, p, q, t, out[3];
+        v = b > v ? b : v;
+        m = b < m ? b : m;
+        if(v > m)
+            hue = v == r ? (g - b) / (v - m) : v == g ? 2 + (b - r) / (v - m) : 4 + (r - g) / (v - m);
+        hue = hue < 0 ? hue + 6 : hue;
+        s = v > 0 ? (v - m) / v : 0;
+        if(saturation)
+            s = s * k > 1 ? 1 : s * k;
+        else
+            v = v * k > 1 ? 1 : v * k;
+        f = hue - (int)hue;
+        p = v * (1 - s);
+        q = v * (1 - f * s);
+        t = v * (1 - (1 - f) * s);
+        // red, green, blue of every sextant
+        double sextant[6][3] = {{v, t, p}, {q, v, p}, {p, v, t}, {p, q, v}, {t, p, v}, {v, p, q}};
+        memcpy(out, sextant[(int)hue % 6], sizeof(out));
+        dst[i].rgbRed = (int)(out[0] * 255 + 0.5);
+        dst[i].rgbGreen = (int)(out[1] * 255 + 0.5);
+        dst[i].rgbBlue = (int)(out[2] * 255 + 0.5);
+    }
+}
+#endif
+
 /*********************************************************/
 // split the original structure
 /*********************************************************/
@@ -400,6 +1168,8 @@ void merge_structure()
 /*********************************************************/
 int readBMP(char *fileName)
 {
+    if(qoi_is_name(fileName))
+        return readQOI(fileName);
     // Open BMP File
     FILE *bmpFile = fopen(fileName,"rb");
     // Check the file
@@ -442,10 +1212,32 @@ int readBMP(char *fileName)
     return 1;
 }
 /*********************************************************/
+// Read QOI into the same globals, the width padded as above
+/*********************************************************/
+int readQOI(char *fileName)
+{
+    IMAGE img = {{0}, {0}, NULL, 0, 0};
+    if(!qoi_load(&img, fileName)) {
+        image_release(&img);
+        return 0;
+    }
+    // QOI rows have no alignment : the decoded pixels are used as they are,
+    // at their own width
+    bmpHeader = img.header;
+    bmpInfo = img.info;
+    BMPSaveData = img.data;
+    return 1;
+}
+/*********************************************************/
 // Save BMP
 /*********************************************************/
 int saveBMP( char *fileName)
 {
+    // QOI, or the rows of a QOI input that need padding in a BMP
+    if(qoi_is_name(fileName) || bmpInfo.biWidth % 4 != 0) {
+        IMAGE img = {bmpHeader, bmpInfo, BMPSaveData, 0, 0};
+        return bmp_save(&img, fileName);
+    }
     if( bmpHeader.bfType != 0x4d42 ) {
         printf("This file is not .BMP!!\n");
         return 0;
@@ -509,5 +1301,5 @@ static double diff_in_millisecond(struct timespec t1, struct timespec t2)
         diff.tv_sec  = t2.tv_sec - t1.tv_sec;
         diff.tv_nsec = t2.tv_nsec - t1.tv_nsec;
     }
-    return (diff.tv_sec + diff.tv_nsec / 1000000.0);
+    return (diff.tv_sec * 1000.0 + diff.tv_nsec / 1000000.0);
 }
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "median.h"
+#include "pool.h"
+
+// rows handed to a pool worker at a time (3x3 path)
+#define BAND_ROWS 32
+
+#define CLAMP(v, lo, hi) ((v) < (lo) ? (lo) : (v) > (hi) ? (hi) : (v))
+
+typedef struct median_strip {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+    int r;
+    int cx0; // first column with a histogram
+    int ncols;
+    unsigned short *fine; // 256 bins per column
+    unsigned short *coarse; // 16 bins per column
+} MEDIANSTRIP;
+
+// add d to the column histograms for source row y of channel c
+static void columns_update(MEDIANSTRIP *s, int c, int y, int d)
+{
+    const unsigned char *row = s->src + ((size_t)y * s->w + s->cx0) * s->cstep + c;
+    for(int j = 0; j < s->ncols; j++) {
+        int v = row[j * s->cstep];
+        s->fine[j * 256 + v] += d;
+        s->coarse[j * 16 + (v >> 4)] += d;
+    }
+}
+
+#define HIST_ADD(h, p) do { \
+    h##0 = _mm_add_epi16(h##0, _mm_loadu_si128((const __m128i *)(p))); \
+    h##1 = _mm_add_epi16(h##1, _mm_loadu_si128((const __m128i *)(p) + 1)); \
+} while(0)
+#define HIST_SUB(h, p) do { \
+    h##0 = _mm_sub_epi16(h##0, _mm_loadu_si128((const __m128i *)(p))); \
+    h##1 = _mm_sub_epi16(h##1, _mm_loadu_si128((const __m128i *)(p) + 1)); \
+} while(0)
+
+// inclusive prefix sums of 16 bins, then the number of bins whose prefix
+// is at most rank : that is the bin holding element rank, *below gets the
+// count of the bins before it
+static int hist_search(__m128i h0, __m128i h1, int rank, int *below)
+{
+    unsigned short p[16] __attribute__((aligned(16)));
+    const __m128i vrank = _mm_set1_epi16(rank);
+    h0 = _mm_add_epi16(h0, _mm_slli_si128(h0, 2));
+    h1 = _mm_add_epi16(h1, _mm_slli_si128(h1, 2));
+    h0 = _mm_add_epi16(h0, _mm_slli_si128(h0, 4));
+    h1 = _mm_add_epi16(h1, _mm_slli_si128(h1, 4));
+    h0 = _mm_add_epi16(h0, _mm_slli_si128(h0, 8));
+    h1 = _mm_add_epi16(h1, _mm_slli_si128(h1, 8));
+    h1 = _mm_add_epi16(h1, _mm_unpackhi_epi64(_mm_shufflehi_epi16(h0, 0xff), _mm_shufflehi_epi16(h0, 0xff)));
+    // counts go up to 65025, compare unsigned
+    __m128i le0 = _mm_cmpeq_epi16(_mm_min_epu16(h0, vrank), h0);
+    __m128i le1 = _mm_cmpeq_epi16(_mm_min_epu16(h1, vrank), h1);
+    // the prefix is non decreasing, so the set bits are the low ones
+    int k = __builtin_ctz(~_mm_movemask_epi8(_mm_packs_epi16(le0, le1)) | 0x10000);
+    _mm_store_si128((__m128i *)p, h0);
+    _mm_store_si128((__m128i *)p + 1, h1);
+    *below = k ? p[k - 1] : 0;
+    return k;
+}
+
+/*********************************************************/
+// channel c of the strip columns [x0,x1) : the coarse
+// window histogram slides every pixel, a fine segment is
+// only brought up to date when the median falls in it
+/*********************************************************/
+static void median_strip_channel(MEDIANSTRIP *s, int c, int x0, int x1)
+{
+    int w = s->w, h = s->h, r = s->r, cstep = s->cstep;
+    int rank = (2 * r + 1) * (2 * r + 1) / 2;
+    unsigned short hf[256] __attribute__((aligned(16)));
+    int pos[16];
+    memset(s->fine, 0, (size_t)s->ncols * 256 * sizeof(*s->fine));
+    memset(s->coarse, 0, (size_t)s->ncols * 16 * sizeof(*s->coarse));
+    for(int i = -r; i <= r; i++)
+        columns_update(s, c, CLAMP(i, 0, h - 1), 1);
+    for(int y = 0; y < h; y++) {
+        if(y > 0) {
+            columns_update(s, c, CLAMP(y - r - 1, 0, h - 1), -1);
+            columns_update(s, c, CLAMP(y + r, 0, h - 1), 1);
+        }
+        __m128i c0 = _mm_setzero_si128(), c1 = c0;
+        for(int j = x0 - r; j <= x0 + r; j++)
+            HIST_ADD(c, s->coarse + (CLAMP(j, 0, w - 1) - s->cx0) * 16);
+        for(int k = 0; k < 16; k++)
+            pos[k] = x0 - 2 * r - 2; // stale
+        unsigned char *out = s->dst + (size_t)y * w * cstep + c;
+        for(int x = x0; x < x1; x++) {
+            if(x > x0) {
+                HIST_ADD(c, s->coarse + (CLAMP(x + r, 0, w - 1) - s->cx0) * 16);
+                HIST_SUB(c, s->coarse + (CLAMP(x - r - 1, 0, w - 1) - s->cx0) * 16);
+            }
+            int sum, k = hist_search(c0, c1, rank, &sum);
+            // a segment behind by more than half a window is cheaper to rebuild
+            unsigned short *seg = hf + k * 16;
+            __m128i f0, f1;
+            if(2 * (x - pos[k]) > 2 * r + 1) {
+                f0 = f1 = _mm_setzero_si128();
+                for(int j = x - r; j <= x + r; j++)
+                    HIST_ADD(f, s->fine + (CLAMP(j, 0, w - 1) - s->cx0) * 256 + k * 16);
+            } else {
+                f0 = _mm_load_si128((const __m128i *)seg);
+                f1 = _mm_load_si128((const __m128i *)seg + 1);
+                for(int p = pos[k] + 1; p <= x; p++) {
+                    HIST_ADD(f, s->fine + (CLAMP(p + r, 0, w - 1) - s->cx0) * 256 + k * 16);
+                    HIST_SUB(f, s->fine + (CLAMP(p - r - 1, 0, w - 1) - s->cx0) * 256 + k * 16);
+                }
+            }
+            _mm_store_si128((__m128i *)seg, f0);
+            _mm_store_si128((__m128i *)seg + 1, f1);
+            pos[k] = x;
+            out[x * cstep] = k * 16 + hist_search(f0, f1, rank - sum, &sum);
+        }
+    }
+}
+
+// Devillard's 19 exchanges network, the median of 9 ends in p[4]
+#define MED9_NETWORK(SORT) \
+    SORT(1, 2); SORT(4, 5); SORT(7, 8); SORT(0, 1); SORT(3, 4); SORT(6, 7); \
+    SORT(1, 2); SORT(4, 5); SORT(7, 8); SORT(0, 3); SORT(5, 8); SORT(4, 7); \
+    SORT(3, 6); SORT(1, 4); SORT(2, 5); SORT(4, 7); SORT(4, 2); SORT(6, 4); \
+    SORT(4, 2)
+#define VSORT(a, b) do { \
+    __m128i t = _mm_min_epu8(p[a], p[b]); \
+    p[b] = _mm_max_epu8(p[a], p[b]); \
+    p[a] = t; \
+} while(0)
+#define SSORT(a, b) do { \
+    if(p[a] > p[b]) { \
+        int t = p[a]; \
+        p[a] = p[b]; \
+        p[b] = t; \
+    } \
+} while(0)
+
+/*********************************************************/
+// 3x3 median of row r1 : the neighbours of a byte are
+// cstep bytes away, so interleaved channels need no
+// shuffle, 16 bytes per iteration
+/*********************************************************/
+static void median_3_row(const unsigned char *r0, const unsigned char *r1, const unsigned char *r2,
+                         unsigned char *out, int w, int cstep)
+{
+    const unsigned char *rows[3] = {r0, r1, r2};
+    int n = w * cstep, i = cstep;
+    if(n - 2 * cstep >= 16) {
+        for(;; i += 16) {
+            if(i + 16 > n - cstep)
+                i = n - cstep - 16; // last vector overlaps the previous one
+            __m128i p[9];
+            for(int k = 0; k < 3; k++) {
+                p[3 * k] = _mm_loadu_si128((const __m128i *)(rows[k] + i - cstep));
+                p[3 * k + 1] = _mm_loadu_si128((const __m128i *)(rows[k] + i));
+                p[3 * k + 2] = _mm_loadu_si128((const __m128i *)(rows[k] + i + cstep));
+            }
+            MED9_NETWORK(VSORT);
+            _mm_storeu_si128((__m128i *)(out + i), p[4]);
+            if(i == n - cstep - 16)
+                break;
+        }
+        i = n - cstep;
+    }
+    // first and last pixels replicate the side column
+    for(int b = 0; b < n; b++) {
+        if(b == cstep && b < i) {
+            b = i - 1;
+            continue;
+        }
+        int x = b / cstep, c = b % cstep, p[9];
+        int xl = x > 0 ? x - 1 : 0, xr = x < w - 1 ? x + 1 : w - 1;
+        for(int k = 0; k < 3; k++) {
+            p[3 * k] = rows[k][xl * cstep + c];
+            p[3 * k + 1] = rows[k][b];
+            p[3 * k + 2] = rows[k][xr * cstep + c];
+        }
+        MED9_NETWORK(SSORT);
+        out[b] = p[4];
+    }
+}
+
+typedef struct median_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+    int radius;
+    int ok;
+} MEDIANJOB;
+
+static void median_strip_job(void *arg, int item)
+{
+    MEDIANJOB *job = arg;
+    int w = job->w, r = job->radius;
+    int x0 = item * MEDIAN_STRIP;
+    int x1 = x0 + MEDIAN_STRIP < w ? x0 + MEDIAN_STRIP : w;
+    int cx0 = x0 - r > 0 ? x0 - r : 0, cx1 = x1 + r < w ? x1 + r : w;
+    MEDIANSTRIP s = {job->src, job->dst, w, job->h, job->cstep, r, cx0, cx1 - cx0, NULL, NULL};
+    s.fine = malloc((size_t)s.ncols * (256 + 16) * sizeof(*s.fine));
+    if(!s.fine) {
+        fprintf(stderr, "median : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    s.coarse = s.fine + (size_t)s.ncols * 256;
+    for(int c = 0; c < job->cstep; c++)
+        median_strip_channel(&s, c, x0, x1);
+    free(s.fine);
+}
+
+static void median_3_band(void *arg, int item)
+{
+    MEDIANJOB *job = arg;
+    int h = job->h, y0 = item * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < h ? y0 + BAND_ROWS : h;
+    size_t n = (size_t)job->w * job->cstep;
+    for(int y = y0; y < y1; y++) {
+        const unsigned char *row = job->src + y * n;
+        median_3_row(y > 0 ? row - n : row, row, y < h - 1 ? row + n : row, job->dst + y * n, job->w, job->cstep);
+    }
+}
+
+int median_filter(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int radius)
+{
+    if(radius < 0 || radius > MEDIAN_MAX_RADIUS) {
+        fprintf(stderr, "median : radius %d out of 0 ~ %d\n", radius, MEDIAN_MAX_RADIUS);
+        return 0;
+    }
+    if(radius == 0) {
+        memcpy(dst, src, (size_t)w * h * cstep);
+        return 1;
+    }
+    MEDIANJOB job = {src, dst, w, h, cstep, radius, 1};
+    if(radius == 1) // the sorting network beats the histograms
+        pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, median_3_band, &job);
+    else
+        pool_run(pool_default(), (w + MEDIAN_STRIP - 1) / MEDIAN_STRIP, median_strip_job, &job);
+    return job.ok;
+}
+
+int median_tri(const unsigned char *src, unsigned char *dst, int w, int h, int radius)
+{
+    return median_filter(src, dst, w, h, 1, radius);
+}
+
+int median_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int radius)
+{
+    return median_filter((const unsigned char *)src, (unsigned char *)dst, w, h, 3, radius);
+}
+
+static void naive_median(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int radius)
+{
+    int rank = (2 * radius + 1) * (2 * radius + 1) / 2;
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++) {
+            for(int c = 0; c < cstep; c++) {
+                int hist[256] = {0}, sum = 0, v = 0;
+                for(int dy = -radius; dy <= radius; dy++) {
+                    const unsigned char *row = src + (size_t)CLAMP(y + dy, 0, h - 1) * w * cstep + c;
+                    for(int dx = -radius; dx <= radius; dx++)
+                        hist[row[CLAMP(x + dx, 0, w - 1) * cstep]]++;
+                }
+                while(sum + hist[v] <= rank)
+                    sum += hist[v++];
+                dst[((size_t)y * w + x) * cstep + c] = v;
+            }
+        }
+    }
+}
+
+void naive_median_tri(const unsigned char *src, unsigned char *dst, int w, int h, int radius)
+{
+    naive_median(src, dst, w, h, 1, radius);
+}
+
+void naive_median_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int radius)
+{
+    naive_median((const unsigned char *)src, (unsigned char *)dst, w, h, 3, radius);
+}
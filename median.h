@@ -0,0 +1,23 @@
+#ifndef MEDIAN_FILTER
+#define MEDIAN_FILTER
+#include "bmp.h"
+
+// (2 * radius + 1)^2 counts must fit the 16 bits histogram bins
+#define MEDIAN_MAX_RADIUS 127
+// columns per vertical strip handed to a pool worker
+#define MEDIAN_STRIP 256
+
+// Median of the (2 * radius + 1)^2 window around each pixel, the border is
+// replicated. Perreault's constant time filter : every column of a strip
+// keeps a histogram of its 2 * radius + 1 rows, the window histogram slides
+// along the row by adding one column histogram and removing another, with
+// a 16 bins coarse level and 256 bins fine segments updated lazily.
+// cstep : bytes per pixel (1 : planar, 3 : RGBTRIPLE), channels are
+// filtered independently.
+int median_filter(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int radius);
+int median_tri(const unsigned char *src, unsigned char *dst, int w, int h, int radius);
+int median_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int radius);
+// O(radius^2) per pixel reference
+void naive_median_tri(const unsigned char *src, unsigned char *dst, int w, int h, int radius);
+void naive_median_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int radius);
+#endif // MEDIAN_FILTER
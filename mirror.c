@@ -1,3 +1,5 @@
+#include <string.h>
+#include <stdint.h>
 #include "mirror.h"
 
 #define THREADS sysconf(_SC_NPROCESSORS_ONLN)
@@ -118,3 +120,525 @@ void sse_flip_horizontal_tri(unsigned char *src, int w, int h)
         }
     }
 }
+
+/*********************************************************/
+// interleaved 24-bit flips : pixels are reversed with byte shuffles that
+// move whole RGBTRIPLEs, so no split/merge to planar data is needed
+/*********************************************************/
+// reverse 16 pixels (48 bytes) held in v0..v2 , a macro so the masks stay
+// in registers even in the -O0 build
+#define SSE_REVERSE_16_ORI(v0, v1, v2) do {                                      \
+        __m128i r0_ = _mm_or_si128(_mm_shuffle_epi8(v1, m01), _mm_shuffle_epi8(v2, m02)); \
+        __m128i r1_ = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, m10),          \
+                                   _mm_shuffle_epi8(v1, m11)), _mm_shuffle_epi8(v2, m12)); \
+        v2 = _mm_or_si128(_mm_shuffle_epi8(v0, m20), _mm_shuffle_epi8(v1, m21));     \
+        v0 = r0_;                                                                  \
+        v1 = r1_;                                                                  \
+    } while(0)
+
+static void sse_flip_row_ori(RGBTRIPLE *row, int w)
+{
+    const __m128i m01 = _mm_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, 14);
+    const __m128i m02 = _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, -128);
+    const __m128i m10 = _mm_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, 15, -128);
+    const __m128i m11 = _mm_setr_epi8(15, -128, 11, 12, 13, 8, 9, 10, 5, 6, 7, 2, 3, 4, -128, 0);
+    const __m128i m12 = _mm_setr_epi8(-128, 0, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128);
+    const __m128i m20 = _mm_setr_epi8(-128, 12, 13, 14, 9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2);
+    const __m128i m21 = _mm_setr_epi8(1, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128);
+    int j = 0;
+    for(; j + 16 <= w / 2; j += 16) {
+        __m128i *l = (__m128i *)(row + j);
+        __m128i *r = (__m128i *)(row + w - j - 16);
+        __m128i l0 = _mm_loadu_si128(l), l1 = _mm_loadu_si128(l + 1), l2 = _mm_loadu_si128(l + 2);
+        __m128i r0 = _mm_loadu_si128(r), r1 = _mm_loadu_si128(r + 1), r2 = _mm_loadu_si128(r + 2);
+        SSE_REVERSE_16_ORI(l0, l1, l2);
+        SSE_REVERSE_16_ORI(r0, r1, r2);
+        _mm_storeu_si128(l, r0);
+        _mm_storeu_si128(l + 1, r1);
+        _mm_storeu_si128(l + 2, r2);
+        _mm_storeu_si128(r, l0);
+        _mm_storeu_si128(r + 1, l1);
+        _mm_storeu_si128(r + 2, l2);
+    }
+    // middle of the row
+    for(; j < w / 2; j++)
+        swap_pixel(&row[j], &row[w-j-1]);
+}
+
+// reverse 16 pixels at p into two overlapping stores : lo for out[0..15] and
+// hi for out[16..47]
+#define AVX_REVERSE_16_ORI(p, lo, hi) do {                                                  \
+        __m256i a_ = _mm256_loadu_si256((const __m256i *)(p));                               \
+        __m256i b_ = _mm256_loadu_si256((const __m256i *)((p) + 16));                        \
+        a_ = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(a_, idx_a), rev4);              \
+        b_ = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(b_, idx_b), rev4);              \
+        lo = _mm256_permutevar8x32_epi32(b_, idx_lo);                                        \
+        hi = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(b_, idx_hi_b),                   \
+                                _mm256_permutevar8x32_epi32(a_, idx_hi_a), 0xfc);            \
+    } while(0)
+
+__attribute__((target("avx2")))
+static void avx_flip_row_ori(RGBTRIPLE *row, int w)
+{
+    // 4 pixels reversed inside the first 12 bytes of each lane
+    const __m256i rev4 = _mm256_setr_epi8(9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2, -128, -128, -128, -128,
+                                          9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2, -128, -128, -128, -128);
+    // pixels 4..7 | 0..3 of the first load , 12..15 | 8..11 of the second , one group per lane
+    const __m256i idx_a = _mm256_setr_epi32(3, 4, 5, 0, 0, 1, 2, 0);
+    const __m256i idx_b = _mm256_setr_epi32(5, 6, 7, 0, 2, 3, 4, 0);
+    // pack the 12-byte lanes back : pixels 15..8 then 7..0
+    const __m256i idx_lo = _mm256_setr_epi32(0, 1, 2, 4, 0, 0, 0, 0);
+    const __m256i idx_hi_b = _mm256_setr_epi32(5, 6, 0, 0, 0, 0, 0, 0);
+    const __m256i idx_hi_a = _mm256_setr_epi32(0, 0, 0, 1, 2, 4, 5, 6);
+    int j = 0;
+    for(; j + 16 <= w / 2; j += 16) {
+        unsigned char *l = (unsigned char *)(row + j);
+        unsigned char *r = (unsigned char *)(row + w - j - 16);
+        __m256i l_lo, l_hi, r_lo, r_hi;
+        AVX_REVERSE_16_ORI(l, l_lo, l_hi);
+        AVX_REVERSE_16_ORI(r, r_lo, r_hi);
+        _mm256_storeu_si256((__m256i *)l, r_lo);
+        _mm256_storeu_si256((__m256i *)(l + 16), r_hi);
+        _mm256_storeu_si256((__m256i *)r, l_lo);
+        _mm256_storeu_si256((__m256i *)(r + 16), l_hi);
+    }
+    for(; j < w / 2; j++)
+        swap_pixel(&row[j], &row[w-j-1]);
+}
+
+static void sse_swap_rows_ori(RGBTRIPLE *a, RGBTRIPLE *b, int w)
+{
+    unsigned char *s1 = (unsigned char *)a, *s2 = (unsigned char *)b;
+    int n = w * 3, j = 0;
+    for(; j + 16 <= n; j += 16) {
+        __m128i v1 = _mm_loadu_si128((__m128i *)(s1 + j));
+        __m128i v2 = _mm_loadu_si128((__m128i *)(s2 + j));
+        _mm_storeu_si128((__m128i *)(s2 + j), v1);
+        _mm_storeu_si128((__m128i *)(s1 + j), v2);
+    }
+    for(; j < n; j++)
+        swap_byte(&s1[j], &s2[j]);
+}
+
+__attribute__((target("avx2")))
+static void avx_swap_rows_ori(RGBTRIPLE *a, RGBTRIPLE *b, int w)
+{
+    unsigned char *s1 = (unsigned char *)a, *s2 = (unsigned char *)b;
+    int n = w * 3, j = 0;
+    for(; j + 32 <= n; j += 32) {
+        __m256i v1 = _mm256_loadu_si256((__m256i *)(s1 + j));
+        __m256i v2 = _mm256_loadu_si256((__m256i *)(s2 + j));
+        _mm256_storeu_si256((__m256i *)(s2 + j), v1);
+        _mm256_storeu_si256((__m256i *)(s1 + j), v2);
+    }
+    for(; j < n; j++)
+        swap_byte(&s1[j], &s2[j]);
+}
+
+void sse_flip_horizontal_ori(RGBTRIPLE *src, int w, int h)
+{
+    for(int i = 0; i < h; i++)
+        sse_flip_row_ori(src + (size_t)i * w, w);
+}
+
+void avx_flip_horizontal_ori(RGBTRIPLE *src, int w, int h)
+{
+    for(int i = 0; i < h; i++)
+        avx_flip_row_ori(src + (size_t)i * w, w);
+}
+
+void sse_flip_vertical_ori(RGBTRIPLE *src, int w, int h)
+{
+    for(int i = 0; i < h / 2; i++)
+        sse_swap_rows_ori(src + (size_t)i * w, src + (size_t)(h - 1 - i) * w, w);
+}
+
+void avx_flip_vertical_ori(RGBTRIPLE *src, int w, int h)
+{
+    for(int i = 0; i < h / 2; i++)
+        avx_swap_rows_ori(src + (size_t)i * w, src + (size_t)(h - 1 - i) * w, w);
+}
+
+// rows y0..y1 (pairs y / h-1-y for the vertical flip) , AVX2 when the
+// cpu has it : the band entry point for callers with their own threads
+void sse_flip_horizontal_rows_ori(RGBTRIPLE *src, int w, int y0, int y1)
+{
+    void (*flip_row)(RGBTRIPLE *, int) = __builtin_cpu_supports("avx2") ? avx_flip_row_ori : sse_flip_row_ori;
+    for(int i = y0; i < y1; i++)
+        flip_row(src + (size_t)i * w, w);
+}
+
+void sse_flip_vertical_rows_ori(RGBTRIPLE *src, int w, int h, int y0, int y1)
+{
+    void (*swap_rows)(RGBTRIPLE *, RGBTRIPLE *, int) = __builtin_cpu_supports("avx2") ? avx_swap_rows_ori : sse_swap_rows_ori;
+    for(int i = y0; i < y1 && i < h / 2; i++)
+        swap_rows(src + (size_t)i * w, src + (size_t)(h - 1 - i) * w, w);
+}
+
+// threads split the rows
+void omp_flip_horizontal_ori(RGBTRIPLE *src, int w, int h)
+{
+    #pragma omp parallel num_threads(THREADS)
+    {
+        int t = omp_get_thread_num(), n = omp_get_num_threads();
+        sse_flip_horizontal_rows_ori(src, w, (int)((long)h * t / n), (int)((long)h * (t + 1) / n));
+    }
+}
+
+void omp_flip_vertical_ori(RGBTRIPLE *src, int w, int h)
+{
+    #pragma omp parallel num_threads(THREADS)
+    {
+        int t = omp_get_thread_num(), n = omp_get_num_threads();
+        sse_flip_vertical_rows_ori(src, w, h, (int)((long)(h / 2) * t / n), (int)((long)(h / 2) * (t + 1) / n));
+    }
+}
+
+/*********************************************************/
+// transpose and rotations, out of place : dst is w rows of h pixels.
+// 90 and 270 are "transpose then mirror" : the source is walked in tiles,
+// each tile is cut in blocks transposed inside registers into a small
+// tile buffer, and the tile rows leave with streaming stores, so dst is
+// written in whole cache lines without being read first. Rotations are
+// clockwise on the buffer as laid out in memory (row 0 first).
+/*********************************************************/
+#define TILE_TRI TRANSPOSE_TILE_TRI
+#define TILE_ORI TRANSPOSE_TILE_ORI
+
+// one pixel of the mapping, for the image edges
+#define TRANSPOSE_DST(x, y, w, h, flip_h, flip_v) \
+    ((size_t)((flip_v) ? (w) - 1 - (x) : (x)) * (h) + ((flip_h) ? (h) - 1 - (y) : (y)))
+
+// 16x16 bytes, dst points at the top left of the destination block
+static void sse_transpose_block_tri(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+                                    int flip_h, int flip_v)
+{
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    __m128i a[16], b[16];
+    #pragma GCC unroll 16
+    for(int i = 0; i < 16; i++)
+        a[i] = _mm_loadu_si128((const __m128i *)(src + (size_t)i * src_stride));
+    #pragma GCC unroll 16
+    for(int i = 0; i < 16; i += 2) {
+        b[i] = _mm_unpacklo_epi8(a[i], a[i+1]);
+        b[i+1] = _mm_unpackhi_epi8(a[i], a[i+1]);
+    }
+    #pragma GCC unroll 16
+    for(int i = 0; i < 16; i += 4) {
+        a[i] = _mm_unpacklo_epi16(b[i], b[i+2]);
+        a[i+1] = _mm_unpackhi_epi16(b[i], b[i+2]);
+        a[i+2] = _mm_unpacklo_epi16(b[i+1], b[i+3]);
+        a[i+3] = _mm_unpackhi_epi16(b[i+1], b[i+3]);
+    }
+    #pragma GCC unroll 16
+    for(int i = 0; i < 16; i += 8) {
+        #pragma GCC unroll 16
+        for(int k = 0; k < 4; k++) {
+            b[i+2*k] = _mm_unpacklo_epi32(a[i+k], a[i+k+4]);
+            b[i+2*k+1] = _mm_unpackhi_epi32(a[i+k], a[i+k+4]);
+        }
+    }
+    // a[k] : source column k
+    #pragma GCC unroll 16
+    for(int k = 0; k < 8; k++) {
+        a[2*k] = _mm_unpacklo_epi64(b[k], b[k+8]);
+        a[2*k+1] = _mm_unpackhi_epi64(b[k], b[k+8]);
+    }
+    #pragma GCC unroll 16
+    for(int k = 0; k < 16; k++) {
+        __m128i v = flip_h ? _mm_shuffle_epi8(a[k], reverse) : a[k];
+        _mm_storeu_si128((__m128i *)(dst + (size_t)(flip_v ? 15 - k : k) * dst_stride), v);
+    }
+}
+
+// 4x4 pixels : each pixel is widened to 32 bits, transposed as dwords and packed back
+static void sse_transpose_block_ori(const RGBTRIPLE *src, int src_stride, RGBTRIPLE *dst, int dst_stride,
+                                    int flip_h, int flip_v)
+{
+    const __m128i widen = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i pack = flip_h ? _mm_setr_epi8(12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2, -1, -1, -1, -1)
+                         : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m128i p[4], t[4];
+    #pragma GCC unroll 4
+    for(int i = 0; i < 4; i++) {
+        const unsigned char *s = (const unsigned char *)(src + (size_t)i * src_stride);
+        int last;
+        memcpy(&last, s + 8, 4);
+        p[i] = _mm_shuffle_epi8(_mm_insert_epi32(_mm_loadl_epi64((const __m128i *)s), last, 2), widen);
+    }
+    t[0] = _mm_unpacklo_epi32(p[0], p[1]);
+    t[1] = _mm_unpackhi_epi32(p[0], p[1]);
+    t[2] = _mm_unpacklo_epi32(p[2], p[3]);
+    t[3] = _mm_unpackhi_epi32(p[2], p[3]);
+    p[0] = _mm_unpacklo_epi64(t[0], t[2]);
+    p[1] = _mm_unpackhi_epi64(t[0], t[2]);
+    p[2] = _mm_unpacklo_epi64(t[1], t[3]);
+    p[3] = _mm_unpackhi_epi64(t[1], t[3]);
+    #pragma GCC unroll 4
+    for(int k = 0; k < 4; k++) {
+        unsigned char *d = (unsigned char *)(dst + (size_t)(flip_v ? 3 - k : k) * dst_stride);
+        __m128i v = _mm_shuffle_epi8(p[k], pack);
+        int last = _mm_extract_epi32(v, 2);
+        _mm_storel_epi64((__m128i *)d, v);
+        memcpy(d + 8, &last, 4);
+    }
+}
+
+// 8x8 pixels , 24 bytes rows moved with masked loads / stores (never past the row)
+__attribute__((target("avx2")))
+static void avx_transpose_block_ori(const RGBTRIPLE *src, int src_stride, RGBTRIPLE *dst, int dst_stride,
+                                    int flip_h, int flip_v)
+{
+    const __m256i six = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+    const __m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+    const __m256i widen = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                           0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i pack = flip_h ?
+                         _mm256_setr_epi8(12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2, -1, -1, -1, -1,
+                                          12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2, -1, -1, -1, -1) :
+                         _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i join = flip_h ? _mm256_setr_epi32(4, 5, 6, 0, 1, 2, 0, 0) : _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 0, 0);
+    __m256i r[8], t[8];
+    #pragma GCC unroll 8
+    for(int i = 0; i < 8; i++) {
+        const int *s = (const int *)(src + (size_t)i * src_stride);
+        r[i] = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(_mm256_maskload_epi32(s, six), spread), widen);
+    }
+    #pragma GCC unroll 8
+    for(int i = 0; i < 8; i += 4) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i+1]);
+        t[i+1] = _mm256_unpackhi_epi32(r[i], r[i+1]);
+        t[i+2] = _mm256_unpacklo_epi32(r[i+2], r[i+3]);
+        t[i+3] = _mm256_unpackhi_epi32(r[i+2], r[i+3]);
+        r[i] = _mm256_unpacklo_epi64(t[i], t[i+2]);
+        r[i+1] = _mm256_unpackhi_epi64(t[i], t[i+2]);
+        r[i+2] = _mm256_unpacklo_epi64(t[i+1], t[i+3]);
+        r[i+3] = _mm256_unpackhi_epi64(t[i+1], t[i+3]);
+    }
+    // t[k] : source column k
+    #pragma GCC unroll 8
+    for(int k = 0; k < 4; k++) {
+        t[k] = _mm256_permute2x128_si256(r[k], r[k+4], 0x20);
+        t[k+4] = _mm256_permute2x128_si256(r[k], r[k+4], 0x31);
+    }
+    #pragma GCC unroll 8
+    for(int k = 0; k < 8; k++) {
+        __m256i v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(t[k], pack), join);
+        _mm256_maskstore_epi32((int *)(dst + (size_t)(flip_v ? 7 - k : k) * dst_stride), six, v);
+    }
+}
+
+// copy tile rows out, streaming stores only when every row is made of whole
+// cache lines (partial lines through the write-combining buffers are slower)
+static void stream_tile_rows(unsigned char *dst, size_t dst_stride, const unsigned char *tile, int rows, int bytes)
+{
+    int aligned = ((uintptr_t)dst % 64) == 0 && dst_stride % 64 == 0 && bytes % 64 == 0;
+    for(int r = 0; r < rows; r++) {
+        __m128i *d = (__m128i *)(dst + r * dst_stride);
+        const __m128i *t = (const __m128i *)(tile + (size_t)r * bytes);
+        if(aligned) {
+            for(int k = 0; k < bytes / 16; k++)
+                _mm_stream_si128(d + k, _mm_load_si128(t + k));
+        } else {
+            memcpy(d, t, bytes);
+        }
+    }
+}
+
+/*********************************************************/
+// source rows y0..y1 of a transpose (then mirror) : the band entry point,
+// y0 should be a multiple of the tile height
+/*********************************************************/
+void sse_transpose_rows_tri(const unsigned char *src, unsigned char *dst, int w, int h,
+                            int flip_h, int flip_v, int y0, int y1)
+{
+    unsigned char tile[TILE_TRI * TILE_TRI] __attribute__((aligned(16)));
+    for(int ty = y0; ty + TILE_TRI <= y1; ty += TILE_TRI) {
+        for(int tx = 0; tx + TILE_TRI <= w; tx += TILE_TRI) {
+            const unsigned char *s = src + (size_t)ty * w + tx;
+            for(int x = 0; x < TILE_TRI; x += 16) {
+                for(int y = 0; y < TILE_TRI; y += 16) {
+                    unsigned char *t = tile + (flip_v ? TILE_TRI - 16 - x : x) * TILE_TRI + (flip_h ? TILE_TRI - 16 - y : y);
+                    sse_transpose_block_tri(s + (size_t)y * w + x, w, t, TILE_TRI, flip_h, flip_v);
+                }
+            }
+            size_t row = flip_v ? w - TILE_TRI - tx : tx;
+            size_t col = flip_h ? h - TILE_TRI - ty : ty;
+            stream_tile_rows(dst + row * h + col, h, tile, TILE_TRI, TILE_TRI);
+        }
+    }
+    _mm_sfence();
+    // right and bottom edges : full blocks straight to dst, then single bytes
+    int full_y = y0 + (y1 - y0) / TILE_TRI * TILE_TRI, full_x = w / TILE_TRI * TILE_TRI;
+    for(int y = y0; y < y1; y += 16) {
+        for(int x = y < full_y ? full_x : 0; y + 16 <= y1 && x + 16 <= w; x += 16) {
+            size_t row = flip_v ? w - 16 - x : x;
+            size_t col = flip_h ? h - 16 - y : y;
+            sse_transpose_block_tri(src + (size_t)y * w + x, w, dst + row * h + col, h, flip_h, flip_v);
+        }
+    }
+    for(int y = y0; y < y1; y++) {
+        int x = y < full_y ? full_x : 0;
+        if(y < y0 + (y1 - y0) / 16 * 16)
+            x += (w - x) / 16 * 16;
+        for(; x < w; x++)
+            dst[TRANSPOSE_DST(x, y, w, h, flip_h, flip_v)] = src[(size_t)y * w + x];
+    }
+}
+
+void sse_transpose_rows_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h,
+                            int flip_h, int flip_v, int y0, int y1)
+{
+    RGBTRIPLE tile[TILE_ORI * TILE_ORI] __attribute__((aligned(16)));
+    int avx = __builtin_cpu_supports("avx2");
+    int block = avx ? 8 : 4;
+    void (*transpose_block)(const RGBTRIPLE *, int, RGBTRIPLE *, int, int, int) =
+        avx ? avx_transpose_block_ori : sse_transpose_block_ori;
+    for(int ty = y0; ty + TILE_ORI <= y1; ty += TILE_ORI) {
+        for(int tx = 0; tx + TILE_ORI <= w; tx += TILE_ORI) {
+            const RGBTRIPLE *s = src + (size_t)ty * w + tx;
+            for(int x = 0; x < TILE_ORI; x += block) {
+                for(int y = 0; y < TILE_ORI; y += block) {
+                    RGBTRIPLE *t = tile + (flip_v ? TILE_ORI - block - x : x) * TILE_ORI + (flip_h ? TILE_ORI - block - y : y);
+                    transpose_block(s + (size_t)y * w + x, w, t, TILE_ORI, flip_h, flip_v);
+                }
+            }
+            size_t row = flip_v ? w - TILE_ORI - tx : tx;
+            size_t col = flip_h ? h - TILE_ORI - ty : ty;
+            stream_tile_rows((unsigned char *)(dst + row * h + col), (size_t)h * sizeof(RGBTRIPLE),
+                             (const unsigned char *)tile, TILE_ORI, TILE_ORI * sizeof(RGBTRIPLE));
+        }
+    }
+    _mm_sfence();
+    int full_y = y0 + (y1 - y0) / TILE_ORI * TILE_ORI, full_x = w / TILE_ORI * TILE_ORI;
+    for(int y = y0; y < y1; y += block) {
+        for(int x = y < full_y ? full_x : 0; y + block <= y1 && x + block <= w; x += block) {
+            size_t row = flip_v ? w - block - x : x;
+            size_t col = flip_h ? h - block - y : y;
+            transpose_block(src + (size_t)y * w + x, w, dst + row * h + col, h, flip_h, flip_v);
+        }
+    }
+    for(int y = y0; y < y1; y++) {
+        int x = y < full_y ? full_x : 0;
+        if(y < y0 + (y1 - y0) / block * block)
+            x += (w - x) / block * block;
+        for(; x < w; x++)
+            dst[TRANSPOSE_DST(x, y, w, h, flip_h, flip_v)] = src[(size_t)y * w + x];
+    }
+}
+
+// rotate 180 : dst row y is src row h-1-y reversed
+static void rotate_180_rows_tri(const unsigned char *src, unsigned char *dst, int w, int h, int y0, int y1)
+{
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    for(int y = y0; y < y1; y++) {
+        const unsigned char *s = src + (size_t)(h - 1 - y) * w;
+        unsigned char *d = dst + (size_t)y * w;
+        int x = 0;
+        for(; x + 16 <= w; x += 16)
+            _mm_storeu_si128((__m128i *)(d + x), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s + w - 16 - x)), reverse));
+        for(; x < w; x++)
+            d[x] = s[w - 1 - x];
+    }
+}
+
+static void rotate_180_rows_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int y0, int y1)
+{
+    for(int y = y0; y < y1; y++)
+        memcpy(dst + (size_t)y * w, src + (size_t)(h - 1 - y) * w, w * sizeof(RGBTRIPLE));
+    sse_flip_horizontal_rows_ori(dst, w, y0, y1);
+}
+
+// 90 : transpose + mirror the rows , 270 : transpose + reverse the rows
+#define ROTATE_FLIP_H(degrees) ((degrees) == 90)
+#define ROTATE_FLIP_V(degrees) ((degrees) == 270)
+
+void naive_transpose_tri(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++)
+            dst[(size_t)x * h + y] = src[(size_t)y * w + x];
+    }
+}
+
+void naive_transpose_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h)
+{
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++)
+            dst[(size_t)x * h + y] = src[(size_t)y * w + x];
+    }
+}
+
+void naive_rotate_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int degrees)
+{
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++) {
+            if(degrees == 180)
+                dst[(size_t)(h - 1 - y) * w + w - 1 - x] = src[(size_t)y * w + x];
+            else
+                dst[TRANSPOSE_DST(x, y, w, h, ROTATE_FLIP_H(degrees), ROTATE_FLIP_V(degrees))] = src[(size_t)y * w + x];
+        }
+    }
+}
+
+void sse_transpose_tri(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    sse_transpose_rows_tri(src, dst, w, h, 0, 0, 0, h);
+}
+
+void sse_transpose_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h)
+{
+    sse_transpose_rows_ori(src, dst, w, h, 0, 0, 0, h);
+}
+
+void sse_rotate_tri(const unsigned char *src, unsigned char *dst, int w, int h, int degrees)
+{
+    if(degrees == 180)
+        rotate_180_rows_tri(src, dst, w, h, 0, h);
+    else
+        sse_transpose_rows_tri(src, dst, w, h, ROTATE_FLIP_H(degrees), ROTATE_FLIP_V(degrees), 0, h);
+}
+
+void sse_rotate_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int degrees)
+{
+    if(degrees == 180)
+        rotate_180_rows_ori(src, dst, w, h, 0, h);
+    else
+        sse_transpose_rows_ori(src, dst, w, h, ROTATE_FLIP_H(degrees), ROTATE_FLIP_V(degrees), 0, h);
+}
+
+// threads take whole tile rows, the tiles of one row go to one thread
+void omp_transpose_tri(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    omp_rotate_tri(src, dst, w, h, 0);
+}
+
+void omp_transpose_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h)
+{
+    omp_rotate_ori(src, dst, w, h, 0);
+}
+
+void omp_rotate_tri(const unsigned char *src, unsigned char *dst, int w, int h, int degrees)
+{
+    #pragma omp parallel for num_threads(THREADS) schedule(dynamic)
+    for(int y = 0; y < h; y += TILE_TRI) {
+        int y1 = y + TILE_TRI < h ? y + TILE_TRI : h;
+        if(degrees == 180)
+            rotate_180_rows_tri(src, dst, w, h, y, y1);
+        else
+            sse_transpose_rows_tri(src, dst, w, h, ROTATE_FLIP_H(degrees), ROTATE_FLIP_V(degrees), y, y1);
+    }
+}
+
+void omp_rotate_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int degrees)
+{
+    #pragma omp parallel for num_threads(THREADS) schedule(dynamic)
+    for(int y = 0; y < h; y += TILE_ORI) {
+        int y1 = y + TILE_ORI < h ? y + TILE_ORI : h;
+        if(degrees == 180)
+            rotate_180_rows_ori(src, dst, w, h, y, y1);
+        else
+            sse_transpose_rows_ori(src, dst, w, h, ROTATE_FLIP_H(degrees), ROTATE_FLIP_V(degrees), y, y1);
+    }
+}
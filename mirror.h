@@ -1,5 +1,5 @@
-#ifndef MIRROR
-#define MIRROR
+#ifndef IMAGE_MIRROR
+#define IMAGE_MIRROR
 #ifdef ARM
 #include <arm_neon.h>
 #else
@@ -24,5 +24,35 @@ void naive_flip_horizontal_ori(RGBTRIPLE *src, int w, int h);
 void naive_flip_horizontal_tri(unsigned char *src, int w, int h);
 void sse_flip_horizontal_tri(unsigned char *src, int w, int h);
 void omp_flip_horizontal_tri(unsigned char *src, int w, int h);
+void sse_flip_vertical_ori(RGBTRIPLE *src, int w, int h);
+void avx_flip_vertical_ori(RGBTRIPLE *src, int w, int h);
+void omp_flip_vertical_ori(RGBTRIPLE *src, int w, int h);
+void sse_flip_horizontal_ori(RGBTRIPLE *src, int w, int h);
+void avx_flip_horizontal_ori(RGBTRIPLE *src, int w, int h);
+void omp_flip_horizontal_ori(RGBTRIPLE *src, int w, int h);
+void sse_flip_horizontal_rows_ori(RGBTRIPLE *src, int w, int y0, int y1);
+void sse_flip_vertical_rows_ori(RGBTRIPLE *src, int w, int h, int y0, int y1);
+// transpose tiles, band callers should start their bands on a multiple
+#define TRANSPOSE_TILE_TRI 64
+#define TRANSPOSE_TILE_ORI 64
+// out of place, dst is w rows of h pixels (h rows of w for 180 degrees),
+// rotations are clockwise in memory order
+void naive_transpose_tri(const unsigned char *src, unsigned char *dst, int w, int h);
+void naive_transpose_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h);
+void naive_rotate_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int degrees);
+void sse_transpose_tri(const unsigned char *src, unsigned char *dst, int w, int h);
+void sse_transpose_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h);
+void sse_rotate_tri(const unsigned char *src, unsigned char *dst, int w, int h, int degrees);
+void sse_rotate_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int degrees);
+void omp_transpose_tri(const unsigned char *src, unsigned char *dst, int w, int h);
+void omp_transpose_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h);
+void omp_rotate_tri(const unsigned char *src, unsigned char *dst, int w, int h, int degrees);
+void omp_rotate_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int degrees);
+// transpose source rows y0..y1 then mirror the result (flip_h : dst rows,
+// flip_v : dst row order), for callers with their own threads
+void sse_transpose_rows_tri(const unsigned char *src, unsigned char *dst, int w, int h,
+                            int flip_h, int flip_v, int y0, int y1);
+void sse_transpose_rows_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h,
+                            int flip_h, int flip_v, int y0, int y1);
 #endif
-#endif // MIRROR
+#endif // IMAGE_MIRROR
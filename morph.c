@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "morph.h"
+#include "pool.h"
+
+// rows handed to a pool worker at a time, a multiple of 16 ; tall elements
+// get taller bands so the 2 * ry rows halo stays a fraction of the band
+#define BAND_ROWS 32
+
+// 16x16 bytes in place : 4 rounds of interleaving row i with row i + 8
+static void transpose_16x16(__m128i *r)
+{
+    __m128i t[16];
+    for(int s = 0; s < 4; s++) {
+        for(int i = 0; i < 8; i++) {
+            t[2 * i] = _mm_unpacklo_epi8(r[i], r[i + 8]);
+            t[2 * i + 1] = _mm_unpackhi_epi8(r[i], r[i + 8]);
+        }
+        memcpy(r, t, sizeof(t));
+    }
+}
+
+typedef void (*MORPHVERT)(const unsigned char *, unsigned char *, int, int, int, int, int, __m128i *, __m128i *);
+typedef void (*MORPHHORZ)(const unsigned char *, unsigned char *, int, int, int, int, unsigned char *, __m128i *, __m128i *, __m128i *);
+
+#define SCALAR_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define SCALAR_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/****************************************************************************/
+// Both passes are written once as macros and instantiated for the minimum
+// (erode, identity 255) and the maximum (dilate, identity 0).
+// Running values : g[i] from the start of the block of i up to i, hb[i] from
+// i to the end of its block ; a window of k = 2r + 1 starting at i is
+// OP(hb[i], g[i + 2r]) since it spans 2 blocks at most.
+
+// Vertical pass of rows [y0,y1) into out (row 0 is y0), n bytes per row,
+// 16 columns per vector, the last vector overlaps the previous one.
+#define MORPH_VERT(NAME, OP, SOP, IDENT) \
+static void NAME(const unsigned char *src, unsigned char *out, int n, int h, int ry, int y0, int y1, \
+                 __m128i *g, __m128i *hb) \
+{ \
+    const __m128i ident = _mm_set1_epi8((char)(IDENT)); \
+    int k = 2 * ry + 1, len = y1 - y0 + 2 * ry, base = y0 - ry; \
+    if(n < 16) { \
+        for(int y = y0; y < y1; y++) { \
+            for(int b = 0; b < n; b++) { \
+                int v = (IDENT); \
+                for(int j = y - ry; j <= y + ry; j++) \
+                    if(j >= 0 && j < h) \
+                        v = SOP(v, src[(size_t)j * n + b]); \
+                out[(size_t)(y - y0) * n + b] = v; \
+            } \
+        } \
+        return; \
+    } \
+    for(int c = 0;; c += 16) { \
+        if(c + 16 > n) \
+            c = n - 16; \
+        for(int i = 0, q = 0; i < len; i++, q = q + 1 < k ? q + 1 : 0) { \
+            int y = base + i; \
+            __m128i v = y < 0 || y >= h ? ident : _mm_loadu_si128((const __m128i *)(src + (size_t)y * n + c)); \
+            g[i] = q ? OP(g[i - 1], v) : v; \
+            hb[i] = v; \
+        } \
+        for(int i = len - 2, q = (len - 2) % k; i >= 0; i--, q = q ? q - 1 : k - 1) { \
+            if(q != k - 1) \
+                hb[i] = OP(hb[i + 1], hb[i]); \
+        } \
+        for(int j = 0; j < y1 - y0; j++) \
+            _mm_storeu_si128((__m128i *)(out + (size_t)j * n + c), OP(hb[j], g[j + 2 * ry])); \
+        if(c + 16 >= n) \
+            break; \
+    } \
+}
+
+// Horizontal pass of up to 16 rows : padded copies are transposed by 16x16
+// tiles, t[i] then holds byte i of every row and the running values move
+// cstep bytes at a time, one channel per byte of the pixel.
+#define MORPH_HORZ(NAME, OP, IDENT) \
+static void NAME(const unsigned char *in, unsigned char *out, int n, int rows, int cstep, int rx, \
+                 unsigned char *pbuf, __m128i *t, __m128i *g, __m128i *hb) \
+{ \
+    int pad = rx * cstep, len = n + 2 * pad, lp = (len + 15) & ~15, k = 2 * rx + 1; \
+    for(int r = 0; r < 16; r++) { \
+        unsigned char *p = pbuf + (size_t)r * lp; \
+        memset(p, (IDENT), lp); \
+        if(r < rows) \
+            memcpy(p + pad, in + (size_t)r * n, n); \
+    } \
+    for(int c = 0; c < lp; c += 16) { \
+        for(int r = 0; r < 16; r++) \
+            t[c + r] = _mm_loadu_si128((const __m128i *)(pbuf + (size_t)r * lp + c)); \
+        transpose_16x16(t + c); \
+    } \
+    for(int i = 0, q = 0, b = 0; i < len; i++) { \
+        g[i] = q ? OP(g[i - cstep], t[i]) : t[i]; \
+        if(++b == cstep) { \
+            b = 0; \
+            q = q + 1 < k ? q + 1 : 0; \
+        } \
+    } \
+    for(int i = len - 1, q = (len - 1) / cstep % k, b = (len - 1) % cstep; i >= 0; i--) { \
+        hb[i] = q == k - 1 || i + cstep >= len ? t[i] : OP(hb[i + cstep], t[i]); \
+        if(b-- == 0) { \
+            b = cstep - 1; \
+            q = q ? q - 1 : k - 1; \
+        } \
+    } \
+    for(int i = 0; i < n; i++) \
+        t[i] = OP(hb[i], g[i + 2 * pad]); \
+    for(int c = 0; c < n; c += 16) { \
+        transpose_16x16(t + c); \
+        for(int r = 0; r < 16; r++) \
+            _mm_storeu_si128((__m128i *)(pbuf + (size_t)r * lp + c), t[c + r]); \
+    } \
+    for(int r = 0; r < rows; r++) \
+        memcpy(out + (size_t)r * n, pbuf + (size_t)r * lp, n); \
+}
+
+MORPH_VERT(erode_vert, _mm_min_epu8, SCALAR_MIN, 255)
+MORPH_VERT(dilate_vert, _mm_max_epu8, SCALAR_MAX, 0)
+MORPH_HORZ(erode_horz, _mm_min_epu8, 255)
+MORPH_HORZ(dilate_horz, _mm_max_epu8, 0)
+
+typedef struct morph_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+    int rx;
+    int ry;
+    int dilate;
+    int band; // rows per band
+    int ok;
+} MORPHJOB;
+
+/*********************************************************/
+// one band : vertical pass into a band buffer, then the
+// horizontal pass 16 rows at a time into dst
+/*********************************************************/
+static void morph_band(void *arg, int item)
+{
+    MORPHJOB *job = arg;
+    MORPHVERT vert = job->dilate ? dilate_vert : erode_vert;
+    MORPHHORZ horz = job->dilate ? dilate_horz : erode_horz;
+    int n = job->w * job->cstep, band = job->band, y0 = item * band;
+    int y1 = y0 + band < job->h ? y0 + band : job->h;
+    int lp = (n + 2 * job->rx * job->cstep + 15) & ~15;
+    size_t vecs = (size_t)2 * (band + 2 * job->ry) + (size_t)3 * lp;
+    __m128i *vec = malloc(vecs * sizeof(__m128i) + (size_t)16 * lp + (size_t)band * n);
+    if(!vec) {
+        fprintf(stderr, "morphology : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    __m128i *t = vec + 2 * (band + 2 * job->ry), *g = t + lp, *hb = g + lp;
+    unsigned char *pbuf = (unsigned char *)(vec + vecs), *buf = pbuf + (size_t)16 * lp;
+    const unsigned char *rows = job->src + (size_t)y0 * n;
+    if(job->ry) {
+        vert(job->src, buf, n, job->h, job->ry, y0, y1, vec, vec + band + 2 * job->ry);
+        rows = buf;
+    }
+    for(int y = y0; y < y1; y += 16) {
+        int count = y1 - y < 16 ? y1 - y : 16;
+        const unsigned char *in = rows + (size_t)(y - y0) * n;
+        unsigned char *out = job->dst + (size_t)y * n;
+        if(job->rx)
+            horz(in, out, n, count, job->cstep, job->rx, pbuf, t, g, hb);
+        else
+            memcpy(out, in, (size_t)count * n);
+    }
+    free(vec);
+}
+
+static int morph_pass(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int rx, int ry, int dilate)
+{
+    MORPHJOB job = {src, dst, w, h, cstep, rx, ry, dilate, BAND_ROWS, 1};
+    if(4 * ry > BAND_ROWS)
+        job.band = (4 * ry + 15) & ~15;
+    pool_run(pool_default(), (h + job.band - 1) / job.band, morph_band, &job);
+    return job.ok;
+}
+
+int morph_filter(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int rx, int ry, int type)
+{
+    if(rx < 0 || ry < 0 || type < MORPH_ERODE || type > MORPH_CLOSE) {
+        fprintf(stderr, "morphology : bad radius %d x %d or operation %d\n", rx, ry, type);
+        return 0;
+    }
+    if(type == MORPH_ERODE || type == MORPH_DILATE)
+        return morph_pass(src, dst, w, h, cstep, rx, ry, type == MORPH_DILATE);
+    unsigned char *tmp = malloc((size_t)w * h * cstep);
+    if(!tmp) {
+        fprintf(stderr, "morphology : out of memory\n");
+        return 0;
+    }
+    int ok = morph_pass(src, tmp, w, h, cstep, rx, ry, type == MORPH_CLOSE)
+             && morph_pass(tmp, dst, w, h, cstep, rx, ry, type == MORPH_OPEN);
+    free(tmp);
+    return ok;
+}
+
+int erode_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry)
+{
+    return morph_filter(src, dst, w, h, 1, rx, ry, MORPH_ERODE);
+}
+
+int dilate_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry)
+{
+    return morph_filter(src, dst, w, h, 1, rx, ry, MORPH_DILATE);
+}
+
+int open_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry)
+{
+    return morph_filter(src, dst, w, h, 1, rx, ry, MORPH_OPEN);
+}
+
+int close_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry)
+{
+    return morph_filter(src, dst, w, h, 1, rx, ry, MORPH_CLOSE);
+}
+
+int morph_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int rx, int ry, int type)
+{
+    return morph_filter((const unsigned char *)src, (unsigned char *)dst, w, h, 3, rx, ry, type);
+}
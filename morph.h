@@ -0,0 +1,24 @@
+#ifndef MORPHOLOGY
+#define MORPHOLOGY
+#include "bmp.h"
+
+#define MORPH_ERODE 0 // minimum over the rectangle
+#define MORPH_DILATE 1 // maximum
+#define MORPH_OPEN 2 // erode then dilate
+#define MORPH_CLOSE 3 // dilate then erode
+
+// Rectangular (2 * rx + 1) x (2 * ry + 1) structuring element, pixels out of
+// the image are ignored. van Herk / Gil-Werman : the row or column is cut in
+// blocks of the element size, a running min / max forward and backward in
+// each block gives any window as 2 of them, 3 comparisons per pixel and
+// pass whatever the size. The vertical pass runs on 16 columns per vector,
+// the horizontal one on 16 rows per vector after an in register transpose.
+// cstep : bytes per pixel (1 : planar, 3 : RGBTRIPLE), channels are
+// filtered independently. dst must not overlap src.
+int morph_filter(const unsigned char *src, unsigned char *dst, int w, int h, int cstep, int rx, int ry, int type);
+int erode_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry);
+int dilate_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry);
+int open_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry);
+int close_tri(const unsigned char *src, unsigned char *dst, int w, int h, int rx, int ry);
+int morph_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int rx, int ry, int type);
+#endif // MORPHOLOGY
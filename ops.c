@@ -0,0 +1,607 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ops.h"
+#include "pool.h"
+#include "gaussian.h"
+#include "mirror.h"
+#include "hsv.h"
+#include "convolve.h"
+#include "unsharp.h"
+#include "edge.h"
+#include "median.h"
+#include "bilateral.h"
+#include "morph.h"
+#include "integral.h"
+#include "histogram.h"
+#include "resize.h"
+#include "pyramid.h"
+#include "warp.h"
+#include "lut.h"
+#include "ycbcr.h"
+
+// rows handed to a pool worker at a time
+#define BAND_ROWS 32
+
+static const struct {
+    const char *name;
+    OPTYPE type;
+    float arg; // default argument
+    int commutes; // gives the same result on a flipped / transposed image
+    int luma; // runs on the Y plane alone after luma / luma420
+} op_names[] = {
+    {"blur", OP_BLUR, 1, 1, 1}, // the 5x5 kernel is symmetric
+    {"flipv", OP_FLIP_V, 0, 1, 0},
+    {"fliph", OP_FLIP_H, 0, 1, 0},
+    {"transpose", OP_TRANSPOSE, 0, 1, 0},
+    {"rot", OP_ROTATE, 90, 1, 0},
+    {"bright", OP_BRIGHTNESS, 1, 1, 0},
+    {"sat", OP_SATURATION, 1, 1, 0},
+    {"sharpen", OP_SHARPEN, 0, 1, 1},
+    {"emboss", OP_EMBOSS, 0, 0, 1}, // not symmetric
+    {"box", OP_BOX, 3, 1, 1},
+    {"unsharp", OP_UNSHARP, 1, 1, 1},
+    {"canny", OP_CANNY, 100, 0, 0}, // ties in the suppression are not symmetric
+    {"median", OP_MEDIAN, 2, 1, 1},
+    {"bilateral", OP_BILATERAL, 8, 0, 1}, // the grid is anchored on the first pixel
+    {"erode", OP_ERODE, 1, 1, 1}, // square element
+    {"dilate", OP_DILATE, 1, 1, 1},
+    {"open", OP_OPEN, 1, 1, 1},
+    {"close", OP_CLOSE, 1, 1, 1},
+    {"mean", OP_MEAN, 2, 1, 1},
+    {"equalize", OP_EQUALIZE, 0, 1, 1},
+    {"clahe", OP_CLAHE, 2, 0, 1}, // the tile grid is anchored on the first pixel
+    {"scale", OP_SCALE, 0.5, 1, 0}, // same factor on both axes, up to the rounding of the first pass
+    {"thumb", OP_THUMB, 256, 1, 0},
+    {"pblur", OP_PYRBLUR, 16, 0, 1}, // the pyramid levels are anchored on the first pixel
+    {"deskew", OP_DESKEW, 0, 0, 0}, // a flip turns the rotation the other way
+    {"gamma", OP_GAMMA, 1, 1, 0},
+    {"contrast", OP_CONTRAST, 1, 1, 0},
+    {"cube", OP_CUBE, 0, 1, 0},
+    {"lblur", OP_LINEAR_BLUR, 1, 1, 0}, // blur in linear light
+    {"luma", OP_LUMA, YCC_BT601, 1, 0},
+    {"luma420", OP_LUMA_420, YCC_BT601, 1, 0},
+};
+
+/*********************************************************/
+// parse "blur=2,fliph,..." , return 0 on unknown operation
+/*********************************************************/
+int ops_parse(OPCHAIN *chain, const char *spec)
+{
+    char buf[256];
+    chain->count = 0;
+    if(!spec || strcmp(spec, "none") == 0)
+        return 1;
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for(char *save, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(tok, '=');
+        size_t k, nnames = sizeof(op_names) / sizeof(op_names[0]);
+        if(value)
+            *value++ = '\0';
+        for(k = 0; k < nnames; k++) {
+            if(strcmp(tok, op_names[k].name) == 0)
+                break;
+        }
+        if(k == nnames || chain->count == OPS_MAX) {
+            fprintf(stderr, "unknown or too many operations : %s\n", tok);
+            ops_release(chain);
+            return 0;
+        }
+        chain->op[chain->count].type = op_names[k].type;
+        chain->op[chain->count].arg = value ? atof(value) : op_names[k].arg;
+        chain->op[chain->count].lut = NULL;
+        if(op_names[k].type == OP_CUBE && !(chain->op[chain->count].lut = value ? lut3d_cached(value) : NULL)) {
+            fprintf(stderr, "cube needs a readable .cube file\n");
+            ops_release(chain);
+            return 0;
+        }
+        if(op_names[k].type == OP_LUMA || op_names[k].type == OP_LUMA_420) {
+            int matrix = (int)chain->op[chain->count].arg;
+            if(matrix != YCC_BT601 && matrix != YCC_BT709 && (matrix != 0 || op_names[k].type != OP_LUMA)) {
+                fprintf(stderr, "%s takes 601 or 709\n", op_names[k].name);
+                ops_release(chain);
+                return 0;
+            }
+        }
+        chain->count++;
+    }
+    return 1;
+}
+
+void ops_release(OPCHAIN *chain)
+{
+    for(int i = 0; i < chain->count; i++) {
+        if(chain->op[i].lut)
+            lut3d_release(chain->op[i].lut);
+    }
+    chain->count = 0;
+}
+
+typedef struct blur_job {
+    const RGBTRIPLE *src;
+    RGBTRIPLE *dst;
+    int w;
+    int h;
+    int linear;
+    int ok;
+} BLURJOB;
+
+static void blur_band(void *arg, int item)
+{
+    BLURJOB *job = arg;
+    int y0 = item * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < job->h ? y0 + BAND_ROWS : job->h;
+    if(!job->linear)
+        sse_gaussian_blur_5_rows_vec_ori_r(job->src, job->dst, job->w, job->h, y0, y1);
+    else if(!sse_gaussian_blur_5_rows_linear_ori_r(job->src, job->dst, job->w, job->h, y0, y1))
+        job->ok = 0;
+}
+
+typedef struct flip_job {
+    RGBTRIPLE *data;
+    int w;
+    int h;
+    int vertical;
+} FLIPJOB;
+
+static void flip_band(void *arg, int item)
+{
+    FLIPJOB *job = arg;
+    int y0 = item * BAND_ROWS;
+    if(job->vertical)
+        sse_flip_vertical_rows_ori(job->data, job->w, job->h, y0, y0 + BAND_ROWS);
+    else
+        sse_flip_horizontal_rows_ori(job->data, job->w, y0, y0 + BAND_ROWS < job->h ? y0 + BAND_ROWS : job->h);
+}
+
+typedef struct plane_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+} PLANEJOB;
+
+static void plane_blur_band(void *arg, int item)
+{
+    PLANEJOB *job = arg;
+    int y0 = item * BAND_ROWS;
+    sse_gaussian_blur_5_rows_tri_r(job->src, job->dst, job->w, job->h, y0, y0 + BAND_ROWS < job->h ? y0 + BAND_ROWS : job->h);
+}
+
+typedef struct transpose_job {
+    const IMAGE *img;
+    RGBTRIPLE *dst;
+} TRANSPOSEJOB;
+
+// one band of source rows of the transposed (and mirrored) view
+static void transpose_band(void *arg, int item)
+{
+    TRANSPOSEJOB *job = arg;
+    const IMAGE *img = job->img;
+    int h = IMAGE_HEIGHT(img);
+    int y0 = item * TRANSPOSE_TILE_ORI;
+    int y1 = y0 + TRANSPOSE_TILE_ORI < h ? y0 + TRANSPOSE_TILE_ORI : h;
+    sse_transpose_rows_ori(img->data, job->dst, IMAGE_WIDTH(img), h,
+                           img->orient & ORIENT_FLIP_H, img->orient & ORIENT_FLIP_V, y0, y1);
+}
+
+static int is_color_op(OPTYPE type)
+{
+    return type == OP_BRIGHTNESS || type == OP_SATURATION || type == OP_GAMMA || type == OP_CONTRAST;
+}
+
+static void op_curve(const OP *op, CURVE *c)
+{
+    if(op->type == OP_GAMMA)
+        curve_gamma(c, op->arg);
+    else if(op->type == OP_CONTRAST)
+        curve_contrast(c, op->arg);
+    else if(op->type == OP_BRIGHTNESS)
+        curve_scale(c, op->arg);
+    else
+        curve_identity(c);
+}
+
+typedef struct color_run {
+    const OP *op;
+    int count;
+} COLORRUN;
+
+// the run on the grid pixels of the bake
+static void color_run_grid(RGBTRIPLE *grid, int n, void *arg)
+{
+    const COLORRUN *run = arg;
+    for(int i = 0; i < run->count; i++) {
+        const OP *op = &run->op[i];
+        CURVE c;
+        if(op->type == OP_BRIGHTNESS) {
+            change_brightness(grid, op->arg, n, 1);
+        } else if(op->type == OP_SATURATION) {
+            change_saturation(grid, op->arg, n, 1);
+        } else {
+            op_curve(op, &c);
+            curve_apply_row(&c, (unsigned char *)grid, (unsigned char *)grid, n, 3);
+        }
+    }
+}
+
+/*********************************************************/
+// a lone hsv adjustment keeps its exact kernel
+/*********************************************************/
+int ops_color_direct(const OPCHAIN *chain, int first, int cstep)
+{
+    OPTYPE type = chain->op[first].type;
+    return cstep == 3 && (type == OP_BRIGHTNESS || type == OP_SATURATION) &&
+           (first + 1 == chain->count || !is_color_op(chain->op[first + 1].type));
+}
+
+/*********************************************************/
+// a run of colour operations as one table
+/*********************************************************/
+int ops_color_run(const OPCHAIN *chain, int first, int cstep, CURVE *curve, LUT3D *lut)
+{
+    COLORRUN run = {&chain->op[first], 0};
+    int hsv = 0;
+    lut->table = NULL;
+    while(first + run.count < chain->count && is_color_op(run.op[run.count].type)) {
+        hsv |= run.op[run.count].type == OP_BRIGHTNESS || run.op[run.count].type == OP_SATURATION;
+        run.count++;
+    }
+    if(run.count == 0)
+        return 0;
+    if(hsv && cstep == 3)
+        return lut3d_bake(lut, LUT3D_BAKE, color_run_grid, &run) ? run.count : 0;
+    curve_identity(curve);
+    for(int i = 0; i < run.count; i++) {
+        CURVE next;
+        op_curve(&run.op[i], &next);
+        curve_then(curve, &next);
+    }
+    return run.count;
+}
+
+static int op_commutes(OPTYPE type)
+{
+    for(size_t k = 0; k < sizeof(op_names) / sizeof(op_names[0]); k++) {
+        if(op_names[k].type == type)
+            return op_names[k].commutes;
+    }
+    return 0;
+}
+
+static int op_luma(OPTYPE type)
+{
+    for(size_t k = 0; k < sizeof(op_names) / sizeof(op_names[0]); k++) {
+        if(op_names[k].type == type)
+            return op_names[k].luma;
+    }
+    return 0;
+}
+
+static void swap_image(IMAGE *a, IMAGE *b)
+{
+    RGBTRIPLE *data = a->data;
+    size_t capacity = a->capacity;
+    a->data = b->data;
+    a->capacity = b->capacity;
+    b->data = data;
+    b->capacity = capacity;
+}
+
+/*********************************************************/
+// apply the pending orientation to the pixels
+/*********************************************************/
+int ops_materialize(IMAGE *img, IMAGE *scratch)
+{
+    int w = IMAGE_WIDTH(img), h = IMAGE_HEIGHT(img);
+    if(img->orient & ORIENT_TRANSPOSE) {
+        int vw = IMAGE_VIEW_WIDTH(img), vh = IMAGE_VIEW_HEIGHT(img);
+        TRANSPOSEJOB job = {img, NULL};
+        if(!image_reserve(scratch, vw, vh))
+            return 0;
+        job.dst = scratch->data;
+        pool_run(pool_default(), (h + TRANSPOSE_TILE_ORI - 1) / TRANSPOSE_TILE_ORI, transpose_band, &job);
+        swap_image(img, scratch);
+        img->info.biWidth = vw;
+        img->info.biHeight = img->info.biHeight < 0 ? -vh : vh;
+    } else {
+        // in place, vertical : a band is a set of row pairs from the top half
+        if(img->orient & ORIENT_FLIP_V) {
+            FLIPJOB job = {img->data, w, h, 1};
+            pool_run(pool_default(), (h / 2 + BAND_ROWS - 1) / BAND_ROWS, flip_band, &job);
+        }
+        if(img->orient & ORIENT_FLIP_H) {
+            FLIPJOB job = {img->data, w, h, 0};
+            pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, flip_band, &job);
+        }
+    }
+    img->orient = 0;
+    return 1;
+}
+
+// the YCbCr planes of an open run of luma operations
+typedef struct luma_run {
+    int matrix; // 0 : the operations work on RGB
+    int subsampled;
+    YCCIMAGE ycc; // ycc.y set while a run is open
+    unsigned char *plane; // output of the filters, swapped with ycc.y
+} LUMARUN;
+
+static int luma_open(LUMARUN *run, const IMAGE *img)
+{
+    int w = IMAGE_WIDTH(img), h = IMAGE_HEIGHT(img);
+    if(!ycc_alloc(&run->ycc, w, h, run->matrix, run->subsampled))
+        return 0;
+    run->plane = malloc((size_t)w * h);
+    if(!run->plane) {
+        fprintf(stderr, "ops : out of memory\n");
+        return 0;
+    }
+    return ycc_from_ori(img->data, &run->ycc);
+}
+
+// back to img, if a run is open
+static int luma_close(LUMARUN *run, IMAGE *img)
+{
+    int ok = 1;
+    if(run->ycc.y)
+        ok = ycc_to_ori(&run->ycc, img->data);
+    ycc_free(&run->ycc);
+    free(run->plane);
+    run->plane = NULL;
+    return ok;
+}
+
+// one operation on the Y plane, w x h
+static int luma_op(const OP *op, LUMARUN *run, int w, int h)
+{
+    unsigned char *t;
+    int ok = 1;
+    for(int pass = 0; pass < (op->type == OP_BLUR ? (int)op->arg : 1); pass++) {
+        const unsigned char *src = run->ycc.y;
+        unsigned char *dst = run->plane;
+        switch(op->type) {
+            case OP_BLUR: {
+                PLANEJOB job = {src, dst, w, h};
+                pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, plane_blur_band, &job);
+                break;
+            }
+            case OP_SHARPEN:
+            case OP_EMBOSS:
+            case OP_BOX: {
+                KERNEL kernel;
+                ok = (op->type == OP_BOX ? kernel_box(&kernel, (int)op->arg)
+                      : kernel_named(&kernel, op->type == OP_SHARPEN ? "sharpen" : "emboss"))
+                     && conv_apply(&kernel, src, dst, w, h, 1);
+                break;
+            }
+            case OP_UNSHARP:
+                ok = unsharp_mask(src, dst, w, h, 1, op->arg, 2, 0);
+                break;
+            case OP_MEDIAN:
+                ok = median_filter(src, dst, w, h, 1, (int)op->arg);
+                break;
+            case OP_BILATERAL:
+                ok = bilateral_filter(src, dst, w, h, 1, op->arg, 20);
+                break;
+            case OP_ERODE:
+            case OP_DILATE:
+            case OP_OPEN:
+            case OP_CLOSE:
+                ok = morph_filter(src, dst, w, h, 1, (int)op->arg, (int)op->arg, MORPH_ERODE + op->type - OP_ERODE);
+                break;
+            case OP_MEAN:
+                ok = box_mean_tri(src, dst, w, h, (int)op->arg, (int)op->arg);
+                break;
+            case OP_EQUALIZE:
+                ok = hist_equalize(src, dst, w, h, 1);
+                break;
+            case OP_CLAHE:
+                ok = clahe(src, dst, w, h, 1, CLAHE_TILES, CLAHE_TILES, op->arg);
+                break;
+            case OP_PYRBLUR:
+                ok = pyramid_blur(src, dst, w, h, op->arg);
+                break;
+            default:
+                ok = 0;
+                break;
+        }
+        if(!ok)
+            return 0;
+        t = run->ycc.y;
+        run->ycc.y = run->plane;
+        run->plane = t;
+    }
+    return 1;
+}
+
+/*********************************************************/
+// apply every operation of the chain on img
+/*********************************************************/
+static int apply_chain(const OPCHAIN *chain, IMAGE *img, IMAGE *scratch, LUMARUN *luma)
+{
+    for(int i = 0; i < chain->count; i++) {
+        const OP *op = &chain->op[i];
+        if(op->type == OP_LUMA || op->type == OP_LUMA_420) {
+            if(!luma_close(luma, img))
+                return 0;
+            luma->matrix = (int)op->arg;
+            luma->subsampled = op->type == OP_LUMA_420;
+            continue;
+        }
+        if(luma->matrix && op_luma(op->type)) {
+            // the orientation is moved on the RGB pixels
+            if(img->orient && !op_commutes(op->type) && !(luma_close(luma, img) && ops_materialize(img, scratch)))
+                return 0;
+            if(!luma->ycc.y && !luma_open(luma, img))
+                return 0;
+            if(!luma_op(op, luma, IMAGE_WIDTH(img), IMAGE_HEIGHT(img)))
+                return 0;
+            continue;
+        }
+        if(!luma_close(luma, img))
+            return 0;
+        if(img->orient && !op_commutes(op->type) && !ops_materialize(img, scratch))
+            return 0;
+        // pixel kernels work on the buffer as it is stored
+        int w = IMAGE_WIDTH(img), h = IMAGE_HEIGHT(img);
+        switch(op->type) {
+            case OP_BLUR:
+            case OP_LINEAR_BLUR:
+                if(!image_reserve(scratch, w, h))
+                    return 0;
+                for(int pass = 0; pass < (int)op->arg; pass++) {
+                    BLURJOB job = {img->data, scratch->data, w, h, op->type == OP_LINEAR_BLUR, 1};
+                    pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, blur_band, &job);
+                    if(!job.ok)
+                        return 0;
+                    swap_image(img, scratch);
+                }
+                break;
+            case OP_FLIP_V:
+                image_orient(img, ORIENT_FLIP_V);
+                break;
+            case OP_FLIP_H:
+                image_orient(img, ORIENT_FLIP_H);
+                break;
+            case OP_TRANSPOSE:
+                image_orient(img, ORIENT_TRANSPOSE);
+                break;
+            case OP_ROTATE:
+                image_rotate(img, (int)op->arg);
+                break;
+            case OP_BRIGHTNESS:
+            case OP_SATURATION:
+            case OP_GAMMA:
+            case OP_CONTRAST: {
+                // the whole run of colour operations in one pass
+                CURVE curve;
+                LUT3D lut;
+                int n, ok;
+                if(ops_color_direct(chain, i, 3)) {
+                    if(op->type == OP_BRIGHTNESS)
+                        change_brightness(img->data, op->arg, w, h);
+                    else
+                        change_saturation(img->data, op->arg, w, h);
+                    break;
+                }
+                n = ops_color_run(chain, i, 3, &curve, &lut);
+                if(!n)
+                    return 0;
+                ok = lut.table ? lut3d_apply_ori(&lut, img->data, img->data, w, h)
+                     : curve_apply_ori(&curve, img->data, img->data, w, h);
+                lut3d_free(&lut);
+                if(!ok)
+                    return 0;
+                i += n - 1;
+                break;
+            }
+            case OP_CUBE:
+                if(!lut3d_apply_ori(op->lut, img->data, img->data, w, h))
+                    return 0;
+                break;
+            case OP_SHARPEN:
+            case OP_EMBOSS:
+            case OP_BOX: {
+                KERNEL kernel;
+                int ok = op->type == OP_BOX ? kernel_box(&kernel, (int)op->arg)
+                         : kernel_named(&kernel, op->type == OP_SHARPEN ? "sharpen" : "emboss");
+                if(!ok || !image_reserve(scratch, w, h) || !conv_apply_ori(&kernel, img->data, scratch->data, w, h))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            }
+            case OP_UNSHARP:
+                if(!image_reserve(scratch, w, h)
+                   || !unsharp_mask((unsigned char *)img->data, (unsigned char *)scratch->data, w, h, 3, op->arg, 2, 0))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            case OP_MEDIAN:
+                if(!image_reserve(scratch, w, h) || !median_ori(img->data, scratch->data, w, h, (int)op->arg))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            case OP_BILATERAL:
+                if(!image_reserve(scratch, w, h) || !bilateral_ori(img->data, scratch->data, w, h, op->arg, 20))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            case OP_ERODE:
+            case OP_DILATE:
+            case OP_OPEN:
+            case OP_CLOSE:
+                if(!image_reserve(scratch, w, h)
+                   || !morph_ori(img->data, scratch->data, w, h, (int)op->arg, (int)op->arg, MORPH_ERODE + op->type - OP_ERODE))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            case OP_MEAN:
+                if(!image_reserve(scratch, w, h) || !box_mean_ori(img->data, scratch->data, w, h, (int)op->arg, (int)op->arg))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            case OP_EQUALIZE:
+                if(!equalize_ori(img->data, w, h))
+                    return 0;
+                break;
+            case OP_CLAHE:
+                if(!image_reserve(scratch, w, h) || !clahe_ori(img->data, scratch->data, w, h, op->arg))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            case OP_SCALE:
+            case OP_THUMB: {
+                // thumb : the longest side down to arg, never up
+                float f = op->type == OP_SCALE ? op->arg : op->arg / (w > h ? w : h);
+                if(op->type == OP_THUMB && f >= 1)
+                    break;
+                int dw = (int)(w * f + 0.5f), dh = (int)(h * f + 0.5f);
+                dw = dw > 0 ? dw : 1;
+                dh = dh > 0 ? dh : 1;
+                if(!image_reserve(scratch, dw, dh) || !resize_ori(img->data, scratch->data, w, h, dw, dh, RESIZE_LANCZOS))
+                    return 0;
+                swap_image(img, scratch);
+                img->info.biWidth = dw;
+                img->info.biHeight = img->info.biHeight < 0 ? -dh : dh;
+                break;
+            }
+            case OP_PYRBLUR:
+                if(!image_reserve(scratch, w, h) || !pyramid_blur_ori(img->data, scratch->data, w, h, op->arg))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            case OP_DESKEW: {
+                // clockwise on screen like rot : counter-clockwise in memory
+                // order when the rows are stored bottom-up
+                double m[9];
+                if(op->arg == 0)
+                    break;
+                warp_rotation(m, w, h, w, h, img->info.biHeight > 0 ? op->arg : -op->arg);
+                if(!image_reserve(scratch, w, h) || !warp_image((unsigned char *)img->data, (unsigned char *)scratch->data, w, h, w, h, 3, m, 255))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            }
+            case OP_CANNY:
+                if(!image_reserve(scratch, w, h)
+                   || !canny_ori(img->data, scratch->data, w, h, (int)(op->arg * 0.4f), (int)op->arg))
+                    return 0;
+                swap_image(img, scratch);
+                break;
+            case OP_LUMA:
+            case OP_LUMA_420:
+                break;
+        }
+    }
+    return luma_close(luma, img);
+}
+
+int ops_apply(const OPCHAIN *chain, IMAGE *img, IMAGE *scratch)
+{
+    LUMARUN luma = {0, 0, {0, 0, 0, 0, NULL, NULL, NULL}, NULL};
+    int ok = apply_chain(chain, img, scratch, &luma);
+    ycc_free(&luma.ycc);
+    free(luma.plane);
+    return ok;
+}
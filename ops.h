@@ -0,0 +1,87 @@
+#ifndef OPERATION_CHAIN
+#define OPERATION_CHAIN
+#include "image.h"
+#include "lut.h"
+
+#define OPS_MAX 16
+
+// Operation chain, written as a comma separated list :
+//   blur[=passes] , flipv , fliph , transpose , rot=<90|180|270> ,
+//   bright=<factor> , sat=<factor> , sharpen , emboss , box=<size> ,
+//   unsharp[=amount] , canny[=high] , median[=radius] , bilateral[=sigma] ,
+//   erode[=radius] , dilate[=radius] , open[=radius] , close[=radius] ,
+//   mean[=radius] , equalize , clahe[=clip] , scale[=factor] , thumb[=size] ,
+//   pblur[=sigma] , deskew=<degrees> , gamma=<g> , contrast=<factor> ,
+//   cube=<file.cube> , lblur[=passes] , luma[=601|709|0] , luma420[=601|709]
+// e.g. "blur=2,fliph,sat=0.5"
+// luma / luma420 run the following blur, sharpen, emboss, box, unsharp,
+// median, bilateral, morphology, mean, equalize, clahe and pblur on the Y
+// plane of YCbCr alone (ycbcr.h) : consecutive ones share one conversion,
+// any other operation converts back first ; luma=0 goes back to RGB.
+// Flips, transpose and rotations only change the image orientation, see
+// image.h ; the pixels are moved when saving or before an operation that
+// does not commute with them.
+typedef enum {
+    OP_BLUR,
+    OP_FLIP_V,
+    OP_FLIP_H,
+    OP_TRANSPOSE,
+    OP_ROTATE,
+    OP_BRIGHTNESS,
+    OP_SATURATION,
+    OP_SHARPEN,
+    OP_EMBOSS,
+    OP_BOX,
+    OP_UNSHARP,
+    OP_CANNY,
+    OP_MEDIAN,
+    OP_BILATERAL,
+    OP_ERODE, // same order as MORPH_*
+    OP_DILATE,
+    OP_OPEN,
+    OP_CLOSE,
+    OP_MEAN,
+    OP_EQUALIZE,
+    OP_CLAHE,
+    OP_SCALE,
+    OP_THUMB,
+    OP_PYRBLUR,
+    OP_DESKEW,
+    OP_GAMMA,
+    OP_CONTRAST,
+    OP_CUBE,
+    OP_LINEAR_BLUR,
+    OP_LUMA,
+    OP_LUMA_420
+} OPTYPE;
+
+typedef struct op {
+    OPTYPE type;
+    float arg;
+    const LUT3D *lut; // cube : the table, loaded once per file
+} OP;
+
+typedef struct op_chain {
+    int count;
+    OP op[OPS_MAX];
+} OPCHAIN;
+
+int ops_parse(OPCHAIN *chain, const char *spec);
+// hand back the cube tables of a parsed chain, count becomes 0
+void ops_release(OPCHAIN *chain);
+// Consecutive bright, sat, gamma and contrast from op[first] as a single
+// lookup : composed 256 entries curves when there are only gamma / contrast
+// or the pixels are planar (bright scales, sat does nothing there), else the
+// adjustments baked once on a LUT3D_BAKE grid (lut->table set, to be freed).
+// Returns how many operations it covers, 0 when op[first] is none of them or
+// the bake failed.
+int ops_color_run(const OPCHAIN *chain, int first, int cstep, CURVE *curve, LUT3D *lut);
+// 1 when op[first] is a bright or sat alone on 3 channel pixels : it is no
+// run, the caller keeps the exact change_brightness / change_saturation
+// instead of the interpolated bake
+int ops_color_direct(const OPCHAIN *chain, int first, int cstep);
+// run the chain in place on img, scratch is an extra buffer kept by caller
+int ops_apply(const OPCHAIN *chain, IMAGE *img, IMAGE *scratch);
+// move the pixels so that img->orient is 0
+int ops_materialize(IMAGE *img, IMAGE *scratch);
+#endif // OPERATION_CHAIN
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "pool.h"
+
+static void run_items(POOLTASK *task)
+{
+    int item;
+    while((item = __atomic_fetch_add(&task->next, 1, __ATOMIC_RELAXED)) < task->count) {
+        task->fn(task->arg, item);
+        __atomic_sub_fetch(&task->left, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+// drop tasks whose items are all claimed, lock must be held
+static POOLTASK *first_open_task(THREADPOOL *pool)
+{
+    while(pool->head &&
+          __atomic_load_n(&pool->head->next, __ATOMIC_RELAXED) >= pool->head->count)
+        pool->head = pool->head->link;
+    return pool->head;
+}
+
+static void *pool_worker(void *arg)
+{
+    THREADPOOL *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for(;;) {
+        POOLTASK *task;
+        while(!pool->stop && !(task = first_open_task(pool)))
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if(pool->stop)
+            break;
+        task->users++;
+        pthread_mutex_unlock(&pool->lock);
+        run_items(task);
+        pthread_mutex_lock(&pool->lock);
+        if(--task->users == 0 && __atomic_load_n(&task->left, __ATOMIC_ACQUIRE) == 0)
+            pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+THREADPOOL *pool_create(int num_threads)
+{
+    THREADPOOL *pool = calloc(1, sizeof(THREADPOOL));
+    if(!pool)
+        return NULL;
+    if(num_threads < 0)
+        num_threads = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->threads = malloc((num_threads + 1) * sizeof(pthread_t));
+    for(int i = 0; i < num_threads; i++) {
+        if(pthread_create(&pool->threads[pool->size], NULL, pool_worker, pool) == 0)
+            pool->size++;
+    }
+    return pool;
+}
+
+void pool_destroy(THREADPOOL *pool)
+{
+    if(!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for(int i = 0; i < pool->size; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
+
+/*********************************************************/
+// call fn(arg, item) for every item, return when all are done
+/*********************************************************/
+void pool_run(THREADPOOL *pool, int count, POOLFN fn, void *arg)
+{
+    POOLTASK task = {fn, arg, count, 0, count, 0, NULL};
+    if(count <= 0)
+        return;
+    if(!pool || pool->size == 0 || count == 1) {
+        for(int i = 0; i < count; i++)
+            fn(arg, i);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    POOLTASK **tail = &pool->head;
+    while(*tail)
+        tail = &(*tail)->link;
+    *tail = &task;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_items(&task);
+
+    pthread_mutex_lock(&pool->lock);
+    // unlink, so no worker can pick the task up once we return
+    for(tail = &pool->head; *tail; tail = &(*tail)->link) {
+        if(*tail == &task) {
+            *tail = task.link;
+            break;
+        }
+    }
+    while(task.users > 0 || __atomic_load_n(&task.left, __ATOMIC_ACQUIRE) > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static THREADPOOL *default_pool = NULL;
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+
+static void default_pool_init(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    default_pool = pool_create(n > 1 ? (int)n - 1 : 0);
+}
+
+THREADPOOL *pool_default(void)
+{
+    pthread_once(&default_once, default_pool_init);
+    return default_pool;
+}
+
+int pool_threads(THREADPOOL *pool)
+{
+    return pool ? pool->size + 1 : 1;
+}
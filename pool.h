@@ -0,0 +1,37 @@
+#ifndef WORKER_POOL
+#define WORKER_POOL
+#include <pthread.h>
+
+// Persistent worker threads : they are spawned once and wait on a condition
+// variable between calls, so a parallel section costs a wake-up instead of
+// pthread_create/pthread_join. pool_run() may be called concurrently and
+// from inside a worker, the caller always takes part in its own work.
+typedef void (*POOLFN)(void *arg, int item);
+
+typedef struct pool_task {
+    POOLFN fn;
+    void *arg;
+    int count; // items 0 ~ count-1
+    int next; // next item to claim
+    int left; // items not finished yet
+    int users; // workers holding this task
+    struct pool_task *link;
+} POOLTASK;
+
+typedef struct thread_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    POOLTASK *head; // tasks which still have items to claim
+    pthread_t *threads;
+    int size;
+    int stop;
+} THREADPOOL;
+
+THREADPOOL *pool_create(int num_threads);
+void pool_destroy(THREADPOOL *pool);
+void pool_run(THREADPOOL *pool, int count, POOLFN fn, void *arg);
+// process wide pool (one worker per online cpu, the caller is the last one)
+THREADPOOL *pool_default(void);
+int pool_threads(THREADPOOL *pool);
+#endif // WORKER_POOL
@@ -0,0 +1,563 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "pyramid.h"
+#include "convolve.h"
+#include "pool.h"
+
+// rows handed to a pool worker at a time
+#define BAND_ROWS 32
+// up to this sigma the blur is a direct separable gaussian at full size
+#define PYRAMID_BLUR_DIRECT 10
+
+typedef struct pyramid_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int sw; // source size
+    int sh;
+    int w; // output size
+    int h;
+    const unsigned char *base; // laplacian : diff = base - expand(src)
+    short *diff;
+    const short *add; // reconstruction : dst = expand(src) + add
+    const KERNEL *k; // direct gaussian
+    int ox; // virtual origin : reduce source at -ox, expand output at +ox
+    int oy;
+    int ok;
+} PYRJOB;
+
+static int clamp_index(int i, int n)
+{
+    return i < 0 ? 0 : i >= n ? n - 1 : i;
+}
+
+static __m128i load_epu8_epi16(const unsigned char *p)
+{
+    return _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)p));
+}
+
+/****************************************************************************/
+// v[x] = r0 + 4 r1 + 6 r2 + 4 r3 + r4 on 16 bits lanes, at most 4080
+static void binomial_column(const unsigned char *const *r, unsigned short *v, int w)
+{
+    int x = 0;
+    for(; x + 8 <= w; x += 8) {
+        __m128i a = _mm_add_epi16(load_epu8_epi16(r[0] + x), load_epu8_epi16(r[4] + x));
+        __m128i b = _mm_add_epi16(load_epu8_epi16(r[1] + x), load_epu8_epi16(r[3] + x));
+        __m128i c = load_epu8_epi16(r[2] + x);
+        a = _mm_add_epi16(a, _mm_slli_epi16(_mm_add_epi16(b, c), 2));
+        _mm_storeu_si128((__m128i *)(v + x), _mm_add_epi16(a, _mm_slli_epi16(c, 1)));
+    }
+    for(; x < w; x++)
+        v[x] = r[0][x] + r[4][x] + 4 * (r[1][x] + r[3][x]) + 6 * r[2][x];
+}
+
+// v[-pad ~ -1] and v[n ~ n + tail - 1] repeat the end entries
+static void pad_row(unsigned short *v, int n, int pad, int tail)
+{
+    for(int i = 1; i <= pad; i++)
+        v[-i] = v[0];
+    for(int i = 0; i < tail; i++)
+        v[n + i] = v[n - 1];
+}
+
+// 8 pixels of a 16 bits vector sum of weight 256, rounded
+static void store_sum_8(unsigned char *out, __m128i sum, int n)
+{
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+    sum = _mm_packus_epi16(sum, sum);
+    if(n >= 8) {
+        _mm_storel_epi64((__m128i *)out, sum);
+    } else {
+        unsigned char tmp[8];
+        _mm_storel_epi64((__m128i *)tmp, sum);
+        memcpy(out, tmp, n);
+    }
+}
+
+/*********************************************************/
+// REDUCE : output row Y is the column sum of source rows
+// 2Y-2 ~ 2Y+2, then the row filter is only evaluated at
+// the even columns ; the even and odd entries of the row
+// are split by packing the low and high halves of 32 bits
+// lanes, so 8 outputs take 3 loads of 16 entries
+/*********************************************************/
+static __m128i even_epi16(__m128i lo, __m128i hi)
+{
+    const __m128i mask = _mm_set1_epi32(0xffff);
+    return _mm_packus_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+}
+
+static __m128i odd_epi16(__m128i lo, __m128i hi)
+{
+    return _mm_packus_epi32(_mm_srli_epi32(lo, 16), _mm_srli_epi32(hi, 16));
+}
+
+static void reduce_row(const PYRJOB *job, int y, unsigned short *v)
+{
+    const unsigned char *r[5];
+    for(int i = 0; i < 5; i++)
+        r[i] = job->src + (size_t)clamp_index(2 * y - 2 + i - job->oy, job->sh) * job->sw;
+    binomial_column(r, v + job->ox, job->sw);
+    int tail = 2 * job->w + 20 - job->sw - job->ox;
+    pad_row(v + job->ox, job->sw, job->ox + 2, tail > 0 ? tail : 0);
+    unsigned char *out = job->dst + (size_t)y * job->w;
+    for(int x = 0; x < job->w; x += 8) {
+        const unsigned short *p = v + 2 * x - 2;
+        __m128i a0 = _mm_loadu_si128((const __m128i *)p), a1 = _mm_loadu_si128((const __m128i *)(p + 8));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(p + 2)), b1 = _mm_loadu_si128((const __m128i *)(p + 10));
+        __m128i c0 = _mm_loadu_si128((const __m128i *)(p + 4)), c1 = _mm_loadu_si128((const __m128i *)(p + 12));
+        __m128i e0 = even_epi16(b0, b1);
+        __m128i sum = _mm_add_epi16(even_epi16(a0, a1), even_epi16(c0, c1));
+        sum = _mm_add_epi16(sum, _mm_slli_epi16(_mm_add_epi16(odd_epi16(a0, a1), odd_epi16(b0, b1)), 2));
+        sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_slli_epi16(e0, 2), _mm_slli_epi16(e0, 1)));
+        store_sum_8(out + x, sum, job->w - x);
+    }
+}
+
+/*********************************************************/
+// EXPAND : an even output row is S[Y-1] + 6 S[Y] + S[Y+1]
+// of the source rows, an odd one 4 (S[Y] + S[Y+1]), the
+// same holds along the row ; 8 source columns give 16
+// interleaved outputs, the weights sum to 64
+/*********************************************************/
+static void expand_row(const PYRJOB *job, int y, unsigned short *v, unsigned char *e)
+{
+    const unsigned char *s0, *s1, *s2;
+    int sy = (y + job->oy) / 2, sw = job->sw, x = 0;
+    s1 = job->src + (size_t)clamp_index(sy, job->sh) * sw;
+    s2 = job->src + (size_t)clamp_index(sy + 1, job->sh) * sw;
+    if((y + job->oy) % 2) {
+        for(; x + 8 <= sw; x += 8) {
+            __m128i a = _mm_add_epi16(load_epu8_epi16(s1 + x), load_epu8_epi16(s2 + x));
+            _mm_storeu_si128((__m128i *)(v + x), _mm_slli_epi16(a, 2));
+        }
+        for(; x < sw; x++)
+            v[x] = 4 * (s1[x] + s2[x]);
+    } else {
+        s0 = job->src + (size_t)clamp_index(sy - 1, job->sh) * sw;
+        for(; x + 8 <= sw; x += 8) {
+            __m128i a = _mm_add_epi16(load_epu8_epi16(s0 + x), load_epu8_epi16(s2 + x));
+            __m128i b = load_epu8_epi16(s1 + x);
+            a = _mm_add_epi16(a, _mm_add_epi16(_mm_slli_epi16(b, 2), _mm_slli_epi16(b, 1)));
+            _mm_storeu_si128((__m128i *)(v + x), a);
+        }
+        for(; x < sw; x++)
+            v[x] = s0[x] + 6 * s1[x] + s2[x];
+    }
+    pad_row(v, sw, 1, 9);
+    const __m128i half = _mm_set1_epi16(32);
+    for(x = 0; x < sw; x += 8) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(v + x - 1));
+        __m128i c = _mm_loadu_si128((const __m128i *)(v + x));
+        __m128i r = _mm_loadu_si128((const __m128i *)(v + x + 1));
+        __m128i even = _mm_add_epi16(_mm_add_epi16(l, r), _mm_add_epi16(_mm_slli_epi16(c, 2), _mm_slli_epi16(c, 1)));
+        __m128i odd = _mm_slli_epi16(_mm_add_epi16(c, r), 2);
+        even = _mm_srli_epi16(_mm_add_epi16(even, half), 6);
+        odd = _mm_srli_epi16(_mm_add_epi16(odd, half), 6);
+        __m128i out = _mm_packus_epi16(_mm_unpacklo_epi16(even, odd), _mm_unpackhi_epi16(even, odd));
+        _mm_storeu_si128((__m128i *)(e + 2 * x), out);
+    }
+}
+
+// the expanded row e goes to dst, or into the laplacian band, or is added
+// to the laplacian band
+static void expand_store(const PYRJOB *job, int y, const unsigned char *e)
+{
+    size_t o = (size_t)y * job->w;
+    int x = 0, w = job->w;
+    if(job->diff) {
+        for(; x + 8 <= w; x += 8) {
+            __m128i d = _mm_sub_epi16(load_epu8_epi16(job->base + o + x), load_epu8_epi16(e + x));
+            _mm_storeu_si128((__m128i *)(job->diff + o + x), d);
+        }
+        for(; x < w; x++)
+            job->diff[o + x] = job->base[o + x] - e[x];
+    } else if(job->add) {
+        for(; x + 8 <= w; x += 8) {
+            __m128i s = _mm_add_epi16(load_epu8_epi16(e + x), _mm_loadu_si128((const __m128i *)(job->add + o + x)));
+            _mm_storel_epi64((__m128i *)(job->dst + o + x), _mm_packus_epi16(s, s));
+        }
+        for(; x < w; x++) {
+            int s = e[x] + job->add[o + x];
+            job->dst[o + x] = s < 0 ? 0 : s > 255 ? 255 : s;
+        }
+    } else {
+        memcpy(job->dst + o, e, w);
+    }
+}
+
+/*********************************************************/
+// SMOOTH : the 5x5 binomial at the same size, the blur
+// passes of pyramid_blur at the smallest level
+/*********************************************************/
+static void smooth_row(const PYRJOB *job, int y, unsigned short *v)
+{
+    const unsigned char *r[5];
+    for(int i = 0; i < 5; i++)
+        r[i] = job->src + (size_t)clamp_index(y - 2 + i, job->h) * job->w;
+    binomial_column(r, v, job->w);
+    pad_row(v, job->w, 2, 10);
+    unsigned char *out = job->dst + (size_t)y * job->w;
+    for(int x = 0; x < job->w; x += 8) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(v + x));
+        __m128i sum = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(v + x - 2)), _mm_loadu_si128((const __m128i *)(v + x + 2)));
+        __m128i near = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(v + x - 1)), _mm_loadu_si128((const __m128i *)(v + x + 1)));
+        sum = _mm_add_epi16(sum, _mm_slli_epi16(_mm_add_epi16(near, c), 2));
+        store_sum_8(out + x, _mm_add_epi16(sum, _mm_slli_epi16(c, 1)), job->w - x);
+    }
+}
+
+static void reduce_band(void *arg, int item)
+{
+    PYRJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h;
+    unsigned short *v = malloc((2 * (size_t)job->w + job->sw + job->ox + 32) * sizeof(unsigned short));
+    if(!v) {
+        fprintf(stderr, "pyramid : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    for(int y = item * BAND_ROWS; y < y1; y++)
+        reduce_row(job, y, v + 2);
+    free(v);
+}
+
+static void expand_band(void *arg, int item)
+{
+    PYRJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h;
+    unsigned short *v = malloc(((size_t)job->sw + 16) * sizeof(unsigned short));
+    unsigned char *e = malloc(2 * (size_t)job->sw + 16);
+    if(!v || !e) {
+        fprintf(stderr, "pyramid : out of memory\n");
+        job->ok = 0;
+        free(v);
+        free(e);
+        return;
+    }
+    for(int y = item * BAND_ROWS; y < y1; y++) {
+        expand_row(job, y, v + 1, e);
+        expand_store(job, y, e + job->ox);
+    }
+    free(v);
+    free(e);
+}
+
+static void smooth_band(void *arg, int item)
+{
+    PYRJOB *job = arg;
+    int y1 = (item + 1) * BAND_ROWS < job->h ? (item + 1) * BAND_ROWS : job->h;
+    unsigned short *v = malloc(((size_t)job->w + 16) * sizeof(unsigned short));
+    if(!v) {
+        fprintf(stderr, "pyramid : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    for(int y = item * BAND_ROWS; y < y1; y++)
+        smooth_row(job, y, v + 2);
+    free(v);
+}
+
+static int run_bands(PYRJOB *job, POOLFN fn)
+{
+    pool_run(pool_default(), (job->h + BAND_ROWS - 1) / BAND_ROWS, fn, job);
+    return job->ok;
+}
+
+static int size_ok(int w, int h)
+{
+    if(w < 1 || h < 1) {
+        fprintf(stderr, "pyramid : bad size %d x %d\n", w, h);
+        return 0;
+    }
+    return 1;
+}
+
+// The source of reduce_to sits at (ox, oy) of a virtual image of clamped
+// pixels, the dw x dh output covers it from (0, 0). The w x h output of
+// expand_from is cut at (ox, oy) out of the expansion of sw x sh.
+static int reduce_to(const unsigned char *src, unsigned char *dst, int sw, int sh, int dw, int dh, int ox, int oy)
+{
+    PYRJOB job = {src, dst, sw, sh, dw, dh, NULL, NULL, NULL, NULL, ox, oy, 1};
+    return run_bands(&job, reduce_band);
+}
+
+static int expand_from(const unsigned char *src, unsigned char *dst, int sw, int sh, int w, int h, int ox, int oy)
+{
+    PYRJOB job = {src, dst, sw, sh, w, h, NULL, NULL, NULL, NULL, ox, oy, 1};
+    return run_bands(&job, expand_band);
+}
+
+int pyramid_reduce(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    return size_ok(w, h) && reduce_to(src, dst, w, h, (w + 1) / 2, (h + 1) / 2, 0, 0);
+}
+
+int pyramid_expand(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    return size_ok(w, h) && expand_from(src, dst, (w + 1) / 2, (h + 1) / 2, w, h, 0, 0);
+}
+
+static int smooth(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    PYRJOB job = {src, dst, w, h, w, h, NULL, NULL, NULL, NULL, 0, 0, 1};
+    return run_bands(&job, smooth_band);
+}
+
+/****************************************************************************/
+// Sizes of the levels and one allocation for all of them : the laplacian
+// bands first (16 bits), then the gaussian levels, every level 16 bytes
+// aligned. The smallest level keeps at least 1 pixel.
+static int pyramid_alloc(PYRAMID *pyr, int w, int h, int levels, int laplacian)
+{
+    memset(pyr, 0, sizeof(PYRAMID));
+    if(!size_ok(w, h))
+        return 0;
+    levels = levels < 1 ? 1 : levels > PYRAMID_MAX_LEVELS ? PYRAMID_MAX_LEVELS : levels;
+    pyr->w[0] = w;
+    pyr->h[0] = h;
+    pyr->levels = 1;
+    while(pyr->levels < levels && (pyr->w[pyr->levels - 1] > 1 || pyr->h[pyr->levels - 1] > 1)) {
+        pyr->w[pyr->levels] = (pyr->w[pyr->levels - 1] + 1) / 2;
+        pyr->h[pyr->levels] = (pyr->h[pyr->levels - 1] + 1) / 2;
+        pyr->levels++;
+    }
+    size_t size = 0, offset[2 * PYRAMID_MAX_LEVELS];
+    for(int i = 0; laplacian && i < pyr->levels - 1; i++) {
+        offset[PYRAMID_MAX_LEVELS + i] = size;
+        size += ((size_t)pyr->w[i] * pyr->h[i] * sizeof(short) + 15) & ~(size_t)15;
+    }
+    for(int i = 0; i < pyr->levels; i++) {
+        offset[i] = size;
+        size += ((size_t)pyr->w[i] * pyr->h[i] + 15) & ~(size_t)15;
+    }
+    if(!(pyr->arena = _mm_malloc(size, 16))) {
+        fprintf(stderr, "pyramid : out of memory\n");
+        return 0;
+    }
+    for(int i = 0; i < pyr->levels; i++)
+        pyr->gauss[i] = (unsigned char *)pyr->arena + offset[i];
+    for(int i = 0; laplacian && i < pyr->levels - 1; i++)
+        pyr->lap[i] = (short *)((unsigned char *)pyr->arena + offset[PYRAMID_MAX_LEVELS + i]);
+    return 1;
+}
+
+static int pyramid_build(PYRAMID *pyr, const unsigned char *src, int w, int h, int levels, int laplacian)
+{
+    if(!pyramid_alloc(pyr, w, h, levels, laplacian))
+        return 0;
+    int ok = 1;
+    memcpy(pyr->gauss[0], src, (size_t)w * h);
+    for(int i = 0; ok && i + 1 < pyr->levels; i++)
+        ok = pyramid_reduce(pyr->gauss[i], pyr->gauss[i + 1], pyr->w[i], pyr->h[i]);
+    for(int i = 0; ok && laplacian && i + 1 < pyr->levels; i++) {
+        PYRJOB job = {pyr->gauss[i + 1], NULL, pyr->w[i + 1], pyr->h[i + 1], pyr->w[i], pyr->h[i],
+                      pyr->gauss[i], pyr->lap[i], NULL, NULL, 0, 0, 1};
+        ok = run_bands(&job, expand_band);
+    }
+    if(!ok)
+        pyramid_free(pyr);
+    return ok;
+}
+
+int pyramid_gaussian(PYRAMID *pyr, const unsigned char *src, int w, int h, int levels)
+{
+    return pyramid_build(pyr, src, w, h, levels, 0);
+}
+
+int pyramid_laplacian(PYRAMID *pyr, const unsigned char *src, int w, int h, int levels)
+{
+    return pyramid_build(pyr, src, w, h, levels, 1);
+}
+
+// the levels are rebuilt from the smallest up into the gaussian slots of
+// the arena, level 0 into dst
+int pyramid_reconstruct(const PYRAMID *pyr, unsigned char *dst)
+{
+    if(!pyr->arena || (pyr->levels > 1 && !pyr->lap[0])) {
+        fprintf(stderr, "pyramid : no laplacian bands\n");
+        return 0;
+    }
+    int ok = 1;
+    for(int i = pyr->levels - 2; ok && i >= 0; i--) {
+        PYRJOB job = {pyr->gauss[i + 1], i ? pyr->gauss[i] : dst, pyr->w[i + 1], pyr->h[i + 1], pyr->w[i], pyr->h[i],
+                      NULL, NULL, pyr->lap[i], NULL, 0, 0, 1};
+        ok = run_bands(&job, expand_band);
+    }
+    if(pyr->levels == 1)
+        memcpy(dst, pyr->gauss[0], (size_t)pyr->w[0] * pyr->h[0]);
+    return ok;
+}
+
+void pyramid_free(PYRAMID *pyr)
+{
+    _mm_free(pyr->arena);
+    memset(pyr, 0, sizeof(PYRAMID));
+}
+
+/****************************************************************************/
+// exp(-x) for x >= 0 without libm : series on x / 64, squared 6 times
+static float exp_neg(float x)
+{
+    float t = x / 64, e = 1 - t * (1 - t / 2 * (1 - t / 3 * (1 - t / 4)));
+    for(int i = 0; i < 6; i++)
+        e *= e;
+    return e;
+}
+
+static void gaussian_kernel(KERNEL *k, float sigma)
+{
+    float g[KERNEL_MAX], sum = 0;
+    int r = (int)(3 * sigma + 0.999f);
+    memset(k, 0, sizeof(KERNEL));
+    k->size = 2 * r + 1;
+    k->divisor = 1;
+    k->separable = 1;
+    for(int i = 0; i < k->size; i++)
+        sum += g[i] = exp_neg((float)(i - r) * (i - r) / (2 * sigma * sigma));
+    for(int i = 0; i < k->size; i++)
+        k->row[i] = k->col[i] = g[i] / sum;
+}
+
+/*********************************************************/
+// direct gaussian, rows [y0,y1) : the source rows of the
+// band (clamped at the ends) are padded by the radius on
+// both sides and go through the row pass once, the
+// column pass takes the kernel size of them
+/*********************************************************/
+static void direct_band(void *arg, int item)
+{
+    PYRJOB *job = arg;
+    int y0 = item * BAND_ROWS, y1 = y0 + BAND_ROWS < job->h ? y0 + BAND_ROWS : job->h;
+    int r = job->k->size / 2, n = job->w + 2 * r, rows = y1 - y0 + 2 * r;
+    float *buf = malloc(((size_t)rows * n + n + job->w) * sizeof(float));
+    if(!buf) {
+        fprintf(stderr, "pyramid : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    float *in = buf + (size_t)rows * n, *out = in + n;
+    for(int i = 0; i < rows; i++) {
+        const unsigned char *s = job->src + (size_t)clamp_index(y0 - r + i, job->h) * job->w;
+        for(int x = 0; x < n; x++)
+            in[x] = s[clamp_index(x - r, job->w)];
+        conv_row_float(job->k, in, buf + (size_t)i * n, n, 1);
+    }
+    const float *col[KERNEL_MAX];
+    for(int y = y0; y < y1; y++) {
+        for(int t = 0; t < job->k->size; t++)
+            col[t] = buf + (size_t)(y - y0 + t) * n + r;
+        conv_col_float(job->k, col, out, job->w);
+        unsigned char *d = job->dst + (size_t)y * job->w;
+        int x = 0;
+        for(; x + 8 <= job->w; x += 8) {
+            __m128i a = _mm_cvtps_epi32(_mm_loadu_ps(out + x)), b = _mm_cvtps_epi32(_mm_loadu_ps(out + x + 4));
+            a = _mm_packs_epi32(a, b);
+            _mm_storel_epi64((__m128i *)(d + x), _mm_packus_epi16(a, a));
+        }
+        for(; x < job->w; x++) {
+            int v = (int)(out[x] + 0.5f);
+            d[x] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+    }
+    free(buf);
+}
+
+/****************************************************************************/
+// Above PYRAMID_BLUR_DIRECT : k reductions, m binomial passes at level k and
+// k expansions. A reduce or an expand at level i adds a variance of 4^i
+// (the kernel has a variance of 1 level i pixel), a pass 4^k, so sigma^2 =
+// 2 (4^k - 1) / 3 + m 4^k ; k is the largest with 4^(k+1) <= sigma^2, m is
+// rounded. The levels sample a virtual image, the source framed by 3 sigma
+// of clamped pixels (up to twice the image size) and stretched to n 2^k + 1
+// pixels : the coarse levels would clamp at their own, much coarser border
+// otherwise, and the last sample of an even size would move in at every
+// level. Levels 1 ~ k and a spare one for the passes share one arena, the
+// expansions go back up through the same slots.
+int pyramid_blur(const unsigned char *src, unsigned char *dst, int w, int h, float sigma)
+{
+    if(!size_ok(w, h))
+        return 0;
+    if(!(sigma >= 0)) {
+        fprintf(stderr, "pyramid : bad sigma %g\n", sigma);
+        return 0;
+    }
+    if(sigma < 0.25f) {
+        memcpy(dst, src, (size_t)w * h);
+        return 1;
+    }
+    if(sigma <= PYRAMID_BLUR_DIRECT) {
+        KERNEL k;
+        gaussian_kernel(&k, sigma);
+        PYRJOB job = {src, dst, w, h, w, h, NULL, NULL, NULL, &k, 0, 0, 1};
+        return run_bands(&job, direct_band);
+    }
+    double var = (double)sigma * sigma, p = 1;
+    int k = 0, lw[PYRAMID_MAX_LEVELS] = {w}, lh[PYRAMID_MAX_LEVELS] = {h};
+    int pad = 3 * sigma < 2 * (w > h ? w : h) ? (int)(3 * sigma) : 2 * (w > h ? w : h);
+    int vw = w + 2 * pad, vh = h + 2 * pad;
+    size_t offset[PYRAMID_MAX_LEVELS + 1], size = 0;
+    while(k + 1 < PYRAMID_MAX_LEVELS && 16 * p <= var && ((vw - 2 + (1 << k)) >> k > 1 || (vh - 2 + (1 << k)) >> k > 1)) {
+        p *= 4;
+        k++;
+    }
+    for(int i = 1; i <= k; i++) {
+        lw[i] = ((vw - 2 + (1 << k)) >> k << (k - i)) + 1;
+        lh[i] = ((vh - 2 + (1 << k)) >> k << (k - i)) + 1;
+        offset[i] = size;
+        size += ((size_t)lw[i] * lh[i] + 15) & ~(size_t)15;
+    }
+    offset[k + 1] = size;
+    size += ((size_t)lw[k] * lh[k] + 15) & ~(size_t)15;
+    unsigned char *arena = _mm_malloc(size, 16);
+    if(!arena) {
+        fprintf(stderr, "pyramid : out of memory\n");
+        return 0;
+    }
+    // once the level is down to 2 x 2 the passes only flatten it
+    int passes = (int)((var - 2 * (p - 1) / 3) / p + 0.5), ok = 1;
+    passes = passes < 1024 ? passes : 1024;
+    const unsigned char *in = src;
+    for(int i = 0; ok && i < k; i++) {
+        ok = reduce_to(in, arena + offset[i + 1], lw[i], lh[i], lw[i + 1], lh[i + 1], i ? 0 : pad, i ? 0 : pad);
+        in = arena + offset[i + 1];
+    }
+    unsigned char *cur = arena + offset[k], *spare = arena + offset[k + 1];
+    for(int i = 0; ok && i < passes; i++) {
+        ok = smooth(cur, spare, lw[k], lh[k]);
+        unsigned char *t = cur;
+        cur = spare;
+        spare = t;
+    }
+    for(int i = k - 1; ok && i >= 0; i--) {
+        unsigned char *out = i ? arena + offset[i] : dst;
+        ok = expand_from(cur, out, lw[i + 1], lh[i + 1], lw[i], lh[i], i ? 0 : pad, i ? 0 : pad);
+        cur = out;
+    }
+    _mm_free(arena);
+    return ok;
+}
+
+int pyramid_blur_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, float sigma)
+{
+    size_t n = (size_t)w * h;
+    unsigned char *plane = malloc(2 * n);
+    if(!plane) {
+        fprintf(stderr, "pyramid : out of memory\n");
+        return 0;
+    }
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *out = (unsigned char *)dst, *blurred = plane + n;
+    int ok = 1;
+    for(int c = 0; ok && c < 3; c++) {
+        for(size_t i = 0; i < n; i++)
+            plane[i] = in[3 * i + c];
+        ok = pyramid_blur(plane, blurred, w, h, sigma);
+        for(size_t i = 0; ok && i < n; i++)
+            out[3 * i + c] = blurred[i];
+    }
+    free(plane);
+    return ok;
+}
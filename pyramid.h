@@ -0,0 +1,38 @@
+#ifndef IMAGE_PYRAMID
+#define IMAGE_PYRAMID
+#include "bmp.h"
+
+#define PYRAMID_MAX_LEVELS 16
+
+// Gaussian / Laplacian pyramids of a planar plane with the 5x5 binomial
+// kernel (1 4 6 4 1)^2 / 256, borders clamped. Level i + 1 is
+// ((w_i + 1) / 2) x ((h_i + 1) / 2). Every level lives in one arena.
+typedef struct image_pyramid {
+    int levels;
+    int w[PYRAMID_MAX_LEVELS];
+    int h[PYRAMID_MAX_LEVELS];
+    unsigned char *gauss[PYRAMID_MAX_LEVELS]; // level 0 is a copy of the source
+    short *lap[PYRAMID_MAX_LEVELS]; // gauss[i] - expand(gauss[i + 1]), levels - 1 of them
+    void *arena;
+} PYRAMID;
+
+// blur fused with the 2x decimation : only the kept pixels are computed and
+// the blurred rows never exist at full size ; dst is ((w + 1) / 2) x ((h + 1) / 2)
+int pyramid_reduce(const unsigned char *src, unsigned char *dst, int w, int h);
+// 2x interpolation by the same kernel, src is ((w + 1) / 2) x ((h + 1) / 2)
+int pyramid_expand(const unsigned char *src, unsigned char *dst, int w, int h);
+// levels is clamped so that the smallest level keeps at least 1 pixel
+int pyramid_gaussian(PYRAMID *pyr, const unsigned char *src, int w, int h, int levels);
+int pyramid_laplacian(PYRAMID *pyr, const unsigned char *src, int w, int h, int levels);
+// level 0 back from the laplacian bands, exact, dst is w[0] x h[0]
+int pyramid_reconstruct(const PYRAMID *pyr, unsigned char *dst);
+void pyramid_free(PYRAMID *pyr);
+
+// Gaussian blur of any sigma, borders clamped. Up to sigma 10 a direct
+// separable kernel of radius 3 sigma ; beyond, reduce k levels (4^(k+1) <=
+// sigma^2), binomial passes at the smallest one and expand back, so a large
+// blur costs a fraction of one full size pass. The variance of the reduce /
+// expand chain is counted, sigma is matched within ~6 %.
+int pyramid_blur(const unsigned char *src, unsigned char *dst, int w, int h, float sigma);
+int pyramid_blur_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, float sigma);
+#endif // IMAGE_PYRAMID
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "qoi.h"
+#include "pool.h"
+
+#define QOI_OP_INDEX 0x00 // 00xxxxxx
+#define QOI_OP_DIFF 0x40 // 01xxxxxx
+#define QOI_OP_LUMA 0x80 // 10xxxxxx
+#define QOI_OP_RUN 0xc0 // 11xxxxxx
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_MASK 0xc0
+#define QOI_HEADER 14
+#define QOI_TRAILER 12 // strip rows, strips and magic after the offsets
+// same limit as the reference decoder, keeps w * h * 4 far from overflowing
+#define QOI_PIXELS_MAX 400000000ULL
+#define QOI_HASH(r,g,b,a) (((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) & 63)
+// a pixel with its alpha, as the colour index keeps it
+#define QOI_PACK(r,g,b,a) ((unsigned int)(r) | (unsigned int)(g) << 8 | (unsigned int)(b) << 16 | (unsigned int)(a) << 24)
+
+static const unsigned char qoi_padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+typedef struct qoi_job {
+    const IMAGE *img; // encode : source
+    RGBTRIPLE *data; // decode : destination, rows bottom-up
+    unsigned char *out; // encode : strip i at QOI_HEADER + 4 * w * first row
+    size_t *len; // encode : bytes of each strip
+    const unsigned char *in; // decode : the stream
+    const unsigned char *table; // decode : strip offsets, NULL for one strip
+    size_t end; // decode : end of the last strip
+    int w;
+    int h;
+    int strip_rows;
+    int strips;
+    int ok;
+} QOIJOB;
+
+// encoder state, reset at every strip
+typedef struct qoi_state {
+    unsigned int index[64];
+    unsigned int prev;
+    int run;
+} QOISTATE;
+
+/****************************************************************************/
+static unsigned int rd32_be(const unsigned char *p)
+{
+    return (unsigned int)p[0] << 24 | (unsigned int)p[1] << 16 | (unsigned int)p[2] << 8 | p[3];
+}
+
+static void wr32_be(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static unsigned long long rd_le(const unsigned char *p, int bytes)
+{
+    unsigned long long v = 0;
+    while(bytes--)
+        v = v << 8 | p[bytes];
+    return v;
+}
+
+static void wr_le(unsigned char *p, unsigned long long v, int bytes)
+{
+    for(int i = 0; i < bytes; i++, v >>= 8)
+        p[i] = v;
+}
+
+int qoi_is_name(const char *fileName)
+{
+    size_t len = strlen(fileName);
+    return len > 4 && strcasecmp(fileName + len - 4, ".qoi") == 0;
+}
+
+/****************************************************************************/
+// Encoder
+/****************************************************************************/
+static unsigned char *encode_pixels(QOISTATE *s, const RGBTRIPLE *px, int n, unsigned char *p)
+{
+    for(int x = 0; x < n; x++) {
+        int r = px[x].rgbRed, g = px[x].rgbGreen, b = px[x].rgbBlue;
+        unsigned int v = QOI_PACK(r, g, b, 255);
+        if(v == s->prev) {
+            if(++s->run == 62) {
+                *p++ = QOI_OP_RUN | (s->run - 1);
+                s->run = 0;
+            }
+            continue;
+        }
+        if(s->run) {
+            *p++ = QOI_OP_RUN | (s->run - 1);
+            s->run = 0;
+        }
+        int hash = QOI_HASH(r, g, b, 255);
+        if(s->index[hash] == v) {
+            *p++ = QOI_OP_INDEX | hash;
+        } else {
+            s->index[hash] = v;
+            signed char vr = r - (int)(s->prev & 0xff);
+            signed char vg = g - (int)(s->prev >> 8 & 0xff);
+            signed char vb = b - (int)(s->prev >> 16 & 0xff);
+            signed char vg_r = vr - vg, vg_b = vb - vg;
+            if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                *p++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+            } else if(vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                *p++ = QOI_OP_LUMA | (vg + 32);
+                *p++ = (vg_r + 8) << 4 | (vg_b + 8);
+            } else {
+                *p++ = QOI_OP_RGB;
+                *p++ = r;
+                *p++ = g;
+                *p++ = b;
+            }
+        }
+        s->prev = v;
+    }
+    return p;
+}
+
+static void encode_strip(void *arg, int item)
+{
+    QOIJOB *job = arg;
+    const IMAGE *img = job->img;
+    int w = job->w, h = job->h;
+    int y0 = item * job->strip_rows;
+    int y1 = y0 + job->strip_rows < h ? y0 + job->strip_rows : h;
+    // QOI is top row first, the memory rows of the strip are reversed
+    // when the image is bottom-up
+    int bottom_up = img->info.biHeight > 0;
+    int m0 = bottom_up ? h - y1 : y0;
+    const RGBTRIPLE *rows = img->data + (size_t)m0 * w;
+    RGBTRIPLE *view = NULL;
+    if(img->orient) {
+        view = malloc((size_t)(y1 - y0) * w * sizeof(RGBTRIPLE));
+        if(!view) {
+            job->ok = 0;
+            return;
+        }
+        image_view_rows(img, view, m0, m0 + y1 - y0);
+        rows = view;
+    }
+    QOISTATE s;
+    unsigned char *start = job->out + QOI_HEADER + (size_t)y0 * w * 4, *p = start;
+    memset(&s, 0, sizeof(s));
+    for(int y = y0; y < y1; y++) {
+        const RGBTRIPLE *row = rows + (size_t)(bottom_up ? y1 - 1 - y : y - y0) * w;
+        int x = 0;
+        if(y == y0) {
+            // a literal, whatever the previous strip ended with
+            *p++ = QOI_OP_RGB;
+            *p++ = row[0].rgbRed;
+            *p++ = row[0].rgbGreen;
+            *p++ = row[0].rgbBlue;
+            s.prev = QOI_PACK(row[0].rgbRed, row[0].rgbGreen, row[0].rgbBlue, 255);
+            s.index[QOI_HASH(row[0].rgbRed, row[0].rgbGreen, row[0].rgbBlue, 255)] = s.prev;
+            x = 1;
+        }
+        p = encode_pixels(&s, row + x, w - x, p);
+    }
+    if(s.run)
+        *p++ = QOI_OP_RUN | (s.run - 1);
+    job->len[item] = p - start;
+    free(view);
+}
+
+unsigned char *qoi_encode(const IMAGE *img, int strip_rows, size_t *size)
+{
+    int w = IMAGE_VIEW_WIDTH(img), h = IMAGE_VIEW_HEIGHT(img);
+    if(w <= 0 || h <= 0 || (unsigned long long)w * h > QOI_PIXELS_MAX) {
+        fprintf(stderr, "qoi : can't code a %d x %d image\n", w, h);
+        return NULL;
+    }
+    if(strip_rows <= 0 || strip_rows > h)
+        strip_rows = h;
+    int strips = (h + strip_rows - 1) / strip_rows;
+    // 4 bytes per pixel at worst, the strips are coded at their worst case
+    // offsets then moved down behind each other
+    size_t bound = QOI_HEADER + (size_t)w * h * 4 + sizeof(qoi_padding) + (size_t)strips * 8 + QOI_TRAILER;
+    unsigned char *buf = malloc(bound);
+    size_t *len = malloc(strips * sizeof(size_t));
+    QOIJOB job = {img, NULL, buf, len, NULL, NULL, 0, w, h, strip_rows, strips, 1};
+    if(buf && len)
+        pool_run(pool_default(), strips, encode_strip, &job);
+    if(!buf || !len || !job.ok) {
+        fprintf(stderr, "qoi : out of memory\n");
+        free(buf);
+        free(len);
+        return NULL;
+    }
+    memcpy(buf, "qoif", 4);
+    wr32_be(buf + 4, w);
+    wr32_be(buf + 8, h);
+    buf[12] = 3; // channels
+    buf[13] = 0; // sRGB
+    size_t at = QOI_HEADER;
+    for(int i = 0; i < strips; i++) {
+        size_t n = len[i];
+        memmove(buf + at, buf + QOI_HEADER + (size_t)i * strip_rows * w * 4, n);
+        len[i] = at; // now the offset of the strip
+        at += n;
+    }
+    memcpy(buf + at, qoi_padding, sizeof(qoi_padding));
+    at += sizeof(qoi_padding);
+    for(int i = 0; i < strips; i++, at += 8)
+        wr_le(buf + at, len[i], 8);
+    wr_le(buf + at, strip_rows, 4);
+    wr_le(buf + at + 4, strips, 4);
+    memcpy(buf + at + 8, "qoix", 4);
+    at += QOI_TRAILER;
+    free(len);
+    *size = at;
+    return buf;
+}
+
+/****************************************************************************/
+// Decoder
+/****************************************************************************/
+// exact : the strip must use its bytes up to end, no more, no less
+static int decode_rows(const unsigned char *p, const unsigned char *end, RGBTRIPLE *data, int w, int h, int y0, int y1,
+                       int exact)
+{
+    unsigned int index[64];
+    unsigned char r = 0, g = 0, b = 0, a = 255;
+    int run = 0;
+    memset(index, 0, sizeof(index));
+    for(int y = y0; y < y1; y++) {
+        RGBTRIPLE *out = data + (size_t)(h - 1 - y) * w;
+        for(int x = 0; x < w; x++) {
+            if(run > 0) {
+                run--;
+            } else {
+                if(p >= end)
+                    return 0;
+                int b1 = *p++;
+                if(b1 == QOI_OP_RGB) {
+                    if(end - p < 3)
+                        return 0;
+                    r = p[0];
+                    g = p[1];
+                    b = p[2];
+                    p += 3;
+                } else if(b1 == QOI_OP_RGBA) {
+                    if(end - p < 4)
+                        return 0;
+                    r = p[0];
+                    g = p[1];
+                    b = p[2];
+                    a = p[3];
+                    p += 4;
+                } else if((b1 & QOI_MASK) == QOI_OP_INDEX) {
+                    r = index[b1];
+                    g = index[b1] >> 8;
+                    b = index[b1] >> 16;
+                    a = index[b1] >> 24;
+                } else if((b1 & QOI_MASK) == QOI_OP_DIFF) {
+                    r += ((b1 >> 4) & 3) - 2;
+                    g += ((b1 >> 2) & 3) - 2;
+                    b += (b1 & 3) - 2;
+                } else if((b1 & QOI_MASK) == QOI_OP_LUMA) {
+                    if(p >= end)
+                        return 0;
+                    int b2 = *p++, vg = (b1 & 0x3f) - 32;
+                    r += vg - 8 + ((b2 >> 4) & 0x0f);
+                    g += vg;
+                    b += vg - 8 + (b2 & 0x0f);
+                } else {
+                    run = b1 & 0x3f;
+                }
+                index[QOI_HASH(r, g, b, a)] = QOI_PACK(r, g, b, a);
+            }
+            out[x].rgbBlue = b;
+            out[x].rgbGreen = g;
+            out[x].rgbRed = r;
+        }
+    }
+    return !exact || (p == end && run == 0);
+}
+
+static void decode_strip(void *arg, int item)
+{
+    QOIJOB *job = arg;
+    int y0 = item * job->strip_rows;
+    int y1 = y0 + job->strip_rows < job->h ? y0 + job->strip_rows : job->h;
+    size_t from = job->table ? rd_le(job->table + (size_t)item * 8, 8) : QOI_HEADER;
+    size_t to = item + 1 < job->strips ? rd_le(job->table + (size_t)(item + 1) * 8, 8) : job->end;
+    if(!decode_rows(job->in + from, job->in + to, job->data, job->w, job->h, y0, y1, job->table != NULL))
+        job->ok = 0;
+}
+
+// use the strip offsets when they are present and consistent : they start
+// at the first chunk, grow and end before the end marker
+static void find_strips(QOIJOB *job, size_t size)
+{
+    job->table = NULL;
+    job->strip_rows = job->h;
+    job->strips = 1;
+    job->end = size - sizeof(qoi_padding);
+    if(size < QOI_HEADER + sizeof(qoi_padding) + 8 + QOI_TRAILER || memcmp(job->in + size - 4, "qoix", 4) != 0)
+        return;
+    unsigned long long rows = rd_le(job->in + size - QOI_TRAILER, 4);
+    unsigned long long strips = rd_le(job->in + size - QOI_TRAILER + 4, 4);
+    size_t room = size - QOI_HEADER - sizeof(qoi_padding) - QOI_TRAILER;
+    if(rows == 0 || strips != (job->h + rows - 1) / rows || strips > room / 8)
+        return;
+    size_t at = size - QOI_TRAILER - strips * 8, end = at - sizeof(qoi_padding);
+    if(memcmp(job->in + end, qoi_padding, sizeof(qoi_padding)) != 0 || rd_le(job->in + at, 8) != QOI_HEADER)
+        return;
+    for(size_t i = 1; i < strips; i++) {
+        unsigned long long prev = rd_le(job->in + at + (i - 1) * 8, 8), next = rd_le(job->in + at + i * 8, 8);
+        if(next <= prev || next >= end)
+            return;
+    }
+    job->table = job->in + at;
+    job->strip_rows = rows;
+    job->strips = strips;
+    job->end = end;
+}
+
+int qoi_decode(IMAGE *img, const unsigned char *buf, size_t size, const char *fileName)
+{
+    if(size < QOI_HEADER + sizeof(qoi_padding) || memcmp(buf, "qoif", 4) != 0) {
+        fprintf(stderr, "%s: not a QOI file\n", fileName);
+        return 0;
+    }
+    unsigned int w = rd32_be(buf + 4), h = rd32_be(buf + 8);
+    if(w == 0 || h == 0 || (unsigned long long)w * h > QOI_PIXELS_MAX || (buf[12] != 3 && buf[12] != 4) || buf[13] > 1) {
+        fprintf(stderr, "%s: bad QOI header\n", fileName);
+        return 0;
+    }
+    if(!image_reserve(img, w, h))
+        return 0;
+    image_header(img, w, h);
+    QOIJOB job = {NULL, img->data, NULL, NULL, buf, NULL, 0, w, h, 0, 0, 1};
+    find_strips(&job, size);
+    pool_run(pool_default(), job.strips, decode_strip, &job);
+    if(!job.ok && job.table) {
+        // the offsets don't match the stream, which may still be fine
+        job.ok = 1;
+        job.table = NULL;
+        job.strip_rows = h;
+        job.strips = 1;
+        job.end = size - sizeof(qoi_padding);
+        decode_strip(&job, 0);
+    }
+    if(!job.ok) {
+        fprintf(stderr, "%s: truncated QOI data\n", fileName);
+        return 0;
+    }
+    return 1;
+}
+
+/****************************************************************************/
+int qoi_load(IMAGE *img, const char *fileName)
+{
+    FILE *qoiFile = fopen(fileName, "rb");
+    if(!qoiFile) {
+        fprintf(stderr, "%s: can't open file\n", fileName);
+        return 0;
+    }
+    // the whole stream is read at once, the strips are then decoded from
+    // memory by the pool
+    long size = -1;
+    unsigned char *buf = NULL;
+    if(fseek(qoiFile, 0, SEEK_END) == 0 && (size = ftell(qoiFile)) > 0 && fseek(qoiFile, 0, SEEK_SET) == 0)
+        buf = malloc(size);
+    int ok = buf && fread(buf, size, 1, qoiFile) == 1;
+    fclose(qoiFile);
+    if(!ok)
+        fprintf(stderr, "%s: can't read file\n", fileName);
+    else
+        ok = qoi_decode(img, buf, size, fileName);
+    free(buf);
+    return ok;
+}
+
+int qoi_save(const IMAGE *img, const char *fileName)
+{
+    size_t size;
+    unsigned char *buf = qoi_encode(img, QOI_STRIP_ROWS, &size);
+    if(!buf)
+        return 0;
+    FILE *newFile = fopen(fileName, "wb");
+    if(!newFile) {
+        fprintf(stderr, "%s: can't create file\n", fileName);
+        free(buf);
+        return 0;
+    }
+    int ok = fwrite(buf, size, 1, newFile) == 1;
+    if(fclose(newFile) != 0)
+        ok = 0;
+    free(buf);
+    return ok;
+}
@@ -0,0 +1,29 @@
+#ifndef QOI_CODEC
+#define QOI_CODEC
+#include <stddef.h>
+#include "image.h"
+
+// QOI ("Quite OK Image", qoiformat.org) : lossless, one pass and a handful
+// of operations per pixel, so it costs far less than moving the 3 bytes per
+// pixel of a BMP through a slow disk or network share.
+// The image is coded in strips of QOI_STRIP_ROWS rows : a strip starts with
+// a literal pixel and no run crosses its end, so it only refers to its own
+// pixels and the strips are encoded / decoded in parallel on the pool. The
+// stream itself stays plain QOI that any decoder reads serially ; the strip
+// offsets are stored after the end marker, where decoders stop reading :
+//   offset of each strip (8 bytes) , strip rows (4) , strips (4) , "qoix"
+// all little endian.
+#define QOI_STRIP_ROWS 64
+
+// 1 when fileName ends with .qoi
+int qoi_is_name(const char *fileName);
+// code the view of img, strip_rows 0 for a single strip ; returns a malloc'd
+// buffer of *size bytes or NULL
+unsigned char *qoi_encode(const IMAGE *img, int strip_rows, size_t *size);
+// fill img as bmp_read does (24 bits, rows bottom-up) from any 3 or 4
+// channels QOI, alpha is dropped ; a stream without strip offsets, or with
+// offsets which do not match it, is decoded serially
+int qoi_decode(IMAGE *img, const unsigned char *buf, size_t size, const char *fileName);
+int qoi_load(IMAGE *img, const char *fileName);
+int qoi_save(const IMAGE *img, const char *fileName);
+#endif // QOI_CODEC
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include "queue.h"
+
+int lfq_init(LFQUEUE *q, size_t size)
+{
+    size_t n = 2;
+    while(n < size)
+        n <<= 1;
+    q->cells = malloc(n * sizeof(LFQCELL));
+    if(!q->cells)
+        return 0;
+    for(size_t i = 0; i < n; i++)
+        q->cells[i].seq = i;
+    q->mask = n - 1;
+    q->head = 0;
+    q->tail = 0;
+    return 1;
+}
+
+void lfq_destroy(LFQUEUE *q)
+{
+    free(q->cells);
+    q->cells = NULL;
+}
+
+int lfq_push(LFQUEUE *q, void *data)
+{
+    LFQCELL *cell;
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for(;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)pos;
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(diff < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+    cell->data = data;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void *lfq_pop(LFQUEUE *q)
+{
+    LFQCELL *cell;
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for(;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)(pos + 1);
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+    void *data = cell->data;
+    __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    return data;
+}
+
+static void backoff(int *spins)
+{
+    const struct timespec nap = {0, 50000};
+    if(*spins < 64) {
+        __builtin_ia32_pause();
+    } else if(*spins < 128) {
+        sched_yield();
+    } else {
+        nanosleep(&nap, NULL);
+    }
+    (*spins)++;
+}
+
+void lfq_push_wait(LFQUEUE *q, void *data)
+{
+    int spins = 0;
+    while(!lfq_push(q, data))
+        backoff(&spins);
+}
+
+void *lfq_pop_wait(LFQUEUE *q)
+{
+    int spins = 0;
+    void *data;
+    while(!(data = lfq_pop(q)))
+        backoff(&spins);
+    return data;
+}
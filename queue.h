@@ -0,0 +1,31 @@
+#ifndef LOCKFREE_QUEUE
+#define LOCKFREE_QUEUE
+#include <stddef.h>
+
+// Bounded multi-producer / multi-consumer lock-free queue of pointers
+// (sequence-numbered ring, every cell carries the turn it is ready for).
+// Size is rounded up to a power of two.
+typedef struct lfq_cell {
+    size_t seq;
+    void *data;
+} LFQCELL;
+
+typedef struct lfq {
+    LFQCELL *cells;
+    size_t mask;
+    char pad0[64];
+    size_t head; // next slot to push
+    char pad1[64];
+    size_t tail; // next slot to pop
+    char pad2[64];
+} LFQUEUE;
+
+int lfq_init(LFQUEUE *q, size_t size);
+void lfq_destroy(LFQUEUE *q);
+// non-blocking, return 0 when the queue is full / NULL when it is empty
+int lfq_push(LFQUEUE *q, void *data);
+void *lfq_pop(LFQUEUE *q);
+// spin, then yield, then sleep until the operation succeeds
+void lfq_push_wait(LFQUEUE *q, void *data);
+void *lfq_pop_wait(LFQUEUE *q);
+#endif // LOCKFREE_QUEUE
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "resize.h"
+#include "pool.h"
+
+// output rows handed to a pool worker at a time
+#define BAND_ROWS 32
+// largest block of the pre-reduction, the row sums stay on 16 bits
+#define REDUCE_MAX 256
+#define PI 3.14159265358979323846
+
+typedef struct resize_taps {
+    int n; // taps per output, padded with zeros
+    int *start; // first source pixel of each output
+    int *count; // taps really used
+    short *coef; // n per output, summing to 1 << RESIZE_BITS
+} TAPS;
+
+static int ifloor(double v)
+{
+    int i = (int)v;
+    return i > v ? i - 1 : i;
+}
+
+// sin(pi x) : folded into [-1/2, 1/2], then the Taylor series up to x^13
+static double sin_pi(double x)
+{
+    x -= 2 * ifloor(x / 2 + 0.5);
+    if(x > 0.5)
+        x = 1 - x;
+    else if(x < -0.5)
+        x = -1 - x;
+    double t = PI * x, t2 = t * t, term = t, sum = t;
+    for(int k = 1; k <= 6; k++) {
+        term *= -t2 / ((2 * k) * (2 * k + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+static double sinc(double x)
+{
+    return x == 0 ? 1 : sin_pi(x) / (PI * x);
+}
+
+static double filter_support(int filter)
+{
+    static const double support[4] = {0.5, 1, 2, 3};
+    return support[filter];
+}
+
+static double filter_weight(int filter, double x)
+{
+    // half open so that a pixel on the edge of the box counts once
+    if(filter == RESIZE_BOX)
+        return x >= -0.5 && x < 0.5 ? 1 : 0;
+    x = x < 0 ? -x : x;
+    switch(filter) {
+        case RESIZE_BILINEAR:
+            return x < 1 ? 1 - x : 0;
+        case RESIZE_BICUBIC:
+            if(x < 1)
+                return (1.5 * x - 2.5) * x * x + 1;
+            return x < 2 ? ((-0.5 * x + 2.5) * x - 4) * x + 2 : 0;
+        default:
+            return x < 3 ? sinc(x) * sinc(x / 3) : 0;
+    }
+}
+
+static void taps_free(TAPS *t)
+{
+    free(t->start);
+    free(t->coef);
+}
+
+/*********************************************************/
+// taps of out outputs over in source pixels covering
+// extent (in, or less after a pre-reduction with a partial
+// last block), n padded to a multiple of align
+/*********************************************************/
+static int taps_build(TAPS *t, int in, double extent, int out, int filter, int align)
+{
+    double scale = extent / out, fscale = scale > 1 ? scale : 1;
+    double support = filter_support(filter) * fscale;
+    int n = (int)(2 * support) + 3;
+    t->n = n = (n + align - 1) / align * align;
+    t->start = malloc(2 * (size_t)out * sizeof(int));
+    t->coef = calloc((size_t)out * n, sizeof(short));
+    double *w = malloc(n * sizeof(double));
+    if(!t->start || !t->coef || !w) {
+        fprintf(stderr, "resize : out of memory\n");
+        taps_free(t);
+        free(w);
+        return 0;
+    }
+    t->count = t->start + out;
+    for(int i = 0; i < out; i++) {
+        double center = (i + 0.5) * scale, sum = 0;
+        int lo = ifloor(center - support), hi = ifloor(center + support) + 1;
+        lo = lo > 0 ? lo : 0;
+        hi = hi < in ? hi : in;
+        for(int j = lo; j < hi; j++)
+            sum += w[j - lo] = filter_weight(filter, (j + 0.5 - center) / fscale);
+        if(sum == 0) {
+            lo = ifloor(center) < in ? ifloor(center) : in - 1;
+            hi = lo + 1;
+            sum = w[0] = 1;
+        }
+        // rounded, the rounding error goes to the biggest tap
+        short *c = t->coef + (size_t)i * n;
+        int total = 0, big = 0;
+        for(int j = 0; j < hi - lo; j++) {
+            c[j] = (short)ifloor(w[j] / sum * (1 << RESIZE_BITS) + 0.5);
+            total += c[j];
+            big = c[j] > c[big] ? j : big;
+        }
+        c[big] += (1 << RESIZE_BITS) - total;
+        t->start[i] = lo;
+        t->count[i] = hi - lo;
+    }
+    free(w);
+    return 1;
+}
+
+/****************************************************************************/
+// Horizontal pass of one row, in padded so that every tap can be loaded.
+// RGB : 2 taps per multiply-add, the 2 pixels are spread as b0 b1 g0 g1 r0
+// r1 on 16 bits lanes and the 2 taps repeated, giving b, g, r on 32 bits.
+// Planar : 8 taps per multiply-add, summed across the vector at the end.
+static void resize_row_h(const TAPS *t, const unsigned char *in, unsigned char *out, int dw, int cstep)
+{
+    const __m128i round = _mm_set1_epi32(1 << (RESIZE_BITS - 1));
+    if(cstep == 3) {
+        const __m128i pairs = _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1);
+        for(int x = 0; x < dw; x++, out += 3) {
+            const unsigned char *p = in + t->start[x] * 3;
+            const short *c = t->coef + (size_t)x * t->n;
+            __m128i acc = round;
+            for(int k = 0; k < t->count[x]; k += 2, p += 6) {
+                int cc;
+                memcpy(&cc, c + k, 4);
+                __m128i v = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *)p), pairs);
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(v, _mm_set1_epi32(cc)));
+            }
+            acc = _mm_srai_epi32(acc, RESIZE_BITS);
+            acc = _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+            int bytes = _mm_cvtsi128_si32(acc);
+            out[0] = bytes;
+            out[1] = bytes >> 8;
+            out[2] = bytes >> 16;
+        }
+        return;
+    }
+    for(int x = 0; x < dw; x++) {
+        const unsigned char *p = in + t->start[x];
+        const short *c = t->coef + (size_t)x * t->n;
+        __m128i acc = _mm_setzero_si128();
+        for(int k = 0; k < t->count[x]; k += 8) {
+            __m128i v = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(p + k)));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i *)(c + k))));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+        acc = _mm_srai_epi32(_mm_add_epi32(acc, round), RESIZE_BITS);
+        acc = _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+        out[x] = _mm_cvtsi128_si32(acc);
+    }
+}
+
+// Vertical pass : n (even) rows of len bytes, 16 bytes per step ; bytes of
+// 2 rows are interleaved so one multiply-add applies both of their taps.
+static void resize_row_v(const short *c, int n, const unsigned char *const *rows, unsigned char *out, int len)
+{
+    const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi32(1 << (RESIZE_BITS - 1));
+    int x = 0;
+    for(; x + 16 <= len; x += 16) {
+        __m128i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+        for(int k = 0; k < n; k += 2) {
+            int cc;
+            memcpy(&cc, c + k, 4);
+            __m128i cv = _mm_set1_epi32(cc);
+            __m128i a = _mm_loadu_si128((const __m128i *)(rows[k] + x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(rows[k + 1] + x));
+            __m128i lo = _mm_unpacklo_epi8(a, b), hi = _mm_unpackhi_epi8(a, b);
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), cv));
+            acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), cv));
+            acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), cv));
+            acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), cv));
+        }
+        acc0 = _mm_packs_epi32(_mm_srai_epi32(acc0, RESIZE_BITS), _mm_srai_epi32(acc1, RESIZE_BITS));
+        acc2 = _mm_packs_epi32(_mm_srai_epi32(acc2, RESIZE_BITS), _mm_srai_epi32(acc3, RESIZE_BITS));
+        _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(acc0, acc2));
+    }
+    for(; x < len; x++) {
+        int s = 1 << (RESIZE_BITS - 1);
+        for(int k = 0; k < n; k++)
+            s += c[k] * rows[k][x];
+        s >>= RESIZE_BITS;
+        out[x] = s < 0 ? 0 : s > 255 ? 255 : s;
+    }
+}
+
+typedef struct resize_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int dw;
+    int dh;
+    int cstep;
+    TAPS tx;
+    TAPS ty;
+    int ok;
+} RESIZEJOB;
+
+/*********************************************************/
+// output rows of a band : the source rows under the taps
+// of each output row are resampled once into a ring of
+// ty.n rows, the windows only move down
+/*********************************************************/
+static void resize_band(void *arg, int item)
+{
+    RESIZEJOB *job = arg;
+    int y0 = item * BAND_ROWS, y1 = y0 + BAND_ROWS < job->dh ? y0 + BAND_ROWS : job->dh;
+    int ring_rows = job->ty.n, cstep = job->cstep, next = 0;
+    size_t len = (size_t)job->dw * cstep, in_len = (size_t)job->w * cstep;
+    size_t pad = ((size_t)job->tx.n + 8) * cstep;
+    const unsigned char **rows = malloc(ring_rows * sizeof(unsigned char *) + ring_rows * len + in_len + pad);
+    if(!rows) {
+        fprintf(stderr, "resize : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    unsigned char *ring = (unsigned char *)(rows + ring_rows), *row_in = ring + ring_rows * len;
+    memset(row_in + in_len, 0, pad);
+    for(int y = y0; y < y1; y++) {
+        int s0 = job->ty.start[y], count = job->ty.count[y];
+        next = next > s0 ? next : s0;
+        for(; next < s0 + count; next++) {
+            memcpy(row_in, job->src + next * in_len, in_len);
+            resize_row_h(&job->tx, row_in, ring + (next % ring_rows) * len, job->dw, cstep);
+        }
+        for(int k = 0; k < ring_rows; k++)
+            rows[k] = k < count ? ring + ((s0 + k) % ring_rows) * len : rows[0];
+        resize_row_v(job->ty.coef + (size_t)y * job->ty.n, (count + 1) & ~1, rows, job->dst + y * len, len);
+    }
+    free(rows);
+}
+
+typedef struct reduce_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+    int fx; // block size
+    int fy;
+    int rw; // reduced size
+    int rh;
+    int ok;
+} REDUCEJOB;
+
+/*********************************************************/
+// box pre-reduction of a band of reduced rows : the fy
+// source rows are summed on 16 bits per vector, then the
+// blocks of fx pixels, partial blocks at the far edges
+// are averaged over what they hold
+/*********************************************************/
+static void reduce_band(void *arg, int item)
+{
+    REDUCEJOB *job = arg;
+    int y0 = item * BAND_ROWS, y1 = y0 + BAND_ROWS < job->rh ? y0 + BAND_ROWS : job->rh, cstep = job->cstep;
+    size_t n = (size_t)job->w * cstep;
+    unsigned short *acc = malloc(n * sizeof(unsigned short));
+    if(!acc) {
+        fprintf(stderr, "resize : out of memory\n");
+        job->ok = 0;
+        return;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    for(int y = y0; y < y1; y++) {
+        int sy0 = y * job->fy, sy1 = sy0 + job->fy < job->h ? sy0 + job->fy : job->h;
+        memset(acc, 0, n * sizeof(unsigned short));
+        for(int sy = sy0; sy < sy1; sy++) {
+            const unsigned char *p = job->src + sy * n;
+            size_t i = 0;
+            for(; i + 16 <= n; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+                __m128i *a = (__m128i *)(acc + i);
+                _mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), _mm_unpacklo_epi8(v, zero)));
+                _mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1), _mm_unpackhi_epi8(v, zero)));
+            }
+            for(; i < n; i++)
+                acc[i] += p[i];
+        }
+        unsigned char *out = job->dst + (size_t)y * job->rw * cstep;
+        for(int x = 0; x < job->rw; x++) {
+            int sx0 = x * job->fx, sx1 = sx0 + job->fx < job->w ? sx0 + job->fx : job->w;
+            unsigned int count = (sx1 - sx0) * (sy1 - sy0);
+            for(int c = 0; c < cstep; c++) {
+                unsigned int sum = count / 2;
+                for(int sx = sx0; sx < sx1; sx++)
+                    sum += acc[sx * cstep + c];
+                out[x * cstep + c] = sum / count;
+            }
+        }
+    }
+    free(acc);
+}
+
+int resize_image(const unsigned char *src, unsigned char *dst, int w, int h, int dw, int dh, int cstep, int filter)
+{
+    if(w < 1 || h < 1 || dw < 1 || dh < 1 || (cstep != 1 && cstep != 3) || filter < RESIZE_BOX || filter > RESIZE_LANCZOS) {
+        fprintf(stderr, "resize : bad resize %d x %d to %d x %d (%d bytes per pixel, filter %d)\n",
+                w, h, dw, dh, cstep, filter);
+        return 0;
+    }
+    RESIZEJOB job = {src, dst, w, h, dw, dh, cstep, {0, NULL, NULL, NULL}, {0, NULL, NULL, NULL}, 1};
+    REDUCEJOB reduce = {src, NULL, w, h, cstep, w / dw / RESIZE_REDUCE_GAP, h / dh / RESIZE_REDUCE_GAP, w, h, 1};
+    double ex = w, ey = h;
+    reduce.fx = reduce.fx < 2 ? 1 : reduce.fx < REDUCE_MAX ? reduce.fx : REDUCE_MAX;
+    reduce.fy = reduce.fy < 2 ? 1 : reduce.fy < REDUCE_MAX ? reduce.fy : REDUCE_MAX;
+    if(reduce.fx > 1 || reduce.fy > 1) {
+        reduce.rw = (w + reduce.fx - 1) / reduce.fx;
+        reduce.rh = (h + reduce.fy - 1) / reduce.fy;
+        reduce.dst = malloc((size_t)reduce.rw * reduce.rh * cstep);
+        if(!reduce.dst) {
+            fprintf(stderr, "resize : out of memory\n");
+            return 0;
+        }
+        pool_run(pool_default(), (reduce.rh + BAND_ROWS - 1) / BAND_ROWS, reduce_band, &reduce);
+        job.src = reduce.dst;
+        job.w = reduce.rw;
+        job.h = reduce.rh;
+        ex = (double)w / reduce.fx;
+        ey = (double)h / reduce.fy;
+    }
+    int ok = reduce.ok && taps_build(&job.tx, job.w, ex, dw, filter, cstep == 3 ? 2 : 8);
+    if(ok && !taps_build(&job.ty, job.h, ey, dh, filter, 2)) {
+        taps_free(&job.tx);
+        ok = 0;
+    }
+    if(ok) {
+        pool_run(pool_default(), (dh + BAND_ROWS - 1) / BAND_ROWS, resize_band, &job);
+        ok = job.ok;
+        taps_free(&job.tx);
+        taps_free(&job.ty);
+    }
+    free(reduce.dst);
+    return ok;
+}
+
+int resize_tri(const unsigned char *src, unsigned char *dst, int w, int h, int dw, int dh, int filter)
+{
+    return resize_image(src, dst, w, h, dw, dh, 1, filter);
+}
+
+int resize_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int dw, int dh, int filter)
+{
+    return resize_image((const unsigned char *)src, (unsigned char *)dst, w, h, dw, dh, 3, filter);
+}
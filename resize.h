@@ -0,0 +1,25 @@
+#ifndef IMAGE_RESIZE
+#define IMAGE_RESIZE
+#include "bmp.h"
+
+#define RESIZE_BOX 0 // support 0.5
+#define RESIZE_BILINEAR 1 // triangle, support 1
+#define RESIZE_BICUBIC 2 // Keys a = -0.5, support 2
+#define RESIZE_LANCZOS 3 // 3 lobes, support 3
+
+// fixed point bits of the filter taps
+#define RESIZE_BITS 14
+// a reduction of 2 x RESIZE_REDUCE_GAP or more first averages whole blocks
+// of pixels, the filter is left with a ratio of RESIZE_REDUCE_GAP or more
+#define RESIZE_REDUCE_GAP 2
+
+// Separable resize of w x h pixels of cstep bytes (1 : planar, 3 :
+// RGBTRIPLE) to dw x dh. The taps of every output column and row are
+// computed once (widened by the ratio when shrinking, clipped to the image
+// and renormalized). Source rows go through the horizontal pass once, 16
+// bits multiply-adds on the taps, into a ring of rows from which the
+// vertical pass makes each output row ; the pool takes bands of output rows.
+int resize_image(const unsigned char *src, unsigned char *dst, int w, int h, int dw, int dh, int cstep, int filter);
+int resize_tri(const unsigned char *src, unsigned char *dst, int w, int h, int dw, int dh, int filter);
+int resize_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int dw, int dh, int filter);
+#endif // IMAGE_RESIZE
@@ -9,4 +9,5 @@ plot "exec_time.log" using 1 with linespoints title "sse original pthread", \
      "exec_time.log" using 2 with linespoints title "sse split", \
      "exec_time.log" using 3 with linespoints title "sse original", \
      "exec_time.log" using 4 with linespoints title "sse prefetch original", \
-     "exec_time.log" using 7 with linespoints title "pthread unroll split"
+     "exec_time.log" using 7 with linespoints title "pthread unroll split", \
+     "exec_time.log" using 12 with linespoints title "sse vectorized original"
@@ -0,0 +1,336 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "image.h"
+#include "ops.h"
+#include "pool.h"
+#include "queue.h"
+
+#define REQUEST_MAX 8192
+
+typedef struct server_buffer {
+    IMAGE img;
+    IMAGE scratch;
+} SERVERBUF;
+
+typedef struct server_ctx {
+    int listen_fd;
+    int wake[2]; // job threads -> dispatcher : a connection came back
+    int stop;
+    LFQUEUE buffers; // warm pixel buffers shared by all job threads
+    LFQUEUE ready_q; // connections with a pending request
+    sem_t ready; // counts ready_q, idle job threads sleep on it
+    LFQUEUE idle_q; // connections handed back to the dispatcher
+    long long jobs;
+} SERVERCTX;
+
+// sockets travel through the queues as non NULL pointers
+#define SOCK_TO_PTR(s) ((void *)(intptr_t)((s) + 1))
+#define PTR_TO_SOCK(p) ((int)(intptr_t)(p) - 1)
+
+// poison pill for the job threads
+static char server_stop;
+
+static long long now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// receive one request packet and the descriptor passed with it (or -1).
+// Only one descriptor is kept : any extra one is closed, and a packet whose
+// control data did not fit fails with EMSGSIZE, nothing left open.
+static ssize_t recv_request(int sock, char *buf, size_t cap, int *fd)
+{
+    union {
+        char raw[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = {buf, cap - 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.raw;
+    msg.msg_controllen = sizeof(ctrl.raw);
+    *fd = -1;
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if(n <= 0)
+        return n;
+    buf[n] = '\0';
+    for(struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if(c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+        int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(int i = 0; i < count; i++) {
+            int got;
+            memcpy(&got, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if(*fd < 0)
+                *fd = got;
+            else
+                close(got);
+        }
+    }
+    if(msg.msg_flags & MSG_CTRUNC) {
+        if(*fd >= 0)
+            close(*fd);
+        *fd = -1;
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return n;
+}
+
+static int load_input(IMAGE *img, const char *input, int fd)
+{
+    if(strcmp(input, "-") != 0)
+        return bmp_load(img, input);
+    int dupfd = fd < 0 ? -1 : dup(fd);
+    FILE *f = dupfd < 0 ? NULL : fdopen(dupfd, "rb");
+    if(!f) {
+        if(dupfd >= 0)
+            close(dupfd);
+        return 0;
+    }
+    rewind(f);
+    int ok = bmp_read(img, f, "<fd>");
+    fclose(f);
+    return ok;
+}
+
+static int save_output(const IMAGE *img, const char *output, int fd)
+{
+    if(strcmp(output, "-") != 0)
+        return bmp_save(img, output);
+    int dupfd = fd < 0 ? -1 : dup(fd);
+    FILE *f = dupfd < 0 ? NULL : fdopen(dupfd, "wb");
+    if(!f) {
+        if(dupfd >= 0)
+            close(dupfd);
+        return 0;
+    }
+    int ok = ftruncate(dupfd, 0) == 0 && fseek(f, 0, SEEK_SET) == 0 && bmp_write(img, f);
+    if(fclose(f) != 0)
+        ok = 0;
+    return ok;
+}
+
+static void run_job(SERVERCTX *ctx, char *req, int fd, char *reply, size_t cap)
+{
+    char ops[256], input[4096], output[4096];
+    OPCHAIN chain;
+    long long t0 = now_ns();
+    if(sscanf(req, "%255s %4095s %4095s", ops, input, output) != 3) {
+        snprintf(reply, cap, "ERR bad request");
+        return;
+    }
+    if(!ops_parse(&chain, ops)) {
+        snprintf(reply, cap, "ERR bad operation chain");
+        return;
+    }
+    SERVERBUF *buf = lfq_pop_wait(&ctx->buffers);
+    if(!load_input(&buf->img, input, fd))
+        snprintf(reply, cap, "ERR can't read input");
+    else if(!ops_apply(&chain, &buf->img, &buf->scratch))
+        snprintf(reply, cap, "ERR operation failed");
+    else if(!save_output(&buf->img, output, fd))
+        snprintf(reply, cap, "ERR can't write output");
+    else
+        snprintf(reply, cap, "OK %lld", (now_ns() - t0) / 1000);
+    ops_release(&chain);
+    lfq_push_wait(&ctx->buffers, buf);
+    __atomic_add_fetch(&ctx->jobs, 1, __ATOMIC_RELAXED);
+}
+
+// answer the pending request of sock, return 0 once the peer is gone
+static int serve_request(SERVERCTX *ctx, int sock)
+{
+    char req[REQUEST_MAX];
+    char reply[256];
+    int fd;
+    ssize_t n = recv_request(sock, req, sizeof(req), &fd);
+    if(n == 0 || (n < 0 && errno != EMSGSIZE))
+        return 0;
+    if(n < 0) {
+        snprintf(reply, sizeof(reply), "ERR truncated descriptors");
+    } else if(strncmp(req, "SHUTDOWN", 8) == 0) {
+        __atomic_store_n(&ctx->stop, 1, __ATOMIC_RELEASE);
+        snprintf(reply, sizeof(reply), "OK 0");
+    } else {
+        run_job(ctx, req, fd, reply, sizeof(reply));
+    }
+    if(fd >= 0)
+        close(fd);
+    return send(sock, reply, strlen(reply), MSG_NOSIGNAL) >= 0;
+}
+
+static void *job_thread(void *arg)
+{
+    SERVERCTX *ctx = arg;
+    const char one = 1;
+    for(;;) {
+        while(sem_wait(&ctx->ready) != 0)
+            ;
+        void *p = lfq_pop_wait(&ctx->ready_q);
+        if(p == &server_stop)
+            break;
+        int sock = PTR_TO_SOCK(p);
+        if(serve_request(ctx, sock)) {
+            lfq_push_wait(&ctx->idle_q, p);
+        } else {
+            close(sock);
+        }
+        if(write(ctx->wake[1], &one, 1) < 0)
+            perror("wake");
+    }
+    return NULL;
+}
+
+// single poll() loop : accepts connections and hands every connection with
+// a readable request to the job threads, which give it back when replied
+static void dispatch(SERVERCTX *ctx)
+{
+    int cap = 64, n = 2;
+    struct pollfd *fds = malloc(cap * sizeof(struct pollfd));
+    fds[0].fd = ctx->listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = ctx->wake[0];
+    fds[1].events = POLLIN;
+    while(!__atomic_load_n(&ctx->stop, __ATOMIC_ACQUIRE)) {
+        if(poll(fds, n, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        if(fds[1].revents & POLLIN) {
+            char drain[64];
+            void *p;
+            if(read(ctx->wake[0], drain, sizeof(drain)) < 0)
+                perror("wake");
+            while((p = lfq_pop(&ctx->idle_q)) != NULL) {
+                if(n == cap) {
+                    cap *= 2;
+                    fds = realloc(fds, cap * sizeof(struct pollfd));
+                }
+                fds[n].fd = PTR_TO_SOCK(p);
+                fds[n].events = POLLIN;
+                fds[n].revents = 0;
+                n++;
+            }
+        }
+        for(int i = 2; i < n; i++) {
+            if(fds[i].revents == 0)
+                continue;
+            lfq_push_wait(&ctx->ready_q, SOCK_TO_PTR(fds[i].fd));
+            sem_post(&ctx->ready);
+            fds[i--] = fds[--n];
+        }
+        if(fds[0].revents & POLLIN) {
+            int sock = accept4(ctx->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if(sock >= 0) {
+                if(n == cap) {
+                    cap *= 2;
+                    fds = realloc(fds, cap * sizeof(struct pollfd));
+                }
+                fds[n].fd = sock;
+                fds[n].events = POLLIN;
+                fds[n].revents = 0;
+                n++;
+            }
+        }
+    }
+    for(int i = 2; i < n; i++)
+        close(fds[i].fd);
+    free(fds);
+}
+
+/*********************************************************/
+// listen on sock_path until a SHUTDOWN request comes
+/*********************************************************/
+int server_run(const char *sock_path, int num_threads)
+{
+    SERVERCTX ctx;
+    struct sockaddr_un addr;
+    memset(&ctx, 0, sizeof(ctx));
+    memset(&addr, 0, sizeof(addr));
+    if(num_threads < 1)
+        num_threads = 1;
+    if(strlen(sock_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", sock_path);
+        return 0;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_path);
+    ctx.listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink(sock_path);
+    if(ctx.listen_fd < 0 ||
+       bind(ctx.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+       listen(ctx.listen_fd, 128) != 0) {
+        perror(sock_path);
+        if(ctx.listen_fd >= 0)
+            close(ctx.listen_fd);
+        return 0;
+    }
+
+    // one buffer pair per job thread, they keep their size between jobs
+    SERVERBUF *bufs = calloc(num_threads, sizeof(SERVERBUF));
+    pthread_t *handler = malloc(num_threads * sizeof(pthread_t));
+    if(pipe2(ctx.wake, O_CLOEXEC | O_NONBLOCK) != 0 || !bufs || !handler ||
+       !lfq_init(&ctx.buffers, num_threads) ||
+       !lfq_init(&ctx.ready_q, 1024) || !lfq_init(&ctx.idle_q, 1024)) {
+        perror(sock_path);
+        close(ctx.listen_fd);
+        free(bufs);
+        free(handler);
+        return 0;
+    }
+    sem_init(&ctx.ready, 0, 0);
+    for(int i = 0; i < num_threads; i++)
+        lfq_push(&ctx.buffers, &bufs[i]);
+    pool_default(); // spawn the kernel workers before the first job
+    printf("serving on %s with %d job threads, %d pool workers\n",
+           sock_path, num_threads, pool_threads(pool_default()));
+    fflush(stdout);
+
+    for(int i = 0; i < num_threads; i++)
+        pthread_create(&handler[i], NULL, job_thread, &ctx);
+    dispatch(&ctx);
+    for(int i = 0; i < num_threads; i++) {
+        lfq_push_wait(&ctx.ready_q, &server_stop);
+        sem_post(&ctx.ready);
+    }
+    for(int i = 0; i < num_threads; i++)
+        pthread_join(handler[i], NULL);
+
+    printf("served %lld jobs\n", ctx.jobs);
+    close(ctx.listen_fd);
+    unlink(sock_path);
+    for(int i = 0; i < num_threads; i++) {
+        image_release(&bufs[i].img);
+        image_release(&bufs[i].scratch);
+    }
+    for(void *p; (p = lfq_pop(&ctx.idle_q)) != NULL;)
+        close(PTR_TO_SOCK(p));
+    close(ctx.wake[0]);
+    close(ctx.wake[1]);
+    sem_destroy(&ctx.ready);
+    lfq_destroy(&ctx.buffers);
+    lfq_destroy(&ctx.ready_q);
+    lfq_destroy(&ctx.idle_q);
+    free(bufs);
+    free(handler);
+    return 1;
+}
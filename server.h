@@ -0,0 +1,18 @@
+#ifndef JOB_SERVER
+#define JOB_SERVER
+
+// Local daemon : jobs come in over a unix domain socket (SOCK_SEQPACKET,
+// one request / one reply per packet). A request is
+//   "<ops> <input> <output>"
+// where <ops> is an operation chain (see ops.h) and <input>/<output> are
+// file paths, or "-" for the file descriptor passed along with the request
+// (SCM_RIGHTS, e.g. a memfd holding a BMP). The reply is
+//   "OK <server latency in us>" or "ERR <reason>".
+// "SHUTDOWN" stops the daemon.
+//
+// One poll() loop owns the idle connections and hands a connection with a
+// pending request to the job threads. Job threads, the worker pool used by
+// the kernels and the pixel buffers are created once and stay warm across
+// jobs, so a job costs no thread spawn and no fresh page faults.
+int server_run(const char *sock_path, int num_threads);
+#endif // JOB_SERVER
@@ -0,0 +1,484 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "stream.h"
+#include "gaussian.h"
+#include "unsharp.h"
+#include "hsv.h"
+#include "lut.h"
+
+#define STREAM_BUF (1 << 20)
+
+enum { FMT_PGM, FMT_PPM, FMT_RAW };
+
+typedef struct stream_io {
+    int fd;
+    unsigned char *buf;
+    size_t pos; // input : next byte to consume , output : bytes pending
+    size_t len; // input : bytes in buf
+    struct stream_io *out; // flushed before the input blocks
+} STREAMIO;
+
+typedef struct frame_info {
+    int format;
+    int width;
+    int height;
+    int channels;
+} FRAMEINFO;
+
+// one step of the row pipeline
+typedef struct stream_stage {
+    OPTYPE type;
+    float arg;
+    int width;
+    int height;
+    int cstep;
+    int in_rows; // rows received in the current frame
+    unsigned char *ring; // blur / unsharp : the last 5 input rows
+    uint16_t *lin; // lblur : the same rows in linear light
+    unsigned char *out; // blur / unsharp : output row
+    CURVE curve; // colour operations without a 3D table
+    LUT3D lut; // colour operations baked, cube
+    int direct; // lone bright / sat : the hsv kernel on every row
+    struct stream_stage *next; // NULL : rows go to the output stream
+    STREAMIO *sink;
+} STREAMSTAGE;
+
+static int io_flush(STREAMIO *io)
+{
+    size_t done = 0;
+    while(done < io->pos) {
+        ssize_t n = write(io->fd, io->buf + done, io->pos - done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return 0;
+        done += n;
+    }
+    io->pos = 0;
+    return 1;
+}
+
+static int io_write(STREAMIO *io, const void *data, size_t n)
+{
+    const unsigned char *p = data;
+    while(n > 0) {
+        size_t room = STREAM_BUF - io->pos;
+        size_t chunk = n < room ? n : room;
+        memcpy(io->buf + io->pos, p, chunk);
+        io->pos += chunk;
+        p += chunk;
+        n -= chunk;
+        if(io->pos == STREAM_BUF && !io_flush(io))
+            return 0;
+    }
+    return 1;
+}
+
+// refill the input buffer, keeping the unread bytes ; 0 at end of stream
+static int io_fill(STREAMIO *io)
+{
+    if(io->pos > 0) {
+        memmove(io->buf, io->buf + io->pos, io->len - io->pos);
+        io->len -= io->pos;
+        io->pos = 0;
+    }
+    // about to block : let the rows we already have go downstream first
+    if(io->out && io->out->pos > 0 && !io_flush(io->out))
+        return 0;
+    for(;;) {
+        ssize_t n = read(io->fd, io->buf + io->len, STREAM_BUF - io->len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return 0;
+        io->len += n;
+        return 1;
+    }
+}
+
+static int io_getc(STREAMIO *io)
+{
+    if(io->pos == io->len && !io_fill(io))
+        return EOF;
+    return io->buf[io->pos++];
+}
+
+// netpbm header number, skipping blanks and comments
+static int pnm_number(STREAMIO *io)
+{
+    int c = io_getc(io), value = 0;
+    while(c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        if(c == '#') {
+            while(c != '\n' && c != EOF)
+                c = io_getc(io);
+        }
+        c = io_getc(io);
+    }
+    if(c < '0' || c > '9')
+        return -1;
+    while(c >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        c = io_getc(io);
+    }
+    return value; // the single blank after the number is consumed
+}
+
+static uint32_t le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*********************************************************/
+// read the header of the next frame, 0 at a clean end of stream
+/*********************************************************/
+static int read_header(STREAMIO *in, FRAMEINFO *frame)
+{
+    int c0 = io_getc(in), c1 = io_getc(in);
+    if(c0 == EOF)
+        return 0;
+    if(c0 == 'P' && (c1 == '5' || c1 == '6')) {
+        frame->format = c1 == '5' ? FMT_PGM : FMT_PPM;
+        frame->channels = c1 == '5' ? 1 : 3;
+        frame->width = pnm_number(in);
+        frame->height = pnm_number(in);
+        if(pnm_number(in) != 255) {
+            fprintf(stderr, "pipe: only maxval 255 is supported\n");
+            return -1;
+        }
+    } else if(c0 == 'R' && c1 == 'A') {
+        unsigned char hdr[16] = {'R', 'A'};
+        for(int i = 2; i < 16; i++) {
+            int c = io_getc(in);
+            if(c == EOF)
+                return -1;
+            hdr[i] = c;
+        }
+        if(memcmp(hdr, "RAWF", 4) != 0)
+            return -1;
+        frame->format = FMT_RAW;
+        frame->width = le32(hdr + 4);
+        frame->height = le32(hdr + 8);
+        frame->channels = le32(hdr + 12);
+    } else {
+        fprintf(stderr, "pipe: unknown frame format\n");
+        return -1;
+    }
+    if(frame->width <= 0 || frame->height <= 0 ||
+       (frame->channels != 1 && frame->channels != 3)) {
+        fprintf(stderr, "pipe: bad frame header\n");
+        return -1;
+    }
+    return 1;
+}
+
+static int write_header(STREAMIO *out, const FRAMEINFO *frame)
+{
+    char hdr[64];
+    int n;
+    if(frame->format == FMT_RAW) {
+        uint32_t v[3] = {frame->width, frame->height, frame->channels};
+        memcpy(hdr, "RAWF", 4);
+        for(int i = 0; i < 3; i++) {
+            hdr[4 + i * 4] = v[i] & 0xff;
+            hdr[5 + i * 4] = (v[i] >> 8) & 0xff;
+            hdr[6 + i * 4] = (v[i] >> 16) & 0xff;
+            hdr[7 + i * 4] = (v[i] >> 24) & 0xff;
+        }
+        n = 16;
+    } else {
+        n = snprintf(hdr, sizeof(hdr), "P%c\n%d %d\n255\n",
+                     frame->format == FMT_PGM ? '5' : '6', frame->width, frame->height);
+    }
+    return io_write(out, hdr, n);
+}
+
+static void flip_row(unsigned char *row, int w, int cstep)
+{
+    for(int l = 0, r = w - 1; l < r; l++, r--) {
+        for(int c = 0; c < cstep; c++) {
+            unsigned char t = row[l * cstep + c];
+            row[l * cstep + c] = row[r * cstep + c];
+            row[r * cstep + c] = t;
+        }
+    }
+}
+
+static int stage_emit(STREAMSTAGE *s, unsigned char *row);
+
+/*********************************************************/
+// push one row into a stage, rows of a frame come in order
+/*********************************************************/
+static int stage_push(STREAMSTAGE *s, unsigned char *row)
+{
+    int r = s->in_rows++;
+    int w = s->width, h = s->height, n = w * s->cstep;
+    switch(s->type) {
+        case OP_FLIP_H:
+            flip_row(row, w, s->cstep);
+            return stage_emit(s, row);
+        case OP_BRIGHTNESS:
+        case OP_SATURATION:
+        case OP_GAMMA:
+        case OP_CONTRAST:
+        case OP_CUBE:
+            if(s->direct && s->type == OP_BRIGHTNESS)
+                change_brightness((RGBTRIPLE *)row, s->arg, w, 1);
+            else if(s->direct)
+                change_saturation((RGBTRIPLE *)row, s->arg, w, 1);
+            else if(s->lut.table)
+                lut3d_apply_row(&s->lut, row, row, w);
+            else
+                curve_apply_row(&s->curve, row, row, w, s->cstep);
+            return stage_emit(s, row);
+        case OP_BLUR:
+        case OP_LINEAR_BLUR:
+        case OP_UNSHARP: {
+            // downstream stages work in place, the ring is only lent as a copy
+            unsigned char *slot = s->ring + (size_t)(r % 5) * n;
+            memcpy(slot, row, n);
+            if(s->lin)
+                srgb_to_linear_row(row, s->lin + (size_t)(r % 5) * n, n);
+            if(h < 5 || r < 2)
+                return stage_emit(s, row);
+            if(r >= 4) {
+                unsigned char *rows[5];
+                for(int k = 0; k < 5; k++)
+                    rows[k] = s->ring + (size_t)((r - 4 + k) % 5) * n;
+                if(s->lin) {
+                    const uint16_t *lin[5];
+                    for(int k = 0; k < 5; k++)
+                        lin[k] = s->lin + (size_t)((r - 4 + k) % 5) * n;
+                    sse_gaussian_blur_5_row_linear(lin, rows[2], s->out, w, s->cstep);
+                } else {
+                    sse_gaussian_blur_5_row(rows, s->out, w, s->cstep);
+                }
+                // the border rows and columns are left as they are by both
+                if(s->type == OP_UNSHARP)
+                    unsharp_combine_row(rows[2], s->out, s->out, n, s->arg, 0);
+                if(!stage_emit(s, s->out))
+                    return 0;
+            }
+            if(r == h - 1) {
+                memcpy(s->out, s->ring + (size_t)((h - 2) % 5) * n, n);
+                if(!stage_emit(s, s->out))
+                    return 0;
+                memcpy(s->out, slot, n);
+                return stage_emit(s, s->out);
+            }
+            return 1;
+        }
+        default:
+            return stage_emit(s, row);
+    }
+}
+
+static int stage_emit(STREAMSTAGE *s, unsigned char *row)
+{
+    if(s->next)
+        return stage_push(s->next, row);
+    return io_write(s->sink, row, (size_t)s->width * s->cstep);
+}
+
+static void free_stages(STREAMSTAGE *s)
+{
+    while(s) {
+        STREAMSTAGE *next = s->next;
+        free(s->ring);
+        free(s->lin);
+        free(s->out);
+        lut3d_free(&s->lut);
+        free(s);
+        s = next;
+    }
+}
+
+// tables are made for blue, green, red pixels, frames are red, green, blue
+static int swap_stage(STREAMSTAGE *s)
+{
+    LUT3D bgr = s->lut;
+    int ok = lut3d_swap_rb(&bgr, &s->lut);
+    lut3d_free(&bgr);
+    return ok;
+}
+
+// the cube swapped for the frames ; gray frames take the gray axis of the
+// table, its 3 outputs averaged
+static int cube_stage(STREAMSTAGE *s, const LUT3D *lut)
+{
+    unsigned char gray[3 * 256];
+    if(s->cstep == 3)
+        return lut3d_swap_rb(lut, &s->lut);
+    for(int v = 0; v < 256; v++)
+        gray[3 * v] = gray[3 * v + 1] = gray[3 * v + 2] = v;
+    lut3d_apply_row(lut, gray, gray, 256);
+    for(int v = 0; v < 256; v++)
+        s->curve.map[0][v] = (gray[3 * v] + gray[3 * v + 1] + gray[3 * v + 2] + 1) / 3;
+    return 1;
+}
+
+// one stage per operation (per pass for blur, a run of colour operations
+// shares one), buffers sized for the frame
+static STREAMSTAGE *build_stages(const OPCHAIN *chain, const FRAMEINFO *frame, STREAMIO *sink)
+{
+    STREAMSTAGE *head = NULL, **tail = &head;
+    size_t n = (size_t)frame->width * frame->channels;
+    for(int i = 0; i < chain->count; i++) {
+        OPTYPE type = chain->op[i].type;
+        int passes = type == OP_BLUR || type == OP_LINEAR_BLUR ? (int)chain->op[i].arg : 1;
+        for(int p = 0; p < passes; p++) {
+            STREAMSTAGE *s = calloc(1, sizeof(STREAMSTAGE));
+            if(!s) {
+                free_stages(head);
+                return NULL;
+            }
+            s->type = chain->op[i].type;
+            s->arg = chain->op[i].arg;
+            s->width = frame->width;
+            s->height = frame->height;
+            s->cstep = frame->channels;
+            s->sink = sink;
+            int window = s->type == OP_BLUR || s->type == OP_LINEAR_BLUR || s->type == OP_UNSHARP;
+            if(window) {
+                s->ring = malloc(5 * n);
+                s->out = malloc(n);
+            }
+            if(s->type == OP_LINEAR_BLUR)
+                s->lin = malloc(5 * n * sizeof(uint16_t));
+            *tail = s;
+            tail = &s->next;
+            if((window && (!s->ring || !s->out)) || (s->type == OP_LINEAR_BLUR && !s->lin)) {
+                free_stages(head);
+                return NULL;
+            }
+            s->direct = ops_color_direct(chain, i, s->cstep);
+            if(!s->direct && (s->type == OP_BRIGHTNESS || s->type == OP_SATURATION || s->type == OP_GAMMA || s->type == OP_CONTRAST)) {
+                // the following colour operations are folded into this stage
+                int run = ops_color_run(chain, i, s->cstep, &s->curve, &s->lut);
+                if(!run || (s->lut.table && !swap_stage(s))) {
+                    free_stages(head);
+                    return NULL;
+                }
+                i += run - 1;
+            }
+            if(s->type == OP_CUBE && !cube_stage(s, chain->op[i].lut)) {
+                free_stages(head);
+                return NULL;
+            }
+        }
+    }
+    return head;
+}
+
+// no operation : move the payload with splice when one side is a pipe
+static int pass_through(STREAMIO *in, STREAMIO *out, size_t bytes)
+{
+    size_t buffered = in->len - in->pos;
+    size_t chunk = buffered < bytes ? buffered : bytes;
+    if(!io_write(out, in->buf + in->pos, chunk))
+        return 0;
+    in->pos += chunk;
+    bytes -= chunk;
+    if(bytes > 0 && !io_flush(out))
+        return 0;
+    while(bytes > 0) {
+        ssize_t n = splice(in->fd, NULL, out->fd, NULL, bytes, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        bytes -= n;
+    }
+    // splice not possible (two files, two sockets ...) : plain buffered copy
+    while(bytes > 0) {
+        if(in->pos == in->len && !io_fill(in))
+            return 0;
+        chunk = in->len - in->pos < bytes ? in->len - in->pos : bytes;
+        if(!io_write(out, in->buf + in->pos, chunk))
+            return 0;
+        in->pos += chunk;
+        bytes -= chunk;
+    }
+    return 1;
+}
+
+/*********************************************************/
+// process frames until the end of the input stream
+/*********************************************************/
+int stream_run(int in_fd, int out_fd, const OPCHAIN *chain)
+{
+    STREAMIO in = {in_fd, malloc(STREAM_BUF), 0, 0, NULL};
+    STREAMIO out = {out_fd, malloc(STREAM_BUF), 0, 0, NULL};
+    unsigned char *row = NULL;
+    size_t row_cap = 0;
+    FRAMEINFO frame;
+    int frames = 0, ok = 1, r;
+    in.out = &out;
+    if(!in.buf || !out.buf)
+        ok = 0;
+    for(int i = 0; i < chain->count; i++) {
+        OPTYPE type = chain->op[i].type;
+        if(type == OP_FLIP_V || type == OP_TRANSPOSE || type == OP_ROTATE
+           || type == OP_SHARPEN || type == OP_EMBOSS || type == OP_BOX || type == OP_CANNY
+           || type == OP_MEDIAN || type == OP_BILATERAL || type == OP_ERODE || type == OP_DILATE
+           || type == OP_OPEN || type == OP_CLOSE || type == OP_MEAN || type == OP_EQUALIZE || type == OP_CLAHE
+           || type == OP_SCALE || type == OP_THUMB || type == OP_PYRBLUR
+           || type == OP_DESKEW || type == OP_LUMA || type == OP_LUMA_420) {
+            fprintf(stderr, "pipe: flipv, transpose, rot, sharpen, emboss, box, canny, median, bilateral,"
+                    " mean, equalize, clahe, scale, thumb, pblur, deskew, luma and the morphology are not available in pipe mode\n");
+            ok = 0;
+        }
+    }
+    while(ok && (r = read_header(&in, &frame)) != 0) {
+        if(r < 0 || !write_header(&out, &frame)) {
+            ok = 0;
+            break;
+        }
+        size_t n = (size_t)frame.width * frame.channels;
+        if(chain->count == 0) {
+            ok = pass_through(&in, &out, n * frame.height);
+        } else {
+            STREAMSTAGE *stages = build_stages(chain, &frame, &out);
+            if(n > row_cap) {
+                free(row);
+                row = malloc(n);
+                row_cap = n;
+            }
+            ok = stages && row;
+            for(int y = 0; ok && y < frame.height; y++) {
+                // whole row in the input buffer : hand it over without copy
+                if(in.len - in.pos >= n) {
+                    ok = stage_push(stages, in.buf + in.pos);
+                    in.pos += n;
+                    continue;
+                }
+                size_t got = 0;
+                while(ok && got < n) {
+                    if(in.pos == in.len && !io_fill(&in)) {
+                        fprintf(stderr, "pipe: truncated frame\n");
+                        ok = 0;
+                        break;
+                    }
+                    size_t chunk = in.len - in.pos < n - got ? in.len - in.pos : n - got;
+                    memcpy(row + got, in.buf + in.pos, chunk);
+                    in.pos += chunk;
+                    got += chunk;
+                }
+                ok = ok && stage_push(stages, row);
+            }
+            free_stages(stages);
+        }
+        ok = ok && io_flush(&out);
+        frames += ok;
+    }
+    fprintf(stderr, "pipe: %d frames\n", frames);
+    free(in.buf);
+    free(out.buf);
+    free(row);
+    return ok;
+}
@@ -0,0 +1,21 @@
+#ifndef PIPE_STREAM
+#define PIPE_STREAM
+#include "ops.h"
+
+// Pipe mode : frames are read from in_fd and written to out_fd one row at
+// a time, so memory stays constant whatever the frame count and the first
+// rows leave before the frame is complete. Supported frames (any number,
+// concatenated) :
+//   - binary PGM (P5) / PPM (P6), maxval 255
+//   - raw : 16 bytes header "RAWF" + width, height, channels (uint32 little
+//     endian, channels 1 or 3) followed by the pixels, top row first
+// Every operation must be row local or have a bounded vertical support
+// (blur, lblur and unsharp keep 5 rows per pass), flipv / transpose / rot, the
+// convolutions, canny, median, bilateral, mean, the morphology, the
+// histogram equalizations, the resizes, pblur and deskew need the whole
+// frame and are refused, so are luma / luma420. The colour operations take 3 channels frames in
+// red, green, blue order like PPM, cube takes gray frames through the gray
+// axis of its table.
+// Without any operation the pixel data is spliced straight through.
+int stream_run(int in_fd, int out_fd, const OPCHAIN *chain);
+#endif // PIPE_STREAM
@@ -0,0 +1,519 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tile.h"
+#include "qoi.h"
+#include "gaussian.h"
+#include "mirror.h"
+#include "pool.h"
+
+#define TILE_HEADER 24
+#define TILE_ENTRY 16
+// biggest tile side accepted from a file
+#define TILE_MAX 8192
+// rows of the 5x5 kernel on each side of a tile
+#define TILE_HALO 2
+
+// output container, the tiles are written by the workers as they come
+typedef struct tile_writer {
+    int fd;
+    char path[4096]; // fileName.part until the end
+    const char *name;
+    int width;
+    int height;
+    int tile;
+    int tiles_x;
+    int tiles_y;
+    int codec;
+    unsigned char *index;
+    long long end; // next free byte of the file
+    int ok;
+} TILEWRITER;
+
+typedef struct tile_job {
+    const TILEFILE *tf;
+    TILEWRITER *out;
+    const RGBTRIPLE *band; // tile_save : top view row of the band of tiles
+    RGBTRIPLE *dst; // tile_read : top left of the region
+    ptrdiff_t stride; // pixels from a row of band / dst to the next
+    int x; // tile_read : the region
+    int y;
+    int w;
+    int h;
+    int tx0; // tile_read : first tile and tiles across of the region
+    int ty0;
+    int tiles_w;
+    int ty; // tile_save : row of tiles of the band
+    int flip_h;
+    int flip_v;
+    int ok;
+} TILEJOB;
+
+/****************************************************************************/
+static unsigned long long rd_le(const unsigned char *p, int bytes)
+{
+    unsigned long long v = 0;
+    while(bytes--)
+        v = v << 8 | p[bytes];
+    return v;
+}
+
+static void wr_le(unsigned char *p, unsigned long long v, int bytes)
+{
+    for(int i = 0; i < bytes; i++, v >>= 8)
+        p[i] = v;
+}
+
+static int same_px(const RGBTRIPLE *a, const RGBTRIPLE *b)
+{
+    return a->rgbBlue == b->rgbBlue && a->rgbGreen == b->rgbGreen && a->rgbRed == b->rgbRed;
+}
+
+int tile_codec(const char *name)
+{
+    const char *names[] = {"raw", "rle", "qoi"};
+    for(int i = 0; i < 3; i++)
+        if(strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+/****************************************************************************/
+// RLE of a tile : a byte c then c + 1 pixels as they are (c < 128), or one
+// pixel repeated c - 126 times (c >= 128)
+/****************************************************************************/
+static size_t rle_encode(const RGBTRIPLE *px, int n, unsigned char *out)
+{
+    unsigned char *p = out;
+    int i = 0;
+    while(i < n) {
+        int run = 1;
+        while(i + run < n && run < 129 && same_px(px + i + run, px + i))
+            run++;
+        if(run >= 2) {
+            *p++ = 126 + run;
+            memcpy(p, px + i, sizeof(RGBTRIPLE));
+            p += sizeof(RGBTRIPLE);
+            i += run;
+            continue;
+        }
+        // literals up to the next pair of equal pixels
+        int lit = 1;
+        while(i + lit < n && lit < 128 && !(i + lit + 1 < n && same_px(px + i + lit, px + i + lit + 1)))
+            lit++;
+        *p++ = lit - 1;
+        memcpy(p, px + i, lit * sizeof(RGBTRIPLE));
+        p += lit * sizeof(RGBTRIPLE);
+        i += lit;
+    }
+    return p - out;
+}
+
+static int rle_decode(const unsigned char *p, size_t len, RGBTRIPLE *px, int n)
+{
+    const unsigned char *end = p + len;
+    int i = 0;
+    while(i < n && p < end) {
+        int c = *p++;
+        int count = c < 128 ? c + 1 : c - 126;
+        size_t bytes = c < 128 ? count * sizeof(RGBTRIPLE) : sizeof(RGBTRIPLE);
+        if(count > n - i || (size_t)(end - p) < bytes)
+            return 0;
+        if(c < 128) {
+            memcpy(px + i, p, bytes);
+        } else {
+            for(int k = 0; k < count; k++)
+                memcpy(px + i + k, p, sizeof(RGBTRIPLE));
+        }
+        p += bytes;
+        i += count;
+    }
+    return i == n && p == end;
+}
+
+/****************************************************************************/
+// Reader
+/****************************************************************************/
+static const unsigned char *tile_entry(const TILEFILE *tf, size_t t)
+{
+    return tf->map + TILE_HEADER + t * TILE_ENTRY;
+}
+
+static int tile_side(int size, int tile, int t)
+{
+    return size - t * tile < tile ? size - t * tile : tile;
+}
+
+int tile_open(TILEFILE *tf, const char *fileName)
+{
+    struct stat st;
+    memset(tf, 0, sizeof(*tf));
+    int fd = open(fileName, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "%s: can't open file\n", fileName);
+        return 0;
+    }
+    void *map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.st_size >= TILE_HEADER)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "%s: not a tiled image\n", fileName);
+        return 0;
+    }
+    tf->map = map;
+    tf->size = st.st_size;
+    long long w = rd_le(tf->map + 4, 4), h = rd_le(tf->map + 8, 4), tile = rd_le(tf->map + 12, 4);
+    int ok = memcmp(tf->map, "TILE", 4) == 0 && w > 0 && h > 0 && w <= 0x7fffffff && h <= 0x7fffffff &&
+             tile > 0 && tile <= TILE_MAX;
+    if(ok) {
+        tf->width = w;
+        tf->height = h;
+        tf->tile = tile;
+        tf->tiles_x = (w + tile - 1) / tile;
+        tf->tiles_y = (h + tile - 1) / tile;
+        size_t tiles = (size_t)tf->tiles_x * tf->tiles_y;
+        ok = tiles <= (tf->size - TILE_HEADER) / TILE_ENTRY;
+        // every tile must lie in the file, raw ones with their exact size
+        for(size_t t = 0; t < tiles && ok; t++) {
+            const unsigned char *e = tile_entry(tf, t);
+            unsigned long long off = rd_le(e, 8), len = rd_le(e + 8, 4), codec = rd_le(e + 12, 4);
+            int tw = tile_side(tf->width, tf->tile, t % tf->tiles_x);
+            int th = tile_side(tf->height, tf->tile, t / tf->tiles_x);
+            ok = codec <= TILE_QOI && off >= TILE_HEADER && off <= tf->size && len <= tf->size - off &&
+                 (codec != TILE_RAW || len == (unsigned long long)tw * th * sizeof(RGBTRIPLE));
+        }
+    }
+    if(!ok) {
+        fprintf(stderr, "%s: not a tiled image\n", fileName);
+        tile_close(tf);
+    }
+    return ok;
+}
+
+void tile_close(TILEFILE *tf)
+{
+    if(tf->map)
+        munmap(tf->map, tf->size);
+    tf->map = NULL;
+}
+
+// tile t into px, tw x th pixels top row first
+static int tile_decode(const TILEFILE *tf, size_t t, int tw, int th, RGBTRIPLE *px)
+{
+    const unsigned char *e = tile_entry(tf, t);
+    const unsigned char *p = tf->map + rd_le(e, 8);
+    size_t len = rd_le(e + 8, 4);
+    switch(rd_le(e + 12, 4)) {
+        case TILE_RAW:
+            memcpy(px, p, len);
+            return 1;
+        case TILE_RLE:
+            return rle_decode(p, len, px, tw * th);
+        default: {
+            // QOI comes back bottom-up
+            IMAGE img = {{0}, {0}, NULL, 0, 0};
+            int ok = qoi_decode(&img, p, len, "tile") && IMAGE_WIDTH(&img) == tw && IMAGE_HEIGHT(&img) == th;
+            for(int y = 0; y < th && ok; y++)
+                memcpy(px + (size_t)y * tw, img.data + (size_t)(th - 1 - y) * tw, tw * sizeof(RGBTRIPLE));
+            image_release(&img);
+            return ok;
+        }
+    }
+}
+
+static void read_tile(void *arg, int item)
+{
+    TILEJOB *job = arg;
+    const TILEFILE *tf = job->tf;
+    int tx = job->tx0 + item % job->tiles_w, ty = job->ty0 + item / job->tiles_w;
+    int x0 = tx * tf->tile, y0 = ty * tf->tile;
+    int tw = tile_side(tf->width, tf->tile, tx), th = tile_side(tf->height, tf->tile, ty);
+    // part of the tile inside the region
+    int ix0 = x0 > job->x ? x0 : job->x, ix1 = x0 + tw < job->x + job->w ? x0 + tw : job->x + job->w;
+    int iy0 = y0 > job->y ? y0 : job->y, iy1 = y0 + th < job->y + job->h ? y0 + th : job->y + job->h;
+    size_t t = (size_t)ty * tf->tiles_x + tx;
+    const RGBTRIPLE *px = (const RGBTRIPLE *)(tf->map + rd_le(tile_entry(tf, t), 8));
+    RGBTRIPLE *buf = NULL;
+    if(rd_le(tile_entry(tf, t) + 12, 4) != TILE_RAW) {
+        buf = malloc((size_t)tw * th * sizeof(RGBTRIPLE));
+        if(!buf || !tile_decode(tf, t, tw, th, buf)) {
+            job->ok = 0;
+            free(buf);
+            return;
+        }
+        px = buf;
+    }
+    for(int y = iy0; y < iy1; y++)
+        memcpy(job->dst + (y - job->y) * job->stride + (ix0 - job->x), px + (size_t)(y - y0) * tw + (ix0 - x0),
+               (ix1 - ix0) * sizeof(RGBTRIPLE));
+    free(buf);
+}
+
+int tile_read(const TILEFILE *tf, int x, int y, int w, int h, RGBTRIPLE *dst, ptrdiff_t stride)
+{
+    if(x < 0 || y < 0 || w <= 0 || h <= 0 || x > tf->width - w || y > tf->height - h) {
+        fprintf(stderr, "tile : region %d,%d %d x %d is not in the %d x %d image\n", x, y, w, h, tf->width, tf->height);
+        return 0;
+    }
+    TILEJOB job;
+    memset(&job, 0, sizeof(job));
+    job.tf = tf;
+    job.dst = dst;
+    job.stride = stride;
+    job.x = x;
+    job.y = y;
+    job.w = w;
+    job.h = h;
+    job.tx0 = x / tf->tile;
+    job.ty0 = y / tf->tile;
+    job.tiles_w = (x + w - 1) / tf->tile - job.tx0 + 1;
+    job.ok = 1;
+    pool_run(pool_default(), job.tiles_w * ((y + h - 1) / tf->tile - job.ty0 + 1), read_tile, &job);
+    if(!job.ok)
+        fprintf(stderr, "tile : corrupted tile\n");
+    return job.ok;
+}
+
+int tile_load(IMAGE *img, const char *fileName)
+{
+    TILEFILE tf;
+    if(!tile_open(&tf, fileName))
+        return 0;
+    int w = tf.width, h = tf.height;
+    int ok = image_reserve(img, w, h);
+    if(ok) {
+        image_header(img, w, h);
+        ok = tile_read(&tf, 0, 0, w, h, img->data + (size_t)(h - 1) * w, -(ptrdiff_t)w);
+    }
+    tile_close(&tf);
+    return ok;
+}
+
+/****************************************************************************/
+// Writer
+/****************************************************************************/
+static int write_all(int fd, const unsigned char *buf, size_t len, long long at)
+{
+    while(len > 0) {
+        ssize_t n = pwrite(fd, buf, len, at);
+        if(n <= 0)
+            return 0;
+        buf += n;
+        len -= n;
+        at += n;
+    }
+    return 1;
+}
+
+static int writer_open(TILEWRITER *wr, const char *fileName, int w, int h, int tile, int codec)
+{
+    wr->name = fileName;
+    wr->width = w;
+    wr->height = h;
+    wr->tile = tile;
+    wr->tiles_x = (w + tile - 1) / tile;
+    wr->tiles_y = (h + tile - 1) / tile;
+    wr->codec = codec;
+    wr->end = TILE_HEADER + (long long)wr->tiles_x * wr->tiles_y * TILE_ENTRY;
+    wr->ok = 1;
+    snprintf(wr->path, sizeof(wr->path), "%s.part", fileName);
+    wr->index = calloc((size_t)wr->tiles_x * wr->tiles_y, TILE_ENTRY);
+    wr->fd = wr->index ? open(wr->path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    if(wr->fd < 0) {
+        fprintf(stderr, "%s: can't create file\n", fileName);
+        free(wr->index);
+        return 0;
+    }
+    return 1;
+}
+
+// code tile t, rows of its width at px + i * stride, and write it at the
+// end of the file ; the workers only share the end offset
+static void writer_put(TILEWRITER *wr, size_t t, const RGBTRIPLE *px, ptrdiff_t stride)
+{
+    int tw = tile_side(wr->width, wr->tile, t % wr->tiles_x), th = tile_side(wr->height, wr->tile, t / wr->tiles_x);
+    size_t raw = (size_t)tw * th * sizeof(RGBTRIPLE), len = raw, coded_len = 0;
+    RGBTRIPLE *pixels = malloc(raw);
+    unsigned char *coded = NULL;
+    if(!pixels) {
+        wr->ok = 0;
+        return;
+    }
+    for(int y = 0; y < th; y++)
+        memcpy(pixels + (size_t)y * tw, px + y * stride, tw * sizeof(RGBTRIPLE));
+    const unsigned char *data = (const unsigned char *)pixels;
+    int codec = TILE_RAW;
+    if(wr->codec == TILE_RLE) {
+        coded = malloc(raw + (size_t)tw * th / 128 + 1);
+        if(coded)
+            coded_len = rle_encode(pixels, tw * th, coded);
+    } else if(wr->codec == TILE_QOI) {
+        IMAGE img = {{0}, {0}, pixels, 0, 0};
+        img.info.biWidth = tw;
+        img.info.biHeight = -th; // top row first
+        coded = qoi_encode(&img, 0, &coded_len);
+    }
+    if(coded && coded_len < raw) {
+        data = coded;
+        len = coded_len;
+        codec = wr->codec;
+    }
+    long long at = __atomic_fetch_add(&wr->end, (long long)len, __ATOMIC_RELAXED);
+    if(!write_all(wr->fd, data, len, at))
+        wr->ok = 0;
+    unsigned char *e = wr->index + t * TILE_ENTRY;
+    wr_le(e, at, 8);
+    wr_le(e + 8, len, 4);
+    wr_le(e + 12, codec, 4);
+    free(pixels);
+    free(coded);
+}
+
+static int writer_close(TILEWRITER *wr)
+{
+    unsigned char header[TILE_HEADER];
+    memcpy(header, "TILE", 4);
+    wr_le(header + 4, wr->width, 4);
+    wr_le(header + 8, wr->height, 4);
+    wr_le(header + 12, wr->tile, 4);
+    wr_le(header + 16, wr->codec, 4);
+    wr_le(header + 20, 0, 4);
+    int ok = wr->ok && write_all(wr->fd, header, TILE_HEADER, 0) &&
+             write_all(wr->fd, wr->index, (size_t)wr->tiles_x * wr->tiles_y * TILE_ENTRY, TILE_HEADER);
+    if(close(wr->fd) != 0)
+        ok = 0;
+    free(wr->index);
+    if(ok && rename(wr->path, wr->name) != 0)
+        ok = 0;
+    if(!ok) {
+        fprintf(stderr, "%s: can't write file\n", wr->name);
+        unlink(wr->path);
+    }
+    return ok;
+}
+
+static void save_tile(void *arg, int item)
+{
+    TILEJOB *job = arg;
+    TILEWRITER *wr = job->out;
+    writer_put(wr, (size_t)job->ty * wr->tiles_x + item, job->band + (size_t)item * wr->tile, job->stride);
+}
+
+int tile_save(const IMAGE *img, const char *fileName, int codec)
+{
+    int w = IMAGE_VIEW_WIDTH(img), h = IMAGE_VIEW_HEIGHT(img);
+    int bottom_up = img->info.biHeight > 0;
+    TILEWRITER wr;
+    if(w <= 0 || h <= 0 || !writer_open(&wr, fileName, w, h, TILE_SIZE, codec))
+        return 0;
+    // one row of tiles at a time, the view is gathered once for all of them
+    RGBTRIPLE *view = img->orient ? malloc((size_t)TILE_SIZE * w * sizeof(RGBTRIPLE)) : NULL;
+    if(img->orient && !view)
+        wr.ok = 0;
+    for(int ty = 0; ty < wr.tiles_y && wr.ok; ty++) {
+        int th = tile_side(h, TILE_SIZE, ty);
+        // first memory row of the band
+        int m0 = bottom_up ? h - ty * TILE_SIZE - th : ty * TILE_SIZE;
+        const RGBTRIPLE *rows = img->data + (size_t)m0 * w;
+        if(view) {
+            image_view_rows(img, view, m0, m0 + th);
+            rows = view;
+        }
+        TILEJOB job;
+        memset(&job, 0, sizeof(job));
+        job.out = &wr;
+        job.band = bottom_up ? rows + (size_t)(th - 1) * w : rows;
+        job.stride = bottom_up ? -(ptrdiff_t)w : w;
+        job.ty = ty;
+        pool_run(pool_default(), wr.tiles_x, save_tile, &job);
+    }
+    free(view);
+    return writer_close(&wr);
+}
+
+/****************************************************************************/
+// Kernels tile by tile
+/****************************************************************************/
+static void blur_tile(void *arg, int item)
+{
+    TILEJOB *job = arg;
+    const TILEFILE *tf = job->tf;
+    int tx = item % tf->tiles_x, ty = item / tf->tiles_x;
+    int x0 = tx * tf->tile, y0 = ty * tf->tile;
+    int tw = tile_side(tf->width, tf->tile, tx), th = tile_side(tf->height, tf->tile, ty);
+    // the tile and its halo, cut by the image border where the kernel
+    // copies the 2 outer pixels as it does on the whole image
+    int rx0 = x0 - TILE_HALO > 0 ? x0 - TILE_HALO : 0;
+    int ry0 = y0 - TILE_HALO > 0 ? y0 - TILE_HALO : 0;
+    int rx1 = x0 + tw + TILE_HALO < tf->width ? x0 + tw + TILE_HALO : tf->width;
+    int ry1 = y0 + th + TILE_HALO < tf->height ? y0 + th + TILE_HALO : tf->height;
+    int rw = rx1 - rx0, rh = ry1 - ry0;
+    RGBTRIPLE *region = malloc(2 * (size_t)rw * rh * sizeof(RGBTRIPLE));
+    if(!region || !tile_read(tf, rx0, ry0, rw, rh, region, rw)) {
+        job->ok = 0;
+        free(region);
+        return;
+    }
+    RGBTRIPLE *out = region + (size_t)rw * rh;
+    sse_gaussian_blur_5_rows_vec_ori_r(region, out, rw, rh, y0 - ry0, y0 - ry0 + th);
+    writer_put(job->out, item, out + (size_t)(y0 - ry0) * rw + (x0 - rx0), rw);
+    free(region);
+}
+
+static void mirror_tile(void *arg, int item)
+{
+    TILEJOB *job = arg;
+    const TILEFILE *tf = job->tf;
+    int tx = item % tf->tiles_x, ty = item / tf->tiles_x;
+    int x0 = tx * tf->tile, y0 = ty * tf->tile;
+    int tw = tile_side(tf->width, tf->tile, tx), th = tile_side(tf->height, tf->tile, ty);
+    // the mirrored region, which straddles up to 4 source tiles ; a
+    // vertical flip is only the row order of the read
+    int sx0 = job->flip_h ? tf->width - x0 - tw : x0, sy0 = job->flip_v ? tf->height - y0 - th : y0;
+    RGBTRIPLE *buf = malloc((size_t)tw * th * sizeof(RGBTRIPLE));
+    int ok = buf != NULL;
+    if(ok && job->flip_v)
+        ok = tile_read(tf, sx0, sy0, tw, th, buf + (size_t)(th - 1) * tw, -(ptrdiff_t)tw);
+    else if(ok)
+        ok = tile_read(tf, sx0, sy0, tw, th, buf, tw);
+    if(ok && job->flip_h)
+        sse_flip_horizontal_rows_ori(buf, tw, 0, th);
+    if(ok)
+        writer_put(job->out, item, buf, tw);
+    else
+        job->ok = 0;
+    free(buf);
+}
+
+static int tile_kernel(const TILEFILE *src, const char *fileName, int codec, POOLFN fn, int flip_h, int flip_v)
+{
+    TILEWRITER wr;
+    if(!writer_open(&wr, fileName, src->width, src->height, src->tile, codec))
+        return 0;
+    TILEJOB job;
+    memset(&job, 0, sizeof(job));
+    job.tf = src;
+    job.out = &wr;
+    job.flip_h = flip_h;
+    job.flip_v = flip_v;
+    job.ok = 1;
+    pool_run(pool_default(), src->tiles_x * src->tiles_y, fn, &job);
+    if(!job.ok)
+        wr.ok = 0;
+    return writer_close(&wr);
+}
+
+int tile_blur(const TILEFILE *src, const char *fileName, int codec)
+{
+    return tile_kernel(src, fileName, codec, blur_tile, 0, 0);
+}
+
+int tile_mirror(const TILEFILE *src, const char *fileName, int codec, int flip_h, int flip_v)
+{
+    return tile_kernel(src, fileName, codec, mirror_tile, flip_h, flip_v);
+}
@@ -0,0 +1,51 @@
+#ifndef TILED_IMAGE
+#define TILED_IMAGE
+#include <stddef.h>
+#include "image.h"
+
+// Tiled container for images too big to be loaded whole : the image is cut
+// in TILE_SIZE x TILE_SIZE tiles (smaller on the right and bottom edges),
+// each one stored on its own, so a region only costs the tiles it covers.
+// File layout, little endian :
+//   "TILE" , width (4) , height (4) , tile side (4) , codec asked for (4) ,
+//   0 (4) , then one entry per tile, rows of tiles top first :
+//   offset (8) , length (4) , codec (4)
+// then the tiles in any order. A tile is its pixels (blue, green, red) top
+// row first, as they are (TILE_RAW), packed in runs (TILE_RLE) or as a
+// plain QOI image (TILE_QOI) ; a tile which does not shrink is kept raw.
+#define TILE_SIZE 256
+#define TILE_RAW 0
+#define TILE_RLE 1
+#define TILE_QOI 2
+
+typedef struct tile_file {
+    unsigned char *map; // the whole file, mapped read only
+    size_t size;
+    int width;
+    int height;
+    int tile; // tile side
+    int tiles_x;
+    int tiles_y;
+} TILEFILE;
+
+// "raw", "rle" or "qoi", -1 otherwise
+int tile_codec(const char *name);
+int tile_open(TILEFILE *tf, const char *fileName);
+void tile_close(TILEFILE *tf);
+// copy columns x ~ x+w-1 of rows y ~ y+h-1 (top row first) to dst, row i of
+// the region at dst + i * stride pixels (stride may be negative) ; only the
+// tiles covering the region are read, in parallel on the pool, raw tiles
+// straight from the mapping
+int tile_read(const TILEFILE *tf, int x, int y, int w, int h, RGBTRIPLE *dst, ptrdiff_t stride);
+// conversions : the view of img, tiles coded in parallel and written at
+// once with pwrite ; the whole image into img, rows bottom-up as bmp_read
+int tile_save(const IMAGE *img, const char *fileName, int codec);
+int tile_load(IMAGE *img, const char *fileName);
+// Kernels tile by tile, the image is never in memory as a whole : every
+// output tile is read with a halo of 2 pixels (5x5 gaussian of gaussian.c,
+// the 2 pixels border of the image copied) or from the mirrored region
+// (flips), computed and written. The output is written next to fileName
+// and renamed at the end, so it may replace src.
+int tile_blur(const TILEFILE *src, const char *fileName, int codec);
+int tile_mirror(const TILEFILE *src, const char *fileName, int codec, int flip_h, int flip_v);
+#endif // TILED_IMAGE
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "unsharp.h"
+#include "gaussian.h"
+#include "pool.h"
+
+// rows handed to a pool worker at a time
+#define BAND_ROWS 32
+
+static int amount_q9(float amount)
+{
+    float q = amount * 512 + 0.5f;
+    return q < 0 ? 0 : q > 32767 ? 32767 : (int)q;
+}
+
+// orig + round(amount * diff) : (diff * 64) * (amount * 512) >> 15 with
+// rounding is exactly what pmulhrsw does on 16 bits lanes
+void unsharp_combine_row(const unsigned char *orig, const unsigned char *blur, unsigned char *out, int n,
+                         float amount, int threshold)
+{
+    const __m128i vk0 = _mm_setzero_si128();
+    const __m128i vamount = _mm_set1_epi16(amount_q9(amount));
+    const __m128i vthreshold = _mm_set1_epi16(threshold - 1);
+    int i = 0, q = amount_q9(amount);
+    for(; i + 16 <= n; i += 16) {
+        __m128i o = _mm_loadu_si128((const __m128i *)(orig + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(blur + i));
+        __m128i olo = _mm_unpacklo_epi8(o, vk0), ohi = _mm_unpackhi_epi8(o, vk0);
+        __m128i dlo = _mm_sub_epi16(olo, _mm_unpacklo_epi8(b, vk0));
+        __m128i dhi = _mm_sub_epi16(ohi, _mm_unpackhi_epi8(b, vk0));
+        __m128i mlo = _mm_cmpgt_epi16(_mm_abs_epi16(dlo), vthreshold);
+        __m128i mhi = _mm_cmpgt_epi16(_mm_abs_epi16(dhi), vthreshold);
+        dlo = _mm_and_si128(_mm_mulhrs_epi16(_mm_slli_epi16(dlo, 6), vamount), mlo);
+        dhi = _mm_and_si128(_mm_mulhrs_epi16(_mm_slli_epi16(dhi, 6), vamount), mhi);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(_mm_add_epi16(olo, dlo), _mm_add_epi16(ohi, dhi)));
+    }
+    for(; i < n; i++) {
+        int d = orig[i] - blur[i], v = orig[i];
+        if(abs(d) >= threshold)
+            v += (d * 64 * q + 0x4000) >> 15;
+        out[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+}
+
+typedef struct unsharp_band {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+    int passes;
+    float amount;
+    int threshold;
+    int y0;
+    int y1;
+    unsigned char *ring; // 5 rows per pass
+    unsigned char *out; // 1 row per pass
+    int start[UNSHARP_MAX_PASSES]; // first row a pass received
+} UNSHARPBAND;
+
+/*********************************************************/
+// row t enters pass p, rows come in order ; the last pass
+// feeds the combine step
+/*********************************************************/
+static void band_push(UNSHARPBAND *b, int p, int t, const unsigned char *row)
+{
+    int n = b->w * b->cstep, h = b->h;
+    if(p == b->passes) {
+        if(t >= b->y0 && t < b->y1)
+            unsharp_combine_row(b->src + (size_t)t * n, row, b->dst + (size_t)t * n, n, b->amount, b->threshold);
+        return;
+    }
+    unsigned char *ring = b->ring + (size_t)p * 5 * n, *slot = ring + (size_t)(t % 5) * n;
+    memcpy(slot, row, n);
+    if(b->start[p] < 0)
+        b->start[p] = t;
+    // the 2 rows border is copied by the blur
+    if(h < 5 || t < 2) {
+        band_push(b, p + 1, t, slot);
+        return;
+    }
+    if(t - 4 >= b->start[p]) {
+        unsigned char *rows[5], *out = b->out + (size_t)p * n;
+        for(int k = 0; k < 5; k++)
+            rows[k] = ring + (size_t)((t - 4 + k) % 5) * n;
+        sse_gaussian_blur_5_row(rows, out, b->w, b->cstep);
+        band_push(b, p + 1, t - 2, out);
+    }
+    if(t == h - 1) {
+        band_push(b, p + 1, h - 2, ring + (size_t)((h - 2) % 5) * n);
+        band_push(b, p + 1, h - 1, slot);
+    }
+}
+
+int unsharp_rows(const unsigned char *src, unsigned char *dst, int w, int h, int cstep,
+                 float amount, int radius, int threshold, int y0, int y1)
+{
+    int passes = radius < 1 ? 1 : (radius + 1) / 2, n = w * cstep;
+    if(passes > UNSHARP_MAX_PASSES) {
+        fprintf(stderr, "unsharp : radius %d above %d\n", radius, 2 * UNSHARP_MAX_PASSES);
+        return 0;
+    }
+    UNSHARPBAND b = {src, dst, w, h, cstep, passes, amount, threshold, y0, y1, NULL, NULL, {0}};
+    b.ring = malloc((size_t)passes * 6 * n);
+    if(!b.ring) {
+        fprintf(stderr, "unsharp : out of memory\n");
+        return 0;
+    }
+    b.out = b.ring + (size_t)passes * 5 * n;
+    for(int p = 0; p < passes; p++)
+        b.start[p] = -1;
+    // every pass widens the support by 2 rows each side
+    int s0 = y0 - 2 * passes > 0 ? y0 - 2 * passes : 0;
+    int s1 = y1 + 2 * passes < h ? y1 + 2 * passes : h;
+    for(int t = s0; t < s1; t++)
+        band_push(&b, 0, t, src + (size_t)t * n);
+    free(b.ring);
+    return 1;
+}
+
+typedef struct unsharp_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int cstep;
+    float amount;
+    int radius;
+    int threshold;
+    int ok;
+} UNSHARPJOB;
+
+static void unsharp_band(void *arg, int item)
+{
+    UNSHARPJOB *job = arg;
+    int y0 = item * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < job->h ? y0 + BAND_ROWS : job->h;
+    if(!unsharp_rows(job->src, job->dst, job->w, job->h, job->cstep, job->amount, job->radius, job->threshold, y0, y1))
+        job->ok = 0;
+}
+
+int unsharp_mask(const unsigned char *src, unsigned char *dst, int w, int h, int cstep,
+                 float amount, int radius, int threshold)
+{
+    UNSHARPJOB job = {src, dst, w, h, cstep, amount, radius, threshold, 1};
+    pool_run(pool_default(), (h + BAND_ROWS - 1) / BAND_ROWS, unsharp_band, &job);
+    return job.ok;
+}
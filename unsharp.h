@@ -0,0 +1,20 @@
+#ifndef UNSHARP_MASK
+#define UNSHARP_MASK
+
+// cascaded 5x5 passes for the largest radius
+#define UNSHARP_MAX_PASSES 8
+
+// Unsharp mask : out = orig + amount * (orig - blur) where |orig - blur| >=
+// threshold, orig elsewhere. The blur is sse_gaussian_blur_5_row repeated
+// (radius + 1) / 2 times (each 5x5 pass reaches 2 pixels further), streamed
+// row by row through 5 rows rings, so besides dst only 6 rows per pass and
+// band are needed. amount is kept in 1/512 steps, up to 63.
+int unsharp_rows(const unsigned char *src, unsigned char *dst, int w, int h, int cstep,
+                 float amount, int radius, int threshold, int y0, int y1);
+// whole image, bands spread over the default worker pool
+int unsharp_mask(const unsigned char *src, unsigned char *dst, int w, int h, int cstep,
+                 float amount, int radius, int threshold);
+// combine step for a row whose blur is already known, out may be blur
+void unsharp_combine_row(const unsigned char *orig, const unsigned char *blur, unsigned char *out, int n,
+                         float amount, int threshold);
+#endif // UNSHARP_MASK
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "warp.h"
+#include "pool.h"
+
+#define WARP_ONE (1 << WARP_FRAC)
+// fixed point coordinates stay below 2^31 up to this magnitude
+#define WARP_SAFE ((1 << (31 - WARP_BITS)) - 2)
+
+typedef struct warp_job {
+    const unsigned char *src;
+    unsigned char *dst;
+    int w;
+    int h;
+    int dw;
+    int dh;
+    int cstep;
+    const double *m;
+    int affine;
+    int fill;
+    int tiles_x;
+    int last; // 8 bytes loads of a pixel pair and the one below start before it
+} WARPJOB;
+
+// v * 2^WARP_BITS rounded down, saturated to the int range
+static int fixed_floor(double v)
+{
+    double f = v * (1 << WARP_BITS);
+    if(f >= 2147483647.0)
+        return 0x7fffffff;
+    if(f <= -2147483648.0)
+        return -0x7fffffff - 1;
+    int i = (int)f;
+    return i > f ? i - 1 : i;
+}
+
+/*********************************************************/
+// one pixel at fixed point (cx, cy), the neighbours out
+// of the source count as fill ; the reference arithmetic
+// of the vector paths
+/*********************************************************/
+static void sample_pixel(const unsigned char *src, int w, int h, int cstep, int cx, int cy, int fill, unsigned char *out)
+{
+    int x0 = cx >> WARP_BITS, y0 = cy >> WARP_BITS;
+    int fx = (cx >> (WARP_BITS - WARP_FRAC)) & (WARP_ONE - 1), fy = (cy >> (WARP_BITS - WARP_FRAC)) & (WARP_ONE - 1);
+    if(x0 < -1 || x0 >= w || y0 < -1 || y0 >= h) {
+        memset(out, fill, cstep);
+        return;
+    }
+    const unsigned char *p[4];
+    for(int i = 0; i < 4; i++) {
+        int x = x0 + (i & 1), y = y0 + (i >> 1);
+        p[i] = x >= 0 && x < w && y >= 0 && y < h ? src + ((size_t)y * w + x) * cstep : NULL;
+    }
+    for(int c = 0; c < cstep; c++) {
+        int v[4];
+        for(int i = 0; i < 4; i++)
+            v[i] = p[i] ? p[i][c] : fill;
+        int top = v[0] * (WARP_ONE - fx) + v[1] * fx, bot = v[2] * (WARP_ONE - fx) + v[3] * fx;
+        out[c] = (top * (WARP_ONE - fy) + bot * fy + (1 << (2 * WARP_FRAC - 1))) >> (2 * WARP_FRAC);
+    }
+}
+
+// source point of destination pixel (x, y) in doubles, 0 behind the plane
+static int map_point(const double *m, double x, double y, double *sx, double *sy)
+{
+    double d = m[6] * x + m[7] * y + m[8];
+    if(!(d > 0))
+        return 0;
+    *sx = (m[0] * x + m[1] * y + m[2]) / d;
+    *sy = (m[3] * x + m[4] * y + m[5]) / d;
+    return 1;
+}
+
+static void sample_point(const WARPJOB *job, int x, int y, unsigned char *out)
+{
+    double sx, sy;
+    if(map_point(job->m, x, y, &sx, &sy))
+        sample_pixel(job->src, job->w, job->h, job->cstep, fixed_floor(sx), fixed_floor(sy), job->fill, out);
+    else
+        memset(out, job->fill, job->cstep);
+}
+
+/*********************************************************/
+// 4 RGBTRIPLE pixels : the 8 bytes at a neighbour hold it
+// and its right one, 2 pixels share a register and a
+// shuffle pairs their channels for the horizontal
+// multiply-add, the vertical one takes the top and bottom
+// sums interleaved
+/*********************************************************/
+static void bilinear4_rgb(const unsigned char *src, int rb, __m128i off, __m128i fx, __m128i fy, unsigned char *out)
+{
+    const __m128i pairs = _mm_setr_epi8(0, 3, 1, 4, 2, 5, -1, -1, 8, 11, 9, 12, 10, 13, -1, -1);
+    const __m128i wx01 = _mm_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 4, 5, 4, 5, 4, 5, 4, 5);
+    const __m128i wx23 = _mm_setr_epi8(8, 9, 8, 9, 8, 9, 8, 9, 12, 13, 12, 13, 12, 13, 12, 13);
+    const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i one = _mm_set1_epi32(WARP_ONE), round = _mm_set1_epi32(1 << (2 * WARP_FRAC - 1));
+    __m128i wx = _mm_or_si128(_mm_slli_epi32(fx, 8), _mm_sub_epi32(one, fx));
+    __m128i wy = _mm_or_si128(_mm_slli_epi32(fy, 16), _mm_sub_epi32(one, fy));
+    __m128i wy4[4] = {_mm_shuffle_epi32(wy, 0x00), _mm_shuffle_epi32(wy, 0x55), _mm_shuffle_epi32(wy, 0xaa), _mm_shuffle_epi32(wy, 0xff)};
+    __m128i res[2];
+    int o[4];
+    _mm_storeu_si128((__m128i *)o, off);
+    for(int i = 0; i < 2; i++) {
+        const unsigned char *a = src + o[2 * i], *b = src + o[2 * i + 1];
+        __m128i top = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)a), _mm_loadl_epi64((const __m128i *)b));
+        __m128i bot = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(a + rb)), _mm_loadl_epi64((const __m128i *)(b + rb)));
+        __m128i w2 = _mm_shuffle_epi8(wx, i ? wx23 : wx01);
+        top = _mm_maddubs_epi16(_mm_shuffle_epi8(top, pairs), w2);
+        bot = _mm_maddubs_epi16(_mm_shuffle_epi8(bot, pairs), w2);
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(top, bot), wy4[2 * i]);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(top, bot), wy4[2 * i + 1]);
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 2 * WARP_FRAC);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 2 * WARP_FRAC);
+        res[i] = _mm_packs_epi32(lo, hi);
+    }
+    __m128i v = _mm_shuffle_epi8(_mm_packus_epi16(res[0], res[1]), compact);
+    int tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    _mm_storel_epi64((__m128i *)out, v);
+    memcpy(out + 8, &tail, 4);
+}
+
+// 4 planar pixels : the 4 top pairs and the 4 bottom pairs gathered into
+// one register, one multiply-add per direction
+static void bilinear4_tri(const unsigned char *src, int rb, __m128i off, __m128i fx, __m128i fy, unsigned char *out)
+{
+    const __m128i pack = _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 0, 1, 4, 5, 8, 9, 12, 13);
+    const __m128i one = _mm_set1_epi32(WARP_ONE), round = _mm_set1_epi32(1 << (2 * WARP_FRAC - 1));
+    __m128i wx = _mm_shuffle_epi8(_mm_or_si128(_mm_slli_epi32(fx, 8), _mm_sub_epi32(one, fx)), pack);
+    __m128i wy = _mm_or_si128(_mm_slli_epi32(fy, 16), _mm_sub_epi32(one, fy));
+    int o[4];
+    _mm_storeu_si128((__m128i *)o, off);
+    __m128i v = _mm_setr_epi16(src[o[0]] | src[o[0] + 1] << 8, src[o[1]] | src[o[1] + 1] << 8,
+                               src[o[2]] | src[o[2] + 1] << 8, src[o[3]] | src[o[3] + 1] << 8,
+                               src[o[0] + rb] | src[o[0] + rb + 1] << 8, src[o[1] + rb] | src[o[1] + rb + 1] << 8,
+                               src[o[2] + rb] | src[o[2] + rb + 1] << 8, src[o[3] + rb] | src[o[3] + rb + 1] << 8);
+    v = _mm_maddubs_epi16(v, wx);
+    v = _mm_madd_epi16(_mm_unpacklo_epi16(v, _mm_srli_si128(v, 8)), wy);
+    v = _mm_srai_epi32(_mm_add_epi32(v, round), 2 * WARP_FRAC);
+    v = _mm_packs_epi32(v, v);
+    int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+    memcpy(out, &bytes, 4);
+}
+
+// 4 pixels at fixed point coordinates : the vector path when all 4 have
+// their 2x2 neighbours inside the source, one by one otherwise
+static void sample4(const WARPJOB *job, __m128i cx, __m128i cy, unsigned char *out)
+{
+    const __m128i minus1 = _mm_set1_epi32(-1);
+    __m128i x0 = _mm_srai_epi32(cx, WARP_BITS), y0 = _mm_srai_epi32(cy, WARP_BITS);
+    __m128i in = _mm_and_si128(_mm_cmpgt_epi32(x0, minus1), _mm_cmplt_epi32(x0, _mm_set1_epi32(job->w - 1)));
+    in = _mm_and_si128(in, _mm_and_si128(_mm_cmpgt_epi32(y0, minus1), _mm_cmplt_epi32(y0, _mm_set1_epi32(job->h - 1))));
+    __m128i off = _mm_mullo_epi32(_mm_add_epi32(_mm_mullo_epi32(y0, _mm_set1_epi32(job->w)), x0), _mm_set1_epi32(job->cstep));
+    if(job->cstep == 3)
+        in = _mm_and_si128(in, _mm_cmplt_epi32(off, _mm_set1_epi32(job->last)));
+    if(_mm_movemask_epi8(in) == 0xffff) {
+        const __m128i mask = _mm_set1_epi32(WARP_ONE - 1);
+        __m128i fx = _mm_and_si128(_mm_srai_epi32(cx, WARP_BITS - WARP_FRAC), mask);
+        __m128i fy = _mm_and_si128(_mm_srai_epi32(cy, WARP_BITS - WARP_FRAC), mask);
+        if(job->cstep == 3)
+            bilinear4_rgb(job->src, job->w * 3, off, fx, fy, out);
+        else
+            bilinear4_tri(job->src, job->w, off, fx, fy, out);
+        return;
+    }
+    int lx[4], ly[4];
+    _mm_storeu_si128((__m128i *)lx, cx);
+    _mm_storeu_si128((__m128i *)ly, cy);
+    for(int i = 0; i < 4; i++)
+        sample_pixel(job->src, job->w, job->h, job->cstep, lx[i], ly[i], job->fill, out + i * job->cstep);
+}
+
+/*********************************************************/
+// affine span [x0,x1) of row y : the coordinates step by
+// m0, m3 in fixed point from the exact start of the span,
+// the drift stays far below a weight step over a tile ;
+// a span reaching beyond WARP_SAFE goes through doubles
+/*********************************************************/
+static void affine_span(const WARPJOB *job, int x0, int x1, int y, unsigned char *out)
+{
+    const double *m = job->m;
+    double sx = m[0] * x0 + m[1] * y + m[2], sy = m[3] * x0 + m[4] * y + m[5];
+    double ex = sx + m[0] * (x1 - 1 - x0), ey = sy + m[3] * (x1 - 1 - x0);
+    int x = x0;
+    if(sx < -WARP_SAFE || sx > WARP_SAFE || sy < -WARP_SAFE || sy > WARP_SAFE
+       || ex < -WARP_SAFE || ex > WARP_SAFE || ey < -WARP_SAFE || ey > WARP_SAFE) {
+        for(; x < x1; x++, out += job->cstep)
+            sample_point(job, x, y, out);
+        return;
+    }
+    int ax = fixed_floor(m[0] + 0.5 / (1 << WARP_BITS)), ay = fixed_floor(m[3] + 0.5 / (1 << WARP_BITS));
+    int cx = fixed_floor(sx), cy = fixed_floor(sy);
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i vx = _mm_add_epi32(_mm_set1_epi32(cx), _mm_mullo_epi32(_mm_set1_epi32(ax), lanes));
+    __m128i vy = _mm_add_epi32(_mm_set1_epi32(cy), _mm_mullo_epi32(_mm_set1_epi32(ay), lanes));
+    __m128i stepx = _mm_set1_epi32(4 * ax), stepy = _mm_set1_epi32(4 * ay);
+    for(; x + 4 <= x1; x += 4, out += 4 * job->cstep) {
+        sample4(job, vx, vy, out);
+        vx = _mm_add_epi32(vx, stepx);
+        vy = _mm_add_epi32(vy, stepy);
+    }
+    int lx[4], ly[4];
+    _mm_storeu_si128((__m128i *)lx, vx);
+    _mm_storeu_si128((__m128i *)ly, vy);
+    for(int i = 0; x < x1; x++, i++, out += job->cstep)
+        sample_pixel(job->src, job->w, job->h, job->cstep, lx[i], ly[i], job->fill, out);
+}
+
+// perspective span : numerators and denominator of 4 pixels in floats from
+// the start of the span, one division ; lanes behind the plane or out of the
+// int range fall to the one by one path, which fills them
+static void perspective_span(const WARPJOB *job, int x0, int x1, int y, unsigned char *out)
+{
+    const double *m = job->m;
+    const __m128 scale = _mm_set1_ps((float)(1 << WARP_BITS)), limit = _mm_set1_ps((float)WARP_SAFE);
+    __m128 nx = _mm_set1_ps((float)(m[0] * x0 + m[1] * y + m[2])), ny = _mm_set1_ps((float)(m[3] * x0 + m[4] * y + m[5]));
+    __m128 nd = _mm_set1_ps((float)(m[6] * x0 + m[7] * y + m[8]));
+    __m128 ax = _mm_set1_ps((float)m[0]), ay = _mm_set1_ps((float)m[3]), ad = _mm_set1_ps((float)m[6]);
+    __m128 i = _mm_setr_ps(0, 1, 2, 3);
+    int x = x0;
+    for(; x + 4 <= x1; x += 4, out += 4 * job->cstep, i = _mm_add_ps(i, _mm_set1_ps(4))) {
+        __m128 d = _mm_add_ps(nd, _mm_mul_ps(ad, i));
+        __m128 sx = _mm_div_ps(_mm_add_ps(nx, _mm_mul_ps(ax, i)), d);
+        __m128 sy = _mm_div_ps(_mm_add_ps(ny, _mm_mul_ps(ay, i)), d);
+        __m128 ok = _mm_and_ps(_mm_cmpgt_ps(d, _mm_setzero_ps()),
+                               _mm_and_ps(_mm_cmplt_ps(_mm_max_ps(sx, sy), limit), _mm_cmpgt_ps(_mm_min_ps(sx, sy), _mm_sub_ps(_mm_setzero_ps(), limit))));
+        __m128i cx = _mm_cvttps_epi32(_mm_floor_ps(_mm_mul_ps(sx, scale)));
+        __m128i cy = _mm_cvttps_epi32(_mm_floor_ps(_mm_mul_ps(sy, scale)));
+        // 0x80000000 is far out of any source
+        cx = _mm_blendv_epi8(_mm_set1_epi32(-0x7fffffff - 1), cx, _mm_castps_si128(ok));
+        sample4(job, cx, cy, out);
+    }
+    for(; x < x1; x++, out += job->cstep)
+        sample_point(job, x, y, out);
+}
+
+static void warp_tile(void *arg, int item)
+{
+    WARPJOB *job = arg;
+    int tx = item % job->tiles_x * WARP_TILE, ty = item / job->tiles_x * WARP_TILE;
+    int x1 = tx + WARP_TILE < job->dw ? tx + WARP_TILE : job->dw;
+    int y1 = ty + WARP_TILE < job->dh ? ty + WARP_TILE : job->dh;
+    for(int y = ty; y < y1; y++) {
+        unsigned char *out = job->dst + ((size_t)y * job->dw + tx) * job->cstep;
+        if(job->affine)
+            affine_span(job, tx, x1, y, out);
+        else
+            perspective_span(job, tx, x1, y, out);
+    }
+}
+
+/****************************************************************************/
+int warp_image(const unsigned char *src, unsigned char *dst, int w, int h, int dw, int dh, int cstep,
+               const double m[9], int fill)
+{
+    if(w < 1 || h < 1 || dw < 1 || dh < 1 || (cstep != 1 && cstep != 3)) {
+        fprintf(stderr, "warp : bad size %d x %d to %d x %d\n", w, h, dw, dh);
+        return 0;
+    }
+    if(w > WARP_SAFE || h > WARP_SAFE || (long long)w * h * cstep > 0x7fffffffLL) {
+        fprintf(stderr, "warp : %d x %d is too large\n", w, h);
+        return 0;
+    }
+    WARPJOB job = {src, dst, w, h, dw, dh, cstep, m, m[6] == 0 && m[7] == 0 && m[8] == 1,
+                   fill < 0 ? 0 : fill > 255 ? 255 : fill, (dw + WARP_TILE - 1) / WARP_TILE,
+                   w * h * cstep - w * cstep - 7};
+    pool_run(pool_default(), job.tiles_x * ((dh + WARP_TILE - 1) / WARP_TILE), warp_tile, &job);
+    return 1;
+}
+
+int warp_affine_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int dw, int dh, const double m[6], int fill)
+{
+    double full[9] = {m[0], m[1], m[2], m[3], m[4], m[5], 0, 0, 1};
+    return warp_image((const unsigned char *)src, (unsigned char *)dst, w, h, dw, dh, 3, full, fill);
+}
+
+int warp_perspective_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int dw, int dh, const double m[9], int fill)
+{
+    return warp_image((const unsigned char *)src, (unsigned char *)dst, w, h, dw, dh, 3, m, fill);
+}
+
+void naive_warp(const unsigned char *src, unsigned char *dst, int w, int h, int dw, int dh, int cstep,
+                const double m[9], int fill)
+{
+    WARPJOB job = {src, dst, w, h, dw, dh, cstep, m, 0, fill < 0 ? 0 : fill > 255 ? 255 : fill, 0, 0};
+    for(int y = 0; y < dh; y++)
+        for(int x = 0; x < dw; x++)
+            sample_point(&job, x, y, dst + ((size_t)y * dw + x) * cstep);
+}
+
+void naive_warp_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int dw, int dh, const double m[9], int fill)
+{
+    naive_warp((const unsigned char *)src, (unsigned char *)dst, w, h, dw, dh, 3, m, fill);
+}
+
+/****************************************************************************/
+// sine and cosine of degrees without libm : reduced to [-180,180], series
+// to x^23 ; right angles are exact, so that their coordinates land on whole
+// pixels
+static void sin_cos_deg(double degrees, double *s, double *c)
+{
+    const double pi = 3.14159265358979323846;
+    degrees -= 360 * (double)(long long)(degrees / 360);
+    degrees = degrees > 180 ? degrees - 360 : degrees < -180 ? degrees + 360 : degrees;
+    if(degrees == (int)degrees && (int)degrees % 90 == 0) {
+        int q = ((int)degrees / 90 + 4) % 4;
+        *s = q == 1 ? 1 : q == 3 ? -1 : 0;
+        *c = q == 0 ? 1 : q == 2 ? -1 : 0;
+        return;
+    }
+    double x = degrees * pi / 180, x2 = x * x, ts = x, tc = 1;
+    *s = ts;
+    *c = tc;
+    for(int n = 1; n <= 11; n++) {
+        ts *= -x2 / ((2 * n) * (2 * n + 1));
+        tc *= -x2 / ((2 * n - 1) * (2 * n));
+        *s += ts;
+        *c += tc;
+    }
+}
+
+void warp_rotation(double m[9], int w, int h, int dw, int dh, double degrees)
+{
+    double s, c, cx = (w - 1) / 2.0, cy = (h - 1) / 2.0, dx = (dw - 1) / 2.0, dy = (dh - 1) / 2.0;
+    sin_cos_deg(degrees, &s, &c);
+    // y grows downwards : the content turns counter-clockwise when every
+    // destination pixel looks at its source rotated clockwise
+    m[0] = c;
+    m[1] = -s;
+    m[2] = cx - c * dx + s * dy;
+    m[3] = s;
+    m[4] = c;
+    m[5] = cy - s * dx - c * dy;
+    m[6] = 0;
+    m[7] = 0;
+    m[8] = 1;
+}
+
+// a x = b by gaussian elimination with partial pivoting, n up to 8
+static int solve(double a[8][8], double *b, int n)
+{
+    for(int i = 0; i < n; i++) {
+        int p = i;
+        for(int r = i + 1; r < n; r++)
+            if((a[r][i] < 0 ? -a[r][i] : a[r][i]) > (a[p][i] < 0 ? -a[p][i] : a[p][i]))
+                p = r;
+        if((a[p][i] < 0 ? -a[p][i] : a[p][i]) < 1e-12)
+            return 0;
+        for(int k = 0; k < n; k++) {
+            double t = a[i][k];
+            a[i][k] = a[p][k];
+            a[p][k] = t;
+        }
+        double t = b[i];
+        b[i] = b[p];
+        b[p] = t;
+        for(int r = i + 1; r < n; r++) {
+            double f = a[r][i] / a[i][i];
+            for(int k = i; k < n; k++)
+                a[r][k] -= f * a[i][k];
+            b[r] -= f * b[i];
+        }
+    }
+    for(int i = n - 1; i >= 0; i--) {
+        for(int k = i + 1; k < n; k++)
+            b[i] -= a[i][k] * b[k];
+        b[i] /= a[i][i];
+    }
+    return 1;
+}
+
+int warp_quad(double m[9], int dw, int dh, const double quad[8])
+{
+    const double corner[8] = {0, 0, dw - 1, 0, dw - 1, dh - 1, 0, dh - 1};
+    double a[8][8], b[8];
+    for(int i = 0; i < 4; i++) {
+        double x = corner[2 * i], y = corner[2 * i + 1], u = quad[2 * i], v = quad[2 * i + 1];
+        double ru[8] = {x, y, 1, 0, 0, 0, -x * u, -y * u}, rv[8] = {0, 0, 0, x, y, 1, -x * v, -y * v};
+        memcpy(a[2 * i], ru, sizeof(ru));
+        memcpy(a[2 * i + 1], rv, sizeof(rv));
+        b[2 * i] = u;
+        b[2 * i + 1] = v;
+    }
+    if(!solve(a, b, 8)) {
+        fprintf(stderr, "warp : degenerate quad\n");
+        return 0;
+    }
+    memcpy(m, b, 8 * sizeof(double));
+    m[8] = 1;
+    return 1;
+}
+
+int warp_invert(const double m[9], double inv[9])
+{
+    double det = m[0] * (m[4] * m[8] - m[5] * m[7]) - m[1] * (m[3] * m[8] - m[5] * m[6]) + m[2] * (m[3] * m[7] - m[4] * m[6]);
+    if((det < 0 ? -det : det) < 1e-12) {
+        fprintf(stderr, "warp : singular matrix\n");
+        return 0;
+    }
+    inv[0] = (m[4] * m[8] - m[5] * m[7]) / det;
+    inv[1] = (m[2] * m[7] - m[1] * m[8]) / det;
+    inv[2] = (m[1] * m[5] - m[2] * m[4]) / det;
+    inv[3] = (m[5] * m[6] - m[3] * m[8]) / det;
+    inv[4] = (m[0] * m[8] - m[2] * m[6]) / det;
+    inv[5] = (m[2] * m[3] - m[0] * m[5]) / det;
+    inv[6] = (m[3] * m[7] - m[4] * m[6]) / det;
+    inv[7] = (m[1] * m[6] - m[0] * m[7]) / det;
+    inv[8] = (m[0] * m[4] - m[1] * m[3]) / det;
+    // keep the affine fast path for affine inputs
+    if(m[6] == 0 && m[7] == 0) {
+        for(int i = 0; i < 6; i++)
+            inv[i] /= inv[8];
+        inv[6] = 0;
+        inv[7] = 0;
+        inv[8] = 1;
+    }
+    return 1;
+}
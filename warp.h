@@ -0,0 +1,39 @@
+#ifndef IMAGE_WARP
+#define IMAGE_WARP
+#include "bmp.h"
+
+// fixed point bits of the source coordinates
+#define WARP_BITS 16
+// bits of the bilinear weights, 6 so that 64 still fits the signed bytes of
+// the multiply-add
+#define WARP_FRAC 6
+// output tiles handed to a pool worker, their source footprint stays compact
+// whatever the rotation
+#define WARP_TILE 64
+
+// Warp of w x h pixels of cstep bytes (1 : planar, 3 : RGBTRIPLE) into dw x
+// dh. The 3x3 matrix m (row major) maps every destination pixel back to the
+// source : sx = (m0 x + m1 y + m2) / (m6 x + m7 y + m8), sy = (m3 x + m4 y +
+// m5) / (m6 x + m7 y + m8), pixel centers on integers, row 0 first. With a
+// last row of 0 0 1 (affine) the coordinates step along the rows in fixed
+// point, otherwise 4 of them are divided at once in floats. 4 pixels are
+// interpolated at a time ; samples falling outside the source take fill.
+int warp_image(const unsigned char *src, unsigned char *dst, int w, int h, int dw, int dh, int cstep,
+               const double m[9], int fill);
+int warp_affine_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int dw, int dh, const double m[6], int fill);
+int warp_perspective_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int dw, int dh, const double m[9], int fill);
+// per pixel reference in doubles, same rounding of the coordinates
+void naive_warp(const unsigned char *src, unsigned char *dst, int w, int h, int dw, int dh, int cstep,
+                const double m[9], int fill);
+void naive_warp_ori(const RGBTRIPLE *src, RGBTRIPLE *dst, int w, int h, int dw, int dh, const double m[9], int fill);
+
+// Matrices for warp_image. warp_rotation turns the image counter-clockwise
+// by degrees in memory order (row 0 on top), the center of dst on the center
+// of src. warp_quad sends the corners of dst (top left, top right, bottom
+// right, bottom left) to the 4 source points of quad (x, y pairs), e.g. the
+// corners of a photographed page. warp_invert turns a source to destination
+// mapping into the one warp_image takes. They return 0 on a degenerate input.
+void warp_rotation(double m[9], int w, int h, int dw, int dh, double degrees);
+int warp_quad(double m[9], int dw, int dh, const double quad[8]);
+int warp_invert(const double m[9], double inv[9]);
+#endif // IMAGE_WARP
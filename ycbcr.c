@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "ycbcr.h"
+#include "pool.h"
+
+// rows handed to a pool worker at a time, even so that a band holds whole
+// chroma rows of 4:2:0
+#define BAND_ROWS 32
+
+typedef struct ycc_job {
+    const RGBTRIPLE *src;
+    RGBTRIPLE *dst;
+    const YCCIMAGE *img;
+    YCCCOEF k;
+    int ok;
+} YCCJOB;
+
+static short q14(double v)
+{
+    return (short)(v < 0 ? v * 16384 - 0.5 : v * 16384 + 0.5);
+}
+
+/*********************************************************/
+// coefficients from the luma weights of red and blue
+/*********************************************************/
+int ycc_coef(YCCCOEF *k, int matrix)
+{
+    double kr, kb, kg;
+    if(matrix == YCC_BT601) {
+        kr = 0.299;
+        kb = 0.114;
+    } else if(matrix == YCC_BT709) {
+        kr = 0.2126;
+        kb = 0.0722;
+    } else {
+        fprintf(stderr, "ycbcr : unknown matrix %d, 601 or 709\n", matrix);
+        return 0;
+    }
+    kg = 1 - kr - kb;
+    // Y = kr R + kg G + kb B , Cb = (B - Y) / (2 - 2 kb) , Cr = (R - Y) / (2 - 2 kr)
+    k->y[0] = q14(kb);
+    k->y[2] = q14(kr);
+    k->y[1] = 16384 - k->y[0] - k->y[2];
+    k->cb[0] = 8192;
+    k->cb[2] = q14(-kr / (2 - 2 * kb));
+    k->cb[1] = -8192 - k->cb[2];
+    k->cr[2] = 8192;
+    k->cr[0] = q14(-kb / (2 - 2 * kr));
+    k->cr[1] = -8192 - k->cr[0];
+    k->cr_red = q14(2 - 2 * kr);
+    k->cb_blue = q14(2 - 2 * kb);
+    k->cb_green = q14(-(2 - 2 * kb) * kb / kg);
+    k->cr_green = q14(-(2 - 2 * kr) * kr / kg);
+    return 1;
+}
+
+int ycc_alloc(YCCIMAGE *img, int w, int h, int matrix, int subsampled)
+{
+    size_t cw = subsampled ? (w + 1) / 2 : w, ch = subsampled ? (h + 1) / 2 : h;
+    img->width = w;
+    img->height = h;
+    img->matrix = matrix;
+    img->subsampled = subsampled;
+    img->y = malloc((size_t)w * h);
+    img->cb = malloc(2 * cw * ch);
+    img->cr = img->cb ? img->cb + cw * ch : NULL;
+    if(!img->y || !img->cb) {
+        fprintf(stderr, "ycbcr : out of memory\n");
+        ycc_free(img);
+        return 0;
+    }
+    return 1;
+}
+
+void ycc_free(YCCIMAGE *img)
+{
+    free(img->y);
+    free(img->cb);
+    img->y = img->cb = img->cr = NULL;
+}
+
+static unsigned char clamp_byte(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/****************************************************************************/
+// byte positions of the blue, green and red of 16 pixels in each of the 3
+// source vectors, and back
+static const signed char deinterleave[3][3][16] = {
+    {   {0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}
+    },
+    {   {1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}
+    },
+    {   {2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}
+    }
+};
+static const signed char interleave[3][3][16] = {
+    {   {0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+        {-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+        {-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1}
+    },
+    {   {-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+        {5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+        {-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1}
+    },
+    {   {-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+        {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+        {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}
+    }
+};
+
+static __m128i shuffle3(__m128i a, __m128i b, __m128i c, const signed char mask[3][16])
+{
+    __m128i v = _mm_shuffle_epi8(a, _mm_loadu_si128((const __m128i *)mask[0]));
+    v = _mm_or_si128(v, _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)mask[1])));
+    return _mm_or_si128(v, _mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i *)mask[2])));
+}
+
+// 16 bits pair of coefficients for a multiply-add, lo on the even lane
+static __m128i pair(int lo, int hi)
+{
+    return _mm_unpacklo_epi16(_mm_set1_epi16(lo), _mm_set1_epi16(hi));
+}
+
+// (kr r + kg g + kb b + 8192 + bias) >> 14 on 8 lanes of 16 bits
+static __m128i dot8(__m128i r, __m128i g, __m128i b, __m128i krg, __m128i kb, __m128i bias)
+{
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), krg), _mm_madd_epi16(_mm_unpacklo_epi16(b, one), kb));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), krg), _mm_madd_epi16(_mm_unpackhi_epi16(b, one), kb));
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, bias), 14);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, bias), 14);
+    return _mm_packs_epi32(lo, hi);
+}
+
+/*********************************************************/
+// one row, blue green red to the 3 planes
+/*********************************************************/
+void ycc_from_row(const YCCCOEF *k, const unsigned char *bgr, unsigned char *y, unsigned char *cb, unsigned char *cr, int n)
+{
+    const __m128i zero = _mm_setzero_si128(), luma = _mm_setzero_si128(), chroma = _mm_set1_epi32(128 << 14);
+    const __m128i y_rg = pair(k->y[2], k->y[1]), y_b = pair(k->y[0], 8192);
+    const __m128i cb_rg = pair(k->cb[2], k->cb[1]), cb_b = pair(k->cb[0], 8192);
+    const __m128i cr_rg = pair(k->cr[2], k->cr[1]), cr_b = pair(k->cr[0], 8192);
+    int x = 0;
+    for(; x + 16 <= n; x += 16) {
+        const unsigned char *p = bgr + 3 * x;
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+        __m128i vb = shuffle3(a, b, c, deinterleave[0]);
+        __m128i vg = shuffle3(a, b, c, deinterleave[1]);
+        __m128i vr = shuffle3(a, b, c, deinterleave[2]);
+        __m128i bl = _mm_unpacklo_epi8(vb, zero), bh = _mm_unpackhi_epi8(vb, zero);
+        __m128i gl = _mm_unpacklo_epi8(vg, zero), gh = _mm_unpackhi_epi8(vg, zero);
+        __m128i rl = _mm_unpacklo_epi8(vr, zero), rh = _mm_unpackhi_epi8(vr, zero);
+        _mm_storeu_si128((__m128i *)(y + x), _mm_packus_epi16(dot8(rl, gl, bl, y_rg, y_b, luma), dot8(rh, gh, bh, y_rg, y_b, luma)));
+        _mm_storeu_si128((__m128i *)(cb + x), _mm_packus_epi16(dot8(rl, gl, bl, cb_rg, cb_b, chroma), dot8(rh, gh, bh, cb_rg, cb_b, chroma)));
+        _mm_storeu_si128((__m128i *)(cr + x), _mm_packus_epi16(dot8(rl, gl, bl, cr_rg, cr_b, chroma), dot8(rh, gh, bh, cr_rg, cr_b, chroma)));
+    }
+    for(; x < n; x++) {
+        const unsigned char *p = bgr + 3 * x;
+        y[x] = clamp_byte((k->y[0] * p[0] + k->y[1] * p[1] + k->y[2] * p[2] + 8192) >> 14);
+        cb[x] = clamp_byte((k->cb[0] * p[0] + k->cb[1] * p[1] + k->cb[2] * p[2] + (128 << 14) + 8192) >> 14);
+        cr[x] = clamp_byte((k->cr[0] * p[0] + k->cr[1] * p[1] + k->cr[2] * p[2] + (128 << 14) + 8192) >> 14);
+    }
+}
+
+// (Y << 14 + kcb cb + kcr cr + 8192) >> 14 on 8 lanes, cb / cr centred
+static __m128i inverse8(__m128i y, __m128i cb, __m128i cr, __m128i k)
+{
+    const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi32(8192);
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cb, cr), k), _mm_slli_epi32(_mm_unpacklo_epi16(y, zero), 14));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cb, cr), k), _mm_slli_epi32(_mm_unpackhi_epi16(y, zero), 14));
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 14);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 14);
+    return _mm_packs_epi32(lo, hi);
+}
+
+/*********************************************************/
+// one row, the 3 planes to blue green red
+/*********************************************************/
+void ycc_to_row(const YCCCOEF *k, const unsigned char *y, const unsigned char *cb, const unsigned char *cr, unsigned char *bgr, int n)
+{
+    const __m128i zero = _mm_setzero_si128(), mid = _mm_set1_epi16(128);
+    const __m128i kr = pair(0, k->cr_red), kg = pair(k->cb_green, k->cr_green), kb = pair(k->cb_blue, 0);
+    int x = 0;
+    for(; x + 16 <= n; x += 16) {
+        __m128i vy = _mm_loadu_si128((const __m128i *)(y + x));
+        __m128i vcb = _mm_loadu_si128((const __m128i *)(cb + x));
+        __m128i vcr = _mm_loadu_si128((const __m128i *)(cr + x));
+        __m128i yl = _mm_unpacklo_epi8(vy, zero), yh = _mm_unpackhi_epi8(vy, zero);
+        __m128i bl = _mm_sub_epi16(_mm_unpacklo_epi8(vcb, zero), mid), bh = _mm_sub_epi16(_mm_unpackhi_epi8(vcb, zero), mid);
+        __m128i rl = _mm_sub_epi16(_mm_unpacklo_epi8(vcr, zero), mid), rh = _mm_sub_epi16(_mm_unpackhi_epi8(vcr, zero), mid);
+        __m128i ob = _mm_packus_epi16(inverse8(yl, bl, rl, kb), inverse8(yh, bh, rh, kb));
+        __m128i og = _mm_packus_epi16(inverse8(yl, bl, rl, kg), inverse8(yh, bh, rh, kg));
+        __m128i or = _mm_packus_epi16(inverse8(yl, bl, rl, kr), inverse8(yh, bh, rh, kr));
+        unsigned char *p = bgr + 3 * x;
+        _mm_storeu_si128((__m128i *)p, shuffle3(ob, og, or, interleave[0]));
+        _mm_storeu_si128((__m128i *)(p + 16), shuffle3(ob, og, or, interleave[1]));
+        _mm_storeu_si128((__m128i *)(p + 32), shuffle3(ob, og, or, interleave[2]));
+    }
+    for(; x < n; x++) {
+        int l = y[x] << 14, u = cb[x] - 128, v = cr[x] - 128;
+        unsigned char *p = bgr + 3 * x;
+        p[0] = clamp_byte((l + k->cb_blue * u + 8192) >> 14);
+        p[1] = clamp_byte((l + k->cb_green * u + k->cr_green * v + 8192) >> 14);
+        p[2] = clamp_byte((l + k->cr_red * v + 8192) >> 14);
+    }
+}
+
+/****************************************************************************/
+// 4:2:0 : out[i] is the rounded mean of a[2i], a[2i + 1], b[2i], b[2i + 1],
+// the last column of an odd width counted twice
+static void half_row(const unsigned char *a, const unsigned char *b, unsigned char *out, int w)
+{
+    const __m128i ones = _mm_set1_epi8(1), two = _mm_set1_epi16(2);
+    int i = 0, cw = (w + 1) / 2;
+    for(; 2 * i + 16 <= w; i += 8) {
+        __m128i s = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(a + 2 * i)), ones),
+                                  _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(b + 2 * i)), ones));
+        s = _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(s, s));
+    }
+    for(; i < cw; i++) {
+        int x1 = 2 * i + 1 < w ? 2 * i + 1 : 2 * i;
+        out[i] = (a[2 * i] + a[x1] + b[2 * i] + b[x1] + 2) >> 2;
+    }
+}
+
+// every chroma sample on its 2 pixels
+static void double_row(const unsigned char *c, unsigned char *out, int w)
+{
+    int i = 0;
+    for(; 2 * i + 32 <= w; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(c + i));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(v, v));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(v, v));
+    }
+    for(int x = 2 * i; x < w; x++)
+        out[x] = c[x / 2];
+}
+
+static void from_band(void *arg, int item)
+{
+    YCCJOB *job = arg;
+    const YCCIMAGE *img = job->img;
+    int w = img->width, h = img->height, cw = (w + 1) / 2;
+    int y0 = item * BAND_ROWS, y1 = y0 + BAND_ROWS < h ? y0 + BAND_ROWS : h;
+    const unsigned char *src = (const unsigned char *)job->src;
+    unsigned char *tmp;
+    if(!img->subsampled) {
+        for(int y = y0; y < y1; y++) {
+            size_t o = (size_t)y * w;
+            ycc_from_row(&job->k, src + 3 * o, img->y + o, img->cb + o, img->cr + o, w);
+        }
+        return;
+    }
+    // full resolution chroma of the 2 rows, then their 2x2 means
+    tmp = malloc(4 * (size_t)w);
+    if(!tmp) {
+        job->ok = 0;
+        return;
+    }
+    for(int y = y0; y < y1; y += 2) {
+        size_t o = (size_t)y * w;
+        ycc_from_row(&job->k, src + 3 * o, img->y + o, tmp, tmp + w, w);
+        if(y + 1 < h)
+            ycc_from_row(&job->k, src + 3 * (o + w), img->y + o + w, tmp + 2 * w, tmp + 3 * w, w);
+        else
+            memcpy(tmp + 2 * w, tmp, 2 * (size_t)w);
+        half_row(tmp, tmp + 2 * w, img->cb + (size_t)y / 2 * cw, w);
+        half_row(tmp + w, tmp + 3 * w, img->cr + (size_t)y / 2 * cw, w);
+    }
+    free(tmp);
+}
+
+static void to_band(void *arg, int item)
+{
+    YCCJOB *job = arg;
+    const YCCIMAGE *img = job->img;
+    int w = img->width, h = img->height, cw = (w + 1) / 2;
+    int y0 = item * BAND_ROWS, y1 = y0 + BAND_ROWS < h ? y0 + BAND_ROWS : h;
+    unsigned char *dst = (unsigned char *)job->dst, *tmp;
+    if(!img->subsampled) {
+        for(int y = y0; y < y1; y++) {
+            size_t o = (size_t)y * w;
+            ycc_to_row(&job->k, img->y + o, img->cb + o, img->cr + o, dst + 3 * o, w);
+        }
+        return;
+    }
+    tmp = malloc(2 * (size_t)w);
+    if(!tmp) {
+        job->ok = 0;
+        return;
+    }
+    for(int y = y0; y < y1; y++) {
+        size_t o = (size_t)y * w;
+        // the chroma row is shared by 2 rows
+        if(y % 2 == 0) {
+            double_row(img->cb + (size_t)y / 2 * cw, tmp, w);
+            double_row(img->cr + (size_t)y / 2 * cw, tmp + w, w);
+        }
+        ycc_to_row(&job->k, img->y + o, tmp, tmp + w, dst + 3 * o, w);
+    }
+    free(tmp);
+}
+
+/*********************************************************/
+// whole images on the pool
+/*********************************************************/
+int ycc_from_ori(const RGBTRIPLE *src, YCCIMAGE *img)
+{
+    YCCJOB job = {src, NULL, img, {{0}, {0}, {0}, 0, 0, 0, 0}, 1};
+    if(!ycc_coef(&job.k, img->matrix))
+        return 0;
+    pool_run(pool_default(), (img->height + BAND_ROWS - 1) / BAND_ROWS, from_band, &job);
+    if(!job.ok)
+        fprintf(stderr, "ycbcr : out of memory\n");
+    return job.ok;
+}
+
+int ycc_to_ori(const YCCIMAGE *img, RGBTRIPLE *dst)
+{
+    YCCJOB job = {NULL, dst, img, {{0}, {0}, {0}, 0, 0, 0, 0}, 1};
+    if(!ycc_coef(&job.k, img->matrix))
+        return 0;
+    pool_run(pool_default(), (img->height + BAND_ROWS - 1) / BAND_ROWS, to_band, &job);
+    if(!job.ok)
+        fprintf(stderr, "ycbcr : out of memory\n");
+    return job.ok;
+}
+
+/****************************************************************************/
+static void naive_weights(int matrix, double *kr, double *kb)
+{
+    *kr = matrix == YCC_BT709 ? 0.2126 : 0.299;
+    *kb = matrix == YCC_BT709 ? 0.0722 : 0.114;
+}
+
+// pixel (x, y) in doubles, chroma centred on 128
+static void naive_pixel(const RGBTRIPLE *p, double kr, double kb, double *l, double *u, double *v)
+{
+    *l = kr * p->rgbRed + (1 - kr - kb) * p->rgbGreen + kb * p->rgbBlue;
+    *u = (p->rgbBlue - *l) / (2 - 2 * kb) + 128;
+    *v = (p->rgbRed - *l) / (2 - 2 * kr) + 128;
+}
+
+void naive_ycc_from_ori(const RGBTRIPLE *src, YCCIMAGE *img)
+{
+    int w = img->width, h = img->height, s = img->subsampled ? 2 : 1, cw = (w + s - 1) / s, ch = (h + s - 1) / s;
+    double kr, kb, l, u, v;
+    naive_weights(img->matrix, &kr, &kb);
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++) {
+            naive_pixel(&src[(size_t)y * w + x], kr, kb, &l, &u, &v);
+            img->y[(size_t)y * w + x] = clamp_byte((int)(l + 0.5));
+        }
+    }
+    // chroma : mean of the s x s block, edges clamped
+    for(int cy = 0; cy < ch; cy++) {
+        for(int cx = 0; cx < cw; cx++) {
+            double su = 0, sv = 0;
+            for(int dy = 0; dy < s; dy++) {
+                for(int dx = 0; dx < s; dx++) {
+                    int x = cx * s + dx < w ? cx * s + dx : w - 1, y = cy * s + dy < h ? cy * s + dy : h - 1;
+                    naive_pixel(&src[(size_t)y * w + x], kr, kb, &l, &u, &v);
+                    su += u;
+                    sv += v;
+                }
+            }
+            img->cb[(size_t)cy * cw + cx] = clamp_byte((int)(su / (s * s) + 0.5));
+            img->cr[(size_t)cy * cw + cx] = clamp_byte((int)(sv / (s * s) + 0.5));
+        }
+    }
+}
+
+void naive_ycc_to_ori(const YCCIMAGE *img, RGBTRIPLE *dst)
+{
+    int w = img->width, h = img->height, s = img->subsampled ? 2 : 1, cw = (w + s - 1) / s;
+    double kr, kb, kg;
+    naive_weights(img->matrix, &kr, &kb);
+    kg = 1 - kr - kb;
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++) {
+            size_t c = (size_t)(y / s) * cw + x / s;
+            double l = img->y[(size_t)y * w + x], u = img->cb[c] - 128.0, v = img->cr[c] - 128.0;
+            RGBTRIPLE *p = &dst[(size_t)y * w + x];
+            p->rgbRed = clamp_byte((int)(l + (2 - 2 * kr) * v + 256.5) - 256);
+            p->rgbGreen = clamp_byte((int)(l - (2 - 2 * kb) * kb / kg * u - (2 - 2 * kr) * kr / kg * v + 256.5) - 256);
+            p->rgbBlue = clamp_byte((int)(l + (2 - 2 * kb) * u + 256.5) - 256);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef YCBCR_IMAGE
+#define YCBCR_IMAGE
+#include "bmp.h"
+
+// full range matrices (JPEG style : Y in 0 ~ 255, Cb / Cr centred on 128)
+#define YCC_BT601 601
+#define YCC_BT709 709
+
+// Luma and chroma planes of a w x h image. With subsampled (4:2:0) the
+// chroma planes are ((w + 1) / 2) x ((h + 1) / 2), each sample the mean of
+// its 2x2 block, and they are replicated back on the way out : 1.5 bytes per
+// pixel instead of 3. y and the chroma planes are separate allocations, so
+// that a filter may swap y with a plane of its own.
+typedef struct ycc_image {
+    int width;
+    int height;
+    int matrix; // YCC_BT601 or YCC_BT709
+    int subsampled;
+    unsigned char *y;
+    unsigned char *cb;
+    unsigned char *cr;
+} YCCIMAGE;
+
+// Q14 coefficients of one matrix, rows blue, green, red of the forward
+// transform and the Cb / Cr terms of the inverse. The forward rows are
+// rounded so that the luma row sums to 1 and the chroma rows to 0 : a gray
+// pixel keeps Y equal to its value and 128 chroma.
+typedef struct ycc_coef {
+    short y[3];
+    short cb[3];
+    short cr[3];
+    short cr_red;
+    short cb_green;
+    short cr_green;
+    short cb_blue;
+} YCCCOEF;
+
+// 0 on an unknown matrix
+int ycc_coef(YCCCOEF *k, int matrix);
+int ycc_alloc(YCCIMAGE *img, int w, int h, int matrix, int subsampled);
+void ycc_free(YCCIMAGE *img);
+// w x h pixels of 3 bytes (blue, green, red), the size of img, 16 pixels per
+// step with byte shuffles and multiply-add, bands of rows on the pool
+int ycc_from_ori(const RGBTRIPLE *src, YCCIMAGE *img);
+int ycc_to_ori(const YCCIMAGE *img, RGBTRIPLE *dst);
+// n pixels of one row at full chroma resolution
+void ycc_from_row(const YCCCOEF *k, const unsigned char *bgr, unsigned char *y, unsigned char *cb, unsigned char *cr, int n);
+void ycc_to_row(const YCCCOEF *k, const unsigned char *y, const unsigned char *cb, const unsigned char *cr, unsigned char *bgr, int n);
+// same per pixel in doubles, rounded, for the tests
+void naive_ycc_from_ori(const RGBTRIPLE *src, YCCIMAGE *img);
+void naive_ycc_to_ori(const YCCIMAGE *img, RGBTRIPLE *dst);
+#endif // YCBCR_IMAGE